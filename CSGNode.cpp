@@ -0,0 +1,375 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    CSG tree of implicit sources with bounding box pruning.  See CSGNode.h.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#include "CSGNode.h"
+#include <math.h>
+#include <algorithm>
+
+using namespace chai3d;
+using namespace std;
+
+
+CSGNode::CSGNode(const ImplicitSource* a_source, const cVector3d& a_lower, const cVector3d& a_upper,
+                 double a_distanceRatio)
+    : m_operation(CSG_PRIMITIVE), m_left(0), m_right(0), m_radius(0.0),
+      m_source(a_source), m_sourceLower(a_lower), m_sourceUpper(a_upper),
+      m_sourceRatio(cMax(a_distanceRatio, 0.0))
+{
+    initialise();
+}
+
+CSGNode::CSGNode(double (*f)(double, double, double), cVector3d (*g)(double, double, double),
+                 const cVector3d& a_lower, const cVector3d& a_upper, double a_distanceRatio)
+    : m_operation(CSG_PRIMITIVE), m_left(0), m_right(0), m_radius(0.0),
+      m_function(f, g), m_sourceLower(a_lower), m_sourceUpper(a_upper),
+      m_sourceRatio(cMax(a_distanceRatio, 0.0))
+{
+    m_source = &m_function;
+    initialise();
+}
+
+CSGNode::CSGNode(CSGOperation a_operation, CSGNode* a_left, CSGNode* a_right, double a_radius)
+    : m_operation(a_operation), m_left(a_left), m_right(a_right), m_radius(a_radius), m_source(0),
+      m_sourceRatio(0.0)
+{
+    m_sourceLower.zero();
+    m_sourceUpper.zero();
+    initialise();
+}
+
+void CSGNode::initialise()
+{
+    m_transformed = false;
+    m_position.zero();
+    m_rotation.identity();
+    m_inverseRotation.identity();
+    m_scale = 1.0;
+    updateBounds();
+}
+
+CSGNode::~CSGNode()
+{
+    delete m_left;
+    delete m_right;
+}
+
+CSGNode* CSGNode::createUnion(vector<CSGNode*> a_nodes)
+{
+    if (a_nodes.empty())
+        return 0;
+    if (a_nodes.size() == 1)
+        return a_nodes[0];
+
+    // split at the median centre along the axis the centres spread most
+    cVector3d lower = 0.5 * (a_nodes[0]->m_lower + a_nodes[0]->m_upper), upper = lower;
+    for (size_t n = 1; n < a_nodes.size(); ++n)
+    {
+        cVector3d centre = 0.5 * (a_nodes[n]->m_lower + a_nodes[n]->m_upper);
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            lower(axis) = cMin(lower(axis), centre(axis));
+            upper(axis) = cMax(upper(axis), centre(axis));
+        }
+    }
+    cVector3d extent = upper - lower;
+    int axis = (extent.x() > extent.y()) ? ((extent.x() > extent.z()) ? 0 : 2)
+                                         : ((extent.y() > extent.z()) ? 1 : 2);
+
+    size_t half = a_nodes.size() / 2;
+    nth_element(a_nodes.begin(), a_nodes.begin() + half, a_nodes.end(),
+                [axis](const CSGNode* a, const CSGNode* b)
+                { return a->m_lower(axis) + a->m_upper(axis) < b->m_lower(axis) + b->m_upper(axis); });
+
+    return new CSGNode(CSG_UNION,
+                       createUnion(vector<CSGNode*>(a_nodes.begin(), a_nodes.begin() + half)),
+                       createUnion(vector<CSGNode*>(a_nodes.begin() + half, a_nodes.end())));
+}
+
+void CSGNode::setTransform(const cVector3d& a_position, const cMatrix3d& a_rotation, double a_scale)
+{
+    m_transformed = true;
+    m_position = a_position;
+    m_rotation = a_rotation;
+    m_inverseRotation = a_rotation.getTranspose();
+    m_scale = a_scale;
+    updateBounds();
+}
+
+//===========================================================================
+/*!
+    Recompute the box of every node of the subtree, bottom up: the box of a
+    union holds both children, an intersection only their overlap, and a
+    difference that of its left child.  A blend can bulge out of its
+    children by a quarter of its radius.  The box is then carried into the
+    parent's coordinates by the node's transform.
+
+    The lower bound outside the box follows: a union is no lower than its
+    lower child, nor a blend by more than a quarter of its radius.  An
+    intersection is no lower than its higher child, and its overlap is at
+    most sqrt 2 times further than the further child box.  A transform
+    scales the value and the distance alike, and its box only gets bigger.
+*/
+//===========================================================================
+void CSGNode::updateBounds()
+{
+    cVector3d lower, upper;
+    switch (m_operation)
+    {
+    case CSG_PRIMITIVE:
+        lower = m_sourceLower;
+        upper = m_sourceUpper;
+        m_boundRatio = m_sourceRatio;
+        m_boundSlack = 0.0;
+        break;
+
+    case CSG_UNION:
+    case CSG_BLEND:
+    case CSG_INTERSECTION:
+        m_left->updateBounds();
+        m_right->updateBounds();
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            if (m_operation == CSG_INTERSECTION)
+            {
+                // children that do not overlap leave a degenerate box
+                lower(axis) = cMax(m_left->m_lower(axis), m_right->m_lower(axis));
+                upper(axis) = cMin(m_left->m_upper(axis), m_right->m_upper(axis));
+                if (lower(axis) > upper(axis))
+                    lower(axis) = upper(axis) = 0.5 * (lower(axis) + upper(axis));
+            }
+            else
+            {
+                double bulge = (m_operation == CSG_BLEND) ? 0.25 * m_radius : 0.0;
+                lower(axis) = cMin(m_left->m_lower(axis), m_right->m_lower(axis)) - bulge;
+                upper(axis) = cMax(m_left->m_upper(axis), m_right->m_upper(axis)) + bulge;
+            }
+        }
+        m_boundRatio = cMin(m_left->m_boundRatio, m_right->m_boundRatio);
+        m_boundSlack = cMax(m_left->m_boundSlack, m_right->m_boundSlack);
+        if (m_operation == CSG_INTERSECTION)
+            m_boundRatio /= sqrt(2.0);
+        if (m_operation == CSG_BLEND)
+            m_boundSlack += 0.25 * m_radius;
+        break;
+
+    case CSG_DIFFERENCE:
+        m_left->updateBounds();
+        m_right->updateBounds();
+        lower = m_left->m_lower;
+        upper = m_left->m_upper;
+        m_boundRatio = m_left->m_boundRatio;
+        m_boundSlack = m_left->m_boundSlack;
+        break;
+    }
+
+    if (!m_transformed)
+    {
+        m_lower = lower;
+        m_upper = upper;
+        return;
+    }
+    m_boundSlack *= m_scale;
+
+    // box around the eight transformed corners
+    for (int corner = 0; corner < 8; ++corner)
+    {
+        cVector3d local((corner & 1) ? upper.x() : lower.x(),
+                        (corner & 2) ? upper.y() : lower.y(),
+                        (corner & 4) ? upper.z() : lower.z());
+        cVector3d p = m_position + m_scale * (m_rotation * local);
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            m_lower(axis) = (corner == 0) ? p(axis) : cMin(m_lower(axis), p(axis));
+            m_upper(axis) = (corner == 0) ? p(axis) : cMax(m_upper(axis), p(axis));
+        }
+    }
+}
+
+int CSGNode::getPrimitiveCount() const
+{
+    if (m_operation == CSG_PRIMITIVE)
+        return 1;
+    return m_left->getPrimitiveCount() + m_right->getPrimitiveCount();
+}
+
+//===========================================================================
+/*!
+    Evaluate the subtree at a_point, given in the parent's coordinates.
+
+    The subtree is not visited when the lower bound on its value at a_point,
+    from the distance to its box, is above a_bound: the lower bound is
+    returned instead.  So the result is either exact, or a lower bound above
+    a_bound.  Each operation sets the bound of its second child from the
+    value of the first, so that a pruned child could not have changed the
+    result: a union child above its sibling's value, a blend child a radius
+    above it, or a subtracted child above minus the value being cut.
+
+    \param  a_point  Query point, in the parent's coordinates.
+    \param  a_bound  Values above this need not be exact.
+    \param  a_prune  False to evaluate every leaf.
+    \param  a_gradient  Returns the gradient at a_point.
+    \param  a_primitives  Incremented for every leaf evaluated.
+    \return  Value of the subtree at a_point, or a lower bound above a_bound.
+*/
+//===========================================================================
+double CSGNode::evaluateNode(const cVector3d& a_point, double a_bound, bool a_prune,
+                             cVector3d& a_gradient, int& a_primitives) const
+{
+    // pruned: the lower bound, rising away from the box
+    cVector3d outside = boxOffset(a_point);
+    double distance = outside.length();
+    double least = m_boundRatio * distance - m_boundSlack;
+    if (a_prune && distance > 0.0 && least > a_bound)
+    {
+        a_gradient = outside * (1.0 / distance);
+        return least;
+    }
+
+    cVector3d point = a_point;
+    double bound = a_bound;
+    if (m_transformed)
+    {
+        point = (1.0 / m_scale) * (m_inverseRotation * (a_point - m_position));
+        bound = a_bound / m_scale;
+    }
+
+    double value = 0.0;
+    cVector3d gradient, other;
+    switch (m_operation)
+    {
+    case CSG_PRIMITIVE:
+    {
+        // first-order distance, f / |grad f|
+        ++a_primitives;
+        value = m_source->evaluate(point, gradient);
+        double length = gradient.length();
+        if (length > 0.0)
+        {
+            value /= length;
+            gradient *= 1.0 / length;
+        }
+        break;
+    }
+
+    case CSG_UNION:
+    {
+        // nearer box first, so the other is pruned more often
+        const CSGNode* first = m_left;
+        const CSGNode* second = m_right;
+        if (m_right->boxOffset(point).lengthsq() < m_left->boxOffset(point).lengthsq())
+            swap(first, second);
+        value = first->evaluateNode(point, bound, a_prune, gradient, a_primitives);
+        double right = second->evaluateNode(point, value, a_prune, other, a_primitives);
+        if (right < value)
+        {
+            value = right;
+            gradient = other;
+        }
+        break;
+    }
+
+    case CSG_INTERSECTION:
+    {
+        // beyond the bound already, whatever the right child holds
+        value = m_left->evaluateNode(point, bound, a_prune, gradient, a_primitives);
+        if (value > bound)
+            break;
+        double right = m_right->evaluateNode(point, bound, a_prune, other, a_primitives);
+        if (right > value)
+        {
+            value = right;
+            gradient = other;
+        }
+        break;
+    }
+
+    case CSG_DIFFERENCE:
+    {
+        // the right child only cuts where it is below -value
+        value = m_left->evaluateNode(point, bound, a_prune, gradient, a_primitives);
+        if (value > bound)
+            break;
+        double right = -m_right->evaluateNode(point, -value, a_prune, other, a_primitives);
+        if (right > value)
+        {
+            value = right;
+            gradient = -other;
+        }
+        break;
+    }
+
+    case CSG_BLEND:
+    {
+        // polynomial smooth minimum; its gradient is the same mix of the
+        // children's gradients.  It equals the smaller child once the
+        // other is m_radius above it, and is at most a quarter of m_radius
+        // below it: children more than that above the bound leave the
+        // blend above it
+        const CSGNode* first = m_left;
+        const CSGNode* second = m_right;
+        if (m_right->boxOffset(point).lengthsq() < m_left->boxOffset(point).lengthsq())
+            swap(first, second);
+        double margin = bound + 0.25 * m_radius;
+        double left = first->evaluateNode(point, margin, a_prune, gradient, a_primitives);
+        double right = second->evaluateNode(point, (left > margin) ? margin : left + m_radius,
+                                            a_prune, other, a_primitives);
+        double h = cClamp(0.5 + 0.5 * (right - left) / m_radius, 0.0, 1.0);
+        value = h * left + (1.0 - h) * right - m_radius * h * (1.0 - h);
+        gradient = h * gradient + (1.0 - h) * other;
+        break;
+    }
+    }
+
+    if (m_transformed)
+    {
+        value *= m_scale;
+        gradient = m_rotation * gradient;
+    }
+    a_gradient = gradient;
+    return value;
+}
+
+cVector3d CSGNode::boxOffset(const cVector3d& a_point) const
+{
+    cVector3d offset;
+    for (int axis = 0; axis < 3; ++axis)
+        offset(axis) = cMax(a_point(axis) - m_upper(axis), 0.0) - cMax(m_lower(axis) - a_point(axis), 0.0);
+    return offset;
+}
+
+double CSGNode::evaluateCounted(const cVector3d& a_point, cVector3d& a_gradient, int& a_primitives) const
+{
+    return evaluateNode(a_point, HUGE_VAL, true, a_gradient, a_primitives);
+}
+
+double CSGNode::evaluateUnpruned(const cVector3d& a_point, cVector3d& a_gradient, int& a_primitives) const
+{
+    return evaluateNode(a_point, HUGE_VAL, false, a_gradient, a_primitives);
+}
+
+double CSGNode::evaluate(const cVector3d& a_point, cVector3d& a_gradient) const
+{
+    int primitives = 0;
+    return evaluateNode(a_point, HUGE_VAL, true, a_gradient, primitives);
+}
+
+double CSGNode::value(const cVector3d& a_point) const
+{
+    cVector3d gradient;
+    return evaluate(a_point, gradient);
+}
+
+cVector3d CSGNode::gradient(const cVector3d& a_point) const
+{
+    cVector3d gradient;
+    evaluate(a_point, gradient);
+    return gradient;
+}
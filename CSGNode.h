@@ -0,0 +1,147 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    A constructive solid geometry tree of implicit sources.  Leaves wrap a
+    source (such as one of ImplicitShapes.h), inner nodes combine two
+    subtrees by union, intersection, difference or smooth blend, and any
+    node can be moved, rotated and uniformly scaled within its parent.
+
+    Every node keeps an axis-aligned box, in its parent's coordinates,
+    and a lower bound on its value outside the box that grows with the
+    distance from it.  A query does not descend into a subtree whose bound
+    is too high to change the result: a union child above its sibling's
+    value, or a subtracted child above minus the value it would cut, so
+    pruning never changes the value of the field.  With a balanced tree
+    (see createUnion()), a query costs about as much as the primitives
+    whose boxes are closer than the nearest surface, however many the
+    scene holds.
+
+    Leaf values are normalised to f / |grad f|, so shapes of different
+    degrees combine sensibly and the blend radius is a distance.  That is
+    not the distance to the surface: far away it is about 1/n of it for a
+    polynomial of degree n.  So each leaf is given the least ratio of its
+    value to the distance from its box, outside it; with none, a leaf is
+    only pruned where any positive value is too high.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#ifndef CSGNODE_H
+#define CSGNODE_H
+
+#include "ImplicitSource.h"
+#include <vector>
+
+//! What a CSGNode does with its children.
+enum CSGOperation
+{
+    CSG_PRIMITIVE,
+    CSG_UNION,
+    CSG_INTERSECTION,
+    CSG_DIFFERENCE,     //!< left minus right
+    CSG_BLEND           //!< smooth union
+};
+
+class CSGNode : public ImplicitSource
+{
+public:
+    //! A leaf for a_source, which must be positive outside [a_lower, a_upper]
+    //! and outlive the node.  Outside the box, f / |grad f| is at least
+    //! a_distanceRatio times the distance from it (1 for a distance field).
+    CSGNode(const ImplicitSource* a_source,
+            const chai3d::cVector3d& a_lower, const chai3d::cVector3d& a_upper,
+            double a_distanceRatio = 0.0);
+
+    //! A leaf for a closed-form function, positive outside [a_lower, a_upper].
+    CSGNode(double (*f)(double, double, double),
+            chai3d::cVector3d (*g)(double, double, double),
+            const chai3d::cVector3d& a_lower, const chai3d::cVector3d& a_upper,
+            double a_distanceRatio = 0.0);
+
+    //! a_left combined with a_right, which the node takes ownership of.
+    //! a_radius is the width of the fillet of CSG_BLEND.
+    CSGNode(CSGOperation a_operation, CSGNode* a_left, CSGNode* a_right, double a_radius = 0.0);
+
+    virtual ~CSGNode();
+
+    //! Union of all of a_nodes (taking ownership), as a tree balanced by
+    //! position so that far away nodes are pruned together.
+    static CSGNode* createUnion(std::vector<CSGNode*> a_nodes);
+
+    //! Place the node in its parent, which sees it moved to a_position,
+    //! rotated by a_rotation and scaled by a_scale.  Call updateBounds() on
+    //! the root once the tree is placed.
+    void setTransform(const chai3d::cVector3d& a_position,
+                      const chai3d::cMatrix3d& a_rotation, double a_scale = 1.0);
+
+    //! Recompute the boxes of this subtree.
+    void updateBounds();
+
+    //! Box of the node in its parent's coordinates.
+    const chai3d::cVector3d& getLower() const { return m_lower; }
+    const chai3d::cVector3d& getUpper() const { return m_upper; }
+
+    CSGOperation getOperation() const { return m_operation; }
+    CSGNode* getLeft() const { return m_left; }
+    CSGNode* getRight() const { return m_right; }
+
+    //! Number of leaves below the node.
+    int getPrimitiveCount() const;
+
+    virtual double value(const chai3d::cVector3d& a_point) const;
+    virtual chai3d::cVector3d gradient(const chai3d::cVector3d& a_point) const;
+    virtual double evaluate(const chai3d::cVector3d& a_point, chai3d::cVector3d& a_gradient) const;
+
+    //! evaluate(), adding the number of leaves evaluated to a_primitives.
+    double evaluateCounted(const chai3d::cVector3d& a_point, chai3d::cVector3d& a_gradient,
+                           int& a_primitives) const;
+
+    //! evaluate() of every leaf, without pruning, to check the pruning.
+    double evaluateUnpruned(const chai3d::cVector3d& a_point, chai3d::cVector3d& a_gradient,
+                            int& a_primitives) const;
+
+private:
+    void initialise();
+
+    //! Value at a_point (parent coordinates), or a lower bound on it above
+    //! a_bound.  Nothing is pruned unless a_prune.
+    double evaluateNode(const chai3d::cVector3d& a_point, double a_bound, bool a_prune,
+                        chai3d::cVector3d& a_gradient, int& a_primitives) const;
+
+    //! Offset of a_point (parent coordinates) from the box; zero inside.
+    chai3d::cVector3d boxOffset(const chai3d::cVector3d& a_point) const;
+
+    CSGOperation m_operation;
+    CSGNode* m_left;
+    CSGNode* m_right;
+    double m_radius;
+
+    //! Source of a leaf; m_function when built from closed-form functions.
+    const ImplicitSource* m_source;
+    FunctionSource m_function;
+
+    //! Box of a leaf's source, in its own coordinates, and the least ratio
+    //! of its value to the distance from the box.
+    chai3d::cVector3d m_sourceLower;
+    chai3d::cVector3d m_sourceUpper;
+    double m_sourceRatio;
+
+    //! Placement in the parent (identity unless m_transformed).
+    bool m_transformed;
+    chai3d::cVector3d m_position;
+    chai3d::cMatrix3d m_rotation;
+    chai3d::cMatrix3d m_inverseRotation;
+    double m_scale;
+
+    //! Box in the parent's coordinates.  Outside it, the value is at least
+    //! m_boundRatio times the distance from it, less m_boundSlack.
+    chai3d::cVector3d m_lower;
+    chai3d::cVector3d m_upper;
+    double m_boundRatio;
+    double m_boundSlack;
+};
+
+#endif
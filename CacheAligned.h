@@ -0,0 +1,60 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    Heap allocation on cache line boundaries for classes that keep
+    per-thread state on lines of their own (alignas(64) members).  Before
+    C++17, and in VS2015, new ignores an alignment above that of
+    max_align_t, so such a class declares CACHE_ALIGNED_NEW in its body.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#ifndef CACHEALIGNED_H
+#define CACHEALIGNED_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+//! Bytes in a cache line; the alignment of the blocks allocated here.
+#define CACHE_LINE_BYTES 64
+
+//! Allocate a_bytes on a cache line boundary; throws std::bad_alloc.
+inline void* cacheAlignedAlloc(size_t a_bytes)
+{
+#ifdef _WIN32
+    void* memory = _aligned_malloc(a_bytes ? a_bytes : 1, CACHE_LINE_BYTES);
+#else
+    void* memory = 0;
+    if (posix_memalign(&memory, CACHE_LINE_BYTES, a_bytes ? a_bytes : 1) != 0)
+        memory = 0;
+#endif
+    if (!memory)
+        throw std::bad_alloc();
+    return memory;
+}
+
+//! Free a block from cacheAlignedAlloc() (NULL is ignored).
+inline void cacheAlignedFree(void* a_memory)
+{
+#ifdef _WIN32
+    _aligned_free(a_memory);
+#else
+    free(a_memory);
+#endif
+}
+
+//! Class-specific new and delete that keep the alignment of the class.
+#define CACHE_ALIGNED_NEW \
+    static void* operator new(size_t a_bytes) { return cacheAlignedAlloc(a_bytes); } \
+    static void* operator new[](size_t a_bytes) { return cacheAlignedAlloc(a_bytes); } \
+    static void operator delete(void* a_memory) { cacheAlignedFree(a_memory); } \
+    static void operator delete[](void* a_memory) { cacheAlignedFree(a_memory); }
+
+#endif
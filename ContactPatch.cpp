@@ -0,0 +1,73 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    Multi-rate haptic rendering through contact patches.  See
+    ContactPatch.h.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#include "ContactPatch.h"
+
+using namespace chai3d;
+
+
+PatchServo::PatchServo()
+    : m_published(0), m_blend(PATCH_BLEND_TICKS)
+{
+}
+
+void PatchServo::publish(const ContactPatch& a_patch)
+{
+    ContactPatch patch = a_patch;
+    patch.sequence = ++m_published;
+    m_patches.write(patch);
+}
+
+void PatchServo::reset()
+{
+    m_current = ContactPatch();
+    m_previous = ContactPatch();
+    m_blend = PATCH_BLEND_TICKS;
+}
+
+//===========================================================================
+/*!
+    One servo tick: hand the tool state to the physics loop, pick up the
+    latest patch, and render it.  For PATCH_BLEND_TICKS ticks after a new
+    patch arrives, the force is a mix of the forces of the new and the old
+    patch at the current tool position, moving linearly to the new one.
+
+    \param  a_toolPos  Position of the tool.
+    \param  a_toolVel  Velocity of the tool.
+    \return Force on the tool.
+*/
+//===========================================================================
+cVector3d PatchServo::update(const cVector3d& a_toolPos, const cVector3d& a_toolVel)
+{
+    ServoToolState tool;
+    tool.pos = a_toolPos;
+    tool.vel = a_toolVel;
+    m_tool.write(tool);
+
+    ContactPatch latest;
+    if (m_patches.read(latest) && latest.sequence != m_current.sequence)
+    {
+        m_previous = m_current;
+        m_current = latest;
+        m_blend = 0;
+    }
+
+    cVector3d force = m_current.force(a_toolPos);
+    if (m_blend < PATCH_BLEND_TICKS)
+    {
+        ++m_blend;
+        double weight = (double)m_blend / PATCH_BLEND_TICKS;
+        force = weight * force + (1.0 - weight) * m_previous.force(a_toolPos);
+    }
+
+    return force;
+}
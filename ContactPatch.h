@@ -0,0 +1,113 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    Multi-rate haptic rendering through a local intermediate representation
+    of the surface (Mark et al., "Adding force feedback to graphics
+    systems", 1996).
+
+    A slow physics loop (around 200 Hz) runs the full proxy solve and
+    describes the surface near the tool by a ContactPatch: the tangent
+    plane at the proxy while the tool is in contact, or at the surface
+    point nearest to the tool while it is not.  A fast servo loop renders
+    the latest patch with a handful of flops per tick, so the device can be
+    updated at several kHz however expensive the surface is.
+
+    A PatchServo carries the tool state to the physics loop and the patch
+    back, through double buffers.  When a new patch arrives the servo
+    blends from the force of the old patch to that of the new one over a
+    few ticks, so the force stays continuous across physics updates.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#ifndef CONTACTPATCH_H
+#define CONTACTPATCH_H
+
+#include "chai3d.h"
+#include "DoubleBuffer.h"
+
+//! The surface around the tool, as seen by the last physics update.
+struct ContactPatch
+{
+    //! A point of the plane: the proxy if anchored, else the surface point nearest the tool.
+    chai3d::cVector3d point;
+
+    //! Outward unit normal of the plane.
+    chai3d::cVector3d normal;
+
+    double stiffness;
+
+    //! False if there is no surface near the tool.
+    bool valid;
+
+    //! True if the tool holds a proxy (at point), which then also carries
+    //! friction: the force pulls the tool to the point, not just out of
+    //! the plane.
+    bool anchored;
+
+    //! Incremented by every physics update, so the servo notices new patches.
+    unsigned int sequence;
+
+    ContactPatch() : stiffness(0.0), valid(false), anchored(false), sequence(0)
+    {
+        point.zero(); normal.zero();
+    }
+
+    //! Force of the patch on a tool at a_toolPos.
+    chai3d::cVector3d force(const chai3d::cVector3d& a_toolPos) const
+    {
+        chai3d::cVector3d toPoint = point - a_toolPos;
+        double depth = toPoint.dot(normal);
+        if (!valid || depth <= 0.0)
+            return chai3d::cVector3d(0.0, 0.0, 0.0);
+        if (anchored)
+            return stiffness * toPoint;
+        return (stiffness * depth) * normal;
+    }
+};
+
+//! Position and velocity of the tool sampled by the servo loop.
+struct ServoToolState
+{
+    chai3d::cVector3d pos;
+    chai3d::cVector3d vel;
+};
+
+//! Number of servo ticks over which a new patch takes over from the old one.
+#define PATCH_BLEND_TICKS 16
+
+class PatchServo
+{
+public:
+    PatchServo();
+
+    //! Servo loop: publish the tool state and return the force on the tool.
+    chai3d::cVector3d update(const chai3d::cVector3d& a_toolPos, const chai3d::cVector3d& a_toolVel);
+
+    //! Physics loop: the latest tool state.  Returns false before the first servo tick.
+    bool readTool(ServoToolState& a_state) const { return m_tool.read(a_state); }
+
+    //! Physics loop: publish the patch found for the tool state read last.
+    void publish(const ContactPatch& a_patch);
+
+    //! Servo loop: forget the current patch, e.g. when rendering switches back to single rate.
+    void reset();
+
+private:
+    DoubleBuffer<ServoToolState> m_tool;
+    DoubleBuffer<ContactPatch> m_patches;
+
+    //! Physics side: sequence number of the last published patch.
+    unsigned int m_published;
+
+    //! Servo side: the patch rendered, the one it is replacing, and the
+    //! number of ticks since it arrived.
+    ContactPatch m_current;
+    ContactPatch m_previous;
+    int m_blend;
+};
+
+#endif
@@ -0,0 +1,71 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    A lock-free double buffer handing the latest value of something from
+    one thread to another running at a different rate, such as a contact
+    patch from a slow physics loop to a fast servo loop.  Unlike a
+    TelemetryRing, only the newest value matters.
+
+    The writer fills the slot the reader is not pointed at and then flips
+    the pointer.  A reader counts itself on the slot it reads, and retries
+    if the pointer flipped under it, so it never sees a slot being written;
+    it never waits.  The writer only waits if a reader is still copying
+    the slot it wants to fill, which takes a few nanoseconds.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#ifndef DOUBLEBUFFER_H
+#define DOUBLEBUFFER_H
+
+#include <atomic>
+#include <thread>
+
+template <typename T>
+class DoubleBuffer
+{
+public:
+    DoubleBuffer() : m_current(0), m_written(false) { m_readers[0] = 0; m_readers[1] = 0; }
+
+    //! Writer side: make a_value the latest.  One writer at a time.
+    void write(const T& a_value)
+    {
+        int next = 1 - m_current.load();
+        while (m_readers[next].load() != 0)
+            std::this_thread::yield();
+        m_slots[next] = a_value;
+        m_current.store(next);
+        m_written.store(true);
+    }
+
+    //! Reader side: copy the latest value.  Returns false if none was written yet.
+    bool read(T& a_value) const
+    {
+        if (!m_written.load())
+            return false;
+
+        for (;;)
+        {
+            int slot = m_current.load();
+            m_readers[slot].fetch_add(1);
+            if (m_current.load() == slot)
+            {
+                a_value = m_slots[slot];
+                m_readers[slot].fetch_sub(1);
+                return true;
+            }
+            m_readers[slot].fetch_sub(1);
+        }
+    }
+
+private:
+    T m_slots[2];
+    std::atomic<int> m_current;
+    std::atomic<bool> m_written;
+    mutable std::atomic<int> m_readers[2];
+};
+
+#endif
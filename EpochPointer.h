@@ -0,0 +1,85 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    An owning pointer to an immutable object that one thread replaces
+    while haptic threads keep reading it, without locks on the read side.
+
+    A reader pins the current object for the lifetime of a Reader, which
+    costs two atomic increments and never waits.  publish() swaps in the
+    new object and then waits until no reader can still hold the old one
+    before deleting it.  Readers are counted under one of two epochs; the
+    publisher flips the epoch and drains the old count twice, so a reader
+    that registered late under a stale epoch is also waited for.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#ifndef EPOCHPOINTER_H
+#define EPOCHPOINTER_H
+
+#include <atomic>
+#include <thread>
+
+template <class T>
+class EpochPointer
+{
+public:
+    EpochPointer() : m_object(0), m_epoch(0) { m_readers[0] = 0; m_readers[1] = 0; }
+    ~EpochPointer() { delete m_object.load(); }
+
+    //! Pins the current object (possibly NULL) while in scope.  Keep it
+    //! for no longer than a haptic tick: publish() waits for it.
+    class Reader
+    {
+    public:
+        Reader(const EpochPointer& a_owner) : m_owner(a_owner)
+        {
+            m_epoch = a_owner.m_epoch.load();
+            a_owner.m_readers[m_epoch].fetch_add(1);
+            m_object = a_owner.m_object.load();
+        }
+        ~Reader() { m_owner.m_readers[m_epoch].fetch_sub(1); }
+
+        const T* get() const { return m_object; }
+        const T* operator->() const { return m_object; }
+
+    private:
+        Reader(const Reader&);
+        Reader& operator=(const Reader&);
+
+        const EpochPointer& m_owner;
+        unsigned int m_epoch;
+        const T* m_object;
+    };
+
+    //! Replace the object by a_object (taking ownership) and delete the
+    //! previous one once no reader holds it.  Call from one thread at a time.
+    void publish(T* a_object)
+    {
+        T* previous = m_object.exchange(a_object);
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            unsigned int old = m_epoch.load();
+            m_epoch.store(old ^ 1);
+            while (m_readers[old].load() != 0)
+                std::this_thread::yield();
+        }
+        delete previous;
+    }
+
+    //! The current object, for the publishing thread only.
+    const T* current() const { return m_object.load(); }
+
+private:
+    EpochPointer(const EpochPointer&);
+    EpochPointer& operator=(const EpochPointer&);
+
+    std::atomic<T*> m_object;
+    std::atomic<unsigned int> m_epoch;
+    mutable std::atomic<int> m_readers[2];
+};
+
+#endif
@@ -0,0 +1,986 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    Implicit functions typed in at run time.  See ExpressionSource.h.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#include "ExpressionSource.h"
+#include <map>
+#include <ctype.h>
+#include <math.h>
+#include <string.h>
+
+using namespace chai3d;
+using namespace std;
+
+
+namespace
+{
+
+enum ExpressionOp
+{
+    OP_X, OP_Y, OP_Z, OP_CONST,
+    OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_NEG,
+    OP_POW, OP_POWI, OP_SQRT, OP_SIN, OP_COS, OP_EXP, OP_LOG, OP_ABS, OP_SIGN,
+    OP_MIN, OP_MAX, OP_LESS
+};
+
+const char* opNames[] =
+{
+    "x", "y", "z", "const",
+    "add", "sub", "mul", "div", "neg",
+    "pow", "powi", "sqrt", "sin", "cos", "exp", "log", "abs", "sign",
+    "min", "max", "less"
+};
+
+//! A node of the expression graph: an input, a constant (value), or an
+//! operation on one or two earlier nodes.  value is the exponent of OP_POWI.
+struct ExpressionNode
+{
+    int op;
+    int a;
+    int b;
+    double value;
+};
+
+//===========================================================================
+/*
+    The expression graph.  Nodes are only made through the builders below,
+    which fold constants, simplify identities and return the existing node
+    for any operation already in the graph, so every subexpression, of the
+    value or of its derivatives, is computed once.
+*/
+//===========================================================================
+class ExpressionGraph
+{
+public:
+    vector<ExpressionNode> nodes;
+
+    int variable(int a_axis) { return make(OP_X + a_axis, -1, -1, 0.0); }
+    int constant(double a_value)
+    {
+        // -0 and 0 are the same constant
+        return make(OP_CONST, -1, -1, (a_value == 0.0) ? 0.0 : a_value);
+    }
+
+    bool isConstant(int a_node) const { return nodes[a_node].op == OP_CONST; }
+    bool isConstant(int a_node, double a_value) const { return isConstant(a_node) && nodes[a_node].value == a_value; }
+    double valueOf(int a_node) const { return nodes[a_node].value; }
+
+    int add(int a, int b)
+    {
+        if (isConstant(a) && isConstant(b)) return constant(valueOf(a) + valueOf(b));
+        if (isConstant(a, 0.0)) return b;
+        if (isConstant(b, 0.0)) return a;
+        if (a == b) return mul(constant(2.0), a);
+        if (nodes[b].op == OP_NEG) return sub(a, nodes[b].a);
+        if (nodes[a].op == OP_NEG) return sub(b, nodes[a].a);
+        return make(OP_ADD, a, b, 0.0);
+    }
+
+    int sub(int a, int b)
+    {
+        if (isConstant(a) && isConstant(b)) return constant(valueOf(a) - valueOf(b));
+        if (isConstant(b, 0.0)) return a;
+        if (isConstant(a, 0.0)) return neg(b);
+        if (a == b) return constant(0.0);
+        if (nodes[b].op == OP_NEG) return add(a, nodes[b].a);
+        return make(OP_SUB, a, b, 0.0);
+    }
+
+    int mul(int a, int b)
+    {
+        if (isConstant(b) && !isConstant(a)) swap(a, b);
+        if (isConstant(a) && isConstant(b)) return constant(valueOf(a) * valueOf(b));
+        if (isConstant(a, 0.0)) return a;
+        if (isConstant(a, 1.0)) return b;
+        if (isConstant(a, -1.0)) return neg(b);
+        if (isConstant(a))
+        {
+            // c1 (c2 x) = (c1 c2) x, and c (-x) = (-c) x
+            const ExpressionNode& node = nodes[b];
+            if (node.op == OP_MUL && isConstant(node.a)) return mul(constant(valueOf(a) * valueOf(node.a)), node.b);
+            if (node.op == OP_MUL && isConstant(node.b)) return mul(constant(valueOf(a) * valueOf(node.b)), node.a);
+            if (node.op == OP_NEG) return mul(constant(-valueOf(a)), node.a);
+        }
+        return make(OP_MUL, a, b, 0.0);
+    }
+
+    int div(int a, int b)
+    {
+        if (isConstant(a) && isConstant(b) && valueOf(b) != 0.0) return constant(valueOf(a) / valueOf(b));
+        if (isConstant(a, 0.0)) return a;
+        if (isConstant(b, 1.0)) return a;
+        if (isConstant(b) && valueOf(b) != 0.0) return mul(constant(1.0 / valueOf(b)), a);
+        return make(OP_DIV, a, b, 0.0);
+    }
+
+    int neg(int a)
+    {
+        if (isConstant(a)) return constant(-valueOf(a));
+        if (nodes[a].op == OP_NEG) return nodes[a].a;
+        return make(OP_NEG, a, -1, 0.0);
+    }
+
+    int powi(int a, int n)
+    {
+        if (n == 0) return constant(1.0);
+        if (n == 1) return a;
+        if (isConstant(a)) return constant(pow(valueOf(a), (double)n));
+        if (nodes[a].op == OP_POWI) return powi(nodes[a].a, n * (int)nodes[a].value);
+        return make(OP_POWI, a, -1, (double)n);
+    }
+
+    int power(int a, int b)
+    {
+        if (isConstant(b))
+        {
+            double e = valueOf(b);
+            if (e == floor(e) && fabs(e) <= 64.0) return powi(a, (int)e);
+            if (e == 0.5) return function(OP_SQRT, a);
+        }
+        if (isConstant(a) && isConstant(b)) return constant(pow(valueOf(a), valueOf(b)));
+        return make(OP_POW, a, b, 0.0);
+    }
+
+    int function(int op, int a)
+    {
+        if (isConstant(a)) return constant(apply(op, valueOf(a), 0.0));
+        return make(op, a, -1, 0.0);
+    }
+
+    int function(int op, int a, int b)
+    {
+        if (isConstant(a) && isConstant(b)) return constant(apply(op, valueOf(a), valueOf(b)));
+        if (a == b) return (op == OP_LESS) ? constant(0.0) : a;
+        return make(op, a, b, 0.0);
+    }
+
+    //! Derivative of a_node along axis a_axis; a_memo holds those already taken.
+    int derivative(int a_node, int a_axis, map<int, int>& a_memo)
+    {
+        map<int, int>::iterator it = a_memo.find(a_node);
+        if (it != a_memo.end())
+            return it->second;
+
+        // a copy: the builders may grow the node array
+        ExpressionNode node = nodes[a_node];
+        int d = 0;
+        switch (node.op)
+        {
+            case OP_X: case OP_Y: case OP_Z:
+                d = constant((node.op - OP_X == a_axis) ? 1.0 : 0.0);
+                break;
+            case OP_CONST: case OP_SIGN: case OP_LESS:
+                d = constant(0.0);
+                break;
+            case OP_ADD:
+                d = add(derivative(node.a, a_axis, a_memo), derivative(node.b, a_axis, a_memo));
+                break;
+            case OP_SUB:
+                d = sub(derivative(node.a, a_axis, a_memo), derivative(node.b, a_axis, a_memo));
+                break;
+            case OP_MUL:
+                d = add(mul(derivative(node.a, a_axis, a_memo), node.b),
+                        mul(node.a, derivative(node.b, a_axis, a_memo)));
+                break;
+            case OP_DIV:
+                // (a / b)' = (a' - (a / b) b') / b
+                d = div(sub(derivative(node.a, a_axis, a_memo), mul(a_node, derivative(node.b, a_axis, a_memo))),
+                        node.b);
+                break;
+            case OP_NEG:
+                d = neg(derivative(node.a, a_axis, a_memo));
+                break;
+            case OP_POWI:
+                d = mul(mul(constant(node.value), powi(node.a, (int)node.value - 1)),
+                        derivative(node.a, a_axis, a_memo));
+                break;
+            case OP_POW:
+            {
+                // (a^b)' = a^b (b' log a + b a' / a)
+                int da = derivative(node.a, a_axis, a_memo);
+                int db = derivative(node.b, a_axis, a_memo);
+                if (isConstant(db, 0.0))
+                    d = mul(mul(node.b, power(node.a, sub(node.b, constant(1.0)))), da);
+                else
+                    d = mul(a_node, add(mul(db, function(OP_LOG, node.a)), div(mul(node.b, da), node.a)));
+                break;
+            }
+            case OP_SQRT:
+                d = div(derivative(node.a, a_axis, a_memo), mul(constant(2.0), a_node));
+                break;
+            case OP_SIN:
+                d = mul(function(OP_COS, node.a), derivative(node.a, a_axis, a_memo));
+                break;
+            case OP_COS:
+                d = neg(mul(function(OP_SIN, node.a), derivative(node.a, a_axis, a_memo)));
+                break;
+            case OP_EXP:
+                d = mul(a_node, derivative(node.a, a_axis, a_memo));
+                break;
+            case OP_LOG:
+                d = div(derivative(node.a, a_axis, a_memo), node.a);
+                break;
+            case OP_ABS:
+                d = mul(function(OP_SIGN, node.a), derivative(node.a, a_axis, a_memo));
+                break;
+            case OP_MIN:
+            case OP_MAX:
+            {
+                // the derivative of whichever operand is taken
+                int less = function(OP_LESS, node.a, node.b);
+                int taken = (node.op == OP_MIN) ? node.a : node.b;
+                int other = (node.op == OP_MIN) ? node.b : node.a;
+                d = add(mul(less, derivative(taken, a_axis, a_memo)),
+                        mul(sub(constant(1.0), less), derivative(other, a_axis, a_memo)));
+                break;
+            }
+        }
+
+        a_memo[a_node] = d;
+        return d;
+    }
+
+    //! a_node with its integer powers reduced to multiplications.
+    int lower(int a_node, map<int, int>& a_memo)
+    {
+        map<int, int>::iterator it = a_memo.find(a_node);
+        if (it != a_memo.end())
+            return it->second;
+
+        ExpressionNode node = nodes[a_node];
+        int result = a_node;
+        if (node.op == OP_POWI)
+        {
+            result = expand(lower(node.a, a_memo), (int)node.value);
+        }
+        else if (node.a >= 0)
+        {
+            int a = lower(node.a, a_memo);
+            int b = (node.b >= 0) ? lower(node.b, a_memo) : -1;
+            switch (node.op)
+            {
+                case OP_ADD:  result = add(a, b); break;
+                case OP_SUB:  result = sub(a, b); break;
+                case OP_MUL:  result = mul(a, b); break;
+                case OP_DIV:  result = div(a, b); break;
+                case OP_NEG:  result = neg(a); break;
+                case OP_POW:  result = power(a, b); break;
+                default:      result = (b >= 0) ? function(node.op, a, b) : function(node.op, a); break;
+            }
+        }
+
+        a_memo[a_node] = result;
+        return result;
+    }
+
+private:
+    struct Key
+    {
+        int op, a, b;
+        uint64_t value;
+        bool operator<(const Key& o) const
+        {
+            if (op != o.op) return op < o.op;
+            if (a != o.a) return a < o.a;
+            if (b != o.b) return b < o.b;
+            return value < o.value;
+        }
+    };
+
+    map<Key, int> m_index;
+
+    int make(int op, int a, int b, double value)
+    {
+        if ((op == OP_ADD || op == OP_MUL || op == OP_MIN || op == OP_MAX) && a > b)
+            swap(a, b);
+
+        Key key = { op, a, b, 0 };
+        memcpy(&key.value, &value, sizeof(value));
+        map<Key, int>::iterator it = m_index.find(key);
+        if (it != m_index.end())
+            return it->second;
+
+        ExpressionNode node = { op, a, b, value };
+        nodes.push_back(node);
+        m_index[key] = (int)nodes.size() - 1;
+        return (int)nodes.size() - 1;
+    }
+
+    // a^n by squaring: a^8 is three multiplications, and a^2 is shared by
+    // every power that needs it
+    int expand(int a, int n)
+    {
+        if (n < 0) return div(constant(1.0), expand(a, -n));
+        if (n == 0) return constant(1.0);
+        if (n == 1) return a;
+        if (n % 2 == 0)
+        {
+            int half = expand(a, n / 2);
+            return make(OP_MUL, half, half, 0.0);
+        }
+        return mul(expand(a, n - 1), a);
+    }
+
+    static double apply(int op, double a, double b)
+    {
+        switch (op)
+        {
+            case OP_SQRT: return sqrt(a);
+            case OP_SIN:  return sin(a);
+            case OP_COS:  return cos(a);
+            case OP_EXP:  return exp(a);
+            case OP_LOG:  return log(a);
+            case OP_ABS:  return fabs(a);
+            case OP_SIGN: return (a > 0.0) ? 1.0 : ((a < 0.0) ? -1.0 : 0.0);
+            case OP_MIN:  return cMin(a, b);
+            case OP_MAX:  return cMax(a, b);
+            case OP_LESS: return (a < b) ? 1.0 : 0.0;
+            default:      return 0.0;
+        }
+    }
+};
+
+//===========================================================================
+/*
+    Recursive descent parser building the expression graph.  Errors are
+    reported as the first failure with its column; every rule returns -1
+    once one has occurred.
+*/
+//===========================================================================
+class ExpressionParser
+{
+public:
+    ExpressionParser(const string& a_text, ExpressionGraph& a_graph)
+        : m_text(a_text), m_graph(a_graph), m_pos(0) {}
+
+    bool parse(int& a_root, string& a_error)
+    {
+        a_root = expression();
+        if (a_root >= 0 && peek() != 0)
+            a_root = fail(string("unexpected '") + peek() + "'");
+        a_error = m_error;
+        return a_root >= 0;
+    }
+
+private:
+    const string& m_text;
+    ExpressionGraph& m_graph;
+    size_t m_pos;
+    string m_error;
+
+    char peek()
+    {
+        while (m_pos < m_text.size() && isspace((unsigned char)m_text[m_pos]))
+            ++m_pos;
+        return (m_pos < m_text.size()) ? m_text[m_pos] : 0;
+    }
+
+    int fail(const string& a_message)
+    {
+        if (m_error.empty())
+            m_error = a_message + " at column " + to_string(m_pos + 1);
+        return -1;
+    }
+
+    // sum := term { (+ | -) term }
+    int expression()
+    {
+        int left = term();
+        while (left >= 0 && (peek() == '+' || peek() == '-'))
+        {
+            char op = m_text[m_pos++];
+            int right = term();
+            if (right < 0)
+                return -1;
+            left = (op == '+') ? m_graph.add(left, right) : m_graph.sub(left, right);
+        }
+        return left;
+    }
+
+    // term := factor { (* | /) factor | power }, the last by juxtaposition
+    int term()
+    {
+        int left = factor();
+        while (left >= 0)
+        {
+            char c = peek();
+            int right;
+            if (c == '*' || c == '/')
+            {
+                ++m_pos;
+                right = factor();
+            }
+            else if (isalnum((unsigned char)c) || c == '.' || c == '(')
+            {
+                c = '*';
+                right = power();
+            }
+            else
+            {
+                break;
+            }
+
+            if (right < 0)
+                return -1;
+            left = (c == '*') ? m_graph.mul(left, right) : m_graph.div(left, right);
+        }
+        return left;
+    }
+
+    // factor := - factor | + factor | power
+    int factor()
+    {
+        char c = peek();
+        if (c == '-' || c == '+')
+        {
+            ++m_pos;
+            int operand = factor();
+            if (operand < 0)
+                return -1;
+            return (c == '-') ? m_graph.neg(operand) : operand;
+        }
+        return power();
+    }
+
+    // power := primary [ ^ factor ]
+    int power()
+    {
+        int base = primary();
+        if (base < 0 || peek() != '^')
+            return base;
+        ++m_pos;
+        int exponent = factor();
+        if (exponent < 0)
+            return -1;
+        return m_graph.power(base, exponent);
+    }
+
+    int primary()
+    {
+        char c = peek();
+        if (isdigit((unsigned char)c) || c == '.')
+            return number();
+        if (isalpha((unsigned char)c))
+            return name();
+        if (c == '(')
+        {
+            ++m_pos;
+            int inner = expression();
+            if (inner < 0)
+                return -1;
+            if (peek() != ')')
+                return fail("expected ')'");
+            ++m_pos;
+            return inner;
+        }
+        if (c == 0)
+            return fail("unexpected end");
+        return fail(string("unexpected '") + c + "'");
+    }
+
+    int number()
+    {
+        size_t start = m_pos;
+        while (m_pos < m_text.size() && isdigit((unsigned char)m_text[m_pos]))
+            ++m_pos;
+        if (m_pos < m_text.size() && m_text[m_pos] == '.')
+            ++m_pos;
+        while (m_pos < m_text.size() && isdigit((unsigned char)m_text[m_pos]))
+            ++m_pos;
+
+        // an exponent only if digits follow, so 2exp(x) is 2 exp(x)
+        if (m_pos < m_text.size() && (m_text[m_pos] == 'e' || m_text[m_pos] == 'E'))
+        {
+            size_t digits = m_pos + 1;
+            if (digits < m_text.size() && (m_text[digits] == '+' || m_text[digits] == '-'))
+                ++digits;
+            if (digits < m_text.size() && isdigit((unsigned char)m_text[digits]))
+            {
+                m_pos = digits;
+                while (m_pos < m_text.size() && isdigit((unsigned char)m_text[m_pos]))
+                    ++m_pos;
+            }
+        }
+
+        string text = m_text.substr(start, m_pos - start);
+        if (text == ".")
+            return fail("expected a number");
+        return m_graph.constant(atof(text.c_str()));
+    }
+
+    int name()
+    {
+        size_t start = m_pos;
+        while (m_pos < m_text.size() && isalpha((unsigned char)m_text[m_pos]))
+            ++m_pos;
+        string word = m_text.substr(start, m_pos - start);
+
+        static const struct { const char* name; int op; int arguments; } functions[] =
+        {
+            { "sqrt", OP_SQRT, 1 }, { "sin", OP_SIN, 1 }, { "cos", OP_COS, 1 }, { "exp", OP_EXP, 1 },
+            { "log", OP_LOG, 1 }, { "abs", OP_ABS, 1 }, { "min", OP_MIN, 2 }, { "max", OP_MAX, 2 }
+        };
+        for (size_t n = 0; n < sizeof(functions) / sizeof(functions[0]); ++n)
+        {
+            if (word != functions[n].name)
+                continue;
+            if (peek() != '(')
+                return fail("expected '(' after " + word);
+            ++m_pos;
+            int first = expression();
+            int second = -1;
+            if (first >= 0 && functions[n].arguments == 2)
+            {
+                if (peek() != ',')
+                    return fail("expected ',' in " + word);
+                ++m_pos;
+                second = expression();
+                if (second < 0)
+                    return -1;
+            }
+            if (first < 0)
+                return -1;
+            if (peek() != ')')
+                return fail("expected ')' after the arguments of " + word);
+            ++m_pos;
+            return (second >= 0) ? m_graph.function(functions[n].op, first, second)
+                                 : m_graph.function(functions[n].op, first);
+        }
+
+        if (word == "pi")
+            return m_graph.constant(C_PI);
+
+        // a run of variables, such as xy, multiplies them
+        if (word.find_first_not_of("xyz") == string::npos)
+        {
+            m_pos = start + 1;
+            return m_graph.variable(word[0] - 'x');
+        }
+
+        m_pos = start;
+        return fail("unknown name '" + word + "'");
+    }
+};
+
+} // namespace
+
+//------------------------------------------------------------------------------
+
+ExpressionSource::ExpressionSource()
+    : m_compiled(false)
+{
+}
+
+//===========================================================================
+/*!
+    Parse an expression, differentiate it, reduce its integer powers and
+    allocate registers to what is left.  Nodes are scheduled in the order
+    a depth-first walk of the value needs them, each subexpression of the
+    value followed by its derivatives, so the registers a sum needs do
+    not grow with its terms.  A register is freed after the last
+    instruction reading it, so an instruction may write to the register
+    of its own operand; a constant is also dropped between reads far
+    apart, and loaded again.
+
+    \param  a_expression  The implicit function of x, y and z.
+    \return True if it compiled.
+*/
+//===========================================================================
+bool ExpressionSource::compile(const string& a_expression)
+{
+    ExpressionGraph graph;
+    ExpressionParser parser(a_expression, graph);
+    int root;
+    string error;
+    if (!parser.parse(root, error))
+    {
+        m_error = error;
+        return false;
+    }
+
+    map<int, int> derivatives[3], lowered;
+    int outputs[4];
+    for (int axis = 0; axis < 3; ++axis)
+        outputs[1 + axis] = graph.derivative(root, axis, derivatives[axis]);
+    outputs[0] = graph.lower(root, lowered);
+    for (int axis = 0; axis < 3; ++axis)
+        outputs[1 + axis] = graph.lower(outputs[1 + axis], lowered);
+
+    vector<double> constants;
+    auto generate = [&](int a_outputCount, Program& a_program) -> bool
+    {
+        const vector<ExpressionNode>& nodes = graph.nodes;
+
+        // every node the outputs need, after the nodes it needs, in the
+        // order depth-first walks from the nodes given to walk() need them
+        vector<int> order;
+        vector<char> visited(nodes.size(), 0);
+        vector<int> stack;
+        auto walk = [&](int a_root)
+        {
+            stack.push_back(a_root);
+            while (!stack.empty())
+            {
+                int node = stack.back();
+                if (visited[node] == 2)
+                {
+                    stack.pop_back();
+                    continue;
+                }
+                if (visited[node] == 0)
+                {
+                    visited[node] = 1;
+                    if (nodes[node].b >= 0 && !visited[nodes[node].b]) stack.push_back(nodes[node].b);
+                    if (nodes[node].a >= 0 && !visited[nodes[node].a]) stack.push_back(nodes[node].a);
+                    continue;
+                }
+                visited[node] = 2;
+                order.push_back(node);
+                stack.pop_back();
+            }
+        };
+
+        // walking the value and then the gradient would keep all that the
+        // gradient shares with the value live in between, one register per
+        // term of a sum.  Instead, walk the value as it was parsed, and
+        // schedule each of its subexpressions with its derivatives, so the
+        // four sums go forward together
+        if (a_outputCount > 1)
+        {
+            vector<char> parsed(root + 1, 0);
+            vector<int> path(1, root);
+            while (!path.empty())
+            {
+                int node = path.back();
+                const ExpressionNode& source = graph.nodes[node];
+                if (parsed[node] == 0)
+                {
+                    parsed[node] = 1;
+                    if (source.b >= 0 && !parsed[source.b]) path.push_back(source.b);
+                    if (source.a >= 0 && !parsed[source.a]) path.push_back(source.a);
+                    continue;
+                }
+                path.pop_back();
+                if (parsed[node] == 2)
+                    continue;
+                parsed[node] = 2;
+
+                walk(lowered.at(node));
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    map<int, int>::iterator d = derivatives[axis].find(node);
+                    map<int, int>::iterator l = (d != derivatives[axis].end()) ? lowered.find(d->second) : lowered.end();
+                    if (l != lowered.end())
+                        walk(l->second);
+                }
+            }
+        }
+        for (int n = 0; n < a_outputCount; ++n)
+            walk(outputs[n]);
+
+        // the instructions reading each node, in order; outputs are read at
+        // the end
+        vector<vector<int> > reads(nodes.size());
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            const ExpressionNode& node = nodes[order[i]];
+            if (node.a >= 0) reads[node.a].push_back((int)i);
+            if (node.b >= 0 && node.b != node.a) reads[node.b].push_back((int)i);
+        }
+        for (int n = 0; n < a_outputCount; ++n)
+            reads[outputs[n]].push_back((int)order.size());
+        vector<size_t> nextRead(nodes.size(), 0);
+
+        // x, y and z stay in the first three registers
+        vector<int> registers(nodes.size(), -1);
+        vector<int> constantIndex(nodes.size(), -1);
+        vector<int> freeRegisters;
+        for (int r = EXPRESSION_MAX_REGISTERS - 1; r >= 3; --r)
+            freeRegisters.push_back(r);
+
+        // put a constant in a free register
+        auto load = [&](int a_node) -> bool
+        {
+            if (freeRegisters.empty())
+                return false;
+            if (constantIndex[a_node] < 0)
+            {
+                constantIndex[a_node] = (int)constants.size();
+                constants.push_back(nodes[a_node].value);
+            }
+            Instruction instruction;
+            instruction.op = OP_CONST;
+            instruction.a = (uint16_t)constantIndex[a_node];
+            instruction.b = 0;
+            registers[a_node] = freeRegisters.back();
+            freeRegisters.pop_back();
+            instruction.dst = (uint8_t)registers[a_node];
+            a_program.code.push_back(instruction);
+            return true;
+        };
+
+        string overflow = "the expression needs more than " + to_string(EXPRESSION_MAX_REGISTERS) + " registers";
+        a_program.code.clear();
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            const ExpressionNode& node = nodes[order[i]];
+            if (node.op <= OP_Z)
+            {
+                registers[order[i]] = node.op - OP_X;
+                continue;
+            }
+            if (node.op == OP_CONST)
+            {
+                if (!load(order[i]))
+                {
+                    error = overflow;
+                    return false;
+                }
+                continue;
+            }
+
+            // a constant dropped since it was last read is loaded again
+            int operands[2] = { node.a, (node.b != node.a) ? node.b : -1 };
+            for (int k = 0; k < 2; ++k)
+                if (operands[k] >= 0 && registers[operands[k]] < 0 && !load(operands[k]))
+                {
+                    error = overflow;
+                    return false;
+                }
+
+            Instruction instruction;
+            instruction.op = (uint8_t)node.op;
+            instruction.a = (node.a >= 0) ? (uint16_t)registers[node.a] : 0;
+            instruction.b = (node.b >= 0) ? (uint16_t)registers[node.b] : 0;
+
+            // free the operands this is the last read of, and the constants
+            // not read again soon, which are cheaper to load again than to
+            // keep
+            for (int k = 0; k < 2; ++k)
+            {
+                if (operands[k] < 0)
+                    continue;
+                int next = ++nextRead[operands[k]];
+                bool last = next == (int)reads[operands[k]].size();
+                bool drop = nodes[operands[k]].op == OP_CONST && !last &&
+                            reads[operands[k]][next] > (int)i + EXPRESSION_CONSTANT_REACH &&
+                            reads[operands[k]][next] < (int)order.size();
+                if ((last || drop) && registers[operands[k]] >= 3)
+                {
+                    freeRegisters.push_back(registers[operands[k]]);
+                    if (drop)
+                        registers[operands[k]] = -1;
+                }
+            }
+
+            if (freeRegisters.empty())
+            {
+                error = overflow;
+                return false;
+            }
+            registers[order[i]] = freeRegisters.back();
+            freeRegisters.pop_back();
+            instruction.dst = (uint8_t)registers[order[i]];
+            a_program.code.push_back(instruction);
+        }
+
+        for (int n = 0; n < a_outputCount; ++n)
+            a_program.outputs[n] = registers[outputs[n]];
+        a_program.outputCount = a_outputCount;
+        return true;
+    };
+
+    Program valueProgram, gradientProgram;
+    if (!generate(1, valueProgram) || !generate(4, gradientProgram))
+    {
+        m_error = error;
+        return false;
+    }
+
+    m_expression = a_expression;
+    m_error.clear();
+    m_constants = constants;
+    m_valueProgram = valueProgram;
+    m_gradientProgram = gradientProgram;
+    m_compiled = true;
+    return true;
+}
+
+string ExpressionSource::disassemble(bool a_gradient) const
+{
+    const Program& program = a_gradient ? m_gradientProgram : m_valueProgram;
+    string listing;
+    char line[128];
+    for (size_t i = 0; i < program.code.size(); ++i)
+    {
+        const Instruction& instruction = program.code[i];
+        if (instruction.op == OP_CONST)
+            snprintf(line, sizeof(line), "r%d = %g\n", instruction.dst, m_constants[instruction.a]);
+        else if (instruction.op == OP_NEG || (instruction.op >= OP_SQRT && instruction.op <= OP_SIGN))
+            snprintf(line, sizeof(line), "r%d = %s r%d\n", instruction.dst, opNames[instruction.op], instruction.a);
+        else
+            snprintf(line, sizeof(line), "r%d = %s r%d, r%d\n", instruction.dst, opNames[instruction.op],
+                     instruction.a, instruction.b);
+        listing += line;
+    }
+    const char* names[4] = { "f", "df/dx", "df/dy", "df/dz" };
+    for (int n = 0; n < program.outputCount; ++n)
+        listing += string(names[n]) + " = r" + to_string(program.outputs[n]) + "\n";
+    return listing;
+}
+
+//===========================================================================
+/*!
+    The register machine.  Registers hold LANES values, one per point, and
+    every instruction loops over them, which the compiler turns into
+    vector instructions for the arithmetic.
+
+    \param  a_program  Program to run.
+    \param  a_x  LANES x coordinates (likewise a_y and a_z).
+    \param  a_outputs  Where to write the LANES values of each output.
+*/
+//===========================================================================
+template <int LANES>
+void ExpressionSource::run(const Program& a_program, const double* a_x, const double* a_y, const double* a_z,
+                           double* const* a_outputs) const
+{
+    double r[EXPRESSION_MAX_REGISTERS][LANES];
+    for (int l = 0; l < LANES; ++l)
+    {
+        r[0][l] = a_x[l];
+        r[1][l] = a_y[l];
+        r[2][l] = a_z[l];
+    }
+
+    const Instruction* code = a_program.code.data();
+    const Instruction* end = code + a_program.code.size();
+    for (; code != end; ++code)
+    {
+        double* d = r[code->dst];
+        if (code->op == OP_CONST)
+        {
+            double c = m_constants[code->a];
+            for (int l = 0; l < LANES; ++l) d[l] = c;
+            continue;
+        }
+
+        const double* a = r[code->a];
+        const double* b = r[code->b];
+        switch (code->op)
+        {
+            case OP_ADD:  for (int l = 0; l < LANES; ++l) d[l] = a[l] + b[l]; break;
+            case OP_SUB:  for (int l = 0; l < LANES; ++l) d[l] = a[l] - b[l]; break;
+            case OP_MUL:  for (int l = 0; l < LANES; ++l) d[l] = a[l] * b[l]; break;
+            case OP_DIV:  for (int l = 0; l < LANES; ++l) d[l] = a[l] / b[l]; break;
+            case OP_NEG:  for (int l = 0; l < LANES; ++l) d[l] = -a[l]; break;
+            case OP_POW:  for (int l = 0; l < LANES; ++l) d[l] = pow(a[l], b[l]); break;
+            case OP_SQRT: for (int l = 0; l < LANES; ++l) d[l] = sqrt(a[l]); break;
+            case OP_SIN:  for (int l = 0; l < LANES; ++l) d[l] = sin(a[l]); break;
+            case OP_COS:  for (int l = 0; l < LANES; ++l) d[l] = cos(a[l]); break;
+            case OP_EXP:  for (int l = 0; l < LANES; ++l) d[l] = exp(a[l]); break;
+            case OP_LOG:  for (int l = 0; l < LANES; ++l) d[l] = log(a[l]); break;
+            case OP_ABS:  for (int l = 0; l < LANES; ++l) d[l] = fabs(a[l]); break;
+            case OP_SIGN: for (int l = 0; l < LANES; ++l) d[l] = (a[l] > 0.0) ? 1.0 : ((a[l] < 0.0) ? -1.0 : 0.0); break;
+            case OP_MIN:  for (int l = 0; l < LANES; ++l) d[l] = (a[l] < b[l]) ? a[l] : b[l]; break;
+            case OP_MAX:  for (int l = 0; l < LANES; ++l) d[l] = (a[l] > b[l]) ? a[l] : b[l]; break;
+            case OP_LESS: for (int l = 0; l < LANES; ++l) d[l] = (a[l] < b[l]) ? 1.0 : 0.0; break;
+        }
+    }
+
+    for (int n = 0; n < a_program.outputCount; ++n)
+        for (int l = 0; l < LANES; ++l)
+            a_outputs[n][l] = r[a_program.outputs[n]][l];
+}
+
+double ExpressionSource::value(const cVector3d& a_point) const
+{
+    if (!m_compiled)
+        return 1.0;
+
+    double x = a_point.x(), y = a_point.y(), z = a_point.z();
+    double f;
+    double* outputs[1] = { &f };
+    run<1>(m_valueProgram, &x, &y, &z, outputs);
+    return f;
+}
+
+cVector3d ExpressionSource::gradient(const cVector3d& a_point) const
+{
+    cVector3d g;
+    evaluate(a_point, g);
+    return g;
+}
+
+double ExpressionSource::evaluate(const cVector3d& a_point, cVector3d& a_gradient) const
+{
+    if (!m_compiled)
+    {
+        a_gradient.zero();
+        return 1.0;
+    }
+
+    double x = a_point.x(), y = a_point.y(), z = a_point.z();
+    double f, gx, gy, gz;
+    double* outputs[4] = { &f, &gx, &gy, &gz };
+    run<1>(m_gradientProgram, &x, &y, &z, outputs);
+    a_gradient.set(gx, gy, gz);
+    return f;
+}
+
+void ExpressionSource::evaluateBatch(const double* a_x, const double* a_y, const double* a_z, int a_count,
+                                     double* a_values, double* a_gx, double* a_gy, double* a_gz) const
+{
+    const int W = EXPRESSION_BATCH_WIDTH;
+    bool gradients = a_gx && a_gy && a_gz;
+    const Program& program = gradients ? m_gradientProgram : m_valueProgram;
+    if (!m_compiled)
+    {
+        for (int n = 0; n < a_count; ++n)
+        {
+            a_values[n] = 1.0;
+            if (gradients)
+                a_gx[n] = a_gy[n] = a_gz[n] = 0.0;
+        }
+        return;
+    }
+
+    int n = 0;
+    for (; n + W <= a_count; n += W)
+    {
+        double* outputs[4] = { a_values + n, gradients ? a_gx + n : 0, gradients ? a_gy + n : 0,
+                               gradients ? a_gz + n : 0 };
+        run<W>(program, a_x + n, a_y + n, a_z + n, outputs);
+    }
+
+    // the last, partial block, padded with copies of its last point
+    if (n < a_count)
+    {
+        double x[W], y[W], z[W], f[W], gx[W], gy[W], gz[W];
+        for (int l = 0; l < W; ++l)
+        {
+            int source = cMin(n + l, a_count - 1);
+            x[l] = a_x[source];
+            y[l] = a_y[source];
+            z[l] = a_z[source];
+        }
+        double* outputs[4] = { f, gx, gy, gz };
+        run<W>(program, x, y, z, outputs);
+        for (int l = 0; n + l < a_count; ++l)
+        {
+            a_values[n + l] = f[l];
+            if (gradients)
+            {
+                a_gx[n + l] = gx[l];
+                a_gy[n + l] = gy[l];
+                a_gz[n + l] = gz[l];
+            }
+        }
+    }
+}
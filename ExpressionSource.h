@@ -0,0 +1,126 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    Implicit functions typed in at run time, such as
+
+        (2x^2 + y^2 + z^2 - 1)^3 - (0.1x^2 + y^2) z^3
+
+    instead of written as C functions and compiled in.  The expression is
+    parsed into a graph in which every subexpression appears once (common
+    subexpressions are merged as the graph is built), constants are
+    folded, and x * 1, x + 0 and the like are simplified away.  The
+    gradient is differentiated symbolically on the same graph, so it
+    shares whatever it can with the value.  Integer powers are then
+    reduced to chains of multiplications (x^8 is three squarings), and the
+    graph is compiled to bytecode for a small register machine.
+
+    The machine runs each instruction over a block of lanes at once, so
+    the compiler can vectorize it: evaluateBatch() computes many points
+    in blocks of EXPRESSION_BATCH_WIDTH, which amortizes the decoding of
+    the bytecode.  Single points (the haptic thread's queries) run the
+    same code on one lane.
+
+    Syntax: numbers, x, y, z, pi, + - * / ^ (right associative; x^-2 is
+    allowed), parentheses, multiplication by juxtaposition (2x, (x+1)y),
+    and the functions sqrt, sin, cos, exp, log, abs, min(a, b), max(a, b).
+
+    Evaluation is thread-safe; compile() is not, and must not run while
+    the source is being rendered.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#ifndef EXPRESSIONSOURCE_H
+#define EXPRESSIONSOURCE_H
+
+#include "ImplicitSource.h"
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+//! Registers of the machine; an expression needing more does not compile.
+#define EXPRESSION_MAX_REGISTERS 128
+
+//! A constant not read again within this many instructions is dropped from
+//! its register, and loaded again when it is.
+#define EXPRESSION_CONSTANT_REACH 16
+
+//! Points evaluated together by evaluateBatch().
+#define EXPRESSION_BATCH_WIDTH 8
+
+class ExpressionSource : public ImplicitSource
+{
+public:
+    ExpressionSource();
+
+    //! Parse and compile a_expression.  On failure, the previous program is
+    //! kept and getError() tells what is wrong, and where.
+    bool compile(const std::string& a_expression);
+
+    //! The expression last compiled successfully.
+    const std::string& getExpression() const { return m_expression; }
+
+    //! Why the last compile() failed.
+    const std::string& getError() const { return m_error; }
+
+    //! True once an expression has compiled.
+    bool isCompiled() const { return m_compiled; }
+
+    //! Instructions of the value program, and of the value and gradient program.
+    int getValueInstructionCount() const { return (int)m_valueProgram.code.size(); }
+    int getGradientInstructionCount() const { return (int)m_gradientProgram.code.size(); }
+
+    //! Listing of the value program, or of the value and gradient program.
+    std::string disassemble(bool a_gradient) const;
+
+    virtual double value(const chai3d::cVector3d& a_point) const;
+    virtual chai3d::cVector3d gradient(const chai3d::cVector3d& a_point) const;
+    virtual double evaluate(const chai3d::cVector3d& a_point, chai3d::cVector3d& a_gradient) const;
+    virtual void valueBatch(const double* a_x, const double* a_y, const double* a_z, int a_count,
+                            double* a_values) const
+    {
+        evaluateBatch(a_x, a_y, a_z, a_count, a_values);
+    }
+
+    //! Values of a_count points given coordinate by coordinate, and their
+    //! gradients if a_gx, a_gy and a_gz are not NULL.
+    virtual void evaluateBatch(const double* a_x, const double* a_y, const double* a_z, int a_count,
+                               double* a_values, double* a_gx = 0, double* a_gy = 0, double* a_gz = 0) const;
+
+private:
+    //! One instruction: dst = op(a, b), or dst = constant a for loads.
+    struct Instruction
+    {
+        uint8_t op;
+        uint8_t dst;
+        uint16_t a;
+        uint16_t b;
+    };
+
+    struct Program
+    {
+        std::vector<Instruction> code;
+
+        //! Registers holding the value and, for the gradient program, the gradient.
+        int outputs[4];
+        int outputCount;
+    };
+
+    //! Run a_program over LANES points and copy its outputs out, output by
+    //! output.
+    template <int LANES>
+    void run(const Program& a_program, const double* a_x, const double* a_y, const double* a_z,
+             double* const* a_outputs) const;
+
+    std::string m_expression;
+    std::string m_error;
+    std::vector<double> m_constants;
+    Program m_valueProgram;
+    Program m_gradientProgram;
+    bool m_compiled;
+};
+
+#endif
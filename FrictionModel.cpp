@@ -0,0 +1,40 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    Stick/slip friction for the implicit surface proxy.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#include "FrictionModel.h"
+
+using namespace chai3d;
+
+void FrictionModel::update(double a_staticFriction, double a_dynamicFriction, FrictionModelType a_type)
+{
+    m_type = a_type;
+    m_staticFriction = a_staticFriction;
+    m_dynamicFriction = a_dynamicFriction;
+
+    m_staticCosSq = 1.0 / (1.0 + a_staticFriction * a_staticFriction);
+    m_kineticCosSq = 1.0 / (1.0 + a_dynamicFriction * a_dynamicFriction);
+    m_kineticSin = a_dynamicFriction / sqrt(1.0 + a_dynamicFriction * a_dynamicFriction);
+}
+
+cVector3d FrictionModel::holdBack(const cVector3d& a_tangent, double a_normalDot) const
+{
+    if (m_type != FRICTION_COULOMB || a_normalDot >= 0.0)
+        return cVector3d(0.0, 0.0, 0.0);
+
+    // keep the tool on the edge of the kinetic cone: the tangential lag is
+    // mu_k times the penetration depth, but never more than the offset itself
+    double lag = -m_dynamicFriction * a_normalDot;
+    double tangentLength = a_tangent.length();
+    if (tangentLength <= lag)
+        return a_tangent;
+
+    return (lag / tangentLength) * a_tangent;
+}
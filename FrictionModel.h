@@ -0,0 +1,95 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    Stick/slip friction for the implicit surface proxy.  The friction cone
+    test is done on squared dot products against constants derived from
+    the friction coefficients, so no trig or normalization is needed per
+    tick.  The constants are only recomputed when the coefficients change.
+
+    Two models are available:
+
+    FRICTION_CONE:      the Salisbury & Tarr friction cone.  The proxy sticks
+                        until the tool leaves the static cone, then slides
+                        fully onto the tangent-plane projection of the tool
+                        until it falls back inside the kinetic cone.
+
+    FRICTION_COULOMB:   Coulomb friction with stick/slip hysteresis.  Same
+                        state transitions, but a sliding proxy trails the
+                        tool so that the tool stays on the edge of the
+                        kinetic cone, giving a dynamic friction force of
+                        mu_k times the normal force.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#ifndef FRICTIONMODEL_H
+#define FRICTIONMODEL_H
+
+#include "chai3d.h"
+
+//! Friction models selectable on an ImplicitMesh.
+enum FrictionModelType
+{
+    FRICTION_CONE,
+    FRICTION_COULOMB
+};
+
+class FrictionModel
+{
+public:
+    FrictionModel() : m_type(FRICTION_CONE), m_staticFriction(-1.0), m_dynamicFriction(-1.0) { sync(0.0, 0.0, FRICTION_CONE); }
+
+    //! Recompute the cone constants if the coefficients or model changed.
+    void sync(double a_staticFriction, double a_dynamicFriction, FrictionModelType a_type)
+    {
+        if (a_staticFriction != m_staticFriction || a_dynamicFriction != m_dynamicFriction || a_type != m_type)
+            update(a_staticFriction, a_dynamicFriction, a_type);
+    }
+
+    //! Next stick/slip state, given the proxy-to-tool vector's dot product with
+    //! the unit surface normal and its squared length.
+    bool updateKinetic(double a_normalDot, double a_lengthSq, bool a_kinetic) const
+    {
+        // |tan(theta)| > mu  <=>  cos^2(theta) < 1 / (1 + mu^2)
+        double normalSq = a_normalDot * a_normalDot;
+
+        if (normalSq < m_staticCosSq * a_lengthSq)
+            a_kinetic = true;
+
+        if (a_kinetic && !(normalSq < m_kineticCosSq * a_lengthSq))
+            a_kinetic = false;
+
+        return a_kinetic;
+    }
+
+    //! Distance from the tool to the kinetic cone for a proxy-to-tool distance.
+    double frictionDistance(double a_length, double a_epsilon) const
+    {
+        return m_kineticSin * a_length + a_epsilon;
+    }
+
+    //! How far a sliding proxy stays behind the tangential offset a_tangent,
+    //! where a_normalDot is the (negative when inside) normal offset.
+    chai3d::cVector3d holdBack(const chai3d::cVector3d& a_tangent, double a_normalDot) const;
+
+    FrictionModelType getType() const { return m_type; }
+
+private:
+    void update(double a_staticFriction, double a_dynamicFriction, FrictionModelType a_type);
+
+    FrictionModelType m_type;
+    double m_staticFriction;
+    double m_dynamicFriction;
+
+    //! cos^2 of the static and kinetic cone half-angles: 1 / (1 + mu^2).
+    double m_staticCosSq;
+    double m_kineticCosSq;
+
+    //! sin of the kinetic cone half-angle: mu_k / sqrt(1 + mu_k^2).
+    double m_kineticSin;
+};
+
+#endif
@@ -0,0 +1,97 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    Gradients of implicit functions that come without one.  See
+    GradientEstimator.h.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#include "GradientEstimator.h"
+#include <math.h>
+#include <float.h>
+
+using namespace chai3d;
+
+
+namespace
+{
+    // the steps of the last call on this thread outside any scope, and
+    // those of the innermost GradientStepScope (NULL outside them all)
+    thread_local GradientSteps threadSteps = { 0, { 0.0, 0.0, 0.0 } };
+    thread_local GradientSteps* scopedSteps = 0;
+
+    // the step of the differences from a_point along a_axis, near a_step
+    // but rounded so that the point moved by it is exactly representable
+    double roundStep(const cVector3d& a_point, int a_axis, double a_step)
+    {
+        volatile double ahead = a_point(a_axis) + a_step;
+        return ahead - a_point(a_axis);
+    }
+
+    // the one-sided differences at a_step and twice it along a_axis,
+    // extrapolated; a_curvature is set to the second derivative there
+    double differentiate(double (*a_function)(double, double, double), const cVector3d& a_point,
+                         double a_value, int a_axis, double a_step, double& a_curvature)
+    {
+        cVector3d near = a_point, far = a_point;
+        near(a_axis) += a_step;
+        far(a_axis) += 2.0 * a_step;
+        double nearValue = a_function(near.x(), near.y(), near.z());
+        double farValue = a_function(far.x(), far.y(), far.z());
+        a_curvature = fabs(farValue - 2.0 * nearValue + a_value) / (a_step * a_step);
+        return (4.0 * nearValue - farValue - 3.0 * a_value) / (2.0 * a_step);
+    }
+}
+
+
+GradientStepScope::GradientStepScope(GradientSteps* a_steps) : m_previous(scopedSteps)
+{
+    scopedSteps = a_steps;
+}
+
+GradientStepScope::~GradientStepScope()
+{
+    scopedSteps = m_previous;
+}
+
+
+cVector3d estimateGradient(double (*a_function)(double, double, double),
+                           const cVector3d& a_point, double a_value)
+{
+    GradientSteps& lastSteps = scopedSteps ? *scopedSteps : threadSteps;
+
+    // with the steps of the last call, kept within the relative bounds at
+    // this point, or with the longest on a first call; compared cubed, so
+    // the cube root is only taken for a shorter step
+    bool remembered = (lastSteps.function == a_function);
+    cVector3d gradient;
+    double curvatures[3];
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        double scale = cMax(fabs(a_point(axis)), 1.0);
+        double step = GRADIENT_RELATIVE_STEP * scale;
+        if (remembered && lastSteps.cubes[axis] < step * step * step)
+            step = cMax(cbrt(lastSteps.cubes[axis]), GRADIENT_MIN_STEP * scale);
+        gradient(axis) = differentiate(a_function, a_point, a_value, axis,
+                                       roundStep(a_point, axis, step), curvatures[axis]);
+    }
+
+    // the steps of the next call: those that balance the truncation error
+    // h^2 |f'''| / 3, with f''' ~ f''^2 / |grad f|, against the rounding
+    // error 4 e / h, with e ~ epsilon max(|f|, |x| |grad f|); the longest
+    // where the function does not curve
+    double slope = gradient.length();
+    double rounding = DBL_EPSILON * cMax(fabs(a_value), cMax(a_point.length(), 1.0) * slope);
+    lastSteps.function = a_function;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        double squared = curvatures[axis] * curvatures[axis];
+        lastSteps.cubes[axis] = (squared > 0.0) ? 6.0 * rounding * slope / squared : HUGE_VAL;
+    }
+
+    return gradient;
+}
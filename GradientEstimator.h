@@ -0,0 +1,82 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    Gradients of implicit functions that come without one.  A hand-derived
+    gradient is easy to get wrong or to pair with the wrong function, and
+    either breaks contact silently; a FunctionSource given no gradient
+    estimates it with estimateGradient() instead.
+
+    Along each axis the function is sampled a step h and 2h away from the
+    point, and the one-sided differences at h and 2h are combined by
+    Richardson extrapolation, which cancels their first-order error:
+
+        df/dx ~ (4 f(x+h) - f(x+2h) - 3 f(x)) / 2h  + O(h^2)
+
+    The value at the point is the one the caller evaluates anyway, so a
+    value and gradient cost exactly six evaluations more than the value
+    alone.  (Extrapolating central differences would need four samples per
+    axis for the same second order.)
+
+    The step adapts to the function along the path of the queries.  The
+    samples also give the second derivative f'', and from it follows the
+    step that balances the truncation error h^2 |f'''| / 3, taking
+    f''' ~ f''^2 / |grad f|, against the rounding error 4 e / h of values
+    good to e ~ epsilon max(|f|, |x| |grad f|): short where the function
+    curves tightly for its slope, less so where its value is large.  That
+    step is taken by the next call for the same function on the same
+    thread, or by the same tool within a GradientStepScope, which is the
+    next Newton step or tick, close by; a first call takes a fixed
+    fraction of the coordinate (or of 1 near the origin), on the long
+    side.  Nothing is sampled twice.  A
+    step made too short by a noisy f'' finds f'' no larger than the noise,
+    which lengthens the next one again.  Every step is rounded so that
+    x + h is exactly representable.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#ifndef GRADIENTESTIMATOR_H
+#define GRADIENTESTIMATOR_H
+
+#include "chai3d.h"
+
+//! First and longest step of the differences, relative to the coordinate
+//! (or to 1 below it).
+#define GRADIENT_RELATIVE_STEP 1e-5
+
+//! Shortest step of the differences, relative as above.
+#define GRADIENT_MIN_STEP 1e-9
+
+//! The steps the last estimate found for a function, cubed, for the next.
+//! Zero-initialised, it holds none.
+struct GradientSteps
+{
+    double (*function)(double, double, double);
+    double cubes[3];
+};
+
+//! While in scope, the estimates on this thread carry their steps in
+//! a_steps instead of the thread's own, so that the gradients a tool gets
+//! depend on its own queries only, whatever else runs on its thread.
+class GradientStepScope
+{
+public:
+    GradientStepScope(GradientSteps* a_steps);
+    ~GradientStepScope();
+
+private:
+    GradientStepScope(const GradientStepScope&);
+    GradientStepScope& operator=(const GradientStepScope&);
+
+    GradientSteps* m_previous;
+};
+
+//! Gradient of a_function at a_point, where its value is a_value, with the
+//! steps found by the last call for a_function (see GradientStepScope).
+chai3d::cVector3d estimateGradient(double (*a_function)(double, double, double),
+                                   const chai3d::cVector3d& a_point, double a_value);
+
+#endif
@@ -0,0 +1,188 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    Timing instrumentation for the haptic loop.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#include "HapticProfiler.h"
+#include <chrono>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+unsigned long long hapticNowNs()
+{
+    // steady_clock is backed by QueryPerformanceCounter on Windows and by
+    // CLOCK_MONOTONIC on Linux; both are invariant across cores
+    return (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//------------------------------------------------------------------------------
+
+static int highestBit(unsigned long long a_value)
+{
+#if defined(_MSC_VER) && defined(_WIN64)
+    unsigned long index;
+    _BitScanReverse64(&index, a_value);
+    return (int)index;
+#elif defined(__GNUC__)
+    return 63 - __builtin_clzll(a_value);
+#else
+    int bit = 0;
+    while (a_value >>= 1) bit++;
+    return bit;
+#endif
+}
+
+int LatencyHistogram::bucketOf(unsigned long long a_ns)
+{
+    if (a_ns < (unsigned long long)SUB_COUNT)
+        return (int)a_ns;
+
+    int msb = highestBit(a_ns);
+    int sub = (int)((a_ns >> (msb - SUB_BITS)) & (SUB_COUNT - 1));
+    int bucket = (msb - SUB_BITS + 1) * SUB_COUNT + sub;
+    return bucket < BUCKET_COUNT ? bucket : BUCKET_COUNT - 1;
+}
+
+unsigned long long LatencyHistogram::bucketMidpoint(int a_bucket)
+{
+    if (a_bucket < SUB_COUNT)
+        return (unsigned long long)a_bucket;
+
+    int shift = a_bucket / SUB_COUNT - 1;
+    unsigned long long low = (unsigned long long)(SUB_COUNT + a_bucket % SUB_COUNT) << shift;
+    return low + ((1ull << shift) >> 1);
+}
+
+void LatencyHistogram::record(unsigned long long a_ns)
+{
+    // single writer: plain load/store pairs avoid locked read-modify-writes
+    std::atomic<unsigned int>& bucket = m_buckets[bucketOf(a_ns)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    m_sum.store(m_sum.load(std::memory_order_relaxed) + a_ns, std::memory_order_relaxed);
+    if (a_ns > m_max.load(std::memory_order_relaxed))
+        m_max.store(a_ns, std::memory_order_relaxed);
+    m_count.store(m_count.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+unsigned long long LatencyHistogram::percentile(double a_fraction) const
+{
+    unsigned long long count = m_count.load(std::memory_order_acquire);
+    if (count == 0)
+        return 0;
+
+    unsigned long long target = (unsigned long long)(a_fraction * (double)count);
+    unsigned long long seen = 0;
+    for (int i = 0; i < BUCKET_COUNT; ++i)
+    {
+        seen += m_buckets[i].load(std::memory_order_relaxed);
+        if (seen > target)
+            return bucketMidpoint(i);
+    }
+
+    return getMax();
+}
+
+double LatencyHistogram::getMean() const
+{
+    unsigned long long count = getCount();
+    return count ? (double)m_sum.load(std::memory_order_relaxed) / (double)count : 0.0;
+}
+
+void LatencyHistogram::reset()
+{
+    for (int i = 0; i < BUCKET_COUNT; ++i)
+        m_buckets[i].store(0, std::memory_order_relaxed);
+    m_count.store(0);
+    m_sum.store(0);
+    m_max.store(0);
+}
+
+//------------------------------------------------------------------------------
+
+HapticProfiler::HapticProfiler(double a_deadlineSeconds)
+    : m_overruns(0),
+      m_deadlineNs((unsigned long long)(a_deadlineSeconds * 1e9)),
+      m_tickStart(0), m_lastMark(0), m_previousTickStart(0), m_lastTickNs(0)
+{
+}
+
+void HapticProfiler::beginTick()
+{
+    m_tickStart = hapticNowNs();
+    m_lastMark = m_tickStart;
+
+    if (m_previousTickStart != 0)
+    {
+        unsigned long long period = m_tickStart - m_previousTickStart;
+        m_histograms[HAPTIC_STAGE_PERIOD].record(period);
+        if (period > m_deadlineNs)
+            m_overruns.store(m_overruns.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    m_previousTickStart = m_tickStart;
+}
+
+void HapticProfiler::mark(HapticStage a_stage)
+{
+    unsigned long long now = hapticNowNs();
+    m_histograms[a_stage].record(now - m_lastMark);
+    m_lastMark = now;
+}
+
+void HapticProfiler::endTick()
+{
+    m_lastTickNs = hapticNowNs() - m_tickStart;
+    m_histograms[HAPTIC_STAGE_TICK].record(m_lastTickNs);
+}
+
+const char* HapticProfiler::stageName(HapticStage a_stage)
+{
+    switch (a_stage)
+    {
+        case HAPTIC_STAGE_GLOBAL_POSITIONS:   return "computeGlobalPositions";
+        case HAPTIC_STAGE_UPDATE_FROM_DEVICE: return "updateFromDevice";
+        case HAPTIC_STAGE_INTERACTION_FORCES: return "computeInteractionForces";
+        case HAPTIC_STAGE_APPLY_TO_DEVICE:    return "applyToDevice";
+        case HAPTIC_STAGE_TICK:               return "tick";
+        case HAPTIC_STAGE_PERIOD:             return "period";
+        default:                              return "unknown";
+    }
+}
+
+std::string HapticProfiler::summary() const
+{
+    const LatencyHistogram& period = m_histograms[HAPTIC_STAGE_PERIOD];
+    const LatencyHistogram& forces = m_histograms[HAPTIC_STAGE_INTERACTION_FORCES];
+
+    char text[256];
+    snprintf(text, sizeof(text),
+             "period p50 %.1f / p99 %.1f / p99.9 %.1f / max %.1f us  --  forces p99 %.1f us  --  overruns %llu",
+             period.percentile(0.50) * 1e-3, period.percentile(0.99) * 1e-3,
+             period.percentile(0.999) * 1e-3, period.getMax() * 1e-3,
+             forces.percentile(0.99) * 1e-3, getOverruns());
+    return std::string(text);
+}
+
+void HapticProfiler::writeCSVHeader(FILE* a_file)
+{
+    fprintf(a_file, "device,stage,count,mean_us,p50_us,p99_us,p999_us,max_us,overruns\n");
+}
+
+void HapticProfiler::writeCSV(FILE* a_file, const std::string& a_label) const
+{
+    for (int i = 0; i < HAPTIC_STAGE_COUNT; ++i)
+    {
+        const LatencyHistogram& h = m_histograms[i];
+        fprintf(a_file, "%s,%s,%llu,%.3f,%.3f,%.3f,%.3f,%.3f,%llu\n",
+                a_label.c_str(), stageName((HapticStage)i), h.getCount(),
+                h.getMean() * 1e-3, h.percentile(0.50) * 1e-3, h.percentile(0.99) * 1e-3,
+                h.percentile(0.999) * 1e-3, h.getMax() * 1e-3, getOverruns());
+    }
+}
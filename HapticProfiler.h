@@ -0,0 +1,144 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    Timing instrumentation for the haptic loop.  Each stage of a haptic
+    tick is timed against a monotonic clock and recorded into a log-linear
+    (HDR-style) latency histogram, so that tail latency and jitter can be
+    inspected rather than just the mean rate.
+
+    Histograms are written by a single haptic thread and may be read at
+    any time by other threads without locks.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#ifndef HAPTICPROFILER_H
+#define HAPTICPROFILER_H
+
+#include <atomic>
+#include <string>
+#include <cstdio>
+
+//! Current time of the monotonic clock in nanoseconds.
+unsigned long long hapticNowNs();
+
+//===========================================================================
+/*
+    Log-linear latency histogram.  Values below 2^SUB_BITS ns are counted
+    exactly; above that every power of two is split into 2^SUB_BITS linear
+    sub-buckets, bounding the relative error to about 3%.
+*/
+//===========================================================================
+class LatencyHistogram
+{
+public:
+    static const int SUB_BITS = 5;
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    static const int BUCKET_COUNT = 64 * SUB_COUNT;
+
+    LatencyHistogram() { reset(); }
+
+    //! Record one value in nanoseconds. Single writer only.
+    void record(unsigned long long a_ns);
+
+    //! Value (in nanoseconds) below which the given fraction of samples fall.
+    unsigned long long percentile(double a_fraction) const;
+
+    //! Largest value recorded.
+    unsigned long long getMax() const { return m_max.load(std::memory_order_relaxed); }
+
+    //! Number of values recorded.
+    unsigned long long getCount() const { return m_count.load(std::memory_order_relaxed); }
+
+    //! Mean of the recorded values.
+    double getMean() const;
+
+    //! Clear all counts. Not safe while the writer is recording.
+    void reset();
+
+private:
+    static int bucketOf(unsigned long long a_ns);
+    static unsigned long long bucketMidpoint(int a_bucket);
+
+    std::atomic<unsigned int> m_buckets[BUCKET_COUNT];
+    std::atomic<unsigned long long> m_count;
+    std::atomic<unsigned long long> m_sum;
+    std::atomic<unsigned long long> m_max;
+};
+
+//! Stages of a haptic tick that are timed separately.
+enum HapticStage
+{
+    HAPTIC_STAGE_GLOBAL_POSITIONS,
+    HAPTIC_STAGE_UPDATE_FROM_DEVICE,
+    HAPTIC_STAGE_INTERACTION_FORCES,
+    HAPTIC_STAGE_APPLY_TO_DEVICE,
+    HAPTIC_STAGE_TICK,
+    HAPTIC_STAGE_PERIOD,
+    HAPTIC_STAGE_COUNT
+};
+
+//===========================================================================
+/*
+    Per-thread profiler for the haptic loop.  Call beginTick() at the top
+    of each iteration, mark() after each stage, and endTick() at the end.
+    HAPTIC_STAGE_TICK holds the busy time of a tick and HAPTIC_STAGE_PERIOD
+    the time between consecutive tick starts; a period longer than the
+    deadline counts as an overrun.
+*/
+//===========================================================================
+class HapticProfiler
+{
+public:
+    HapticProfiler(double a_deadlineSeconds = 0.001);
+
+    //! Start timing a new tick.
+    void beginTick();
+
+    //! Record the time since the previous mark as the given stage.
+    void mark(HapticStage a_stage);
+
+    //! Finish timing the current tick.
+    void endTick();
+
+    //! Histogram of a stage.
+    const LatencyHistogram& getHistogram(HapticStage a_stage) const { return m_histograms[a_stage]; }
+
+    //! Busy time of the last tick [ns].
+    unsigned long long getLastTickNs() const { return m_lastTickNs; }
+
+    //! Number of ticks whose period exceeded the deadline.
+    unsigned long long getOverruns() const { return m_overruns.load(std::memory_order_relaxed); }
+
+    //! Deadline in nanoseconds.
+    unsigned long long getDeadlineNs() const { return m_deadlineNs; }
+
+    //! Change the deadline; call before the first tick.
+    void setDeadline(double a_seconds) { m_deadlineNs = (unsigned long long)(a_seconds * 1e9); }
+
+    //! One-line summary of the tick period, suitable for a HUD label.
+    std::string summary() const;
+
+    //! Write one CSV row per stage, prefixed by a_label.
+    void writeCSV(FILE* a_file, const std::string& a_label) const;
+
+    //! Write the CSV column header matching writeCSV().
+    static void writeCSVHeader(FILE* a_file);
+
+    //! Name of a stage.
+    static const char* stageName(HapticStage a_stage);
+
+private:
+    LatencyHistogram m_histograms[HAPTIC_STAGE_COUNT];
+    std::atomic<unsigned long long> m_overruns;
+    unsigned long long m_deadlineNs;
+    unsigned long long m_tickStart;
+    unsigned long long m_lastMark;
+    unsigned long long m_previousTickStart;
+    unsigned long long m_lastTickNs;
+};
+
+#endif
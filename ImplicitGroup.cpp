@@ -0,0 +1,348 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    Broad phase for many ImplicitMesh objects.  See ImplicitGroup.h.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#include "ImplicitGroup.h"
+#include <algorithm>
+
+using namespace chai3d;
+using namespace std;
+
+
+ImplicitGroup::ImplicitGroup()
+    : m_generation(0), m_margin(0.02), m_releases(0), m_visited(0)
+{
+}
+
+ImplicitGroup::~ImplicitGroup()
+{
+}
+
+void ImplicitGroup::addObject(ImplicitMesh* a_object)
+{
+    m_objects.push_back(a_object);
+    addChild(a_object);
+}
+
+void ImplicitGroup::removeObject(ImplicitMesh* a_object)
+{
+    vector<ImplicitMesh*>::iterator it = find(m_objects.begin(), m_objects.end(), a_object);
+    if (it == m_objects.end())
+        return;
+    m_objects.erase(it);
+    removeChild(a_object);
+}
+
+// build the subtree over a_items[a_begin, a_end), splitting at the median
+// centre along the axis the centres spread most; returns its node index
+static int buildNode(ImplicitGroupHierarchy& a_hierarchy,
+                     const vector<cVector3d>& a_lower, const vector<cVector3d>& a_upper,
+                     vector<int>& a_items, int a_begin, int a_end)
+{
+    ImplicitGroupHierarchy::Node node;
+    node.lower = a_lower[a_items[a_begin]];
+    node.upper = a_upper[a_items[a_begin]];
+    cVector3d low = 0.5 * (node.lower + node.upper), high = low;
+    for (int n = a_begin + 1; n < a_end; ++n)
+    {
+        int item = a_items[n];
+        cVector3d centre = 0.5 * (a_lower[item] + a_upper[item]);
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            node.lower(axis) = cMin(node.lower(axis), a_lower[item](axis));
+            node.upper(axis) = cMax(node.upper(axis), a_upper[item](axis));
+            low(axis) = cMin(low(axis), centre(axis));
+            high(axis) = cMax(high(axis), centre(axis));
+        }
+    }
+
+    int index = (int)a_hierarchy.nodes.size();
+    a_hierarchy.nodes.push_back(node);
+
+    if (a_end - a_begin == 1)
+    {
+        node.left = node.right = -1;
+        node.object = a_items[a_begin];
+    }
+    else
+    {
+        cVector3d extent = high - low;
+        int axis = (extent.x() > extent.y()) ? ((extent.x() > extent.z()) ? 0 : 2)
+                                             : ((extent.y() > extent.z()) ? 1 : 2);
+        int half = (a_begin + a_end) / 2;
+        nth_element(a_items.begin() + a_begin, a_items.begin() + half, a_items.begin() + a_end,
+                    [&](int a, int b)
+                    { return a_lower[a](axis) + a_upper[a](axis) < a_lower[b](axis) + a_upper[b](axis); });
+
+        node.object = -1;
+        node.left = buildNode(a_hierarchy, a_lower, a_upper, a_items, a_begin, half);
+        node.right = buildNode(a_hierarchy, a_lower, a_upper, a_items, half, a_end);
+    }
+
+    a_hierarchy.nodes[index] = node;
+    return index;
+}
+
+//===========================================================================
+/*!
+    Rebuild the hierarchy over the objects as they are placed now.  The box
+    of every bounded object is carried into the group's coordinates (around
+    its eight corners) and grown by the margin; children without a box are
+    visited on every tick instead.  The new hierarchy replaces the old one
+    once no haptic tick is still reading it.
+*/
+//===========================================================================
+void ImplicitGroup::update()
+{
+    ImplicitGroupHierarchy* hierarchy = new ImplicitGroupHierarchy();
+    hierarchy->generation = ++m_generation;
+
+    vector<cVector3d> lower, upper;
+    for (size_t n = 0; n < m_objects.size(); ++n)
+    {
+        ImplicitMesh* object = m_objects[n];
+        cVector3d boxLower, boxUpper;
+        if (!object->getHapticBounds(boxLower, boxUpper))
+        {
+            hierarchy->always.push_back(object);
+            continue;
+        }
+
+        cVector3d position = object->getLocalPos();
+        cMatrix3d rotation = object->getLocalRot();
+        cVector3d low, high;
+        for (int corner = 0; corner < 8; ++corner)
+        {
+            cVector3d local((corner & 1) ? boxUpper.x() : boxLower.x(),
+                            (corner & 2) ? boxUpper.y() : boxLower.y(),
+                            (corner & 4) ? boxUpper.z() : boxLower.z());
+            cVector3d p = position + rotation * local;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                low(axis) = (corner == 0) ? p(axis) : cMin(low(axis), p(axis));
+                high(axis) = (corner == 0) ? p(axis) : cMax(high(axis), p(axis));
+            }
+        }
+
+        cVector3d margin(m_margin, m_margin, m_margin);
+        lower.push_back(low - margin);
+        upper.push_back(high + margin);
+        hierarchy->objects.push_back(object);
+    }
+
+    // children that were not added through addObject()
+    for (size_t n = 0; n < m_children.size(); ++n)
+    {
+        if (find(m_objects.begin(), m_objects.end(), m_children[n]) == m_objects.end())
+            hierarchy->always.push_back(m_children[n]);
+    }
+
+    if (!hierarchy->objects.empty())
+    {
+        vector<int> items(hierarchy->objects.size());
+        for (size_t n = 0; n < items.size(); ++n)
+            items[n] = (int)n;
+        hierarchy->nodes.reserve(2 * items.size() - 1);
+        buildNode(*hierarchy, lower, upper, items, 0, (int)items.size());
+    }
+
+    m_hierarchy.publish(hierarchy);
+}
+
+void ImplicitGroup::releaseProxies()
+{
+    for (size_t n = 0; n < m_objects.size(); ++n)
+        m_objects[n]->releaseProxies();
+    m_releases.fetch_add(1, std::memory_order_release);
+}
+
+ImplicitGroup::Contacts* ImplicitGroup::claimContacts(unsigned int a_IDN)
+{
+    Contacts* contacts = 0;
+    for (int i = 0; i < IMPLICIT_MAX_TOOLS && !contacts; ++i)
+        if (m_contacts[i].owner.load(std::memory_order_acquire) == a_IDN)
+            contacts = &m_contacts[i];
+
+    for (int i = 0; i < IMPLICIT_MAX_TOOLS && !contacts; ++i)
+    {
+        unsigned int expected = IMPLICIT_NO_TOOL;
+        if (m_contacts[i].owner.compare_exchange_strong(expected, a_IDN))
+        {
+            m_contacts[i].count = 0;
+            m_contacts[i].tracked = false;
+            contacts = &m_contacts[i];
+        }
+        else if (expected == a_IDN)
+        {
+            contacts = &m_contacts[i];
+        }
+    }
+
+    // released since the tool's last tick: it starts afresh too
+    unsigned int releases = m_releases.load(std::memory_order_acquire);
+    if (contacts && contacts->releases != releases)
+    {
+        contacts->count = 0;
+        contacts->tracked = false;
+        contacts->releases = releases;
+    }
+    return contacts;
+}
+
+int ImplicitGroup::getContacts(unsigned int a_IDN, ImplicitMesh** a_objects, int a_capacity) const
+{
+    for (int i = 0; i < IMPLICIT_MAX_TOOLS; ++i)
+    {
+        if (m_contacts[i].owner.load(std::memory_order_acquire) != a_IDN)
+            continue;
+
+        int count = cMin(m_contacts[i].count, a_capacity);
+        for (int n = 0; n < count; ++n)
+            a_objects[n] = m_contacts[i].objects[n];
+        return count;
+    }
+
+    return 0;
+}
+
+//===========================================================================
+/*!
+    Compute the interaction of a tool with the objects near it.  Like
+    cGenericObject::computeInteractions(), the tool is carried into the
+    group's coordinates and the forces of the children back out of them,
+    but only the objects whose box meets the box around the tool's path
+    since its previous tick are descended into, along with those the tool
+    still touched on that tick, which need the tick to let go of their
+    proxy.
+
+    \param  a_toolPos  Position of the tool, in the parent's coordinates.
+    \param  a_toolVel  Velocity of the tool, in the parent's coordinates.
+    \param  a_IDN  Identification number of the force algorithm.
+    \param  a_interactions  Recorder of the interaction events.
+    \return Force of the objects on the tool, in the parent's coordinates.
+*/
+//===========================================================================
+cVector3d ImplicitGroup::computeInteractions(const cVector3d& a_toolPos,
+                                             const cVector3d& a_toolVel,
+                                             const unsigned int a_IDN,
+                                             cInteractionRecorder& a_interactions)
+{
+    if (getGhostEnabled())
+        return cVector3d(0.0, 0.0, 0.0);
+
+    EpochPointer<ImplicitGroupHierarchy>::Reader hierarchy(m_hierarchy);
+    if (!hierarchy.get())
+    {
+        // update() has not run yet: visit every child
+        return cGenericObject::computeInteractions(a_toolPos, a_toolVel, a_IDN, a_interactions);
+    }
+
+    cMatrix3d toLocal = m_localRot.getTranspose();
+    cVector3d toolPos = toLocal * (a_toolPos - m_localPos);
+    cVector3d toolVel = toLocal * a_toolVel;
+
+    cVector3d force(0.0, 0.0, 0.0);
+    int visited = 0;
+
+    for (size_t n = 0; n < hierarchy->always.size(); ++n)
+    {
+        force += hierarchy->always[n]->computeInteractions(toolPos, toolVel, a_IDN, a_interactions);
+        ++visited;
+    }
+
+    // the objects touched on the previous tick, unless they have left the group since
+    Contacts* contacts = claimContacts(a_IDN);
+    ImplicitMesh* previous[IMPLICIT_GROUP_MAX_CONTACTS];
+    int previousCount = 0;
+    if (contacts)
+    {
+        for (int n = 0; n < contacts->count; ++n)
+        {
+            if (contacts->generation == hierarchy->generation ||
+                find(hierarchy->objects.begin(), hierarchy->objects.end(), contacts->objects[n]) != hierarchy->objects.end())
+                previous[previousCount++] = contacts->objects[n];
+        }
+    }
+
+    // the box around the tool's path since its previous tick
+    cVector3d pathLower = toolPos, pathUpper = toolPos;
+    bool tracked = contacts && contacts->tracked;
+    if (tracked)
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            pathLower(axis) = cMin(pathLower(axis), contacts->toolPos(axis));
+            pathUpper(axis) = cMax(pathUpper(axis), contacts->toolPos(axis));
+        }
+    }
+
+    ImplicitMesh* touched[IMPLICIT_GROUP_MAX_CONTACTS];
+    int touchedCount = 0;
+    auto visit = [&](ImplicitMesh* a_object, bool a_skipped)
+    {
+        // an object skipped on the previous tick did not see the tool there
+        if (a_skipped && tracked)
+        {
+            cMatrix3d rotation = a_object->getLocalRot();
+            a_object->setFreeProxy(a_IDN, rotation.getTranspose() * (contacts->toolPos - a_object->getLocalPos()));
+        }
+
+        force += a_object->computeInteractions(toolPos, toolVel, a_IDN, a_interactions);
+        ++visited;
+
+        const ImplicitProxyState* state = a_object->findProxyState(a_IDN);
+        if (state && (state->inside || state->touched) && touchedCount < IMPLICIT_GROUP_MAX_CONTACTS)
+            touched[touchedCount++] = a_object;
+    };
+
+    for (int n = 0; n < previousCount; ++n)
+        visit(previous[n], false);
+
+    // descend into the boxes meeting the path; the tree is balanced, so
+    // its depth is far below the size of the stack
+    const vector<ImplicitGroupHierarchy::Node>& nodes = hierarchy->nodes;
+    int stack[64];
+    int top = 0;
+    if (!nodes.empty())
+        stack[top++] = 0;
+    while (top > 0)
+    {
+        const ImplicitGroupHierarchy::Node& node = nodes[stack[--top]];
+        if (pathUpper.x() < node.lower.x() || pathLower.x() > node.upper.x() ||
+            pathUpper.y() < node.lower.y() || pathLower.y() > node.upper.y() ||
+            pathUpper.z() < node.lower.z() || pathLower.z() > node.upper.z())
+            continue;
+
+        if (node.object < 0)
+        {
+            stack[top++] = node.left;
+            stack[top++] = node.right;
+            continue;
+        }
+
+        ImplicitMesh* object = hierarchy->objects[node.object];
+        if (find(previous, previous + previousCount, object) == previous + previousCount)
+            visit(object, true);
+    }
+
+    if (contacts)
+    {
+        for (int n = 0; n < touchedCount; ++n)
+            contacts->objects[n] = touched[n];
+        contacts->count = touchedCount;
+        contacts->generation = hierarchy->generation;
+        contacts->toolPos = toolPos;
+        contacts->tracked = true;
+    }
+    m_visited.store(visited, std::memory_order_relaxed);
+
+    // convert the reaction force into the parent's coordinates
+    return m_localRot * force;
+}
@@ -0,0 +1,145 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    A broad phase for scenes with many ImplicitMesh objects.  CHAI3D asks
+    every object of the world for its interaction on every haptic tick,
+    which costs one evaluation of every implicit surface even when the tool
+    is nowhere near it.  An ImplicitGroup holds the objects as its children
+    and answers computeInteractions() itself: it keeps a bounding volume
+    hierarchy over the haptic bounds of its objects and only descends into
+    the objects whose box (grown by a margin) meets the tool's path since
+    its previous tick, plus those the tool was in contact with on that
+    tick, so that they can release their proxy.  Objects skipped on the
+    previous tick are told where the tool was, so that they sweep its path
+    like the objects that were not.
+
+    The hierarchy is rebuilt by update(), on the graphics thread, whenever
+    objects are added, removed or moved, and handed to the haptic threads
+    through an EpochPointer, so a tick never waits for a rebuild.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#ifndef IMPLICITGROUP_H
+#define IMPLICITGROUP_H
+
+#include "ImplicitMesh.h"
+#include "EpochPointer.h"
+#include <vector>
+
+//! Objects remembered per tool as touched on its previous tick.
+#define IMPLICIT_GROUP_MAX_CONTACTS 16
+
+//! The hierarchy built by ImplicitGroup::update(), immutable once published.
+struct ImplicitGroupHierarchy
+{
+    //! A node of the tree: a leaf if object >= 0, else children left and right.
+    struct Node
+    {
+        chai3d::cVector3d lower;
+        chai3d::cVector3d upper;
+        int left;
+        int right;
+        int object;
+    };
+
+    //! Nodes, root first (empty if no object is bounded).
+    std::vector<Node> nodes;
+
+    //! Bounded objects, indexed by the leaves.
+    std::vector<ImplicitMesh*> objects;
+
+    //! Children visited on every tick: unbounded objects and anything
+    //! added with addChild() rather than addObject().
+    std::vector<chai3d::cGenericObject*> always;
+
+    //! Incremented by every update().
+    unsigned int generation;
+};
+
+class ImplicitGroup : public chai3d::cGenericObject
+{
+public:
+    ImplicitGroup();
+    virtual ~ImplicitGroup();
+
+    //! The contacts of each tool keep to a cache line of their own.
+    CACHE_ALIGNED_NEW
+
+    //! Add a_object as a child of the group, which deletes it along with
+    //! the group like any CHAI3D parent.  Call update() when done.
+    void addObject(ImplicitMesh* a_object);
+
+    //! Remove a_object from the group (without deleting it).  Call update()
+    //! before deleting it.
+    void removeObject(ImplicitMesh* a_object);
+
+    //! Rebuild the hierarchy from the current placement of the objects and
+    //! hand it to the haptic threads.  Call after adding, removing or moving
+    //! objects, from one thread at a time.
+    void update();
+
+    //! Distance the tool may be outside an object's box and still reach it,
+    //! which covers objects moved a little since the last update().  Takes
+    //! effect at the next update().
+    void setMargin(double a_margin) { m_margin = a_margin; }
+    double getMargin() const { return m_margin; }
+
+    //! Number of objects in the group.
+    int getObjectCount() const { return (int)m_objects.size(); }
+
+    //! An object of the group, in the order they were added.
+    ImplicitMesh* getObject(int a_index) const { return m_objects[a_index]; }
+
+    //! Let go of every tool's proxies on every object of the group, and of
+    //! where the tools were, as ImplicitMesh::releaseProxies() does.  Safe
+    //! from any thread, but not while objects are added or removed.
+    void releaseProxies();
+
+    //! Copy the objects a tool was in contact with after its last tick into
+    //! a_objects (at most a_capacity) and return their number.  Call from
+    //! the tool's haptic thread.
+    int getContacts(unsigned int a_IDN, ImplicitMesh** a_objects, int a_capacity) const;
+
+    //! Number of objects the last tick descended into.
+    int getVisitedCount() const { return m_visited.load(std::memory_order_relaxed); }
+
+    //! Descend only into the objects near the tool.
+    virtual chai3d::cVector3d computeInteractions(const chai3d::cVector3d& a_toolPos,
+                                                  const chai3d::cVector3d& a_toolVel,
+                                                  const unsigned int a_IDN,
+                                                  chai3d::cInteractionRecorder& a_interactions);
+
+private:
+    //! Where each tool was on its previous tick, and the objects it was in
+    //! contact with then, against the hierarchy generation they were found
+    //! in.  Slots are claimed like ImplicitMesh proxy states and only
+    //! written by their tool's thread.
+    struct alignas(64) Contacts
+    {
+        std::atomic<unsigned int> owner;
+        chai3d::cVector3d toolPos;
+        bool tracked;
+        unsigned int generation;
+        unsigned int releases;
+        int count;
+        ImplicitMesh* objects[IMPLICIT_GROUP_MAX_CONTACTS];
+
+        Contacts() : owner(IMPLICIT_NO_TOOL), tracked(false), generation(0), releases(0), count(0) {}
+    };
+
+    Contacts* claimContacts(unsigned int a_IDN);
+
+    std::vector<ImplicitMesh*> m_objects;
+    EpochPointer<ImplicitGroupHierarchy> m_hierarchy;
+    unsigned int m_generation;
+    double m_margin;
+    Contacts m_contacts[IMPLICIT_MAX_TOOLS];
+    std::atomic<unsigned int> m_releases;
+    std::atomic<int> m_visited;
+};
+
+#endif
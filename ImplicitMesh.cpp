@@ -24,7 +24,10 @@ using namespace chai3d;
 
 
 ImplicitMesh::ImplicitMesh()
-    : m_surfaceFunction(0), m_projectedSphere(0.05)
+    : m_projectedSphere(0.05), m_primarySource(&m_functionSource), m_source(&m_functionSource),
+      m_recorder(0), m_frictionModel(FRICTION_CONE), m_newtonLimit(0), m_shapeVersion(0), m_releases(0),
+      m_sampledStale(false), m_avatar(0), m_texture(0), m_sampledTexture(0), m_sampledOctaves(0),
+      m_meshGranularity(0.0)
 {
     // because we are haptically rendering this object as an implicit surface
     // rather than a set of polygons, we will not need a collision detector
@@ -46,44 +49,434 @@ void ImplicitMesh::createFromFunction(
 							chai3d::cVector3d (*g)(double, double, double),
 							cVector3d a_lowerBound, cVector3d a_upperBound,
                             double a_granularity)
+{
+    // remember the function used to create this object
+    setSurfaceFunction(f, g);
+    buildMesh(a_lowerBound, a_upperBound, a_granularity);
+}
+
+void ImplicitMesh::createFromSource(const ImplicitSource* a_source,
+                                    cVector3d a_lowerBound, cVector3d a_upperBound,
+                                    double a_granularity,
+                                    const std::string& a_cacheFile, uint64_t a_cacheKey)
+{
+    setSource(a_source);
+    buildMesh(a_lowerBound, a_upperBound, a_granularity, a_cacheFile, a_cacheKey);
+}
+
+void ImplicitMesh::buildMesh(cVector3d a_lowerBound, cVector3d a_upperBound, double a_granularity,
+                             const std::string& a_cacheFile, uint64_t a_cacheKey)
+{
+    // the octaves of the texture coarse enough for the lattice are sampled
+    // with the surface; a grid with texture in it is not kept in the cache
+    // file, whose key does not cover the texture
+    const SurfaceTexture* texture = m_texture.load(std::memory_order_acquire);
+    int meshedOctaves = texture ? texture->getMeshedOctaves(a_granularity) : 0;
+    TexturedSource textured(*m_primarySource, texture, 0, meshedOctaves);
+    const ImplicitSource& source = (meshedOctaves > 0) ? (const ImplicitSource&)textured : *m_primarySource;
+    std::string cacheFile = (meshedOctaves > 0) ? std::string() : a_cacheFile;
+
+    // sample the implicit surface once, in the narrow band around it only;
+    // half the smallest extent of the box is "far" from the surface
+    cVector3d extent = a_upperBound - a_lowerBound;
+    double far = 0.5 * cMin(extent.x(), cMin(extent.y(), extent.z()));
+    bool cached = !cacheFile.empty() && m_sampledField.load(cacheFile, a_cacheKey) &&
+                  m_sampledField.matches(a_lowerBound, a_upperBound, a_granularity, far);
+    if (!cached)
+    {
+        m_sampledField.build(source, a_lowerBound, a_upperBound, a_granularity, far);
+        if (!cacheFile.empty())
+            m_sampledField.save(cacheFile, a_cacheKey);
+    }
+    m_sampledTexture = texture;
+    m_sampledOctaves = meshedOctaves;
+    m_sampledStale.store(false);
+    m_meshGranularity = a_granularity;
+
+    // add the triangles to our mesh
+    std::vector<cVector3d> triangles;
+    marchField(m_sampledField, a_lowerBound, a_upperBound, a_granularity, triangles);
+    for (size_t n = 0; n + 2 < triangles.size(); n += 3)
+        this->newTriangle(triangles[n], triangles[n + 1], triangles[n + 2]);
+
+    // compute face normals for our mesh so that lighting works properly
+    this->computeAllNormals();
+
+    // the lattice only holds the surface inside the box
+    setHapticBounds(a_lowerBound, a_upperBound);
+}
+
+void ImplicitMesh::marchField(const SampledField& a_field, const cVector3d& a_lowerBound,
+                              const cVector3d& a_upperBound, double a_granularity,
+                              std::vector<cVector3d>& a_triangles)
 {
     // variables to hold raw triangles returned from marching cubes algorithm
     GLint tcount;
     GLfloat vertices[5*3*3];
+    GLfloat corners[8];
+
+    // only cells of the original box are marched
+    cVector3d extent = a_upperBound - a_lowerBound;
+    int cells[3];
+    for (int axis = 0; axis < 3; ++axis)
+        cells[axis] = (int)floor(extent(axis) / a_granularity + 1e-6) + 1;
 
-    // sample the implicit surface by stepping through each dimension
-    for (GLfloat x = a_lowerBound.x(); x <= a_upperBound.x(); x += a_granularity)
-        for (GLfloat y = a_lowerBound.y(); y <= a_upperBound.y(); y += a_granularity)
-            for (GLfloat z = a_lowerBound.z(); z <= a_upperBound.z(); z += a_granularity)
-            {
-                // call marching cubes to get the triangular facets for this cell
-                vMarchCubeCustom(x, y, z, a_granularity, f, tcount, vertices);
-
-                // add resulting triangles (if any) to our mesh
-                for (int i = 0; i < tcount; ++i) {
-                    int ix = i*9;
-                    this->newTriangle(
-                        cVector3d(vertices[ix+0], vertices[ix+1], vertices[ix+2]),
-                        cVector3d(vertices[ix+3], vertices[ix+4], vertices[ix+5]),
-                        cVector3d(vertices[ix+6], vertices[ix+7], vertices[ix+8])
-                    );
+    // march through each cell of every brick; cells of the far field hold
+    // no part of the surface
+    for (int brick = 0; brick < a_field.getBrickCount(); ++brick)
+    {
+        int bi, bj, bk;
+        a_field.getBrickOrigin(brick, bi, bj, bk);
+
+        for (int k = bk; k < cMin(bk + SAMPLED_BRICK_SIZE, cells[2]); ++k)
+            for (int j = bj; j < cMin(bj + SAMPLED_BRICK_SIZE, cells[1]); ++j)
+                for (int i = bi; i < cMin(bi + SAMPLED_BRICK_SIZE, cells[0]); ++i)
+                {
+                    corners[0] = a_field.node(i,   j,   k);
+                    corners[1] = a_field.node(i+1, j,   k);
+                    corners[2] = a_field.node(i+1, j+1, k);
+                    corners[3] = a_field.node(i,   j+1, k);
+                    corners[4] = a_field.node(i,   j,   k+1);
+                    corners[5] = a_field.node(i+1, j,   k+1);
+                    corners[6] = a_field.node(i+1, j+1, k+1);
+                    corners[7] = a_field.node(i,   j+1, k+1);
+
+                    // call marching cubes to get the triangular facets for this cell
+                    cVector3d p = a_field.nodePosition(i, j, k);
+                    vMarchCubeValues(p.x(), p.y(), p.z(), a_granularity, corners, tcount, vertices);
+
+                    for (int t = 0; t < tcount * 3; ++t)
+                        a_triangles.push_back(cVector3d(vertices[t*3+0], vertices[t*3+1], vertices[t*3+2]));
                 }
-            }
+    }
+}
 
-    // compute face normals for our mesh so that lighting works properly
+void ImplicitMesh::marchSurface(const ImplicitSource& a_source, const cVector3d& a_lowerBound,
+                                const cVector3d& a_upperBound, double a_granularity,
+                                std::vector<cVector3d>& a_triangles, int a_threads)
+{
+    SampledField field;
+    cVector3d extent = a_upperBound - a_lowerBound;
+    field.build(a_source, a_lowerBound, a_upperBound, a_granularity,
+                0.5 * cMin(extent.x(), cMin(extent.y(), extent.z())), a_threads);
+    marchField(field, a_lowerBound, a_upperBound, a_granularity, a_triangles);
+}
+
+//===========================================================================
+/*!
+    Show a new surface of the same source, which has changed in place.
+    The source is not swapped, so haptic threads carry on through it; the
+    sampled grid, however, still holds the old surface, so they are moved
+    back onto the source and the grid is left alone (a tick may still be
+    reading it) but refused by setSampledBackend() from now on.
+
+    \param  a_triangles  Three corners per triangle, from marchSurface().
+    \param  a_lowerBound  Box the surface was meshed in (likewise a_upperBound).
+*/
+//===========================================================================
+void ImplicitMesh::replaceSurface(const std::vector<cVector3d>& a_triangles,
+                                  const cVector3d& a_lowerBound, const cVector3d& a_upperBound)
+{
+    m_sampledStale.store(true);
+    m_source.store(m_primarySource);
+
+    // the haptic threads render the new source from the moment it was
+    // published, so their projections onto the old one go first; the
+    // mesh can take a while.  The box, grown to hold both surfaces before
+    // the change, now holds the new one only
+    setHapticBounds(a_lowerBound, a_upperBound);
+    invalidateProjections();
+
+    this->clear();
+    for (size_t n = 0; n + 2 < a_triangles.size(); n += 3)
+        this->newTriangle(a_triangles[n], a_triangles[n + 1], a_triangles[n + 2]);
     this->computeAllNormals();
-    
-    // remember the function used to create this object
-    m_surfaceFunction = f;
-	m_gradientFunction = g;
+}
+
+void ImplicitMesh::rebuildMesh()
+{
+    ImplicitHapticBounds bounds = readHapticBounds();
+    if (!bounds.bounded || m_meshGranularity <= 0.0)
+        return;
+
+    // the haptic threads may be reading m_sampledField, so the mesh is
+    // marched from a grid of its own
+    const SurfaceTexture* texture = m_texture.load(std::memory_order_acquire);
+    int meshedOctaves = texture ? texture->getMeshedOctaves(m_meshGranularity) : 0;
+    TexturedSource textured(*m_primarySource, texture, 0, meshedOctaves);
+    const ImplicitSource& source = (meshedOctaves > 0) ? (const ImplicitSource&)textured : *m_primarySource;
+
+    cVector3d extent = bounds.upper - bounds.lower;
+    double far = 0.5 * cMin(extent.x(), cMin(extent.y(), extent.z()));
+    SampledField field;
+    field.build(source, bounds.lower, bounds.upper, m_meshGranularity, far);
+
+    std::vector<cVector3d> triangles;
+    marchField(field, bounds.lower, bounds.upper, m_meshGranularity, triangles);
+    this->clear();
+    for (size_t n = 0; n + 2 < triangles.size(); n += 3)
+        this->newTriangle(triangles[n], triangles[n + 1], triangles[n + 2]);
+    this->computeAllNormals();
+}
+
+void ImplicitMesh::setTexture(const SurfaceTexture* a_texture)
+{
+    // ticks on a grid add the octaves it does not hold of the texture it
+    // was sampled with, so one holding the octaves of another texture is
+    // dropped like the grid of a replaced surface
+    if (m_sampledOctaves > 0 && a_texture != m_sampledTexture)
+    {
+        m_sampledStale.store(true);
+        m_source.store(m_primarySource);
+    }
+    m_texture.store(a_texture, std::memory_order_release);
+    invalidateProjections();
+}
+
+void ImplicitMesh::setSurfaceFunction(double (*f)(double, double, double),
+                                      chai3d::cVector3d (*g)(double, double, double))
+{
+    m_functionSource = FunctionSource(f, g);
+    setSource(&m_functionSource);
+}
+
+void ImplicitMesh::setSource(const ImplicitSource* a_source)
+{
+    // the box of the old source goes first, so no tick skips the new
+    // source on the strength of it
+    m_bounds.write(ImplicitHapticBounds());
+    m_primarySource = a_source;
+    m_source.store(a_source);
+    m_sampledField.clear();
+    invalidateProjections();
+}
+
+void ImplicitMesh::setHapticBounds(const cVector3d& a_lower, const cVector3d& a_upper)
+{
+    ImplicitHapticBounds bounds;
+    bounds.bounded = true;
+    bounds.lower = a_lower;
+    bounds.upper = a_upper;
+    m_bounds.write(bounds);
+}
+
+void ImplicitMesh::growHapticBounds(const cVector3d& a_lower, const cVector3d& a_upper)
+{
+    ImplicitHapticBounds bounds = readHapticBounds();
+    if (!bounds.bounded)
+        return;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        bounds.lower(axis) = cMin(bounds.lower(axis), a_lower(axis));
+        bounds.upper(axis) = cMax(bounds.upper(axis), a_upper(axis));
+    }
+    m_bounds.write(bounds);
+}
+
+bool ImplicitMesh::getHapticBounds(cVector3d& a_lower, cVector3d& a_upper) const
+{
+    ImplicitHapticBounds bounds = readHapticBounds();
+    a_lower = bounds.lower;
+    a_upper = bounds.upper;
+    return bounds.bounded;
+}
+
+ImplicitHapticBounds ImplicitMesh::readHapticBounds() const
+{
+    ImplicitHapticBounds bounds;
+    m_bounds.read(bounds);
+    return bounds;
+}
+
+bool ImplicitMesh::setSampledBackend(bool a_enabled)
+{
+    if (a_enabled && (m_sampledField.isEmpty() || m_sampledStale.load()))
+        return false;
+
+    if (a_enabled)
+    {
+        // replaceSurface() marks the grid stale before it moves the source
+        // back, so either it sees this store or this sees the mark
+        m_source.store(&m_sampledField);
+        if (m_sampledStale.load())
+        {
+            m_source.store(m_primarySource);
+            return false;
+        }
+    }
+    else
+    {
+        m_source.store(m_primarySource);
+    }
+    invalidateProjections();
+    return true;
+}
+
+//===========================================================================
+/*!
+    Find the proxy state slot owned by a tool.  Slots are claimed lock-free
+    the first time a tool reaches this object, after which each haptic
+    thread only ever touches its own slot.  A slot the object has released
+    since the tool last saw it is reset here, by that thread.
+
+    \param  a_IDN  Identification number of the force algorithm.
+    \return The slot of the tool, or NULL if every slot is taken.
+*/
+//===========================================================================
+ImplicitProxyState* ImplicitMesh::claimProxyState(unsigned int a_IDN)
+{
+    ImplicitProxyState* state = 0;
+    for (int i = 0; i < IMPLICIT_MAX_TOOLS && !state; ++i)
+        if (m_proxyStates[i].owner.load(std::memory_order_acquire) == a_IDN)
+            state = &m_proxyStates[i];
+
+    for (int i = 0; i < IMPLICIT_MAX_TOOLS && !state; ++i)
+    {
+        unsigned int expected = IMPLICIT_NO_TOOL;
+        if (m_proxyStates[i].owner.compare_exchange_strong(expected, a_IDN))
+        {
+            m_proxyStates[i].reset();
+            state = &m_proxyStates[i];
+        }
+        else if (expected == a_IDN)
+        {
+            state = &m_proxyStates[i];
+        }
+    }
+
+    unsigned int releases = m_releases.load(std::memory_order_acquire);
+    if (state && state->releases != releases)
+    {
+        state->reset();
+        state->releases = releases;
+    }
+    return state;
+}
+
+void ImplicitMesh::setFreeProxy(unsigned int a_IDN, const cVector3d& a_toolPos)
+{
+    ImplicitProxyState* state = claimProxyState(a_IDN);
+    if (state && !state->inside && !state->touched)
+    {
+        state->proxy = a_toolPos;
+        state->tracked = true;
+    }
+}
+
+void ImplicitMesh::setProxyState(unsigned int a_IDN, const cVector3d& a_proxy,
+                                 bool a_inside, bool a_touched, bool a_kinetic, bool a_tracked)
+{
+    ImplicitProxyState* state = claimProxyState(a_IDN);
+    if (state)
+    {
+        state->reset();
+        state->proxy = a_proxy;
+        state->inside = a_inside;
+        state->touched = a_touched;
+        state->kinetic = a_kinetic;
+        state->tracked = a_tracked;
+        state->avatar = m_avatar.load(std::memory_order_acquire);
+    }
+}
+
+bool ImplicitMesh::getContactPatch(unsigned int a_IDN, const cVector3d& a_toolPos, ContactPatch& a_patch)
+{
+    a_patch = ContactPatch();
+    const ImplicitSource& smooth = *m_source.load(std::memory_order_acquire);
+    const SurfaceTexture* texture = m_texture.load(std::memory_order_acquire);
+    TexturedSource textured(smooth, texture, getUnsampledOctave(smooth, texture));
+    const ImplicitSource& source = texture ? (const ImplicitSource&)textured : smooth;
+
+    const ImplicitProxyState* state = findProxyState(a_IDN);
+    const ToolAvatar* avatar = m_avatar.load(std::memory_order_acquire);
+    if (avatar && avatar->getPointCount() > 0)
+    {
+        // the avatar is pushed along its contact normal, from its position
+        if (state && state->inside)
+        {
+            a_patch.point = state->proxy;
+            a_patch.normal = state->normal;
+            a_patch.anchored = true;
+        }
+        else
+        {
+            // the plane under the point that is nearest the surface, to
+            // first order, carried from that point to the tool position
+            ImplicitHapticBounds bounds = readHapticBounds();
+            for (int axis = 0; axis < 3 && bounds.bounded; ++axis)
+                if (a_toolPos(axis) + avatar->getReach() < bounds.lower(axis) ||
+                    a_toolPos(axis) - avatar->getReach() > bounds.upper(axis))
+                    return false;
+
+            ToolAvatarSamples samples;
+            avatar->sample(source, a_toolPos, samples);
+            int nearest = 0;
+            for (int n = 1; n < samples.count; ++n)
+                if (samples.distance[n] < samples.distance[nearest])
+                    nearest = n;
+            if (samples.distance[nearest] >= 1e300)
+                return false;
+            a_patch.normal.set(samples.gx[nearest], samples.gy[nearest], samples.gz[nearest]);
+            a_patch.point = a_toolPos - samples.distance[nearest] * a_patch.normal;
+        }
+        a_patch.stiffness = m_material->getStiffness();
+        a_patch.valid = true;
+        return true;
+    }
+
+    if (state && state->inside)
+    {
+        a_patch.point = state->proxy;
+        a_patch.anchored = true;
+    }
+    else
+    {
+        // away from the surface the nearest point is far, and its plane
+        // could cut through the rest of the object
+        ImplicitHapticBounds bounds = readHapticBounds();
+        for (int axis = 0; axis < 3 && bounds.bounded; ++axis)
+            if (a_toolPos(axis) < bounds.lower(axis) || a_toolPos(axis) > bounds.upper(axis))
+                return false;
+        a_patch.point = findNearestSurfacePoint(source, a_toolPos, 0.00001);
+    }
+
+    a_patch.normal = source.gradient(a_patch.point);
+    double length = a_patch.normal.length();
+    if (length == 0.0)
+        return false;
+    a_patch.normal *= 1.0 / length;
+    a_patch.stiffness = m_material->getStiffness();
+    a_patch.valid = true;
+    return true;
+}
+
+void ImplicitMesh::getProjectionCacheStats(unsigned long long& a_hits, unsigned long long& a_misses) const
+{
+    a_hits = 0;
+    a_misses = 0;
+    for (int i = 0; i < IMPLICIT_MAX_TOOLS; ++i)
+    {
+        a_hits += m_proxyStates[i].projections.getHits();
+        a_misses += m_proxyStates[i].projections.getMisses();
+    }
+}
+
+const ImplicitProxyState* ImplicitMesh::findProxyState(unsigned int a_IDN) const
+{
+    for (int i = 0; i < IMPLICIT_MAX_TOOLS; ++i)
+        if (m_proxyStates[i].owner.load(std::memory_order_acquire) == a_IDN)
+            return &m_proxyStates[i];
+
+    return 0;
 }
 
 //! Contains code for graphically rendering this object in OpenGL.
 void ImplicitMesh::render(cRenderOptions& a_options)
 {
-    // update the position and visibility of the proxy sphere
-    m_projectedSphere.setShowEnabled(m_interactionInside);
-    m_projectedSphere.setLocalPos(m_interactionPoint);
+    // show the proxy of the last telemetry drained, which the haptic thread
+    // handed over whole through the ring
+    m_projectedSphere.setShowEnabled(m_shownTelemetry.inside);
+    m_projectedSphere.setLocalPos(m_shownTelemetry.proxy);
     
     // get the base class to render the mesh
     cMesh::render(a_options);
@@ -93,8 +486,9 @@ void ImplicitMesh::render(cRenderOptions& a_options)
 //===========================================================================
 /*!
     This method should contain the core of the implicit surface rendering
-    algorithm implementation.  The member variables m_interactionPoint
-    and m_interactionInside should both be set by this method.
+    algorithm implementation.  The proxy of each tool is tracked in its own
+    ImplicitProxyState slot.  The first tool's ticks go to the telemetry
+    ring, from which render() draws its proxy.
 
     \param  a_toolPos  Position of the tool.
     \param  a_toolVel  Velocity of the tool.
@@ -114,160 +508,634 @@ void ImplicitMesh::computeLocalInteraction(const cVector3d& a_toolPos,
     double mu_s = m_material->getStaticFriction();
     double mu_k = m_material->getDynamicFriction();
 
+	ImplicitProxyState* state = claimProxyState(a_IDN);
+	if (!state)
+		return;
+
+	// estimated gradients follow this tool's path, not the thread's
+	GradientStepScope steps(&state->gradientSteps);
+
+	// a proxy held by the point is no place for an avatar, nor the other
+	// way round: a tool whose shape was changed starts afresh
+	const ToolAvatar* avatar = m_avatar.load(std::memory_order_acquire);
+	if (state->avatar != avatar)
+	{
+		state->reset();
+		state->avatar = avatar;
+	}
+
+	// a recording starting with this tick keeps the state it starts from
+	if (m_recorder && state == &m_proxyStates[0] && m_recorder->isAwaitingBegin())
+	{
+		double proxy[3] = { state->proxy.x(), state->proxy.y(), state->proxy.z() };
+		m_recorder->begin(proxy, (state->inside ? TRAJECTORY_INSIDE : 0) |
+		                         (state->touched ? TRAJECTORY_TOUCHED : 0) |
+		                         (state->kinetic ? TRAJECTORY_KINETIC : 0) |
+		                         (state->tracked ? TRAJECTORY_TRACKED : 0));
+	}
+
+	// the backend may be switched by the graphics thread; use one for the whole tick
+	// the version first: if it is new, so is the source
+	unsigned int version = m_shapeVersion.load(std::memory_order_acquire);
+	const ImplicitSource& smooth = *m_source.load(std::memory_order_acquire);
+
+	// the texture is laid over the source for this tick, through the
+	// tool's own cache of heights; over the sampled grid, only the octaves
+	// too fine to have been sampled into it
+	const SurfaceTexture* texture = m_texture.load(std::memory_order_acquire);
+	TexturedSource textured(smooth, texture, getUnsampledOctave(smooth, texture),
+	                        SURFACE_TEXTURE_MAX_OCTAVES, &state->textures, version);
+	const ImplicitSource& source = texture ? (const ImplicitSource&)textured : smooth;
+
 	chai3d::cVector3d planeNormal;
-	chai3d::cVector3d avgNormal;
 	chai3d::cVector3d seedPoint;
 	chai3d::cVector3d fromProxyToHapticPoint;
-	chai3d::cVector3d temp;
-	double cosTheta;
+	double normalDot = 0.0;
 	double frictionDist = 0.0;
 	double epsilon = 0.00001;
 
-	debugToolPos = a_toolPos;
-	functionValue = m_surfaceFunction(a_toolPos.x(), a_toolPos.y(), a_toolPos.z());
-
-	//// Get the gradient at the previously approximated proxy position.. use as plane normal.
-	planeNormal = m_gradientFunction(m_interactionPoint.x(), m_interactionPoint.y(), m_interactionPoint.z());
-	planeNormal.normalize();
-	fromProxyToHapticPoint = a_toolPos - m_interactionPoint;
-
-	
-//	if (gradientQ.size() < 11)
-//		gradientQ.push(planeNormal);
-	
-	
-//	for (int i = 0; i < 11, i++)
-//	{
-//		planeNormal = gradientQ.pop()
-//		avgNormal += planeNormal;
-//		gradientQ.push(planeNormal);
-//	}
-
-//	planeNormal = avgNormal * 0.1;
-	
-	if (functionValue < 0.0 || touched)
+	// this tick's snapshot lives on the haptic thread's stack until it is published
+	ImplicitTelemetry sample;
+	sample.toolPos = a_toolPos;
+
+	// a tool of finite size has a tick of its own
+	if (avatar && avatar->getPointCount() > 0)
+	{
+		computeAvatarInteraction(state, source, *avatar, a_toolPos, sample);
+		publishTick(state, a_toolPos, a_toolVel, sample);
+		return;
+	}
+
+	// with no proxy held, the proxy is where the tool was on the last tick,
+	// and the path from there is swept for the surface
+	bool sweep = state->tracked && !state->touched;
+
+	// early rejection: a path outside the bounds stays outside the surface,
+	// so unless the tool holds a proxy the source need not be evaluated at
+	// all; the distance from the tool to the box stands in for the value
+	// (it is positive)
+	double functionValue = 0.0;
+	bool outside = false;
+	if (!state->touched)
 	{
-		double radToDeg = 180 / M_PI;
-		
-		temp = fromProxyToHapticPoint; 
-		temp.normalize();
-
-		cosTheta = temp.dot(planeNormal);
-
-		debugTempVec = temp;
-		debugTempB = cosTheta;
-		
-		cosThta = cosTheta;
-		theta = acos(cosTheta) * radToDeg;
-		tanTheta = tan(acos(cosTheta));
-		thetaK = atan(mu_k) * radToDeg;
-		sinThetak = sin(atan(mu_k));	
-
-		if (abs(tan(acos(cosTheta))) > mu_s)
-			kinetic = true;
-
-		if (kinetic)
+		ImplicitHapticBounds bounds = readHapticBounds();
+		const cVector3d& from = sweep ? state->proxy : a_toolPos;
+		cVector3d excess;
+		for (int axis = 0; axis < 3 && bounds.bounded; ++axis)
 		{
-			if (abs(tan(acos(cosTheta))) > mu_k)
-			{
-				frictionDist = sin(atan(mu_k)) * fromProxyToHapticPoint.length() + epsilon;
-			}
-			else
-				kinetic = false;
+			outside = outside || cMin(from(axis), a_toolPos(axis)) > bounds.upper(axis) ||
+			                     cMax(from(axis), a_toolPos(axis)) < bounds.lower(axis);
+			excess(axis) = cMax(a_toolPos(axis) - bounds.upper(axis), 0.0) +
+			               cMax(bounds.lower(axis) - a_toolPos(axis), 0.0);
+		}
+		functionValue = excess.length();
+	}
+	if (!outside)
+		functionValue = source.value(a_toolPos);
+
+	// a fast stroke can pass through a thin part of the surface between two
+	// ticks, or enter it far from where it ends: the proxy is seeded where
+	// the path first entered
+	cVector3d entry = a_toolPos;
+	bool entered = functionValue < 0.0;
+	if (sweep && !outside)
+		entered = sweepSegment(source, state->proxy, a_toolPos, functionValue, epsilon, entry);
+
+	// whatever the friction cone makes of it, a path that entered the
+	// surface leaves the proxy where it did
+	if (entered && !state->touched)
+	{
+		sample.seedPoint = entry;
+		state->proxy = projectToSurface(state, source, version, entry, epsilon, &sample);
+		state->touched = true;
+	}
+
+	fromProxyToHapticPoint = a_toolPos - state->proxy;
+
+
+	if (entered || state->touched)
+	{
+		//// Get the gradient at the previously approximated proxy position.. use as plane normal.
+		// A proxy taken from the projection cache comes with it, and one
+		// that stays put keeps it, so a tool resting on the surface costs
+		// one evaluation per tick.
+		if (state->proxyGradientValid && state->proxyGradientVersion == version)
+		{
+			planeNormal = state->proxyGradient;
 		}
 		else
 		{
-			if (abs(tan(acos(cosTheta))) > mu_s)
-			{
-				frictionDist += sin(atan(mu_k)) * fromProxyToHapticPoint.length() + epsilon;
-				kinetic = true;
-			}
+			planeNormal = source.gradient(state->proxy);
+			state->proxyGradient = planeNormal;
+			state->proxyGradientVersion = version;
+			state->proxyGradientValid = true;
 		}
+		planeNormal.normalize();
 
+		// The friction cone test works on the squared dot product of the
+		// proxy-to-tool vector with the normal, against constants that are
+		// only recomputed when the friction coefficients change.
+		normalDot = fromProxyToHapticPoint.dot(planeNormal);
+		double lengthSq = fromProxyToHapticPoint.dot(fromProxyToHapticPoint);
 
-		debugTempA = frictionDist;
-		
-		if (kinetic)
+		state->friction.sync(mu_s, mu_k, (FrictionModelType)m_frictionModel.load(std::memory_order_relaxed));
+		state->kinetic = state->friction.updateKinetic(normalDot, lengthSq, state->kinetic);
+
+		if (state->kinetic)
 		{
-			if (touched)
-			{
-				chai3d::cVector3d projToolVectorOntoPlaneNormal;
-
-				// Project onto the plane normal and reverse it's direction since here, theta > 90.
-				projToolVectorOntoPlaneNormal = fromProxyToHapticPoint.dot(planeNormal) * planeNormal;
-
-				temp = fromProxyToHapticPoint - projToolVectorOntoPlaneNormal;
-				temp.normalize();
-
-				temp = temp * frictionDist;				
-							
-				// New seed point will be on the tangent plane defined by the previously approximated
-				// proxy position and the gradient vector at that point.
-				seedPoint = m_interactionPoint + fromProxyToHapticPoint - projToolVectorOntoPlaneNormal;// -temp;
-
-				
-				// Can do the two lines immediately following this comment instead of the two that preceed this comment.
-//				temp = ((fromProxyToHapticPoint - projToolVectorOntoPlaneNormal).length() - frictionDist) * temp;
-//				seedPoint = m_interactionPoint + temp;
-
-				
-				debugSeedPoint = seedPoint;
-
-				m_interactionPoint = findNearestSurfacePoint(seedPoint, epsilon);        
-
-				if (fromProxyToHapticPoint.dot(planeNormal) > epsilon)
-					touched = false;
-			}	
-			else
-			{
-				m_interactionPoint = findNearestSurfacePoint(a_toolPos, epsilon);
-				touched = true;
-			}
+			frictionDist = state->friction.frictionDistance(sqrt(lengthSq), epsilon);
+
+			chai3d::cVector3d projToolVectorOntoPlaneNormal;
+
+			// Project onto the plane normal and reverse it's direction since here, theta > 90.
+			projToolVectorOntoPlaneNormal = normalDot * planeNormal;
+
+			// New seed point will be on the tangent plane defined by the previously approximated
+			// proxy position and the gradient vector at that point, held back by the friction
+			// model (not at all for the friction cone).
+			seedPoint = state->proxy + fromProxyToHapticPoint - projToolVectorOntoPlaneNormal
+			          - state->friction.holdBack(fromProxyToHapticPoint - projToolVectorOntoPlaneNormal, normalDot);
+
+			sample.seedPoint = seedPoint;
+
+			state->proxy = projectToSurface(state, source, version, seedPoint, epsilon, &sample);
+
+			if (normalDot > epsilon)
+				state->touched = false;
 		}
 
-		m_interactionInside = true;
+		state->inside = true;
 	}
 	else
 	{
-		if ((a_toolPos.x() !=  m_interactionPoint.x()) || (a_toolPos.y() != m_interactionPoint.y()) || (a_toolPos.z() != m_interactionPoint.z()))
-			kinetic = true;
+		if ((a_toolPos.x() !=  state->proxy.x()) || (a_toolPos.y() != state->proxy.y()) || (a_toolPos.z() != state->proxy.z()))
+			state->kinetic = true;
 		else
-			kinetic = false;
+			state->kinetic = false;
 
 		// m_interactionProjectedPoint is the "proxy" point on the surface
 		// that the rendering algorithm tracks.  It should be equal to the
 		// tool position when the tool is not in contact with the object.
-		m_interactionPoint = a_toolPos;
+		state->proxy = a_toolPos;
+		state->proxyGradientValid = false;
 
-		// m_interactionInside should be set to true when the tool is in contact
+		// inside should be set to true when the tool is in contact
 		// with the object.
-		m_interactionInside = false;
+		state->inside = false;
+		state->tracked = true;
+	}
+
+	// let sources on slow storage page in the surroundings of the proxy
+	if (!outside)
+		source.prefetch(state->proxy);
+
+	if (state == &m_proxyStates[0])
+	{
+		double proxyToToolLength = fromProxyToHapticPoint.length();
+		if (proxyToToolLength > 0.0)
+			sample.proxyToTool = fromProxyToHapticPoint / proxyToToolLength;
+		sample.functionValue = functionValue;
+		sample.cosTheta = proxyToToolLength > 0.0 ? normalDot / proxyToToolLength : 0.0;
+		sample.frictionDist = frictionDist;
+	}
+	publishTick(state, a_toolPos, a_toolVel, sample);
+}
+
+
+//===========================================================================
+/*!
+    Hand the tick of the first tool to the telemetry ring, from which
+    render() shows its proxy, and to the recorder, once the tick is done.
+
+    \param  a_state  Proxy state of the tool.
+    \param  a_toolPos  Position of the tool.
+    \param  a_toolVel  Velocity of the tool.
+    \param  a_sample  Snapshot of the tick, completed from a_state.
+*/
+//===========================================================================
+void ImplicitMesh::publishTick(const ImplicitProxyState* a_state, const cVector3d& a_toolPos,
+                               const cVector3d& a_toolVel, ImplicitTelemetry& a_sample)
+{
+	// the first tool to touch this object is the one shown by render(), and
+	// the only producer of telemetry so the ring keeps a single writer
+	if (a_state != &m_proxyStates[0])
+		return;
+
+	a_sample.proxy = a_state->proxy;
+	a_sample.touched = a_state->touched;
+	a_sample.kinetic = a_state->kinetic;
+	a_sample.inside = a_state->inside;
+	m_telemetry.push(a_sample);
+
+	if (m_recorder)
+	{
+		cVector3d force(0.0, 0.0, 0.0);
+		if (a_state->inside)
+			force = m_material->getStiffness() * (a_state->proxy - a_toolPos);
+
+		TrajectoryRecord record;
+		for (int i = 0; i < 3; ++i)
+		{
+			record.toolPos[i] = a_toolPos(i);
+			record.toolVel[i] = a_toolVel(i);
+			record.proxy[i] = a_state->proxy(i);
+			record.force[i] = force(i);
+		}
+		record.flags = (a_state->inside ? TRAJECTORY_INSIDE : 0) |
+		               (a_state->touched ? TRAJECTORY_TOUCHED : 0) |
+		               (a_state->kinetic ? TRAJECTORY_KINETIC : 0);
+		m_recorder->record(record);
+	}
+}
+
+
+
+//===========================================================================
+/*!
+    One tick of a tool of finite size (see ToolAvatar.h).  The proxy is the
+    position of the avatar.  Its points are evaluated in one batch, around
+    the proxy while it is held on the surface, and otherwise where the
+    avatar, swept from its last position, first touches it.  The
+    frictionless position of the avatar is the one nearest the tool that
+    keeps every point outside the surface, and the contact normal points
+    from the tool to it.  Against that normal, the friction model decides
+    as for a single point whether the proxy sticks, or slides tangentially
+    towards the tool, still held out of the surface.  Newton steps then
+    put the point nearest the surface back on it.
+
+    \param  a_state  Proxy state of the tool.
+    \param  a_source  Source of this tick.
+    \param  a_avatar  Contact points of the tool.
+    \param  a_toolPos  Position of the tool.
+    \param  a_sample  Snapshot of the tick, filled in.
+*/
+//===========================================================================
+void ImplicitMesh::computeAvatarInteraction(ImplicitProxyState* a_state, const ImplicitSource& a_source,
+                                            const ToolAvatar& a_avatar, const cVector3d& a_toolPos,
+                                            ImplicitTelemetry& a_sample)
+{
+	double epsilon = 0.00001;
+
+	// early rejection: an avatar whose path is out of the bounds by its
+	// reach cannot touch
+	const cVector3d& from = a_state->tracked ? a_state->proxy : a_toolPos;
+	bool outside = false;
+	ImplicitHapticBounds bounds;
+	if (!a_state->touched)
+		bounds = readHapticBounds();
+	for (int axis = 0; axis < 3 && bounds.bounded; ++axis)
+		outside = outside || cMin(a_toolPos(axis), from(axis)) - a_avatar.getReach() > bounds.upper(axis) ||
+		                     cMax(a_toolPos(axis), from(axis)) + a_avatar.getReach() < bounds.lower(axis);
+
+	// with no proxy held, the avatar is swept from where the tool was on
+	// the last tick, and first touches the surface where it entered: the
+	// planes of points sampled deep inside would push it out anywhere
+	cVector3d pushed = a_toolPos;
+	int planes = 0;
+	ToolAvatarSamples samples;
+	if (!outside)
+	{
+		if (a_state->touched)
+			a_avatar.sample(a_source, a_state->proxy, samples);
+		else if (a_state->tracked)
+			sweepAvatar(a_source, a_avatar, from, a_toolPos, epsilon, samples);
+		else
+			a_avatar.sample(a_source, a_toolPos, samples);
+		planes = a_avatar.solve(samples, a_toolPos, pushed);
+
+		a_sample.functionValue = samples.count ? samples.value[0] : 0.0;
+		for (int n = 1; n < samples.count; ++n)
+			a_sample.functionValue = cMin(a_sample.functionValue, samples.value[n]);
+	}
+
+	cVector3d fromProxyToTool = a_toolPos - a_state->proxy;
+	if (planes == 0 || (pushed - a_toolPos).length() == 0.0)
+	{
+		// nothing in the way of the tool: the avatar follows it freely
+		a_state->kinetic = fromProxyToTool.length() > 0.0;
+		a_state->proxy = a_toolPos;
+		a_state->inside = false;
+		a_state->touched = false;
+		a_state->tracked = true;
+		return;
+	}
+
+	a_state->normal = pushed - a_toolPos;
+	a_state->normal.normalize();
+	a_sample.gradient = a_state->normal;
+
+	if (!a_state->touched)
+	{
+		// first contact: plant the avatar where the surface stops it
+		a_sample.seedPoint = pushed;
+		a_state->proxy = pushed;
+		a_state->touched = true;
+		a_state->kinetic = true;
+	}
+	else
+	{
+		double normalDot = fromProxyToTool.dot(a_state->normal);
+		double lengthSq = fromProxyToTool.dot(fromProxyToTool);
+		a_state->friction.sync(m_material->getStaticFriction(), m_material->getDynamicFriction(),
+		                       (FrictionModelType)m_frictionModel.load(std::memory_order_relaxed));
+		a_state->kinetic = a_state->friction.updateKinetic(normalDot, lengthSq, a_state->kinetic);
+
+		// a sticking avatar stays put, a sliding one follows the tool along
+		// the surface, held back by the friction model; either is kept out
+		// of the surface
+		cVector3d target = a_state->proxy;
+		if (a_state->kinetic)
+		{
+			cVector3d tangent = fromProxyToTool - normalDot * a_state->normal;
+			target += tangent - a_state->friction.holdBack(tangent, normalDot);
+			a_sample.frictionDist = a_state->friction.frictionDistance(sqrt(lengthSq), epsilon);
+		}
+		a_sample.seedPoint = target;
+
+		cVector3d previous = a_state->proxy;
+		a_avatar.solve(samples, target, a_state->proxy);
+		a_sample.deltaMovement = (a_state->proxy - previous).length();
+
+		double proxyToToolLength = sqrt(lengthSq);
+		if (proxyToToolLength > 0.0)
+		{
+			a_sample.proxyToTool = fromProxyToTool / proxyToToolLength;
+			a_sample.cosTheta = normalDot / proxyToToolLength;
+		}
+	}
+	a_state->inside = true;
+
+	// the planes are tangent where the points were sampled, so a curved
+	// surface leaves the avatar off it, or in it; Newton steps along the
+	// normal of the point nearest the surface put that point back on it,
+	// still keeping the others out
+	for (int i = 0; i < IMPLICIT_AVATAR_REFINEMENTS; ++i)
+	{
+		a_avatar.sample(a_source, a_state->proxy, samples);
+		int nearest = 0;
+		for (int n = 1; n < samples.count; ++n)
+			if (samples.distance[n] < samples.distance[nearest])
+				nearest = n;
+		double distance = samples.distance[nearest];
+		if (fabs(distance) < epsilon || distance >= 1e300)
+			break;
+		cVector3d normal(samples.gx[nearest], samples.gy[nearest], samples.gz[nearest]);
+		a_avatar.solve(samples, a_state->proxy - distance * normal, a_state->proxy);
+	}
+
+	// let sources on slow storage page in the surroundings of the avatar
+	a_source.prefetch(a_state->proxy);
+}
+
+
+//===========================================================================
+/*!
+    Find where an avatar moving straight from a_from, clear of the
+    surface, to a_to first touches it, as sweepSegment() does for a point:
+    the avatar is marched by the first order distance of its nearest point
+    (but at least IMPLICIT_SWEEP_STEP, in at most IMPLICIT_SWEEP_SAMPLES
+    steps) until a point is inside, and the step is then narrowed by
+    bisection.  The returned samples are those of the last position found
+    clear, just off the surface, or of a_to if the path is clear.
+
+    \param  a_source  Source to sweep.
+    \param  a_avatar  Contact points of the tool.
+    \param  a_from  Start of the path (clear of the surface).
+    \param  a_to  End of the path.
+    \param  epsilon  Length below which the bracket is not narrowed further.
+    \param  a_samples  Returns the points evaluated at the entry, or at a_to.
+    \return True if the avatar enters the surface along the path.
+*/
+//===========================================================================
+bool ImplicitMesh::sweepAvatar(const ImplicitSource& a_source, const ToolAvatar& a_avatar, const cVector3d& a_from,
+                               const cVector3d& a_to, double epsilon, ToolAvatarSamples& a_samples) const
+{
+	cVector3d path = a_to - a_from;
+	double length = path.length();
+
+	// march along the path for the first position with a point inside
+	double outsideT = 0.0, insideT = -1.0;
+	double t = (length > IMPLICIT_SWEEP_STEP) ? 0.0 : 1.0;
+	for (int i = 0; i < IMPLICIT_SWEEP_SAMPLES; ++i)
+	{
+		a_avatar.sample(a_source, a_from + t * path, a_samples);
+		double nearest = 1e300;
+		bool inside = false;
+		for (int n = 0; n < a_samples.count; ++n)
+		{
+			nearest = cMin(nearest, a_samples.distance[n]);
+			inside = inside || a_samples.value[n] < 0.0;
+		}
+		if (inside)
+		{
+			insideT = t;
+			break;
+		}
+		outsideT = t;
+		if (t >= 1.0)
+			return false;
+		t = cMin(t + cMax(nearest, IMPLICIT_SWEEP_STEP) / length, 1.0);
+
+		// a stroke too long for the steps is only tested at its end
+		if (i == IMPLICIT_SWEEP_SAMPLES - 2)
+			t = 1.0;
+	}
+	if (insideT < 0.0)
+		return false;
+
+	// narrow the step in which the avatar enters
+	for (int i = 0; i < IMPLICIT_SWEEP_BISECTIONS && (insideT - outsideT) * length > epsilon; ++i)
+	{
+		double middle = 0.5 * (outsideT + insideT);
+		a_avatar.sample(a_source, a_from + middle * path, a_samples);
+		bool inside = false;
+		for (int n = 0; n < a_samples.count && !inside; ++n)
+			inside = a_samples.value[n] < 0.0;
+		if (inside)
+			insideT = middle;
+		else
+			outsideT = middle;
 	}
 
-	debugTouched = touched;
-	debugKinetic = kinetic;
+	a_avatar.sample(a_source, a_from + outsideT * path, a_samples);
+	return true;
 }
 
 
+//===========================================================================
+/*!
+    Find where the straight path of the tool from a_from, outside the
+    surface, to a_to first enters it.  The path is marched by the first
+    order distance to the surface, f / |grad f|, at each point (but at
+    least IMPLICIT_SWEEP_STEP, and in at most IMPLICIT_SWEEP_SAMPLES
+    steps) until a point inside is found.  The step in which the path
+    enters is then narrowed by bisection, and one false position step
+    refines the crossing.  The returned point is the last one found
+    outside, just above the surface.
+
+    \param  a_source  Source to sweep.
+    \param  a_from  Start of the path (outside).
+    \param  a_to  End of the path.
+    \param  a_toValue  Value of the source at a_to.
+    \param  epsilon  Length below which the bracket is not narrowed further.
+    \param  a_entry  Returns where the path enters the surface.
+    \return True if the path enters the surface.
+*/
+//===========================================================================
+bool ImplicitMesh::sweepSegment(const ImplicitSource& a_source, const cVector3d& a_from, const cVector3d& a_to,
+                                double a_toValue, double epsilon, cVector3d& a_entry) const
+{
+	cVector3d path = a_to - a_from;
+	double length = path.length();
+
+	// march along the path for the first point inside; a path shorter than
+	// the step is only tested at its end
+	double outsideT = 0.0, insideT = -1.0;
+	double outsideValue = -1.0, insideValue = 0.0;
+	double t = 0.0;
+	cVector3d gradient;
+	for (int i = 0; i < IMPLICIT_SWEEP_SAMPLES && length > IMPLICIT_SWEEP_STEP; ++i)
+	{
+		double value = a_source.evaluate(a_from + t * path, gradient);
+		if (value < 0.0)
+		{
+			insideT = t;
+			insideValue = value;
+			break;
+		}
+		outsideT = t;
+		outsideValue = value;
+
+		double gradientLength = gradient.length();
+		double step = (gradientLength > 0.0) ? value / gradientLength : 0.0;
+		t += cMax(step, IMPLICIT_SWEEP_STEP) / length;
+		if (t >= 1.0)
+			break;
+	}
+	if (insideT < 0.0)
+	{
+		if (a_toValue >= 0.0)
+			return false;
+		insideT = 1.0;
+		insideValue = a_toValue;
+	}
+
+	// narrow the bracket down
+	for (int i = 0; i < IMPLICIT_SWEEP_BISECTIONS && (insideT - outsideT) * length > epsilon; ++i)
+	{
+		double mid = 0.5 * (outsideT + insideT);
+		double value = a_source.value(a_from + mid * path);
+		if (value < 0.0)
+		{
+			insideT = mid;
+			insideValue = value;
+		}
+		else
+		{
+			outsideT = mid;
+			outsideValue = value;
+		}
+	}
+
+	// one false position step towards the root, if the outside end was evaluated
+	if (outsideValue > 0.0)
+	{
+		double root = outsideT + (insideT - outsideT) * outsideValue / (outsideValue - insideValue);
+		if (root > outsideT && root < insideT && a_source.value(a_from + root * path) >= 0.0)
+			outsideT = root;
+	}
+
+	a_entry = a_from + outsideT * path;
+	return true;
+}
 
-cVector3d ImplicitMesh::findNearestSurfacePoint(cVector3d seedPoint, double epsilon)
+cVector3d ImplicitMesh::findNearestSurfacePoint(const ImplicitSource& a_source, cVector3d seedPoint,
+                                                double epsilon, ImplicitTelemetry* a_telemetry)
 {
 	chai3d::cVector3d p(seedPoint);
 	chai3d::cVector3d deltaP;
+	chai3d::cVector3d gradient;
+	int limit = m_newtonLimit.load(std::memory_order_relaxed);
+	int iterations = 0;
 
 	do
 	{
-		debugGradientVector = m_gradientFunction(p.x(), p.y(), p.z());
+		double value = a_source.evaluate(p, gradient);
 
-		deltaP = -1 * m_surfaceFunction(p.x(), p.y(), p.z()) * debugGradientVector / debugGradientVector.dot(debugGradientVector); 
+		// a flat (clamped) region of a sampled field gives no direction to move in
+		double gradientSq = gradient.dot(gradient);
+		if (gradientSq == 0.0)
+			break;
+
+		deltaP = -1 * value * gradient / gradientSq; 
 		p += deltaP;
 
-		deltaMovement = deltaP.length();
+	} while (deltaP.length() > epsilon && (limit == 0 || ++iterations < limit));
 
+	if (a_telemetry)
+	{
+		a_telemetry->gradient = gradient;
+		a_telemetry->deltaMovement = deltaP.length();
+	}
 
+	return p;
+}
 
+cVector3d ImplicitMesh::projectToSurface(ImplicitProxyState* a_state, const ImplicitSource& a_source,
+                                         unsigned int a_version, const cVector3d& seedPoint, double epsilon,
+                                         ImplicitTelemetry* a_telemetry)
+{
+	// a seed within the convergence tolerance of a recent one converges to
+	// within the tolerance of the same point
+	ImplicitTelemetry sample;
+	cVector3d p;
+	a_state->proxyGradientValid = a_state->projections.lookup(seedPoint, a_version, epsilon, p, sample.gradient);
+	if (a_state->proxyGradientValid)
+	{
+		sample.deltaMovement = 0.0;
+		a_state->proxyGradient = sample.gradient;
+		a_state->proxyGradientVersion = a_version;
+	}
+	else
+	{
+		p = findNearestSurfacePoint(a_source, seedPoint, epsilon, &sample);
+		a_state->projections.store(seedPoint, a_version, epsilon, p, sample.gradient);
+	}
 
-	} while (deltaP.length() > epsilon);
+	if (a_telemetry)
+	{
+		a_telemetry->gradient = sample.gradient;
+		a_telemetry->deltaMovement = sample.deltaMovement;
+	}
 
 	return p;
-}
\ No newline at end of file
+}
+
+
+//===========================================================================
+/*!
+    Spring force between the tool and the proxy it owns on the surface.
+
+    \param  a_toolPos  Position of the tool in local coordinates.
+    \param  a_toolVel  Velocity of the tool in local coordinates.
+    \param  a_toolID  Identification number of the force algorithm.
+    \param  a_reactionForce  Returned reaction force.
+    \return True if the tool is in contact with the surface.
+*/
+//===========================================================================
+bool ImplicitSurfaceEffect::computeForce(const cVector3d& a_toolPos,
+                                         const cVector3d& a_toolVel,
+                                         const unsigned int& a_toolID,
+                                         cVector3d& a_reactionForce)
+{
+    const ImplicitProxyState* state = m_mesh->findProxyState(a_toolID);
+    if (state && state->inside)
+    {
+        double stiffness = m_mesh->m_material->getStiffness();
+        a_reactionForce = stiffness * (state->proxy - a_toolPos);
+        return true;
+    }
+
+    a_reactionForce.zero();
+    return false;
+}
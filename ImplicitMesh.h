@@ -20,38 +20,366 @@
 #define IMPLICITMESH_H
 
 #include "chai3d.h"
-#include <queue>
+#include "CacheAligned.h"
+#include "TelemetryRing.h"
+#include "TrajectoryLog.h"
+#include "FrictionModel.h"
+#include "ImplicitSource.h"
+#include "SampledField.h"
+#include "ContactPatch.h"
+#include "DoubleBuffer.h"
+#include "ProjectionCache.h"
+#include "ToolAvatar.h"
+#include "SurfaceTexture.h"
+#include <atomic>
+#include <vector>
 
 using namespace chai3d;
 
+//! Maximum number of tools (force algorithms) that may touch one object at once.
+#define IMPLICIT_MAX_TOOLS 8
+
+//! Owner id of a proxy state slot that has not been claimed by any tool.
+#define IMPLICIT_NO_TOOL 0xFFFFFFFFu
+
+//! Shortest step, and most steps, taken along the tool's path between two
+//! ticks when looking for where it entered the surface.  Features thinner
+//! than the step may be missed; strokes too long for the steps end at the
+//! tool, so a tick stays bounded.
+#define IMPLICIT_SWEEP_STEP 0.002
+#define IMPLICIT_SWEEP_SAMPLES 16
+
+//! Bisections narrowing the step in which the tool entered the surface.
+#define IMPLICIT_SWEEP_BISECTIONS 12
+
+//! Newton steps putting an avatar in contact back onto the surface after
+//! the solve against the planes of its points.
+#define IMPLICIT_AVATAR_REFINEMENTS 3
+
+//! Proxy state tracked independently for each tool touching the surface.
+//! Every slot sits on its own cache line so that tools running on separate
+//! haptic threads never write to a shared line.
+struct alignas(64) ImplicitProxyState
+{
+    //! The a_IDN of the tool that owns this slot, or IMPLICIT_NO_TOOL.
+    std::atomic<unsigned int> owner;
+
+    //! The proxy position on (or off) the surface, in local coordinates;
+    //! with an avatar, the position of the avatar.
+    chai3d::cVector3d proxy;
+
+    //! With an avatar, the direction the surface pushes it in while in contact.
+    chai3d::cVector3d normal;
+
+    //! True while the tool is in contact with the surface.
+    bool inside;
+
+    //! True once the proxy has been planted on the surface.
+    bool touched;
+
+    //! True while the proxy is sliding (outside the static friction cone).
+    bool kinetic;
+
+    //! True once a tick has left the proxy in free space, at the tool, so
+    //! that the next tick can sweep the path from there.
+    bool tracked;
+
+    //! Friction cone constants, cached per tool so each haptic thread owns its copy.
+    FrictionModel friction;
+
+    //! The tool's recent projections onto the surface.
+    ProjectionCache projections;
+
+    //! The gradient at the proxy on version proxyGradientVersion of the
+    //! shape, while proxyGradientValid: from the projection cache, or from
+    //! the first tick that needed it, until the proxy moves.
+    chai3d::cVector3d proxyGradient;
+    unsigned int proxyGradientVersion;
+    bool proxyGradientValid;
+
+    //! Heights of the texture this tool computed recently.
+    TextureCache textures;
+
+    //! Steps of the tool's last estimated gradient, for its next one.
+    GradientSteps gradientSteps;
+
+    //! The object's count of releaseProxies() calls this state has caught up with.
+    unsigned int releases;
+
+    //! The avatar (or NULL for the point) the proxy was found for.
+    const ToolAvatar* avatar;
+
+    ImplicitProxyState() : owner(IMPLICIT_NO_TOOL), releases(0), avatar(0) { reset(); }
+    void reset() { proxy.zero(); normal.zero(); inside = false; touched = false; kinetic = false; tracked = false;
+                   proxyGradientValid = false; gradientSteps = GradientSteps(); }
+};
+
+//! Snapshot of the proxy algorithm state for one haptic tick.
+struct ImplicitTelemetry
+{
+    chai3d::cVector3d toolPos;
+    chai3d::cVector3d proxy;
+    chai3d::cVector3d seedPoint;
+    chai3d::cVector3d gradient;
+    chai3d::cVector3d proxyToTool;
+    double functionValue;
+    double deltaMovement;
+    double cosTheta;
+    double frictionDist;
+    bool touched;
+    bool kinetic;
+    bool inside;
+
+    ImplicitTelemetry()
+        : functionValue(0.0), deltaMovement(0.0), cosTheta(0.0), frictionDist(0.0),
+          touched(false), kinetic(false), inside(false)
+    {
+        toolPos.zero(); proxy.zero(); seedPoint.zero(); gradient.zero(); proxyToTool.zero();
+    }
+};
+
+//! Number of per-tick snapshots buffered between the haptic and graphics loops.
+#define IMPLICIT_TELEMETRY_CAPACITY 256
+
+//! Box, in local coordinates, outside which the source is positive.
+struct ImplicitHapticBounds
+{
+    bool bounded;
+    chai3d::cVector3d lower;
+    chai3d::cVector3d upper;
+
+    ImplicitHapticBounds() : bounded(false) { lower.zero(); upper.zero(); }
+};
+
 class ImplicitMesh : public chai3d::cMesh
 {
     //! A visible sphere that tracks the position of the proxy on the surface
     chai3d::cShapeSphere m_projectedSphere;
+
+    //! Proxy state of every tool touching this object, claimed by a_IDN.
+    ImplicitProxyState m_proxyStates[IMPLICIT_MAX_TOOLS];
+
+    //! Return the proxy state slot of a tool, claiming a free one if needed.
+    ImplicitProxyState* claimProxyState(unsigned int a_IDN);
     
-    //! A pointer to the implicit function used to create this object
-    double (*m_surfaceFunction)(double, double, double);
+    //! The implicit function (and gradient) used to create this object
+    FunctionSource m_functionSource;
+
+    //! The source used to create this object: m_functionSource, or one set by the caller.
+    const ImplicitSource* m_primarySource;
+
+    //! The same source sampled, near its surface, on the lattice used to build the mesh.
+    SampledField m_sampledField;
+
+    //! The source the haptic thread queries: m_primarySource or m_sampledField.
+    std::atomic<const ImplicitSource*> m_source;
+
+    //! Box outside which a tool with no proxy held on the surface skips the
+    //! source.  Published whole, like the source, so a tick never sees half
+    //! of a new box; set before the source it bounds on a change of source.
+    DoubleBuffer<ImplicitHapticBounds> m_bounds;
+
+    //! The current box (unbounded if none was ever set), read in one piece.
+    ImplicitHapticBounds readHapticBounds() const;
+
+    //! Sample m_primarySource (or load it from a_cacheFile) and march the
+    //! lattice into triangles.
+    void buildMesh(chai3d::cVector3d a_lowerBound, chai3d::cVector3d a_upperBound,
+                   double a_granularity, const std::string& a_cacheFile = "",
+                   uint64_t a_cacheKey = 0);
+
+    //! March the cells of a_field inside the box into a_triangles, three corners each.
+    static void marchField(const SampledField& a_field, const chai3d::cVector3d& a_lowerBound,
+                           const chai3d::cVector3d& a_upperBound, double a_granularity,
+                           std::vector<chai3d::cVector3d>& a_triangles);
     
-	cVector3d findNearestSurfacePoint(cVector3d seedPoint, double epsilon);
+	cVector3d findNearestSurfacePoint(const ImplicitSource& a_source, cVector3d seedPoint,
+	                                  double epsilon, ImplicitTelemetry* a_telemetry = 0);
+
+	//! findNearestSurfacePoint() through the projection cache of a tool;
+	//! a_version is the shape version read before a_source.
+	cVector3d projectToSurface(ImplicitProxyState* a_state, const ImplicitSource& a_source,
+	                           unsigned int a_version, const cVector3d& seedPoint, double epsilon,
+	                           ImplicitTelemetry* a_telemetry);
+
+	//! Find where the path from a_from (outside) to a_to first enters the surface.
+	bool sweepSegment(const ImplicitSource& a_source, const cVector3d& a_from, const cVector3d& a_to,
+	                  double a_toValue, double epsilon, cVector3d& a_entry) const;
+
+	//! Find where an avatar moving from a_from (clear) to a_to first touches the surface.
+	bool sweepAvatar(const ImplicitSource& a_source, const ToolAvatar& a_avatar, const cVector3d& a_from,
+	                 const cVector3d& a_to, double epsilon, ToolAvatarSamples& a_samples) const;
+
+	//! One tick of a tool of finite size (see setAvatar()).
+	void computeAvatarInteraction(ImplicitProxyState* a_state, const ImplicitSource& a_source,
+	                              const ToolAvatar& a_avatar, const cVector3d& a_toolPos,
+	                              ImplicitTelemetry& a_sample);
+
+	//! Publish the tick of the first tool to the telemetry ring (and so
+	//! to render()) and the recorder.
+	void publishTick(const ImplicitProxyState* a_state, const cVector3d& a_toolPos,
+	                 const cVector3d& a_toolVel, ImplicitTelemetry& a_sample);
+
+	//! Per-tick snapshots of the first tool's proxy, drained by the graphics loop.
+	TelemetryRing<ImplicitTelemetry, IMPLICIT_TELEMETRY_CAPACITY> m_telemetry;
+
+	//! The last snapshot drained from m_telemetry, whose proxy render()
+	//! shows; touched by the graphics thread only.
+	ImplicitTelemetry m_shownTelemetry;
 
-	chai3d::cVector3d (*m_gradientFunction)(double, double, double);
+	//! Optional recorder of the first tool's trajectory, proxy and force.
+	TrajectoryRecorder* m_recorder;
 
-	bool touched = false;
-	bool kinetic = false;
-	
-	queue<chai3d::cVector3d> gradientQ;
+	//! The FrictionModelType used for all tools.
+	std::atomic<int> m_frictionModel;
+
+	//! Most Newton iterations of findNearestSurfacePoint(), or 0 for no limit.
+	std::atomic<int> m_newtonLimit;
+
+	//! Changes whenever a projection onto the surface could change, so the
+	//! projection caches forget what they hold.
+	std::atomic<unsigned int> m_shapeVersion;
+
+	//! Number of releaseProxies() calls so far.
+	std::atomic<unsigned int> m_releases;
+
+	//! True once replaceSurface() or setTexture() has left m_sampledField
+	//! behind the source.
+	std::atomic<bool> m_sampledStale;
+
+	//! The contact points of every tool, or NULL for single points.
+	std::atomic<const ToolAvatar*> m_avatar;
+
+	//! The texture laid over the source, or NULL for a smooth surface.
+	std::atomic<const SurfaceTexture*> m_texture;
+
+	//! The texture sampled into m_sampledField when it was built, and how
+	//! many of its octaves (the coarse ones the lattice resolves).
+	const SurfaceTexture* m_sampledTexture;
+	int m_sampledOctaves;
+
+	//! Lattice spacing the mesh was built on, or 0 before it is.
+	double m_meshGranularity;
+
+	//! The first octave of a_texture not already in a_source.
+	int getUnsampledOctave(const ImplicitSource& a_source, const SurfaceTexture* a_texture) const
+	{
+		return (&a_source == &m_sampledField && a_texture == m_sampledTexture) ? m_sampledOctaves : 0;
+	}
 
 public:
     ImplicitMesh();
     virtual ~ImplicitMesh();
 
-    //! Create a polygon mesh from an implicit surface function for visual rendering.
+    //! The proxy states and the telemetry ring keep to cache lines of their own.
+    CACHE_ALIGNED_NEW
+
+    //! Create a polygon mesh from an implicit surface function for visual
+    //! rendering, keeping the sampled lattice for setSampledBackend().  If
+    //! g is NULL the gradient is estimated by finite differences.
     void createFromFunction(double (*f)(double, double, double),
 							chai3d::cVector3d (*g)(double, double, double),
 							chai3d::cVector3d a_lowerBound,
                             chai3d::cVector3d a_upperBound,
                             double a_granularity);
 
+    //! Create a polygon mesh from any implicit source, such as a VolumeSource.
+    //! a_source must outlive this object.  If a_cacheFile is given, the
+    //! sampled grid is read from it when it was saved with a_cacheKey over
+    //! the same lattice, and written to it otherwise.
+    void createFromSource(const ImplicitSource* a_source,
+                          chai3d::cVector3d a_lowerBound,
+                          chai3d::cVector3d a_upperBound,
+                          double a_granularity,
+                          const std::string& a_cacheFile = "",
+                          uint64_t a_cacheKey = 0);
+
+    //! Sample a_source over the box and march it into a_triangles, three
+    //! corners per triangle, on a_threads threads (0 for one per core).
+    //! Touches no object, so a new surface can be meshed in the background.
+    static void marchSurface(const ImplicitSource& a_source, const chai3d::cVector3d& a_lowerBound,
+                             const chai3d::cVector3d& a_upperBound, double a_granularity,
+                             std::vector<chai3d::cVector3d>& a_triangles, int a_threads = 0);
+
+    //! Show a_triangles (from marchSurface()) in place of the mesh, after the
+    //! source has changed in place, such as a reloaded plugin; call right
+    //! after the change, as the tools' projections onto the old source are
+    //! dropped before the mesh is rebuilt, and growHapticBounds() with the
+    //! new box right before it.  From then on the haptic threads render
+    //! from the source: the sampled grid is out of date and
+    //! setSampledBackend(true) fails.  Graphics thread only.
+    void replaceSurface(const std::vector<chai3d::cVector3d>& a_triangles,
+                        const chai3d::cVector3d& a_lowerBound, const chai3d::cVector3d& a_upperBound);
+
+    //! Use an implicit surface function for haptic rendering only, without
+    //! building a visual mesh (used by the headless tools).  g may be NULL.
+    void setSurfaceFunction(double (*f)(double, double, double),
+                            chai3d::cVector3d (*g)(double, double, double));
+
+    //! Use any implicit source for haptic rendering only.
+    void setSource(const ImplicitSource* a_source);
+
+    //! Declare the source positive outside [a_lower, a_upper] (local
+    //! coordinates), so that ticks outside it are answered without
+    //! evaluating it.  The create methods set their box; setSource() and
+    //! setSurfaceFunction() clear it.
+    void setHapticBounds(const chai3d::cVector3d& a_lower, const chai3d::cVector3d& a_upper);
+
+    //! Make the box hold [a_lower, a_upper] as well (if there is one), so
+    //! that it bounds the source before and after it changes in place.
+    void growHapticBounds(const chai3d::cVector3d& a_lower, const chai3d::cVector3d& a_upper);
+
+    //! The box set by setHapticBounds(), or false if there is none.
+    bool getHapticBounds(chai3d::cVector3d& a_lower, chai3d::cVector3d& a_upper) const;
+
+    //! Render haptically from the sampled grid instead of the function.
+    //! Returns false if createFromFunction has not sampled one, or it is
+    //! out of date.
+    bool setSampledBackend(bool a_enabled);
+
+    //! True while the haptic thread queries the sampled grid.
+    bool isSampledBackend() const { return m_source.load() == &m_sampledField; }
+
+    //! Stop the projection of the proxy onto the surface after a_limit
+    //! Newton iterations, even if it has not converged (0 for no limit).
+    //! Cheaper, less exact ticks when the loop is overloaded.
+    void setNewtonIterationLimit(int a_limit)
+    {
+        m_newtonLimit.store(a_limit, std::memory_order_relaxed);
+        invalidateProjections();
+    }
+    int getNewtonIterationLimit() const { return m_newtonLimit.load(std::memory_order_relaxed); }
+
+    //! Touch the surface with a_avatar, a tool of finite size, instead of a
+    //! single point (NULL to go back to a point).  a_avatar must outlive
+    //! this object; a tool in contact switches on its next tick, and starts
+    //! afresh from where it is, as its proxy was held for the other shape.
+    void setAvatar(const ToolAvatar* a_avatar) { m_avatar.store(a_avatar, std::memory_order_release); }
+    const ToolAvatar* getAvatar() const { return m_avatar.load(std::memory_order_acquire); }
+
+    //! Lay a_texture over the surface (NULL for a smooth one); see
+    //! SurfaceTexture.h.  a_texture must outlive this object.  The haptic
+    //! threads feel it from their next tick.  The mesh and the sampled grid
+    //! show its coarse octaves only if it is set before they are built (or
+    //! the mesh once rebuildMesh() is called); a grid holding the octaves
+    //! of another texture is out of date, as after replaceSurface().
+    void setTexture(const SurfaceTexture* a_texture);
+    const SurfaceTexture* getTexture() const { return m_texture.load(std::memory_order_acquire); }
+
+    //! March the mesh again over the box and lattice it was built on, with
+    //! the coarse octaves of the texture set now.  The sampled grid, which
+    //! the haptic threads may be reading, is left as it is.
+    void rebuildMesh();
+
+    //! The grid sampled by createFromFunction (empty otherwise).
+    const SampledField& getSampledField() const { return m_sampledField; }
+
+    //! Record every tick of the first tool into a_recorder (NULL to disable).
+    void setRecorder(TrajectoryRecorder* a_recorder) { m_recorder = a_recorder; }
+
+    //! Select the friction model used when the proxy sticks and slides.
+    void setFrictionModel(FrictionModelType a_type) { m_frictionModel.store(a_type); }
+
     //! Contains code for graphically rendering this object in OpenGL.
     virtual void render(chai3d::cRenderOptions& a_options);
 
@@ -60,22 +388,90 @@ public:
                                          const chai3d::cVector3d& a_toolVel,
                                          const unsigned int a_IDN);
 
-	chai3d::cVector3d ImplicitMesh::debugSeedPoint;
-	chai3d::cVector3d ImplicitMesh::debugToolPos;
-	chai3d::cVector3d ImplicitMesh::debugGradientVector;
-	double functionValue;
-	double deltaMovement;
-	bool debugKinetic;
-	bool debugTouched;
-	double debugTempA;
-	double debugTempB;
-	chai3d::cVector3d ImplicitMesh::debugTempVec;
-	
-	double cosThta;
-	double theta;
-	double tanTheta;
-	double thetaK;
-	double sinThetaK;
+    //! Tell the object where a tool was on the previous tick, when it was
+    //! not asked about that tick (see ImplicitGroup), so the next tick
+    //! sweeps the right path.  Ignored while the tool is in contact.  Call
+    //! from the tool's haptic thread only.
+    void setFreeProxy(unsigned int a_IDN, const chai3d::cVector3d& a_toolPos);
+
+    //! Let go of the proxy of every tool, as if none had touched the object
+    //! yet, so each starts afresh from where it is on its next tick.  For
+    //! when a tool's ticks have not been running through the object, such
+    //! as across a switch of the rendering mode.  Safe from any thread:
+    //! each tool applies it to its own proxy, on its own thread.
+    void releaseProxies() { m_releases.fetch_add(1, std::memory_order_release); }
+
+    //! Put the proxy of a tool in a given state, such as the one a recorded
+    //! trajectory started from (see TrajectoryLog.h).  Call from the tool's
+    //! haptic thread only.
+    void setProxyState(unsigned int a_IDN, const chai3d::cVector3d& a_proxy,
+                       bool a_inside, bool a_touched, bool a_kinetic, bool a_tracked);
+
+    //! The tangent plane around a tool for multi-rate rendering, in local
+    //! coordinates: at the tool's proxy while it is in contact, otherwise
+    //! at the surface point nearest a_toolPos.  Call from the tool's haptic
+    //! thread after its tick.  With an avatar, the plane is the one its
+    //! point nearest the surface would slide on, carried to the avatar's
+    //! position.  Returns false (and an invalid patch) if the tool is out
+    //! of the bounds or the surface has no normal there.
+    bool getContactPatch(unsigned int a_IDN, const chai3d::cVector3d& a_toolPos, ContactPatch& a_patch);
+
+    //! Forget the projections cached by every tool; call after changing the
+    //! source itself (such as the transform of a CSG node).  Changes made
+    //! through this class do so already.
+    void invalidateProjections() { m_shapeVersion.fetch_add(1, std::memory_order_release); }
+
+    //! Projections taken from the tools' caches, and made afresh, so far.
+    void getProjectionCacheStats(unsigned long long& a_hits, unsigned long long& a_misses) const;
+
+    //! Return the proxy state of a tool, or NULL if it has not touched this object yet.
+    const ImplicitProxyState* findProxyState(unsigned int a_IDN) const;
+
+    //! Pop the oldest telemetry snapshot. Call from the graphics thread
+    //! only: render() shows the proxy of the last snapshot popped.
+    bool popTelemetry(ImplicitTelemetry& a_sample)
+    {
+        if (!m_telemetry.pop(a_sample))
+            return false;
+        m_shownTelemetry = a_sample;
+        return true;
+    }
+
+    //! Pop all pending snapshots, keeping only the newest. Graphics thread only.
+    bool popLatestTelemetry(ImplicitTelemetry& a_sample)
+    {
+        if (!m_telemetry.popLatest(a_sample))
+            return false;
+        m_shownTelemetry = a_sample;
+        return true;
+    }
+
+    //! Number of snapshots dropped because no consumer kept up.
+    unsigned int getTelemetryDropped() const { return m_telemetry.getDropped(); }
+};
+
+//===========================================================================
+/*
+    Renders a spring force between the tool and its own proxy on an
+    ImplicitMesh.  Unlike cEffectSurface, which reads the single
+    m_interactionPoint of the parent object, this effect looks up the proxy
+    by tool id, so several tools can touch the same surface at once.
+*/
+//===========================================================================
+class ImplicitSurfaceEffect : public chai3d::cGenericEffect
+{
+public:
+    ImplicitSurfaceEffect(ImplicitMesh* a_parent)
+        : chai3d::cGenericEffect(a_parent), m_mesh(a_parent) {}
+
+    //! Compute the reaction force of the tool identified by a_toolID.
+    virtual bool computeForce(const chai3d::cVector3d& a_toolPos,
+                              const chai3d::cVector3d& a_toolVel,
+                              const unsigned int& a_toolID,
+                              chai3d::cVector3d& a_reactionForce);
+
+private:
+    ImplicitMesh* m_mesh;
 };
 
 #endif
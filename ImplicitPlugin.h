@@ -0,0 +1,91 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    The interface of implicit shape plugins: shared libraries (.so, .dll)
+    that PluginSource loads, and reloads whenever they are rebuilt, while
+    the haptic threads keep running.  This header is all a plugin needs; it
+    is plain C so that plugins can be written in C as well.
+
+    A plugin exports one function, implicitPluginInfo(), returning a
+    description of its shape that stays valid while it is loaded:
+
+        static double value(double x, double y, double z) { ... }
+
+        static const ImplicitPluginInfo info =
+        {
+            IMPLICIT_PLUGIN_ABI, "blob",
+            value, NULL, NULL,
+            { -1.5, -1.5, -1.5 }, { 1.5, 1.5, 1.5 },
+            IMPLICIT_SYMMETRIC_X | IMPLICIT_SYMMETRIC_Y, 0.0
+        };
+
+        IMPLICIT_PLUGIN_EXPORT const ImplicitPluginInfo* implicitPluginInfo(void) { return &info; }
+
+    See TorusPlugin.cpp for a complete one.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#ifndef IMPLICITPLUGIN_H
+#define IMPLICITPLUGIN_H
+
+//! Version of ImplicitPluginInfo; plugins built against another are refused.
+#define IMPLICIT_PLUGIN_ABI 1
+
+//! Name of the function every plugin exports.
+#define IMPLICIT_PLUGIN_ENTRY "implicitPluginInfo"
+
+//! Symmetries a shape may declare: f is unchanged when the coordinate is negated.
+#define IMPLICIT_SYMMETRIC_X 1
+#define IMPLICIT_SYMMETRIC_Y 2
+#define IMPLICIT_SYMMETRIC_Z 4
+
+#ifdef __cplusplus
+#define IMPLICIT_PLUGIN_EXTERN extern "C"
+#else
+#define IMPLICIT_PLUGIN_EXTERN
+#endif
+
+#if defined(_WIN32)
+#define IMPLICIT_PLUGIN_EXPORT IMPLICIT_PLUGIN_EXTERN __declspec(dllexport)
+#else
+#define IMPLICIT_PLUGIN_EXPORT IMPLICIT_PLUGIN_EXTERN __attribute__((visibility("default")))
+#endif
+
+typedef struct ImplicitPluginInfo
+{
+    //! IMPLICIT_PLUGIN_ABI, as the plugin was built.
+    int abi;
+
+    //! Name of the shape.
+    const char* name;
+
+    //! The implicit function, negative inside.  Required.  Called from the
+    //! haptic threads: it must not allocate, block or keep state.
+    double (*value)(double x, double y, double z);
+
+    //! a_count values at once, coordinate by coordinate, or NULL.
+    void (*valueBatch)(const double* x, const double* y, const double* z, int count, double* values);
+
+    //! The value, and its gradient written to gradient[0..2], or NULL to
+    //! have the gradient estimated from value.
+    double (*evaluate)(double x, double y, double z, double* gradient);
+
+    //! Box outside which the function is positive; the shape is meshed over it.
+    double lower[3];
+    double upper[3];
+
+    //! IMPLICIT_SYMMETRIC_X, _Y and _Z flags of the symmetries of the function.
+    unsigned int symmetry;
+
+    //! Bound on the length of the gradient inside the box, or 0 if unknown.
+    double lipschitz;
+} ImplicitPluginInfo;
+
+//! Signature of implicitPluginInfo().
+typedef const ImplicitPluginInfo* (*ImplicitPluginEntry)(void);
+
+#endif
@@ -0,0 +1,99 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    The implicit surface functions (and their gradients) that can be
+    rendered by ImplicitMesh.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#include "ImplicitShapes.h"
+#include <string.h>
+
+using namespace chai3d;
+
+
+// [CPSC.86] Implicit Sphere and Implciit Sphere Gradient Functions.
+double implicitSphere(double x, double y, double z)
+{
+    return x*x + y*y + z*z - 1.0;
+}
+
+cVector3d implicitSphereGrad(double x, double y, double z)
+{
+	return cVector3d(2.0*x, 2.0*y, 2.0*z);
+}
+
+
+
+// [CPSC.86] Implicit Heart and Implicit Heart Gradient Functions.
+double implicitHeart(double x, double y, double z)
+{
+	return (pow((2*x*x + y*y + z*z - 1.0), 3.0) - (0.1*x*x + y*y)*z*z*z);
+}
+
+cVector3d implicitHeartGrad(double x, double y, double z)
+{
+	double termA = pow((2.0*x*x + y*y + z*z - 1.0), 2.0);
+	return cVector3d
+	(
+		12.0*x*pow((2.0*x*x + y * y + z * z - 1.0), 2.0) - 0.2*x*z*z*z,
+		6.0*y*pow((2.0*x*x + y * y + z * z - 1.0), 2.0) - 2.0*y*z*z*z,
+		6.0*z*pow((2.0*x*x + y * y + z * z - 1.0), 2.0) - 3.0*z*z*(0.1*x*x + y*y)
+	);
+}
+
+
+
+// [CPSC.86] Implicit Whiffle Cube and Implicit Whiffle Cube Gradient Functions.
+double implicitWhiffleCube(double x, double y, double z)
+{
+	return (pow((pow(x, 8.0) + pow(y, 8.0) + pow(z, 8.0)), 8.0)   +   pow((x*x + y*y + z*z - 0.44), -8.0) - 1);
+}
+
+cVector3d implicitWhiffleCubeGrad(double x, double y, double z)
+{
+	double termA = pow((pow(x, 8.0) + pow(y, 8.0) + pow(z, 8.0)), 7.0);
+	double termB = pow((x*x + y*y + z*z - 0.44), -9.0);
+
+	return cVector3d
+	(
+		64.0*pow(x,7.0)*termA - 16.0*x*termB,
+		64.0*pow(y,7.0)*termA - 16.0*y*termB,
+		64.0*pow(z,7.0)*termA - 16.0*z*termB
+	);
+}
+
+
+
+
+// [CPSC.86] Implicit Custom and Implicit Custom Gradient Functions.
+double implicitCustom(double x, double y, double z)
+{
+	return 		12.0*x*pow((2.0*x*x + y * y + z * z - 1.0), 2.0) - 0.2*x*z*z*z + 
+				6.0*y*pow((2.0*x*x + y * y + z * z - 1.0), 2.0) + 
+				6.0*z*pow((2.0*x*x + y * y + z * z - 1.0), 2.0);
+
+}
+
+
+
+const ImplicitShape implicitShapes[IMPLICIT_SHAPE_COUNT] =
+{
+    { "sphere",  implicitSphere,      implicitSphereGrad },
+    { "heart",   implicitHeart,       implicitHeartGrad },
+    { "whiffle", implicitWhiffleCube, implicitWhiffleCubeGrad },
+    { "custom",  implicitCustom,      0 },
+};
+
+const ImplicitShape* findImplicitShape(const char* a_name)
+{
+    for (int i = 0; i < IMPLICIT_SHAPE_COUNT; ++i)
+        if (strcmp(implicitShapes[i].name, a_name) == 0)
+            return &implicitShapes[i];
+
+    return 0;
+}
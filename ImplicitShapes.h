@@ -0,0 +1,60 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    The implicit surface functions (and their gradients) that can be
+    rendered by ImplicitMesh, shared by the interactive application and
+    the headless tools.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#ifndef IMPLICITSHAPES_H
+#define IMPLICITSHAPES_H
+
+#include "chai3d.h"
+
+// [CPSC.86] Implicit Sphere and Implicit Sphere Gradient Functions.
+double implicitSphere(double x, double y, double z);
+chai3d::cVector3d implicitSphereGrad(double x, double y, double z);
+
+// [CPSC.86] Implicit Heart and Implicit Heart Gradient Functions.
+double implicitHeart(double x, double y, double z);
+chai3d::cVector3d implicitHeartGrad(double x, double y, double z);
+
+//! Least ratio of f / |grad f| to the distance from the box [-1, 1]^3 of the
+//! sphere, and [-1.5, 1.5]^3 of the heart, outside it (see CSGNode.h).  The
+//! sphere's is (d + 1) / 2d of the distance d - 1 from the sphere; the
+//! heart's tends to 0.157 far away, where it grows as a sextic.
+#define IMPLICIT_SPHERE_DISTANCE_RATIO 0.5
+#define IMPLICIT_HEART_DISTANCE_RATIO 0.15
+
+// [CPSC.86] Implicit Whiffle Cube and Implicit Whiffle Cube Gradient Functions.
+double implicitWhiffleCube(double x, double y, double z);
+chai3d::cVector3d implicitWhiffleCubeGrad(double x, double y, double z);
+
+// [CPSC.86] Implicit Custom Function.
+double implicitCustom(double x, double y, double z);
+
+//! A named implicit shape with the gradient it is rendered with.
+struct ImplicitShape
+{
+    const char* name;
+    double (*function)(double, double, double);
+
+    //! NULL for shapes whose gradient is estimated (see GradientEstimator.h).
+    chai3d::cVector3d (*gradient)(double, double, double);
+};
+
+//! Number of entries in implicitShapes.
+#define IMPLICIT_SHAPE_COUNT 4
+
+//! All built-in shapes: "sphere", "heart", "whiffle" and "custom".
+extern const ImplicitShape implicitShapes[IMPLICIT_SHAPE_COUNT];
+
+//! Look up a built-in shape by name. Returns NULL if there is none.
+const ImplicitShape* findImplicitShape(const char* a_name);
+
+#endif
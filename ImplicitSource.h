@@ -0,0 +1,125 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    The scalar field that ImplicitMesh renders haptically.  A source is
+    anything that can be evaluated (with its gradient) at a point, f < 0
+    being inside and f > 0 outside: a closed-form C function, or a field
+    sampled from one ahead of time.
+
+    Sources are queried from the haptic thread, so value() and gradient()
+    must not allocate or block.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#ifndef IMPLICITSOURCE_H
+#define IMPLICITSOURCE_H
+
+#include "chai3d.h"
+#include "GradientEstimator.h"
+
+class ImplicitSource
+{
+public:
+    virtual ~ImplicitSource() {}
+
+    //! Value of the field at a_point.
+    virtual double value(const chai3d::cVector3d& a_point) const = 0;
+
+    //! Gradient of the field at a_point.
+    virtual chai3d::cVector3d gradient(const chai3d::cVector3d& a_point) const = 0;
+
+    //! Value and gradient at a_point together, for sources that share work between them.
+    virtual double evaluate(const chai3d::cVector3d& a_point, chai3d::cVector3d& a_gradient) const
+    {
+        a_gradient = gradient(a_point);
+        return value(a_point);
+    }
+
+    //! Values at a_count points given coordinate by coordinate, for callers
+    //! with many points at once; sources that can evaluate them together
+    //! (such as ExpressionSource) do so faster than point by point.
+    virtual void valueBatch(const double* a_x, const double* a_y, const double* a_z, int a_count,
+                            double* a_values) const
+    {
+        for (int n = 0; n < a_count; ++n)
+            a_values[n] = value(chai3d::cVector3d(a_x[n], a_y[n], a_z[n]));
+    }
+
+    //! Values and gradients at a_count points, the gradients coordinate by
+    //! coordinate too, or values only if a_gx, a_gy and a_gz are NULL.
+    virtual void evaluateBatch(const double* a_x, const double* a_y, const double* a_z, int a_count,
+                               double* a_values, double* a_gx = 0, double* a_gy = 0, double* a_gz = 0) const
+    {
+        if (!a_gx || !a_gy || !a_gz)
+        {
+            valueBatch(a_x, a_y, a_z, a_count, a_values);
+            return;
+        }
+        for (int n = 0; n < a_count; ++n)
+        {
+            chai3d::cVector3d g;
+            a_values[n] = evaluate(chai3d::cVector3d(a_x[n], a_y[n], a_z[n]), g);
+            a_gx[n] = g.x();
+            a_gy[n] = g.y();
+            a_gz[n] = g.z();
+        }
+    }
+
+    //! Hint that queries will soon be made around a_point.  Called from the
+    //! haptic thread with each proxy position, so it must only record the
+    //! request; sources backed by slow storage act on it elsewhere.
+    virtual void prefetch(const chai3d::cVector3d& /*a_point*/) const {}
+};
+
+//===========================================================================
+/*
+    A source backed by a pair of closed-form C functions, such as the
+    shapes in ImplicitShapes.h.  Without a gradient function, the gradient
+    is estimated from the function (see GradientEstimator.h).
+*/
+//===========================================================================
+class FunctionSource : public ImplicitSource
+{
+public:
+    FunctionSource() : m_function(0), m_gradient(0) {}
+
+    FunctionSource(double (*f)(double, double, double),
+                   chai3d::cVector3d (*g)(double, double, double))
+        : m_function(f), m_gradient(g) {}
+
+    virtual double value(const chai3d::cVector3d& a_point) const
+    {
+        return m_function(a_point.x(), a_point.y(), a_point.z());
+    }
+
+    virtual chai3d::cVector3d gradient(const chai3d::cVector3d& a_point) const
+    {
+        if (!m_gradient)
+            return estimateGradient(m_function, a_point, value(a_point));
+        return m_gradient(a_point.x(), a_point.y(), a_point.z());
+    }
+
+    virtual double evaluate(const chai3d::cVector3d& a_point, chai3d::cVector3d& a_gradient) const
+    {
+        double f = value(a_point);
+        a_gradient = m_gradient ? m_gradient(a_point.x(), a_point.y(), a_point.z())
+                                : estimateGradient(m_function, a_point, f);
+        return f;
+    }
+
+    virtual void valueBatch(const double* a_x, const double* a_y, const double* a_z, int a_count,
+                            double* a_values) const
+    {
+        for (int n = 0; n < a_count; ++n)
+            a_values[n] = m_function(a_x[n], a_y[n], a_z[n]);
+    }
+
+    double (*m_function)(double, double, double);
+    chai3d::cVector3d (*m_gradient)(double, double, double);
+};
+
+#endif
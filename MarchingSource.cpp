@@ -111,6 +111,9 @@ GLvoid vMarchingCubes();
 GLvoid vMarchCube1(GLfloat fX, GLfloat fY, GLfloat fZ, GLfloat fScale);
 GLvoid vMarchCube2(GLfloat fX, GLfloat fY, GLfloat fZ, GLfloat fScale);
 GLvoid (*vMarchCube)(GLfloat fX, GLfloat fY, GLfloat fZ, GLfloat fScale) = vMarchCube1;
+GLvoid vMarchCubeValues(GLfloat fX, GLfloat fY, GLfloat fZ, GLfloat fScale,
+                        const GLfloat afCubeValue[8],
+                        GLint &iTriCount, GLfloat *afVertices);
 
 /*
 int main_mc(int argc, char **argv)
@@ -699,15 +702,8 @@ GLvoid vMarchCubeCustom(GLfloat fX, GLfloat fY, GLfloat fZ, GLfloat fScale,
                         double (*f)(double, double, double),
                         GLint &iTriCount, GLfloat *afVertices)
 {
-    extern GLint aiCubeEdgeFlags[256];
-    extern GLint a2iTriangleConnectionTable[256][16];
-
-    GLint iCorner, iVertex, iVertexTest, iEdge, iTriangle, iFlagIndex, iEdgeFlags;
-    GLfloat fOffset;
-    GLvector sColor;
+    GLint iVertex;
     GLfloat afCubeValue[8];
-    GLvector asEdgeVertex[12];
-    GLvector asEdgeNorm[12];
 
     //Make a local copy of the values at the cube's corners
     for(iVertex = 0; iVertex < 8; iVertex++)
@@ -717,6 +713,23 @@ GLvoid vMarchCubeCustom(GLfloat fX, GLfloat fY, GLfloat fZ, GLfloat fScale,
                                  fZ + a2fVertexOffset[iVertex][2]*fScale);
     }
 
+    vMarchCubeValues(fX, fY, fZ, fScale, afCubeValue, iTriCount, afVertices);
+}
+
+// vMarchCubeValues is the same as vMarchCubeCustom, but takes the function
+// values at the cube's corners (in the corner order of a2fVertexOffset)
+// instead of evaluating them, so that a lattice sampled once can be reused.
+GLvoid vMarchCubeValues(GLfloat fX, GLfloat fY, GLfloat fZ, GLfloat fScale,
+                        const GLfloat afCubeValue[8],
+                        GLint &iTriCount, GLfloat *afVertices)
+{
+    extern GLint aiCubeEdgeFlags[256];
+    extern GLint a2iTriangleConnectionTable[256][16];
+
+    GLint iCorner, iVertex, iVertexTest, iEdge, iTriangle, iFlagIndex, iEdgeFlags;
+    GLfloat fOffset;
+    GLvector asEdgeVertex[12];
+
     //Find which vertices are inside of the surface and which are outside
     iFlagIndex = 0;
     for(iVertexTest = 0; iVertexTest < 8; iVertexTest++)
@@ -18,4 +18,12 @@ GLvoid vMarchCubeCustom(GLfloat fX, GLfloat fY, GLfloat fZ, GLfloat fScale,
                         double (*f)(double, double, double),
                         GLint &iTriCount, GLfloat *afVertices);
 
+// vMarchCubeValues does the same from the values already sampled at the
+// cell's eight corners, ordered (0,0,0) (1,0,0) (1,1,0) (0,1,0) and then
+// the same four at z = 1.
+
+GLvoid vMarchCubeValues(GLfloat fX, GLfloat fY, GLfloat fZ, GLfloat fScale,
+                        const GLfloat afCubeValue[8],
+                        GLint &iTriCount, GLfloat *afVertices);
+
 #endif
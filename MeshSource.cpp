@@ -0,0 +1,502 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    Triangle mesh as a signed distance implicit surface.  See MeshSource.h.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#include "MeshSource.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+
+using namespace chai3d;
+using namespace std;
+
+//! Triangles per leaf of the hierarchy.
+#define MESH_LEAF_TRIANGLES 4
+
+//! A node is summed as a dipole when the query point is farther than this
+//! many times its radius from its centroid.
+#define MESH_DIPOLE_DISTANCE 2.0
+
+
+MeshSource::MeshSource()
+    : m_buildSeconds(0.0), m_loadSeconds(0.0)
+{
+}
+
+//---------------------------------------------------------------------------
+// Append a triangle, skipping degenerate ones (they have no inside, and
+// no well defined closest point).
+//---------------------------------------------------------------------------
+static void addTriangle(const vector<cVector3d>& a_vertices, vector<int>& a_triangles, int a, int b, int c)
+{
+    int count = (int)a_vertices.size();
+    if (a < 0 || b < 0 || c < 0 || a >= count || b >= count || c >= count)
+        return;
+
+    cVector3d normal = (a_vertices[b] - a_vertices[a]).cross(a_vertices[c] - a_vertices[a]);
+    if (normal.lengthsq() == 0.0)
+        return;
+
+    a_triangles.push_back(a);
+    a_triangles.push_back(b);
+    a_triangles.push_back(c);
+}
+
+//---------------------------------------------------------------------------
+// Vertex index of an OBJ face token ("v", "v/vt", "v//vn" or "v/vt/vn"),
+// where negative indices count back from the last vertex read.
+//---------------------------------------------------------------------------
+static int objIndex(const char* a_token, int a_vertexCount)
+{
+    int index = atoi(a_token);
+    return (index < 0) ? a_vertexCount + index : index - 1;
+}
+
+bool MeshSource::loadOBJ(const string& a_fileName)
+{
+    FILE* file = fopen(a_fileName.c_str(), "r");
+    if (!file)
+        return false;
+
+    vector<cVector3d> vertices;
+    vector<int> triangles;
+    vector<int> face;
+    char line[1024];
+
+    while (fgets(line, sizeof(line), file))
+    {
+        if (line[0] == 'v' && line[1] == ' ')
+        {
+            double x, y, z;
+            if (sscanf(line + 2, "%lf %lf %lf", &x, &y, &z) == 3)
+                vertices.push_back(cVector3d(x, y, z));
+        }
+        else if (line[0] == 'f' && line[1] == ' ')
+        {
+            // split the polygon into a fan around its first vertex
+            face.clear();
+            for (char* token = strtok(line + 2, " \t\r\n"); token; token = strtok(0, " \t\r\n"))
+                face.push_back(objIndex(token, (int)vertices.size()));
+            for (size_t n = 2; n < face.size(); ++n)
+                addTriangle(vertices, triangles, face[0], face[n-1], face[n]);
+        }
+    }
+    fclose(file);
+
+    if (triangles.empty())
+        return false;
+
+    m_vertices.swap(vertices);
+    m_triangles.swap(triangles);
+    buildHierarchy();
+    return true;
+}
+
+bool MeshSource::loadSTL(const string& a_fileName)
+{
+    FILE* file = fopen(a_fileName.c_str(), "rb");
+    if (!file)
+        return false;
+
+    vector<cVector3d> vertices;
+    vector<int> triangles;
+
+    // a binary file is an 80 byte header, a triangle count, and 50 bytes per triangle
+    fseek(file, 0, SEEK_END);
+    long fileSize = ftell(file);
+    fseek(file, 80, SEEK_SET);
+    uint32_t count = 0;
+    bool binary = fread(&count, 4, 1, file) == 1 && fileSize == 84 + 50 * (long)count;
+
+    if (binary)
+    {
+        unsigned char record[50];
+        for (uint32_t t = 0; t < count && fread(record, 50, 1, file) == 1; ++t)
+        {
+            // skip the facet normal, which is often wrong, and the attribute bytes
+            float v[9];
+            memcpy(v, record + 12, sizeof(v));
+            int first = (int)vertices.size();
+            for (int n = 0; n < 3; ++n)
+                vertices.push_back(cVector3d(v[3*n], v[3*n+1], v[3*n+2]));
+            addTriangle(vertices, triangles, first, first + 1, first + 2);
+        }
+    }
+    else
+    {
+        fseek(file, 0, SEEK_SET);
+        char line[1024];
+        int corners = 0;
+        while (fgets(line, sizeof(line), file))
+        {
+            double x, y, z;
+            if (sscanf(line, " vertex %lf %lf %lf", &x, &y, &z) != 3)
+                continue;
+            vertices.push_back(cVector3d(x, y, z));
+            if (++corners % 3 == 0)
+            {
+                int first = (int)vertices.size() - 3;
+                addTriangle(vertices, triangles, first, first + 1, first + 2);
+            }
+        }
+    }
+    fclose(file);
+
+    if (triangles.empty())
+        return false;
+
+    m_vertices.swap(vertices);
+    m_triangles.swap(triangles);
+    buildHierarchy();
+    return true;
+}
+
+bool MeshSource::load(const string& a_fileName)
+{
+    size_t dot = a_fileName.find_last_of('.');
+    string extension = (dot == string::npos) ? "" : a_fileName.substr(dot + 1);
+    for (size_t n = 0; n < extension.size(); ++n)
+        extension[n] = (char)tolower(extension[n]);
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    bool loaded = false;
+    if (extension == "obj")
+        loaded = loadOBJ(a_fileName);
+    else if (extension == "stl")
+        loaded = loadSTL(a_fileName);
+    m_loadSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return loaded;
+}
+
+void MeshSource::getBounds(cVector3d& a_lower, cVector3d& a_upper) const
+{
+    if (m_nodes.empty())
+    {
+        a_lower.zero();
+        a_upper.zero();
+        return;
+    }
+    a_lower = m_nodes[0].m_lower;
+    a_upper = m_nodes[0].m_upper;
+}
+
+void MeshSource::fitToBox(double a_halfExtent)
+{
+    if (m_vertices.empty())
+        return;
+
+    cVector3d lower = m_vertices[0], upper = m_vertices[0];
+    for (size_t n = 1; n < m_vertices.size(); ++n)
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            lower(axis) = cMin(lower(axis), m_vertices[n](axis));
+            upper(axis) = cMax(upper(axis), m_vertices[n](axis));
+        }
+
+    cVector3d extent = upper - lower;
+    double longest = cMax(extent.x(), cMax(extent.y(), extent.z()));
+    double scale = (longest > 0.0) ? 2.0 * a_halfExtent / longest : 1.0;
+    cVector3d centre = 0.5 * (lower + upper);
+
+    for (size_t n = 0; n < m_vertices.size(); ++n)
+        m_vertices[n] = scale * (m_vertices[n] - centre);
+
+    buildHierarchy();
+}
+
+//===========================================================================
+/*!
+    Build the bounding volume hierarchy over the triangles, splitting each
+    node at the median centre along its longest axis.  The triangles are
+    reordered so that each leaf covers a contiguous range of them.
+*/
+//===========================================================================
+void MeshSource::buildHierarchy()
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    int count = getTriangleCount();
+    vector<cVector3d> centres(count);
+    vector<int> order(count);
+    for (int t = 0; t < count; ++t)
+    {
+        const cVector3d& a = m_vertices[m_triangles[3*t]];
+        const cVector3d& b = m_vertices[m_triangles[3*t+1]];
+        const cVector3d& c = m_vertices[m_triangles[3*t+2]];
+        centres[t] = (a + b + c) / 3.0;
+        order[t] = t;
+    }
+
+    m_nodes.clear();
+    m_nodes.reserve(2 * (count / MESH_LEAF_TRIANGLES + 1));
+    if (count > 0)
+        buildNode(0, count, order, centres);
+
+    // store the triangles in leaf order, with their normals
+    vector<int> triangles(m_triangles.size());
+    m_normals.resize(count);
+    for (int t = 0; t < count; ++t)
+    {
+        for (int n = 0; n < 3; ++n)
+            triangles[3*t + n] = m_triangles[3*order[t] + n];
+        const cVector3d& a = m_vertices[triangles[3*t]];
+        m_normals[t] = (m_vertices[triangles[3*t+1]] - a).cross(m_vertices[triangles[3*t+2]] - a);
+        m_normals[t].normalize();
+    }
+    m_triangles.swap(triangles);
+
+    m_buildSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int MeshSource::buildNode(int a_first, int a_count, vector<int>& a_order, const vector<cVector3d>& a_centres)
+{
+    int index = (int)m_nodes.size();
+    m_nodes.push_back(Node());
+
+    Node node;
+    node.m_first = a_first;
+    node.m_count = a_count;
+    node.m_left = node.m_right = -1;
+
+    // bounds, and the area-weighted normal and centroid of the dipole
+    double area = 0.0;
+    node.m_normal.zero();
+    node.m_centroid.zero();
+    node.m_lower = node.m_upper = m_vertices[m_triangles[3*a_order[a_first]]];
+    for (int t = a_first; t < a_first + a_count; ++t)
+    {
+        const int* v = &m_triangles[3*a_order[t]];
+        cVector3d normal = 0.5 * (m_vertices[v[1]] - m_vertices[v[0]]).cross(m_vertices[v[2]] - m_vertices[v[0]]);
+        double triangleArea = normal.length();
+        node.m_normal += normal;
+        node.m_centroid += triangleArea * a_centres[a_order[t]];
+        area += triangleArea;
+
+        for (int n = 0; n < 3; ++n)
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                node.m_lower(axis) = cMin(node.m_lower(axis), m_vertices[v[n]](axis));
+                node.m_upper(axis) = cMax(node.m_upper(axis), m_vertices[v[n]](axis));
+            }
+    }
+    node.m_centroid *= 1.0 / area;
+
+    node.m_radius = 0.0;
+    for (int t = a_first; t < a_first + a_count; ++t)
+        for (int n = 0; n < 3; ++n)
+            node.m_radius = cMax(node.m_radius, (m_vertices[m_triangles[3*a_order[t] + n]] - node.m_centroid).length());
+
+    if (a_count > MESH_LEAF_TRIANGLES)
+    {
+        cVector3d extent = node.m_upper - node.m_lower;
+        int axis = (extent.x() > extent.y()) ? ((extent.x() > extent.z()) ? 0 : 2)
+                                             : ((extent.y() > extent.z()) ? 1 : 2);
+        int half = a_count / 2;
+        nth_element(a_order.begin() + a_first, a_order.begin() + a_first + half, a_order.begin() + a_first + a_count,
+                    [&](int a, int b) { return a_centres[a](axis) < a_centres[b](axis); });
+
+        node.m_left = buildNode(a_first, half, a_order, a_centres);
+        node.m_right = buildNode(a_first + half, a_count - half, a_order, a_centres);
+    }
+
+    m_nodes[index] = node;
+    return index;
+}
+
+//---------------------------------------------------------------------------
+// Closest point to p on triangle abc (Ericson, Real-Time Collision
+// Detection, 5.1.5), by the Voronoi region p falls into.
+//---------------------------------------------------------------------------
+static cVector3d closestOnTriangle(const cVector3d& p, const cVector3d& a, const cVector3d& b, const cVector3d& c)
+{
+    cVector3d ab = b - a, ac = c - a, ap = p - a;
+    double d1 = ab.dot(ap), d2 = ac.dot(ap);
+    if (d1 <= 0.0 && d2 <= 0.0)
+        return a;
+
+    cVector3d bp = p - b;
+    double d3 = ab.dot(bp), d4 = ac.dot(bp);
+    if (d3 >= 0.0 && d4 <= d3)
+        return b;
+
+    double vc = d1*d4 - d3*d2;
+    if (vc <= 0.0 && d1 >= 0.0 && d3 <= 0.0)
+        return a + (d1 / (d1 - d3)) * ab;
+
+    cVector3d cp = p - c;
+    double d5 = ab.dot(cp), d6 = ac.dot(cp);
+    if (d6 >= 0.0 && d5 <= d6)
+        return c;
+
+    double vb = d5*d2 - d1*d6;
+    if (vb <= 0.0 && d2 >= 0.0 && d6 <= 0.0)
+        return a + (d2 / (d2 - d6)) * ac;
+
+    double va = d3*d6 - d5*d4;
+    if (va <= 0.0 && (d4 - d3) >= 0.0 && (d5 - d6) >= 0.0)
+        return b + ((d4 - d3) / ((d4 - d3) + (d5 - d6))) * (c - b);
+
+    double denom = 1.0 / (va + vb + vc);
+    return a + (vb * denom) * ab + (vc * denom) * ac;
+}
+
+//---------------------------------------------------------------------------
+// Squared distance from p to the box [lower, upper] (0 inside it).
+//---------------------------------------------------------------------------
+static inline double boxDistanceSq(const cVector3d& p, const cVector3d& lower, const cVector3d& upper)
+{
+    double d = 0.0;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        double e = cMax(lower(axis) - p(axis), 0.0) + cMax(p(axis) - upper(axis), 0.0);
+        d += e*e;
+    }
+    return d;
+}
+
+double MeshSource::closestPoint(const cVector3d& a_point, cVector3d& a_closest, int& a_triangle) const
+{
+    double bestSq = 1e300;
+    a_closest = a_point;
+    a_triangle = -1;
+    if (!m_nodes.empty())
+        closestPoint(0, a_point, bestSq, a_closest, a_triangle);
+    return sqrt(bestSq);
+}
+
+void MeshSource::closestPoint(int a_node, const cVector3d& a_point, double& a_bestSq,
+                              cVector3d& a_closest, int& a_triangle) const
+{
+    const Node& node = m_nodes[a_node];
+    if (node.m_left < 0)
+    {
+        for (int t = node.m_first; t < node.m_first + node.m_count; ++t)
+        {
+            const int* v = &m_triangles[3*t];
+            cVector3d closest = closestOnTriangle(a_point, m_vertices[v[0]], m_vertices[v[1]], m_vertices[v[2]]);
+            double distanceSq = (a_point - closest).lengthsq();
+            if (distanceSq < a_bestSq)
+            {
+                a_bestSq = distanceSq;
+                a_closest = closest;
+                a_triangle = t;
+            }
+        }
+        return;
+    }
+
+    // visit the nearer child first, so the farther one is more often pruned
+    int first = node.m_left, second = node.m_right;
+    double firstSq = boxDistanceSq(a_point, m_nodes[first].m_lower, m_nodes[first].m_upper);
+    double secondSq = boxDistanceSq(a_point, m_nodes[second].m_lower, m_nodes[second].m_upper);
+    if (secondSq < firstSq)
+    {
+        swap(first, second);
+        swap(firstSq, secondSq);
+    }
+
+    if (firstSq < a_bestSq)
+        closestPoint(first, a_point, a_bestSq, a_closest, a_triangle);
+    if (secondSq < a_bestSq)
+        closestPoint(second, a_point, a_bestSq, a_closest, a_triangle);
+}
+
+double MeshSource::windingNumber(const cVector3d& a_point) const
+{
+    return m_nodes.empty() ? 0.0 : windingNumber(0, a_point) / (4.0 * C_PI);
+}
+
+//---------------------------------------------------------------------------
+// Solid angle subtended at a_point by the triangles below a node.
+//---------------------------------------------------------------------------
+double MeshSource::windingNumber(int a_node, const cVector3d& a_point) const
+{
+    const Node& node = m_nodes[a_node];
+
+    // far away, the triangles look like one dipole at their centroid
+    cVector3d r = node.m_centroid - a_point;
+    double distance = r.length();
+    if (distance > MESH_DIPOLE_DISTANCE * node.m_radius)
+        return node.m_normal.dot(r) / (distance * distance * distance);
+
+    if (node.m_left >= 0)
+        return windingNumber(node.m_left, a_point) + windingNumber(node.m_right, a_point);
+
+    // exact solid angle of each triangle (Van Oosterom and Strackee)
+    double angle = 0.0;
+    for (int t = node.m_first; t < node.m_first + node.m_count; ++t)
+    {
+        const int* v = &m_triangles[3*t];
+        cVector3d a = m_vertices[v[0]] - a_point;
+        cVector3d b = m_vertices[v[1]] - a_point;
+        cVector3d c = m_vertices[v[2]] - a_point;
+        double la = a.length(), lb = b.length(), lc = c.length();
+        double numerator = a.dot(b.cross(c));
+        double denominator = la*lb*lc + a.dot(b)*lc + b.dot(c)*la + c.dot(a)*lb;
+        angle += 2.0 * atan2(numerator, denominator);
+    }
+    return angle;
+}
+
+double MeshSource::evaluate(const cVector3d& a_point, cVector3d& a_gradient) const
+{
+    cVector3d closest;
+    int triangle;
+    double distance = closestPoint(a_point, closest, triangle);
+    if (triangle < 0)
+    {
+        a_gradient.zero();
+        return 0.0;
+    }
+
+    double sign = (windingNumber(a_point) > 0.5) ? -1.0 : 1.0;
+
+    // on the surface itself, the gradient is the normal of the triangle
+    if (distance > 1e-12)
+        a_gradient = (sign / distance) * (a_point - closest);
+    else
+        a_gradient = m_normals[triangle];
+    return sign * distance;
+}
+
+double MeshSource::value(const cVector3d& a_point) const
+{
+    cVector3d gradient;
+    return evaluate(a_point, gradient);
+}
+
+cVector3d MeshSource::gradient(const cVector3d& a_point) const
+{
+    cVector3d gradient;
+    evaluate(a_point, gradient);
+    return gradient;
+}
+
+uint64_t MeshSource::getKey() const
+{
+    // FNV-1a over the vertex coordinates of every triangle
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t n = 0; n < m_triangles.size(); ++n)
+    {
+        const cVector3d& v = m_vertices[m_triangles[n]];
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            double coordinate = v(axis);
+            unsigned char bytes[sizeof(double)];
+            memcpy(bytes, &coordinate, sizeof(bytes));
+            for (size_t b = 0; b < sizeof(bytes); ++b)
+                hash = (hash ^ bytes[b]) * 1099511628211ull;
+        }
+    }
+    return hash;
+}
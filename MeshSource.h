@@ -0,0 +1,113 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    A triangle mesh (OBJ or STL) used as an implicit surface: the signed
+    distance to its triangles.  The distance is found through a bounding
+    volume hierarchy, visiting the nearer child first and skipping boxes
+    farther than the best triangle so far.
+
+    The sign comes from the generalised winding number, so meshes with
+    small holes or flipped triangles still have a sensible inside.  Far
+    from a node, its triangles are summed as a single dipole (the fast
+    winding number approximation) instead of one solid angle each.
+
+    The exact distance is costly to query at haptic rates, so the mesh is
+    normally sampled into a SampledField first, near its surface only.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#ifndef MESHSOURCE_H
+#define MESHSOURCE_H
+
+#include "ImplicitSource.h"
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+class MeshSource : public ImplicitSource
+{
+public:
+    MeshSource();
+
+    //! Load a Wavefront OBJ file (polygons are split into fans).
+    bool loadOBJ(const std::string& a_fileName);
+
+    //! Load an STL file, binary or ASCII.
+    bool loadSTL(const std::string& a_fileName);
+
+    //! Load an OBJ or STL file, by extension.
+    bool load(const std::string& a_fileName);
+
+    //! Number of triangles loaded.
+    int getTriangleCount() const { return (int)m_triangles.size() / 3; }
+
+    //! Centre the mesh on the origin and scale its longest side to 2 * a_halfExtent.
+    void fitToBox(double a_halfExtent);
+
+    //! Box around all vertices.
+    void getBounds(chai3d::cVector3d& a_lower, chai3d::cVector3d& a_upper) const;
+
+    //! Closest point of the mesh to a_point, and the triangle it lies on.
+    double closestPoint(const chai3d::cVector3d& a_point, chai3d::cVector3d& a_closest, int& a_triangle) const;
+
+    //! Generalised winding number of the mesh around a_point (1 inside, 0 outside).
+    double windingNumber(const chai3d::cVector3d& a_point) const;
+
+    virtual double value(const chai3d::cVector3d& a_point) const;
+    virtual chai3d::cVector3d gradient(const chai3d::cVector3d& a_point) const;
+    virtual double evaluate(const chai3d::cVector3d& a_point, chai3d::cVector3d& a_gradient) const;
+
+    //! Hash of the (transformed) triangles, to key a cached sampling of this mesh.
+    uint64_t getKey() const;
+
+    //! Seconds taken to build the hierarchy after the last load or fit.
+    double getBuildSeconds() const { return m_buildSeconds; }
+
+    //! Seconds the last load() took, reading the file and building the hierarchy.
+    double getLoadSeconds() const { return m_loadSeconds; }
+
+private:
+    struct Node
+    {
+        //! Bounds of the triangles below the node.
+        chai3d::cVector3d m_lower;
+        chai3d::cVector3d m_upper;
+
+        //! Area-weighted normal sum and area centroid of the triangles,
+        //! and the radius around the centroid that holds them all.
+        chai3d::cVector3d m_normal;
+        chai3d::cVector3d m_centroid;
+        double m_radius;
+
+        //! Children (leaf if m_left < 0), or the triangle range of a leaf.
+        int m_left;
+        int m_right;
+        int m_first;
+        int m_count;
+    };
+
+    void buildHierarchy();
+    int buildNode(int a_first, int a_count, std::vector<int>& a_order,
+                  const std::vector<chai3d::cVector3d>& a_centres);
+    void closestPoint(int a_node, const chai3d::cVector3d& a_point, double& a_bestSq,
+                      chai3d::cVector3d& a_closest, int& a_triangle) const;
+    double windingNumber(int a_node, const chai3d::cVector3d& a_point) const;
+
+    std::vector<chai3d::cVector3d> m_vertices;
+
+    //! Three vertex indices per triangle, reordered so every leaf is a range.
+    std::vector<int> m_triangles;
+
+    //! Unit normal of every triangle.
+    std::vector<chai3d::cVector3d> m_normals;
+
+    std::vector<Node> m_nodes;
+    double m_buildSeconds;
+    double m_loadSeconds;
+};
+
+#endif
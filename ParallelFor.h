@@ -0,0 +1,51 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    A minimal parallel loop for the offline work done before rendering
+    starts (sampling fields, fitting surfaces).  Never call it from the
+    haptic thread: it starts and joins threads.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#ifndef PARALLELFOR_H
+#define PARALLELFOR_H
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+//! Number of threads to use for a requested count, 0 meaning one per core.
+inline int parallelThreadCount(int a_threads)
+{
+    if (a_threads > 0)
+        return a_threads;
+    int cores = (int)std::thread::hardware_concurrency();
+    return (cores > 0) ? cores : 1;
+}
+
+//! Run a_body(n, worker) for n in [0, a_count) on a_threads threads.  Work
+//! is handed out one item at a time, and a_body can keep per-worker state
+//! indexed by its second argument (0 to a_threads - 1).
+template <class Body>
+void parallelFor(int a_count, int a_threads, const Body& a_body)
+{
+    std::atomic<int> next(0);
+    auto work = [&](int a_worker)
+    {
+        for (int n = next++; n < a_count; n = next++)
+            a_body(n, a_worker);
+    };
+
+    std::vector<std::thread> workers;
+    for (int w = 1; w < a_threads; ++w)
+        workers.push_back(std::thread(work, w));
+    work(0);
+    for (size_t w = 0; w < workers.size(); ++w)
+        workers[w].join();
+}
+
+#endif
@@ -0,0 +1,489 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    Implicit shapes loaded from plugins.  See PluginSource.h.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#include "PluginSource.h"
+#include "ImplicitMesh.h"
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <math.h>
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#include <unistd.h>
+#endif
+
+using namespace chai3d;
+using namespace std;
+
+
+namespace
+{
+
+// modification stamp of a file, or 0 if it does not exist; to the
+// nanosecond (100 ns on Windows), as a rebuild may well rewrite the file
+// within the second it was last written in, and at the same size
+long long fileStamp(const string& a_path)
+{
+#if defined(_WIN32)
+    WIN32_FILE_ATTRIBUTE_DATA info;
+    if (!GetFileAttributesExA(a_path.c_str(), GetFileExInfoStandard, &info))
+        return 0;
+    unsigned long long written = ((unsigned long long)info.ftLastWriteTime.dwHighDateTime << 32) |
+                                 info.ftLastWriteTime.dwLowDateTime;
+    unsigned long long size = ((unsigned long long)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+#else
+    struct stat info;
+    if (stat(a_path.c_str(), &info) != 0)
+        return 0;
+#if defined(__APPLE__)
+    const struct timespec& time = info.st_mtimespec;
+#else
+    const struct timespec& time = info.st_mtim;
+#endif
+    unsigned long long written = (unsigned long long)time.tv_sec * 1000000000ull + time.tv_nsec;
+    unsigned long long size = (unsigned long long)info.st_size;
+#endif
+    return (long long)((written * 31) ^ size);
+}
+
+double steadySeconds()
+{
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+string describePoint(const cVector3d& a_point)
+{
+    char text[96];
+    snprintf(text, sizeof(text), "(%g, %g, %g)", a_point.x(), a_point.y(), a_point.z());
+    return text;
+}
+
+// a loaded plugin seen as a source, to mesh it before it is published
+class LibrarySource : public ImplicitSource
+{
+public:
+    LibrarySource(const ImplicitPluginLibrary& a_library) : m_library(a_library) {}
+
+    virtual double value(const cVector3d& a_point) const { return m_library.value(a_point); }
+
+    virtual cVector3d gradient(const cVector3d& a_point) const
+    {
+        cVector3d g;
+        m_library.evaluate(a_point, g);
+        return g;
+    }
+
+    virtual double evaluate(const cVector3d& a_point, cVector3d& a_gradient) const
+    {
+        return m_library.evaluate(a_point, a_gradient);
+    }
+
+private:
+    const ImplicitPluginLibrary& m_library;
+};
+
+} // namespace
+
+//------------------------------------------------------------------------------
+
+ImplicitPluginLibrary* ImplicitPluginLibrary::open(const string& a_path, string& a_error)
+{
+    // a library already loaded from a path is returned again by the loader
+    // rather than read anew, so each version is loaded from a copy of its own
+    static unsigned int loads = 0;
+    string copy = a_path + "." + to_string(++loads) + ".live";
+
+    // and named by a path, as the loader looks a bare name up in its
+    // search path instead of the current directory
+#if defined(_WIN32)
+    if (copy.find_first_of("/\\:") == string::npos)
+        copy = ".\\" + copy;
+#else
+    if (copy.find('/') == string::npos)
+        copy = "./" + copy;
+#endif
+    {
+        ifstream source(a_path.c_str(), ios::binary);
+        ofstream target(copy.c_str(), ios::binary | ios::trunc);
+        if (!source || !target || !(target << source.rdbuf()))
+        {
+            a_error = "cannot copy " + a_path + " to " + copy;
+            remove(copy.c_str());
+            return 0;
+        }
+    }
+
+    ImplicitPluginLibrary* library = new ImplicitPluginLibrary();
+    library->m_copy = copy;
+
+#if defined(_WIN32)
+    library->m_handle = (void*)LoadLibraryA(copy.c_str());
+    if (!library->m_handle)
+    {
+        a_error = "cannot load " + a_path + " (error " + to_string(GetLastError()) + ")";
+        delete library;
+        return 0;
+    }
+    ImplicitPluginEntry entry = (ImplicitPluginEntry)GetProcAddress((HMODULE)library->m_handle,
+                                                                    IMPLICIT_PLUGIN_ENTRY);
+#else
+    library->m_handle = dlopen(copy.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!library->m_handle)
+    {
+        const char* reason = dlerror();
+        a_error = "cannot load " + a_path + ": " + (reason ? reason : "unknown error");
+        delete library;
+        return 0;
+    }
+
+    // the mapping outlives the name
+    unlink(copy.c_str());
+    library->m_copy.clear();
+
+    ImplicitPluginEntry entry = (ImplicitPluginEntry)dlsym(library->m_handle, IMPLICIT_PLUGIN_ENTRY);
+#endif
+
+    if (!entry)
+    {
+        a_error = a_path + " does not export " IMPLICIT_PLUGIN_ENTRY "()";
+        delete library;
+        return 0;
+    }
+
+    library->m_info = entry();
+    if (!library->m_info || library->m_info->abi != IMPLICIT_PLUGIN_ABI || !library->m_info->value)
+    {
+        a_error = a_path + " was built for another plugin interface (expected version " +
+                  to_string(IMPLICIT_PLUGIN_ABI) + ") or has no value function";
+        delete library;
+        return 0;
+    }
+
+    return library;
+}
+
+ImplicitPluginLibrary::~ImplicitPluginLibrary()
+{
+#if defined(_WIN32)
+    if (m_handle)
+        FreeLibrary((HMODULE)m_handle);
+#else
+    if (m_handle)
+        dlclose(m_handle);
+#endif
+    if (!m_copy.empty())
+        remove(m_copy.c_str());
+}
+
+double ImplicitPluginLibrary::value(const cVector3d& a_point) const
+{
+    return m_info->value(a_point.x(), a_point.y(), a_point.z());
+}
+
+double ImplicitPluginLibrary::evaluate(const cVector3d& a_point, cVector3d& a_gradient) const
+{
+    if (!m_info->evaluate)
+    {
+        double f = value(a_point);
+        a_gradient = estimateGradient(m_info->value, a_point, f);
+        return f;
+    }
+
+    double g[3];
+    double f = m_info->evaluate(a_point.x(), a_point.y(), a_point.z(), g);
+    a_gradient.set(g[0], g[1], g[2]);
+    return f;
+}
+
+void ImplicitPluginLibrary::valueBatch(const double* a_x, const double* a_y, const double* a_z, int a_count,
+                                       double* a_values) const
+{
+    if (m_info->valueBatch)
+    {
+        m_info->valueBatch(a_x, a_y, a_z, a_count, a_values);
+        return;
+    }
+    for (int n = 0; n < a_count; ++n)
+        a_values[n] = m_info->value(a_x[n], a_y[n], a_z[n]);
+}
+
+//===========================================================================
+/*!
+    Check a plugin against itself before it is rendered.  A plugin whose
+    gradient belongs to another function, or whose box or symmetry is
+    wrong, renders a surface other than the one meshed; a value that is
+    not finite throws the proxy off the surface.  Values are compared
+    relative to their size, gradients with an estimate from the function
+    (see GradientEstimator.h).
+
+    \param  a_report  The first failure, or a summary of the plugin.
+    \return True if the plugin can be rendered.
+*/
+//===========================================================================
+bool ImplicitPluginLibrary::validate(string& a_report) const
+{
+    const ImplicitPluginInfo& info = *m_info;
+    string name = info.name ? info.name : "plugin";
+    cVector3d lower(info.lower[0], info.lower[1], info.lower[2]);
+    cVector3d upper(info.upper[0], info.upper[1], info.upper[2]);
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        if (!(upper(axis) > lower(axis)))
+        {
+            a_report = name + ": its box is empty";
+            return false;
+        }
+    }
+
+    // cell centres of a lattice over the box
+    const int samples = PLUGIN_VALIDATION_SAMPLES;
+    vector<double> xs, ys, zs, values;
+    double steepest = 0.0;
+    for (int k = 0; k < samples; ++k)
+        for (int j = 0; j < samples; ++j)
+            for (int i = 0; i < samples; ++i)
+            {
+                cVector3d t((i + 0.5) / samples, (j + 0.5) / samples, (k + 0.5) / samples);
+                cVector3d p(lower.x() + t.x() * (upper.x() - lower.x()),
+                            lower.y() + t.y() * (upper.y() - lower.y()),
+                            lower.z() + t.z() * (upper.z() - lower.z()));
+                double f = value(p);
+                if (!std::isfinite(f))
+                {
+                    a_report = name + ": the value is not finite at " + describePoint(p);
+                    return false;
+                }
+                double tolerance = 1e-9 * (1.0 + fabs(f));
+
+                cVector3d g;
+                double fused = evaluate(p, g);
+                if (!std::isfinite(g.x()) || !std::isfinite(g.y()) || !std::isfinite(g.z()))
+                {
+                    a_report = name + ": the gradient is not finite at " + describePoint(p);
+                    return false;
+                }
+                if (info.evaluate)
+                {
+                    cVector3d estimate = estimateGradient(info.value, p, f);
+                    if (fabs(fused - f) > tolerance)
+                    {
+                        a_report = name + ": evaluate() and value() disagree at " + describePoint(p);
+                        return false;
+                    }
+                    if ((g - estimate).length() > 1e-3 * cMax(estimate.length(), 1.0))
+                    {
+                        a_report = name + ": the gradient of evaluate() is not that of value() at " +
+                                   describePoint(p);
+                        return false;
+                    }
+                }
+                steepest = cMax(steepest, g.length());
+
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    if (!(info.symmetry & (1u << axis)))
+                        continue;
+                    cVector3d mirrored = p;
+                    mirrored(axis) = -mirrored(axis);
+                    if (fabs(value(mirrored) - f) > tolerance)
+                    {
+                        a_report = name + ": declared symmetric in " + string(1, (char)('x' + axis)) +
+                                   " but is not at " + describePoint(p);
+                        return false;
+                    }
+                }
+
+                xs.push_back(p.x());
+                ys.push_back(p.y());
+                zs.push_back(p.z());
+                values.push_back(f);
+            }
+
+    if (info.lipschitz > 0.0 && steepest > info.lipschitz * (1.0 + 1e-6))
+    {
+        a_report = name + ": the gradient reaches " + to_string(steepest) + ", above its Lipschitz bound of " +
+                   to_string(info.lipschitz);
+        return false;
+    }
+
+    if (info.valueBatch)
+    {
+        vector<double> batch(values.size());
+        info.valueBatch(&xs[0], &ys[0], &zs[0], (int)values.size(), &batch[0]);
+        for (size_t n = 0; n < values.size(); ++n)
+        {
+            if (!(fabs(batch[n] - values[n]) <= 1e-9 * (1.0 + fabs(values[n]))))
+            {
+                a_report = name + ": valueBatch() and value() disagree at " +
+                           describePoint(cVector3d(xs[n], ys[n], zs[n]));
+                return false;
+            }
+        }
+    }
+
+    a_report = name + ": steepest gradient " + to_string(steepest) +
+               (info.evaluate ? ", analytic gradient" : ", estimated gradient") +
+               (info.valueBatch ? ", batched" : "");
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+double PluginSource::value(const cVector3d& a_point) const
+{
+    EpochPointer<ImplicitPluginLibrary>::Reader library(m_library);
+    return library.get() ? library->value(a_point) : 1.0;
+}
+
+cVector3d PluginSource::gradient(const cVector3d& a_point) const
+{
+    cVector3d g;
+    evaluate(a_point, g);
+    return g;
+}
+
+double PluginSource::evaluate(const cVector3d& a_point, cVector3d& a_gradient) const
+{
+    EpochPointer<ImplicitPluginLibrary>::Reader library(m_library);
+    if (!library.get())
+    {
+        a_gradient.zero();
+        return 1.0;
+    }
+    return library->evaluate(a_point, a_gradient);
+}
+
+void PluginSource::valueBatch(const double* a_x, const double* a_y, const double* a_z, int a_count,
+                              double* a_values) const
+{
+    EpochPointer<ImplicitPluginLibrary>::Reader library(m_library);
+    if (library.get())
+    {
+        library->valueBatch(a_x, a_y, a_z, a_count, a_values);
+        return;
+    }
+    for (int n = 0; n < a_count; ++n)
+        a_values[n] = 1.0;
+}
+
+void PluginSource::evaluateBatch(const double* a_x, const double* a_y, const double* a_z, int a_count,
+                                 double* a_values, double* a_gx, double* a_gy, double* a_gz) const
+{
+    if (!a_gx || !a_gy || !a_gz)
+    {
+        valueBatch(a_x, a_y, a_z, a_count, a_values);
+        return;
+    }
+
+    // one pin for the whole batch, so the points cannot straddle a reload
+    EpochPointer<ImplicitPluginLibrary>::Reader library(m_library);
+    for (int n = 0; n < a_count; ++n)
+    {
+        cVector3d g(0.0, 0.0, 0.0);
+        a_values[n] = library.get() ? library->evaluate(cVector3d(a_x[n], a_y[n], a_z[n]), g) : 1.0;
+        a_gx[n] = g.x();
+        a_gy[n] = g.y();
+        a_gz[n] = g.z();
+    }
+}
+
+//------------------------------------------------------------------------------
+
+PluginReloader::PluginReloader(const string& a_path, double a_granularity)
+    : m_path(a_path), m_granularity(a_granularity), m_stamp(fileStamp(a_path)), m_changedAt(0.0),
+      m_pending(false), m_requested(false), m_busy(false), m_done(false)
+{
+}
+
+PluginReloader::~PluginReloader()
+{
+    if (m_worker.joinable())
+        m_worker.join();
+    delete m_result.library;
+}
+
+bool PluginReloader::poll(PluginBuild& a_build)
+{
+    if (m_done.load())
+    {
+        m_worker.join();
+        a_build = m_result;
+        m_result = PluginBuild();
+        m_done.store(false);
+        m_busy.store(false);
+        return true;
+    }
+    if (m_busy.load())
+        return false;
+
+    // wait for the file to stop changing, since the linker writes it in pieces
+    double now = steadySeconds();
+    long long stamp = fileStamp(m_path);
+    if (stamp != m_stamp)
+    {
+        m_stamp = stamp;
+        m_changedAt = now;
+        m_pending = true;
+    }
+    bool settled = m_pending && now - m_changedAt >= PLUGIN_SETTLE_SECONDS;
+    if (stamp == 0 || !(settled || m_requested))
+        return false;
+
+    m_pending = false;
+    m_requested = false;
+    m_busy.store(true);
+    m_worker = thread([this]()
+    {
+        m_result = build(m_path, m_granularity);
+        m_done.store(true);
+    });
+    return false;
+}
+
+PluginBuild PluginReloader::build(const string& a_path, double a_granularity)
+{
+    PluginBuild result;
+    double start = steadySeconds();
+
+    string report;
+    ImplicitPluginLibrary* library = ImplicitPluginLibrary::open(a_path, report);
+    if (!library)
+    {
+        result.message = report;
+        return result;
+    }
+    if (!library->validate(report))
+    {
+        result.message = report;
+        delete library;
+        return result;
+    }
+
+    // the box, a cell larger all round so that the mesh closes
+    const ImplicitPluginInfo& info = library->getInfo();
+    cVector3d margin(a_granularity, a_granularity, a_granularity);
+    result.lower = cVector3d(info.lower[0], info.lower[1], info.lower[2]) - margin;
+    result.upper = cVector3d(info.upper[0], info.upper[1], info.upper[2]) + margin;
+
+    // on half the cores, leaving the rest to the haptic and graphics threads
+    int threads = cMax(1, (int)thread::hardware_concurrency() / 2);
+    ImplicitMesh::marchSurface(LibrarySource(*library), result.lower, result.upper, a_granularity,
+                               result.triangles, threads);
+
+    result.library = library;
+    result.message = report + ", " + to_string(result.triangles.size() / 3) + " triangles";
+    result.seconds = steadySeconds() - start;
+    return result;
+}
@@ -0,0 +1,183 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    Implicit shapes loaded from plugins (see ImplicitPlugin.h), which can
+    be rebuilt and swapped in while the haptic threads keep rendering, so
+    that iterating on a shape function does not mean restarting the rig.
+
+    PluginSource is the ImplicitSource an ImplicitMesh renders; it holds
+    the loaded plugin in an EpochPointer.  Every evaluation pins the plugin
+    it calls, and publish() unloads the previous plugin only once no
+    evaluation can still be running its code.
+
+    PluginReloader watches the plugin file.  When it changes, and has
+    stopped changing, a background thread loads a private copy of it,
+    checks it against its own metadata and marches its mesh; the graphics
+    loop then publishes the plugin and shows the mesh in one step, so the
+    surface that is felt and the one that is seen change together.  A
+    plugin that fails to load or to validate never reaches the haptic
+    threads: the previous one stays.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#ifndef PLUGINSOURCE_H
+#define PLUGINSOURCE_H
+
+#include "ImplicitSource.h"
+#include "ImplicitPlugin.h"
+#include "EpochPointer.h"
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+//! Lattice points per axis at which a plugin is checked before it is used.
+#define PLUGIN_VALIDATION_SAMPLES 12
+
+//! Seconds a changed plugin file must stay unchanged before it is reloaded,
+//! so that a library still being written is not loaded.
+#define PLUGIN_SETTLE_SECONDS 0.5
+
+//===========================================================================
+/*
+    One loaded copy of a plugin.  The library is loaded from a private
+    copy of the file, so that the file can be rebuilt while it is loaded
+    and each version loads as a library of its own.
+*/
+//===========================================================================
+class ImplicitPluginLibrary
+{
+public:
+    //! Load the plugin a_path, or return NULL and say why in a_error.
+    static ImplicitPluginLibrary* open(const std::string& a_path, std::string& a_error);
+
+    ~ImplicitPluginLibrary();
+
+    const ImplicitPluginInfo& getInfo() const { return *m_info; }
+
+    double value(const chai3d::cVector3d& a_point) const;
+    double evaluate(const chai3d::cVector3d& a_point, chai3d::cVector3d& a_gradient) const;
+    void valueBatch(const double* a_x, const double* a_y, const double* a_z, int a_count, double* a_values) const;
+
+    //! Check the plugin on a lattice over its box: values are finite, the
+    //! batched and fused entry points agree with value, the gradient
+    //! agrees with the function, and the declared symmetries and Lipschitz
+    //! bound hold.  Returns false, with the first failure in a_report.
+    bool validate(std::string& a_report) const;
+
+private:
+    ImplicitPluginLibrary() : m_handle(0), m_info(0) {}
+    ImplicitPluginLibrary(const ImplicitPluginLibrary&);
+    ImplicitPluginLibrary& operator=(const ImplicitPluginLibrary&);
+
+    void* m_handle;
+    const ImplicitPluginInfo* m_info;
+
+    //! The private copy loaded, removed once unloaded.
+    std::string m_copy;
+};
+
+//===========================================================================
+/*
+    The ImplicitSource of whichever plugin is published.  Without one the
+    function is positive everywhere.
+*/
+//===========================================================================
+class PluginSource : public ImplicitSource
+{
+public:
+    //! Render a_library (taking ownership) from now on, and unload the
+    //! previous plugin once no haptic thread can still be calling it.
+    //! Call from one thread at a time; it waits for the evaluations in
+    //! flight, which last no longer than a tick.
+    void publish(ImplicitPluginLibrary* a_library) { m_library.publish(a_library); }
+
+    //! The published plugin, for the publishing thread only.
+    const ImplicitPluginLibrary* current() const { return m_library.current(); }
+
+    virtual double value(const chai3d::cVector3d& a_point) const;
+    virtual chai3d::cVector3d gradient(const chai3d::cVector3d& a_point) const;
+    virtual double evaluate(const chai3d::cVector3d& a_point, chai3d::cVector3d& a_gradient) const;
+
+    //! Values of a_count points through the plugin's batched entry point.
+    virtual void valueBatch(const double* a_x, const double* a_y, const double* a_z, int a_count,
+                            double* a_values) const;
+
+    //! Values and gradients of a_count points, all from the same plugin.
+    virtual void evaluateBatch(const double* a_x, const double* a_y, const double* a_z, int a_count,
+                               double* a_values, double* a_gx = 0, double* a_gy = 0, double* a_gz = 0) const;
+
+private:
+    EpochPointer<ImplicitPluginLibrary> m_library;
+};
+
+//! A plugin loaded, validated and meshed in the background.
+struct PluginBuild
+{
+    PluginBuild() : library(0), seconds(0.0) {}
+
+    //! The plugin, or NULL if it failed; whoever receives it owns it.
+    ImplicitPluginLibrary* library;
+
+    //! What failed, or a summary of the plugin.
+    std::string message;
+
+    //! Its surface, three corners per triangle, and the box it was meshed in.
+    std::vector<chai3d::cVector3d> triangles;
+    chai3d::cVector3d lower;
+    chai3d::cVector3d upper;
+
+    //! Seconds the build took.
+    double seconds;
+};
+
+//===========================================================================
+/*
+    Rebuilds a plugin in the background whenever its file changes.  Only
+    poll() and reload() are called, from one thread (the graphics loop).
+*/
+//===========================================================================
+class PluginReloader
+{
+public:
+    //! Watch a_path, and mesh its versions with cells a_granularity wide.
+    PluginReloader(const std::string& a_path, double a_granularity);
+
+    //! Waits for a build in progress.
+    ~PluginReloader();
+
+    //! Load the plugin again even though its file has not changed.
+    void reload() { m_requested = true; }
+
+    //! Start a build if the file has changed and settled, and return true
+    //! with a finished build in a_build.  Cheap enough to call every frame.
+    bool poll(PluginBuild& a_build);
+
+    //! Load, validate and mesh a_path now, on the calling thread.
+    static PluginBuild build(const std::string& a_path, double a_granularity);
+
+private:
+    PluginReloader(const PluginReloader&);
+    PluginReloader& operator=(const PluginReloader&);
+
+    std::string m_path;
+    double m_granularity;
+
+    //! Modification stamp of the file as last seen, and when it last changed.
+    long long m_stamp;
+    double m_changedAt;
+    bool m_pending;
+    bool m_requested;
+
+    //! The background build, and its result once m_done is set.
+    std::thread m_worker;
+    std::atomic<bool> m_busy;
+    std::atomic<bool> m_done;
+    PluginBuild m_result;
+};
+
+#endif
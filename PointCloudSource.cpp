@@ -0,0 +1,725 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    Compactly supported RBF surface fitted to a point cloud.  See
+    PointCloudSource.h.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#include "PointCloudSource.h"
+#include "ParallelFor.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+
+using namespace chai3d;
+using namespace std;
+
+//! Most grid cells along an axis; the cells grow beyond the support radius if needed.
+#define CLOUD_GRID_MAX_CELLS 128
+
+//! Rows of the system handled as one unit of parallel work.
+#define CLOUD_SOLVER_BLOCK 256
+
+//! Relative residual at which the conjugate gradient solve stops.
+#define CLOUD_SOLVER_TOLERANCE 1e-6
+
+#define CLOUD_SOLVER_MAX_ITERATIONS 2000
+
+//! Total weight below which the far field blends in: that of one centre 3/4 of the support away.
+#define CLOUD_FAR_FIELD_WEIGHT 0.015625
+
+
+PointCloudSource::PointCloudSource()
+    : m_support(1.0), m_invSupport(1.0), m_cellSize(1.0),
+      m_fitSeconds(0.0), m_solverIterations(0), m_solverResidual(0.0)
+{
+    m_gridOrigin.zero();
+    m_gridSize[0] = m_gridSize[1] = m_gridSize[2] = 0;
+}
+
+bool PointCloudSource::loadXYZ(const string& a_fileName)
+{
+    FILE* file = fopen(a_fileName.c_str(), "r");
+    if (!file)
+        return false;
+
+    vector<cVector3d> points, normals;
+    char line[1024];
+    while (fgets(line, sizeof(line), file))
+    {
+        double p[6];
+        if (sscanf(line, "%lf %lf %lf %lf %lf %lf", &p[0], &p[1], &p[2], &p[3], &p[4], &p[5]) != 6)
+            continue;
+        points.push_back(cVector3d(p[0], p[1], p[2]));
+        normals.push_back(cVector3d(p[3], p[4], p[5]));
+    }
+    fclose(file);
+
+    if (points.empty())
+        return false;
+    setPoints(points, normals);
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// Size in bytes of a PLY scalar type, or 0 if it is unknown.
+//---------------------------------------------------------------------------
+static int plyTypeSize(const string& a_type)
+{
+    if (a_type == "char" || a_type == "uchar" || a_type == "int8" || a_type == "uint8")
+        return 1;
+    if (a_type == "short" || a_type == "ushort" || a_type == "int16" || a_type == "uint16")
+        return 2;
+    if (a_type == "int" || a_type == "uint" || a_type == "int32" || a_type == "uint32" ||
+        a_type == "float" || a_type == "float32")
+        return 4;
+    if (a_type == "double" || a_type == "float64")
+        return 8;
+    return 0;
+}
+
+//---------------------------------------------------------------------------
+// Little-endian binary PLY scalar at a_data, as a double.
+//---------------------------------------------------------------------------
+static double plyValue(const string& a_type, const unsigned char* a_data)
+{
+    if (a_type == "float" || a_type == "float32")  { float v;    memcpy(&v, a_data, 4); return v; }
+    if (a_type == "double" || a_type == "float64") { double v;   memcpy(&v, a_data, 8); return v; }
+    if (a_type == "char" || a_type == "int8")      { return (double)(signed char)a_data[0]; }
+    if (a_type == "uchar" || a_type == "uint8")    { return (double)a_data[0]; }
+    if (a_type == "short" || a_type == "int16")    { int16_t v;  memcpy(&v, a_data, 2); return v; }
+    if (a_type == "ushort" || a_type == "uint16")  { uint16_t v; memcpy(&v, a_data, 2); return v; }
+    if (a_type == "int" || a_type == "int32")      { int32_t v;  memcpy(&v, a_data, 4); return v; }
+    uint32_t v;
+    memcpy(&v, a_data, 4);
+    return v;
+}
+
+bool PointCloudSource::loadPLY(const string& a_fileName)
+{
+    FILE* file = fopen(a_fileName.c_str(), "rb");
+    if (!file)
+        return false;
+
+    char line[1024];
+    if (!fgets(line, sizeof(line), file) || strncmp(line, "ply", 3) != 0)
+    {
+        fclose(file);
+        return false;
+    }
+
+    // header: only the vertex element is read, and it must come first
+    bool binary = false, ascii = false;
+    long vertexCount = -1;
+    bool inVertex = false;
+    vector<string> types, names;
+    while (fgets(line, sizeof(line), file))
+    {
+        char word[3][256];
+        int words = sscanf(line, "%255s %255s %255s", word[0], word[1], word[2]);
+        if (words < 1)
+            continue;
+        string keyword = word[0];
+
+        if (keyword == "end_header")
+            break;
+        else if (keyword == "format" && words >= 2)
+        {
+            ascii = (strcmp(word[1], "ascii") == 0);
+            binary = (strcmp(word[1], "binary_little_endian") == 0);
+        }
+        else if (keyword == "element" && words >= 3)
+        {
+            inVertex = (strcmp(word[1], "vertex") == 0) && vertexCount < 0;
+            if (inVertex)
+                vertexCount = atol(word[2]);
+            else if (vertexCount < 0)
+                vertexCount = -2;   // another element precedes the vertices
+        }
+        else if (keyword == "property" && inVertex && words >= 3)
+        {
+            types.push_back(word[1]);
+            names.push_back(word[2]);
+        }
+    }
+
+    int column[6] = { -1, -1, -1, -1, -1, -1 };
+    const char* wanted[6] = { "x", "y", "z", "nx", "ny", "nz" };
+    int stride = 0;
+    vector<int> offsets;
+    bool valid = (ascii || binary) && vertexCount > 0;
+    for (size_t n = 0; n < names.size(); ++n)
+    {
+        for (int c = 0; c < 6; ++c)
+            if (names[n] == wanted[c])
+                column[c] = (int)n;
+        offsets.push_back(stride);
+        int size = plyTypeSize(types[n]);
+        valid = valid && size > 0;
+        stride += size;
+    }
+    for (int c = 0; c < 6; ++c)
+        valid = valid && column[c] >= 0;
+    if (!valid)
+    {
+        fclose(file);
+        return false;
+    }
+
+    vector<cVector3d> points, normals;
+    points.reserve(vertexCount);
+    normals.reserve(vertexCount);
+    vector<unsigned char> record(stride);
+    vector<double> values(names.size());
+
+    for (long v = 0; v < vertexCount; ++v)
+    {
+        if (binary)
+        {
+            if (fread(&record[0], stride, 1, file) != 1)
+                break;
+            for (size_t n = 0; n < names.size(); ++n)
+                values[n] = plyValue(types[n], &record[offsets[n]]);
+        }
+        else
+        {
+            if (!fgets(line, sizeof(line), file))
+                break;
+            char* text = line;
+            for (size_t n = 0; n < names.size(); ++n)
+                values[n] = strtod(text, &text);
+        }
+        points.push_back(cVector3d(values[column[0]], values[column[1]], values[column[2]]));
+        normals.push_back(cVector3d(values[column[3]], values[column[4]], values[column[5]]));
+    }
+    fclose(file);
+
+    if (points.empty())
+        return false;
+    setPoints(points, normals);
+    return true;
+}
+
+bool PointCloudSource::load(const string& a_fileName)
+{
+    size_t dot = a_fileName.find_last_of('.');
+    string extension = (dot == string::npos) ? "" : a_fileName.substr(dot + 1);
+    for (size_t n = 0; n < extension.size(); ++n)
+        extension[n] = (char)tolower(extension[n]);
+
+    if (extension == "xyz")
+        return loadXYZ(a_fileName);
+    if (extension == "ply")
+        return loadPLY(a_fileName);
+    return false;
+}
+
+void PointCloudSource::setPoints(const vector<cVector3d>& a_points, const vector<cVector3d>& a_normals)
+{
+    m_points = a_points;
+    m_normals = a_normals;
+    m_normals.resize(m_points.size());
+}
+
+void PointCloudSource::fitToBox(double a_halfExtent)
+{
+    if (m_points.empty())
+        return;
+
+    cVector3d lower = m_points[0], upper = m_points[0];
+    for (size_t n = 1; n < m_points.size(); ++n)
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            lower(axis) = cMin(lower(axis), m_points[n](axis));
+            upper(axis) = cMax(upper(axis), m_points[n](axis));
+        }
+
+    cVector3d extent = upper - lower;
+    double longest = cMax(extent.x(), cMax(extent.y(), extent.z()));
+    double scale = (longest > 0.0) ? 2.0 * a_halfExtent / longest : 1.0;
+    cVector3d centre = 0.5 * (lower + upper);
+
+    for (size_t n = 0; n < m_points.size(); ++n)
+        m_points[n] = scale * (m_points[n] - centre);
+}
+
+//===========================================================================
+/*!
+    Fit the surface to the loaded cloud.
+
+    \param  a_spacing  Cell size used to thin the cloud into centres.
+    \param  a_support  Radius of every basis function.
+    \param  a_smoothing  Added to the diagonal of the system (0 interpolates).
+    \param  a_threads  Number of solver threads, or 0 for one per core.
+    \return  False if there is nothing to fit or the solve did not converge.
+*/
+//===========================================================================
+bool PointCloudSource::fit(double a_spacing, double a_support, double a_smoothing, int a_threads)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    m_support = a_support;
+    m_invSupport = 1.0 / a_support;
+
+    clusterCentres(a_spacing);
+    if (m_centres.empty())
+        return false;
+    buildGrid();
+    bool converged = solve(a_smoothing, parallelThreadCount(a_threads));
+
+    m_fitSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return converged;
+}
+
+//---------------------------------------------------------------------------
+// Average the points (and normals) falling in each cell of a_spacing into
+// one centre, dropping cells whose normals cancel out.
+//---------------------------------------------------------------------------
+void PointCloudSource::clusterCentres(double a_spacing)
+{
+    m_centres.clear();
+    m_centreNormals.clear();
+    if (m_points.empty())
+        return;
+
+    cVector3d lower = m_points[0];
+    for (size_t n = 1; n < m_points.size(); ++n)
+        for (int axis = 0; axis < 3; ++axis)
+            lower(axis) = cMin(lower(axis), m_points[n](axis));
+
+    // 21 bits of cell index per axis
+    vector<pair<uint64_t, int> > keys(m_points.size());
+    for (size_t n = 0; n < m_points.size(); ++n)
+    {
+        uint64_t key = 0;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            uint64_t cell = (uint64_t)cMin(floor((m_points[n](axis) - lower(axis)) / a_spacing), 2097151.0);
+            key = (key << 21) | cell;
+        }
+        keys[n] = make_pair(key, (int)n);
+    }
+    sort(keys.begin(), keys.end());
+
+    for (size_t first = 0; first < keys.size(); )
+    {
+        size_t last = first;
+        cVector3d position(0.0, 0.0, 0.0), normal(0.0, 0.0, 0.0);
+        for (; last < keys.size() && keys[last].first == keys[first].first; ++last)
+        {
+            position += m_points[keys[last].second];
+            normal += m_normals[keys[last].second];
+        }
+
+        if (normal.length() > 0.0)
+        {
+            m_centres.push_back(position * (1.0 / (double)(last - first)));
+            m_centreNormals.push_back(normal * (1.0 / normal.length()));
+        }
+        first = last;
+    }
+}
+
+int PointCloudSource::cellOf(const cVector3d& a_point) const
+{
+    int cell[3];
+    for (int axis = 0; axis < 3; ++axis)
+        cell[axis] = cClamp((int)floor((a_point(axis) - m_gridOrigin(axis)) / m_cellSize), 0, m_gridSize[axis] - 1);
+    return cell[0] + m_gridSize[0]*(cell[1] + m_gridSize[1]*cell[2]);
+}
+
+//---------------------------------------------------------------------------
+// Far field: the planes of the nearest centres of the eight cells around
+// a_point, mixed between the cell middles by smoothstep weights, so the
+// value and gradient are continuous where a single nearest plane would
+// jump from cell to cell.
+//---------------------------------------------------------------------------
+double PointCloudSource::farField(const cVector3d& a_point, cVector3d& a_gradient) const
+{
+    int lower[3], upper[3];
+    double fraction[3];
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        double u = (a_point(axis) - m_gridOrigin(axis)) / m_cellSize - 0.5;
+        double base = floor(u);
+        fraction[axis] = u - base;
+        lower[axis] = cClamp((int)base, 0, m_gridSize[axis] - 1);
+        upper[axis] = cClamp((int)base + 1, 0, m_gridSize[axis] - 1);
+    }
+
+    double value = 0.0;
+    a_gradient.zero();
+    for (int corner = 0; corner < 8; ++corner)
+    {
+        int cell[3];
+        double weight = 1.0;
+        cVector3d weightGradient(1.0, 1.0, 1.0);
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            bool high = (corner >> axis) & 1;
+            cell[axis] = high ? upper[axis] : lower[axis];
+            double f = fraction[axis];
+            double smooth = f*f*(3.0 - 2.0*f);
+            double w = high ? smooth : 1.0 - smooth;
+            double dw = (high ? 6.0 : -6.0) * f*(1.0 - f) / m_cellSize;
+            for (int other = 0; other < 3; ++other)
+                weightGradient(other) *= (other == axis) ? dw : w;
+            weight *= w;
+        }
+
+        int nearest = m_cellNearest[cell[0] + m_gridSize[0]*(cell[1] + m_gridSize[1]*cell[2])];
+        double plane = m_centreNormals[nearest].dot(a_point - m_centres[nearest]) + m_weights[nearest];
+        value += weight * plane;
+        a_gradient += weight * m_centreNormals[nearest] + plane * weightGradient;
+    }
+    return value;
+}
+
+//---------------------------------------------------------------------------
+// Bucket the centres into the query grid (reordering them by cell), and
+// find an approximate nearest centre for every cell, by two sweeps that
+// pass the candidates of the neighbours along.
+//---------------------------------------------------------------------------
+void PointCloudSource::buildGrid()
+{
+    // bounds of the centres, with a margin of one support radius
+    cVector3d lower = m_centres[0], upper = m_centres[0];
+    for (size_t n = 1; n < m_centres.size(); ++n)
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            lower(axis) = cMin(lower(axis), m_centres[n](axis));
+            upper(axis) = cMax(upper(axis), m_centres[n](axis));
+        }
+    cVector3d margin(m_support, m_support, m_support);
+    m_gridOrigin = lower - margin;
+    cVector3d extent = (upper + margin) - m_gridOrigin;
+
+    m_cellSize = cMax(m_support, cMax(extent.x(), cMax(extent.y(), extent.z())) / CLOUD_GRID_MAX_CELLS);
+    for (int axis = 0; axis < 3; ++axis)
+        m_gridSize[axis] = cMax(1, (int)ceil(extent(axis) / m_cellSize));
+    int cells = m_gridSize[0] * m_gridSize[1] * m_gridSize[2];
+
+    // counting sort of the centres by cell
+    vector<int> cellOfCentre(m_centres.size());
+    m_cellStart.assign(cells + 1, 0);
+    for (size_t n = 0; n < m_centres.size(); ++n)
+    {
+        cellOfCentre[n] = cellOf(m_centres[n]);
+        m_cellStart[cellOfCentre[n] + 1]++;
+    }
+    for (int c = 0; c < cells; ++c)
+        m_cellStart[c + 1] += m_cellStart[c];
+
+    vector<int> fill(m_cellStart.begin(), m_cellStart.end() - 1);
+    vector<cVector3d> centres(m_centres.size()), normals(m_centres.size());
+    for (size_t n = 0; n < m_centres.size(); ++n)
+    {
+        int slot = fill[cellOfCentre[n]]++;
+        centres[slot] = m_centres[n];
+        normals[slot] = m_centreNormals[n];
+    }
+    m_centres.swap(centres);
+    m_centreNormals.swap(normals);
+
+    // nearest centre to the middle of each cell
+    m_cellNearest.assign(cells, -1);
+    vector<double> nearestSq(cells, 1e300);
+    auto cellMiddle = [&](int i, int j, int k)
+    {
+        return m_gridOrigin + cVector3d((i + 0.5) * m_cellSize, (j + 0.5) * m_cellSize, (k + 0.5) * m_cellSize);
+    };
+    auto offer = [&](int a_cell, const cVector3d& a_middle, int a_centre)
+    {
+        double distanceSq = (m_centres[a_centre] - a_middle).lengthsq();
+        if (distanceSq < nearestSq[a_cell])
+        {
+            nearestSq[a_cell] = distanceSq;
+            m_cellNearest[a_cell] = a_centre;
+        }
+    };
+
+    for (int k = 0; k < m_gridSize[2]; ++k)
+        for (int j = 0; j < m_gridSize[1]; ++j)
+            for (int i = 0; i < m_gridSize[0]; ++i)
+            {
+                int cell = i + m_gridSize[0]*(j + m_gridSize[1]*k);
+                for (int n = m_cellStart[cell]; n < m_cellStart[cell + 1]; ++n)
+                    offer(cell, cellMiddle(i, j, k), n);
+            }
+
+    for (int pass = 0; pass < 2; ++pass)
+        for (int step = 0; step < cells; ++step)
+        {
+            int cell = (pass == 0) ? step : cells - 1 - step;
+            int i = cell % m_gridSize[0];
+            int j = (cell / m_gridSize[0]) % m_gridSize[1];
+            int k = cell / (m_gridSize[0] * m_gridSize[1]);
+            cVector3d middle = cellMiddle(i, j, k);
+
+            for (int dk = -1; dk <= 1; ++dk)
+                for (int dj = -1; dj <= 1; ++dj)
+                    for (int di = -1; di <= 1; ++di)
+                    {
+                        int ni = i + di, nj = j + dj, nk = k + dk;
+                        if (ni < 0 || nj < 0 || nk < 0 ||
+                            ni >= m_gridSize[0] || nj >= m_gridSize[1] || nk >= m_gridSize[2])
+                            continue;
+                        int neighbour = m_cellNearest[ni + m_gridSize[0]*(nj + m_gridSize[1]*nk)];
+                        if (neighbour >= 0)
+                            offer(cell, middle, neighbour);
+                    }
+        }
+}
+
+//---------------------------------------------------------------------------
+// Wendland's C2 function of r = distance / support (0 beyond 1).
+//---------------------------------------------------------------------------
+static inline double wendland(double r)
+{
+    double t = 1.0 - r;
+    double t2 = t*t;
+    return t2*t2 * (4.0*r + 1.0);
+}
+
+//===========================================================================
+/*!
+    Solve for the constant of every centre, so that the field vanishes at
+    each of them.  Row j of the system is
+
+        sum_i phi_i(c_j) w_i = - sum_i phi_i(c_j) n_i . (c_j - c_i)
+
+    which is sparse (phi has compact support), symmetric and positive
+    definite.  The rows are built, and conjugate gradients run, in blocks
+    of rows spread over a_threads threads; sums are reduced in block
+    order, so the result does not depend on the number of threads.
+*/
+//===========================================================================
+bool PointCloudSource::solve(double a_smoothing, int a_threads)
+{
+    int count = (int)m_centres.size();
+    int blocks = (count + CLOUD_SOLVER_BLOCK - 1) / CLOUD_SOLVER_BLOCK;
+    double supportSq = m_support * m_support;
+
+    // visit every centre within the support of centre j
+    auto forNeighbours = [&](int j, auto a_visit)
+    {
+        const cVector3d& c = m_centres[j];
+        int cell[3];
+        for (int axis = 0; axis < 3; ++axis)
+            cell[axis] = (int)floor((c(axis) - m_gridOrigin(axis)) / m_cellSize);
+
+        for (int k = cMax(cell[2] - 1, 0); k <= cMin(cell[2] + 1, m_gridSize[2] - 1); ++k)
+            for (int jj = cMax(cell[1] - 1, 0); jj <= cMin(cell[1] + 1, m_gridSize[1] - 1); ++jj)
+            {
+                int row = m_gridSize[0]*(jj + m_gridSize[1]*k);
+                int first = m_cellStart[row + cMax(cell[0] - 1, 0)];
+                int last = m_cellStart[row + cMin(cell[0] + 1, m_gridSize[0] - 1) + 1];
+                for (int i = first; i < last; ++i)
+                {
+                    double distanceSq = (c - m_centres[i]).lengthsq();
+                    if (distanceSq < supportSq)
+                        a_visit(i, sqrt(distanceSq) * m_invSupport);
+                }
+            }
+    };
+
+    // sparse rows, in compressed row storage
+    vector<int> rowStart(count + 1, 0);
+    parallelFor(blocks, a_threads, [&](int b, int)
+    {
+        for (int j = b * CLOUD_SOLVER_BLOCK; j < cMin(count, (b + 1) * CLOUD_SOLVER_BLOCK); ++j)
+        {
+            int entries = 0;
+            forNeighbours(j, [&](int, double) { ++entries; });
+            rowStart[j + 1] = entries;
+        }
+    });
+    for (int j = 0; j < count; ++j)
+        rowStart[j + 1] += rowStart[j];
+
+    vector<int> columns(rowStart[count]);
+    vector<double> entries(rowStart[count]);
+    vector<double> rhs(count);
+    parallelFor(blocks, a_threads, [&](int b, int)
+    {
+        for (int j = b * CLOUD_SOLVER_BLOCK; j < cMin(count, (b + 1) * CLOUD_SOLVER_BLOCK); ++j)
+        {
+            int entry = rowStart[j];
+            double sum = 0.0;
+            forNeighbours(j, [&](int i, double r)
+            {
+                double phi = wendland(r);
+                columns[entry] = i;
+                entries[entry] = phi + ((i == j) ? a_smoothing : 0.0);
+                ++entry;
+                sum += phi * m_centreNormals[i].dot(m_centres[j] - m_centres[i]);
+            });
+            rhs[j] = -sum;
+        }
+    });
+
+    // conjugate gradients, from w = 0
+    m_weights.assign(count, 0.0);
+    vector<double> residual(rhs), direction(rhs), product(count), partial(blocks);
+
+    auto reduce = [&]()
+    {
+        double sum = 0.0;
+        for (int b = 0; b < blocks; ++b)
+            sum += partial[b];
+        return sum;
+    };
+
+    parallelFor(blocks, a_threads, [&](int b, int)
+    {
+        double sum = 0.0;
+        for (int j = b * CLOUD_SOLVER_BLOCK; j < cMin(count, (b + 1) * CLOUD_SOLVER_BLOCK); ++j)
+            sum += rhs[j] * rhs[j];
+        partial[b] = sum;
+    });
+    double rhsNorm = sqrt(reduce());
+    double residualSq = rhsNorm * rhsNorm;
+
+    m_solverIterations = 0;
+    m_solverResidual = 0.0;
+    if (rhsNorm == 0.0)
+        return true;
+
+    while (m_solverIterations < CLOUD_SOLVER_MAX_ITERATIONS)
+    {
+        // product = A direction, and direction . product
+        parallelFor(blocks, a_threads, [&](int b, int)
+        {
+            double sum = 0.0;
+            for (int j = b * CLOUD_SOLVER_BLOCK; j < cMin(count, (b + 1) * CLOUD_SOLVER_BLOCK); ++j)
+            {
+                double value = 0.0;
+                for (int e = rowStart[j]; e < rowStart[j + 1]; ++e)
+                    value += entries[e] * direction[columns[e]];
+                product[j] = value;
+                sum += direction[j] * value;
+            }
+            partial[b] = sum;
+        });
+        double alpha = residualSq / reduce();
+
+        // step, and the new residual norm
+        parallelFor(blocks, a_threads, [&](int b, int)
+        {
+            double sum = 0.0;
+            for (int j = b * CLOUD_SOLVER_BLOCK; j < cMin(count, (b + 1) * CLOUD_SOLVER_BLOCK); ++j)
+            {
+                m_weights[j] += alpha * direction[j];
+                residual[j] -= alpha * product[j];
+                sum += residual[j] * residual[j];
+            }
+            partial[b] = sum;
+        });
+        double nextResidualSq = reduce();
+        ++m_solverIterations;
+
+        m_solverResidual = sqrt(nextResidualSq) / rhsNorm;
+        if (m_solverResidual < CLOUD_SOLVER_TOLERANCE)
+            return true;
+
+        double beta = nextResidualSq / residualSq;
+        residualSq = nextResidualSq;
+        for (int j = 0; j < count; ++j)
+            direction[j] = residual[j] + beta * direction[j];
+    }
+    return false;
+}
+
+//===========================================================================
+/*!
+    Value and gradient of the normalised blend at a_point.  Only the
+    centres in the 27 grid cells around the point can reach it.
+*/
+//===========================================================================
+double PointCloudSource::evaluate(const cVector3d& a_point, cVector3d& a_gradient) const
+{
+    a_gradient.zero();
+    if (m_centres.empty())
+        return 0.0;
+
+    int cell[3];
+    for (int axis = 0; axis < 3; ++axis)
+        cell[axis] = (int)floor((a_point(axis) - m_gridOrigin(axis)) / m_cellSize);
+
+    double supportSq = m_support * m_support;
+    double gradientScale = -20.0 * m_invSupport * m_invSupport;
+    double numerator = 0.0, denominator = 0.0;
+    cVector3d numeratorGradient(0.0, 0.0, 0.0), denominatorGradient(0.0, 0.0, 0.0);
+
+    for (int k = cMax(cell[2] - 1, 0); k <= cMin(cell[2] + 1, m_gridSize[2] - 1); ++k)
+        for (int j = cMax(cell[1] - 1, 0); j <= cMin(cell[1] + 1, m_gridSize[1] - 1); ++j)
+        {
+            if (cell[0] + 1 < 0 || cell[0] - 1 >= m_gridSize[0])
+                continue;
+            int row = m_gridSize[0]*(j + m_gridSize[1]*k);
+            int first = m_cellStart[row + cMax(cell[0] - 1, 0)];
+            int last = m_cellStart[row + cMin(cell[0] + 1, m_gridSize[0] - 1) + 1];
+
+            for (int i = first; i < last; ++i)
+            {
+                cVector3d offset = a_point - m_centres[i];
+                double distanceSq = offset.lengthsq();
+                if (distanceSq >= supportSq)
+                    continue;
+
+                double r = sqrt(distanceSq) * m_invSupport;
+                double t = 1.0 - r;
+                double t3 = t*t*t;
+                double phi = t3*t * (4.0*r + 1.0);
+                cVector3d phiGradient = (gradientScale * t3) * offset;
+
+                double local = m_centreNormals[i].dot(offset) + m_weights[i];
+                numerator += local * phi;
+                numeratorGradient += phi * m_centreNormals[i] + local * phiGradient;
+                denominator += phi;
+                denominatorGradient += phiGradient;
+            }
+        }
+
+    // as the weights fade towards the edge of the support, the far field
+    // takes over, carrying a weight that rises smoothly from nothing
+    if (denominator < CLOUD_FAR_FIELD_WEIGHT)
+    {
+        double fade = 1.0 - denominator / CLOUD_FAR_FIELD_WEIGHT;
+        double weight = CLOUD_FAR_FIELD_WEIGHT * fade*fade;
+        cVector3d weightGradient = (-2.0 * fade) * denominatorGradient;
+
+        cVector3d farGradient;
+        double far = farField(a_point, farGradient);
+        numerator += far * weight;
+        numeratorGradient += weight * farGradient + far * weightGradient;
+        denominator += weight;
+        denominatorGradient += weightGradient;
+    }
+
+    double value = numerator / denominator;
+    a_gradient = (numeratorGradient - value * denominatorGradient) * (1.0 / denominator);
+    return value;
+}
+
+double PointCloudSource::value(const cVector3d& a_point) const
+{
+    cVector3d gradient;
+    return evaluate(a_point, gradient);
+}
+
+cVector3d PointCloudSource::gradient(const cVector3d& a_point) const
+{
+    cVector3d gradient;
+    evaluate(a_point, gradient);
+    return gradient;
+}
@@ -0,0 +1,125 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    An implicit surface fitted to a scanned point cloud with normals, using
+    compactly supported radial basis functions (Ohtake et al., "3D
+    scattered data approximation with adaptive compactly supported radial
+    basis functions", 2004).
+
+    The cloud is first thinned to one centre per cell of a_spacing, by
+    averaging the points and normals in each cell.  Every centre carries
+    the plane through it as a local approximation of the surface, plus a
+    constant solved for so that the field vanishes at every centre:
+
+        f(x) = sum_i (n_i . (x - c_i) + w_i) phi_i(x) / sum_i phi_i(x)
+
+    where phi_i is the Wendland function of radius a_support around c_i.
+    The constants come from one sparse, symmetric positive definite system,
+    solved by conjugate gradients on all cores.
+
+    The blend is normalised, so the field behaves like a distance within
+    the support of the centres.  Where the total weight falls below that
+    of one centre 3/4 of the support away, a far field fades in: the planes
+    of the cells' nearest centres, mixed smoothly between cells.  It
+    owns the value beyond every support, so the field keeps the right sign
+    there with no jump in the value or gradient at the edge.  Centres are
+    bucketed in a uniform grid with cells one support radius wide, so a
+    query only visits the 27 cells around it.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#ifndef POINTCLOUDSOURCE_H
+#define POINTCLOUDSOURCE_H
+
+#include "ImplicitSource.h"
+#include <string>
+#include <vector>
+
+class PointCloudSource : public ImplicitSource
+{
+public:
+    PointCloudSource();
+
+    //! Load a text file with one "x y z nx ny nz" point per line.
+    bool loadXYZ(const std::string& a_fileName);
+
+    //! Load the vertices (x, y, z, nx, ny, nz) of an ASCII or binary little-endian PLY file.
+    bool loadPLY(const std::string& a_fileName);
+
+    //! Load an XYZ or PLY file, by extension.
+    bool load(const std::string& a_fileName);
+
+    //! Use the given points and (outward) normals.
+    void setPoints(const std::vector<chai3d::cVector3d>& a_points,
+                   const std::vector<chai3d::cVector3d>& a_normals);
+
+    //! Number of points loaded.
+    int getPointCount() const { return (int)m_points.size(); }
+
+    //! A loaded point.
+    const chai3d::cVector3d& getPoint(int a_index) const { return m_points[a_index]; }
+
+    //! Centre the cloud on the origin and scale its longest side to 2 * a_halfExtent.
+    //! Call before fit().
+    void fitToBox(double a_halfExtent);
+
+    //! Fit the surface, with centres a_spacing apart and basis functions
+    //! a_support wide (a few times a_spacing).  a_smoothing > 0 trades
+    //! interpolation of noisy centres for a smoother surface.  Runs on
+    //! a_threads threads, or one per core if 0.  Returns false if the
+    //! cloud is empty or the solver did not converge.
+    bool fit(double a_spacing, double a_support, double a_smoothing = 0.0, int a_threads = 0);
+
+    //! Number of centres the last fit() kept.
+    int getCentreCount() const { return (int)m_centres.size(); }
+
+    //! Wall-clock seconds taken by the last fit().
+    double getFitSeconds() const { return m_fitSeconds; }
+
+    //! Conjugate gradient iterations, and the final relative residual, of the last fit().
+    int getSolverIterations() const { return m_solverIterations; }
+    double getSolverResidual() const { return m_solverResidual; }
+
+    virtual double value(const chai3d::cVector3d& a_point) const;
+    virtual chai3d::cVector3d gradient(const chai3d::cVector3d& a_point) const;
+    virtual double evaluate(const chai3d::cVector3d& a_point, chai3d::cVector3d& a_gradient) const;
+
+private:
+    void clusterCentres(double a_spacing);
+    void buildGrid();
+    int cellOf(const chai3d::cVector3d& a_point) const;
+    double farField(const chai3d::cVector3d& a_point, chai3d::cVector3d& a_gradient) const;
+    bool solve(double a_smoothing, int a_threads);
+
+    //! Loaded cloud.
+    std::vector<chai3d::cVector3d> m_points;
+    std::vector<chai3d::cVector3d> m_normals;
+
+    //! Centres, sorted by grid cell, with their unit normals and constants.
+    std::vector<chai3d::cVector3d> m_centres;
+    std::vector<chai3d::cVector3d> m_centreNormals;
+    std::vector<double> m_weights;
+
+    double m_support;
+    double m_invSupport;
+
+    //! Uniform grid over the centres: cell c holds centres
+    //! [m_cellStart[c], m_cellStart[c + 1]), x fastest.
+    chai3d::cVector3d m_gridOrigin;
+    double m_cellSize;
+    int m_gridSize[3];
+    std::vector<int> m_cellStart;
+
+    //! Approximate nearest centre to every cell, for the far field.
+    std::vector<int> m_cellNearest;
+
+    double m_fitSeconds;
+    int m_solverIterations;
+    double m_solverResidual;
+};
+
+#endif
@@ -0,0 +1,62 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    Memoized projections onto the implicit surface.  See ProjectionCache.h.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#include "ProjectionCache.h"
+#include <math.h>
+
+using namespace chai3d;
+
+
+int ProjectionCache::slotOf(const cVector3d& a_seed, double a_tolerance)
+{
+    double cell = PROJECTION_CACHE_CELL * a_tolerance;
+    long long i = (long long)floor(a_seed.x() / cell);
+    long long j = (long long)floor(a_seed.y() / cell);
+    long long k = (long long)floor(a_seed.z() / cell);
+    unsigned long long hash = (unsigned long long)(i * 73856093LL) ^
+                              (unsigned long long)(j * 19349663LL) ^
+                              (unsigned long long)(k * 83492791LL);
+    return (int)(hash & (PROJECTION_CACHE_SIZE - 1));
+}
+
+bool ProjectionCache::lookup(const cVector3d& a_seed, unsigned int a_version, double a_tolerance,
+                             cVector3d& a_point, cVector3d& a_gradient)
+{
+    const Entry& entry = m_entries[slotOf(a_seed, a_tolerance)];
+    cVector3d offset = a_seed - entry.seed;
+    if (entry.valid && entry.version == a_version && offset.dot(offset) <= a_tolerance * a_tolerance)
+    {
+        a_point = entry.point;
+        a_gradient = entry.gradient;
+        m_hits.store(m_hits.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    m_misses.store(m_misses.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    return false;
+}
+
+void ProjectionCache::store(const cVector3d& a_seed, unsigned int a_version, double a_tolerance,
+                            const cVector3d& a_point, const cVector3d& a_gradient)
+{
+    Entry& entry = m_entries[slotOf(a_seed, a_tolerance)];
+    entry.seed = a_seed;
+    entry.point = a_point;
+    entry.gradient = a_gradient;
+    entry.version = a_version;
+    entry.valid = true;
+}
+
+void ProjectionCache::clear()
+{
+    for (int n = 0; n < PROJECTION_CACHE_SIZE; ++n)
+        m_entries[n].valid = false;
+}
@@ -0,0 +1,78 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    Memoized projections of seed points onto the implicit surface.  While
+    the tool rests on the surface or slides slowly over it, the proxy is
+    projected from nearly the same seed on every tick, and Newton's method
+    converges to nearly the same point.  A small direct-mapped cache,
+    owned by one tool (and so by one haptic thread), remembers the last
+    projections made: a seed within the tolerance of a remembered one
+    takes its converged point without touching the surface.
+
+    An entry lives in the slot given by the cell of the seed on a lattice
+    a few tolerances wide, and is only taken for the version of the shape
+    it was computed on, so any change of source, backend or iteration
+    limit forgets everything.  Its answer is off from a fresh projection
+    by about the distance between the seeds, which is no more than the
+    convergence tolerance of Newton's method itself.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#ifndef PROJECTIONCACHE_H
+#define PROJECTIONCACHE_H
+
+#include "chai3d.h"
+#include <atomic>
+
+//! Entries of a projection cache; a power of two.
+#define PROJECTION_CACHE_SIZE 8
+
+//! Width of the lattice cells keying the cache, in tolerances.
+#define PROJECTION_CACHE_CELL 4.0
+
+class ProjectionCache
+{
+public:
+    ProjectionCache() : m_hits(0), m_misses(0) { clear(); }
+
+    //! The projection remembered for a seed within a_tolerance of a_seed on
+    //! version a_version of the shape, with the gradient at it.  Counts a
+    //! hit or a miss.
+    bool lookup(const chai3d::cVector3d& a_seed, unsigned int a_version, double a_tolerance,
+                chai3d::cVector3d& a_point, chai3d::cVector3d& a_gradient);
+
+    //! Remember the projection of a_seed, replacing whatever shared its slot.
+    void store(const chai3d::cVector3d& a_seed, unsigned int a_version, double a_tolerance,
+               const chai3d::cVector3d& a_point, const chai3d::cVector3d& a_gradient);
+
+    //! Forget every entry (the counters are kept).
+    void clear();
+
+    //! Lookups answered and not answered so far; may be read from any thread.
+    unsigned long long getHits() const { return m_hits.load(std::memory_order_relaxed); }
+    unsigned long long getMisses() const { return m_misses.load(std::memory_order_relaxed); }
+
+private:
+    struct Entry
+    {
+        chai3d::cVector3d seed;
+        chai3d::cVector3d point;
+        chai3d::cVector3d gradient;
+        unsigned int version;
+        bool valid;
+    };
+
+    static int slotOf(const chai3d::cVector3d& a_seed, double a_tolerance);
+
+    Entry m_entries[PROJECTION_CACHE_SIZE];
+
+    //! Written by the owning thread only.
+    std::atomic<unsigned long long> m_hits;
+    std::atomic<unsigned long long> m_misses;
+};
+
+#endif
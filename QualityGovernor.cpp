@@ -0,0 +1,91 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    Quality of service for the haptic loop.  See QualityGovernor.h.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#include "QualityGovernor.h"
+
+
+QualityGovernor::QualityGovernor(double a_deadlineSeconds)
+    : m_deadlineNs(a_deadlineSeconds * 1e9), m_cost(0.0), m_level(QUALITY_FULL), m_tick(0),
+      m_sinceChange(0), m_sinceLoaded(0), m_lastStepUp(0), m_recoverTicks(QUALITY_RECOVER_TICKS)
+{
+}
+
+//===========================================================================
+/*!
+    Account one tick.  The cost is smoothed over about eight ticks, so a
+    single slow tick does not change the level but a run of them does, and
+    a tick several deadlines long does at once.
+
+    \param  a_tickNs  Busy time of the tick [ns].
+    \return Level of the next tick.
+*/
+//===========================================================================
+QualityLevel QualityGovernor::update(unsigned long long a_tickNs)
+{
+    ++m_tick;
+    ++m_sinceChange;
+    m_cost += 0.125 * ((double)a_tickNs - m_cost);
+
+    QualityLevel level = getLevel();
+    if (m_cost > QUALITY_STEP_UP_LOAD * m_deadlineNs)
+        m_sinceLoaded = 0;
+    else
+        ++m_sinceLoaded;
+
+    if (m_cost > QUALITY_STEP_DOWN_LOAD * m_deadlineNs)
+    {
+        if (level + 1 < QUALITY_LEVEL_COUNT && m_sinceChange >= QUALITY_SETTLE_TICKS)
+        {
+            // overloaded again soon after stepping up: wait longer next time
+            if (m_lastStepUp != 0 && m_tick - m_lastStepUp < m_recoverTicks)
+                m_recoverTicks = (2 * m_recoverTicks < QUALITY_MAX_RECOVER_TICKS) ? 2 * m_recoverTicks
+                                                                                   : QUALITY_MAX_RECOVER_TICKS;
+            else
+                m_recoverTicks = QUALITY_RECOVER_TICKS;
+
+            change((QualityLevel)(level + 1));
+        }
+    }
+    else if (level > QUALITY_FULL && m_sinceLoaded >= m_recoverTicks)
+    {
+        m_lastStepUp = m_tick;
+        m_sinceLoaded = 0;
+        change((QualityLevel)(level - 1));
+    }
+
+    return getLevel();
+}
+
+void QualityGovernor::change(QualityLevel a_level)
+{
+    QualityTransition transition;
+    transition.tick = m_tick;
+    transition.from = getLevel();
+    transition.to = a_level;
+    transition.costNs = m_cost;
+    transition.deadlineNs = m_deadlineNs;
+    m_transitions.push(transition);
+
+    m_level.store(a_level, std::memory_order_relaxed);
+    m_sinceChange = 0;
+}
+
+const char* QualityGovernor::levelName(QualityLevel a_level)
+{
+    switch (a_level)
+    {
+        case QUALITY_FULL:             return "full";
+        case QUALITY_FEWER_ITERATIONS: return "fewer iterations";
+        case QUALITY_SAMPLED:          return "sampled grid";
+        case QUALITY_PLANE_HOLD:       return "plane hold";
+        default:                       return "unknown";
+    }
+}
@@ -0,0 +1,120 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    Quality of service for the haptic loop.  When a shape is expensive or
+    the proxy solve struggles, a tick that overruns its deadline makes the
+    loop slow down, and a slow loop makes the device soft or unstable.  A
+    QualityGovernor watches the busy time of each tick and, as its smoothed
+    cost nears the deadline, steps down to a cheaper way of rendering:
+
+    - QUALITY_FULL: the proxy solve as it is;
+    - QUALITY_FEWER_ITERATIONS: Newton's method to the surface stops after
+      a few iterations instead of at convergence;
+    - QUALITY_SAMPLED: the surface is read from the sampled grid instead of
+      its source, also with fewer iterations;
+    - QUALITY_PLANE_HOLD: the surface is not queried at all; the tool is
+      held by the plane it was pressed against when the level was entered
+      (or, if it pressed on nothing, rendered as at QUALITY_SAMPLED), and
+      its proxy starts afresh when the level is left.
+
+    Once the cost has stayed well under the deadline for a while it steps
+    back up one level.  If the level it returns to overloads the loop again
+    soon after, the wait before the next try doubles, so the governor does
+    not flip between two levels.
+
+    Every transition is queued for the graphics loop to log.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#ifndef QUALITYGOVERNOR_H
+#define QUALITYGOVERNOR_H
+
+#include "TelemetryRing.h"
+#include <atomic>
+
+//! Ways of rendering, from the most faithful to the cheapest.
+enum QualityLevel
+{
+    QUALITY_FULL,
+    QUALITY_FEWER_ITERATIONS,
+    QUALITY_SAMPLED,
+    QUALITY_PLANE_HOLD,
+    QUALITY_LEVEL_COUNT
+};
+
+//! Newton iterations allowed below QUALITY_FULL.
+#define QUALITY_NEWTON_ITERATIONS 3
+
+//! Fractions of the deadline the smoothed tick cost must rise above to
+//! step down, and stay below to step up.
+#define QUALITY_STEP_DOWN_LOAD 0.8
+#define QUALITY_STEP_UP_LOAD 0.4
+
+//! Ticks after a transition before the next step down, while the
+//! smoothed cost settles to that of the new level.
+#define QUALITY_SETTLE_TICKS 100
+
+//! Fewest and most ticks of low cost before stepping up.
+#define QUALITY_RECOVER_TICKS 1000
+#define QUALITY_MAX_RECOVER_TICKS 64000
+
+//! A change of level, for the log.
+struct QualityTransition
+{
+    unsigned long long tick;
+    QualityLevel from;
+    QualityLevel to;
+
+    //! Smoothed tick cost and deadline when the level changed [ns].
+    double costNs;
+    double deadlineNs;
+};
+
+class QualityGovernor
+{
+public:
+    QualityGovernor(double a_deadlineSeconds = 0.001);
+
+    //! Change the deadline; call before the first tick.
+    void setDeadline(double a_seconds) { m_deadlineNs = a_seconds * 1e9; }
+
+    //! Haptic thread: account the busy time of the tick just ended [ns] and
+    //! return the level of the next tick.
+    QualityLevel update(unsigned long long a_tickNs);
+
+    //! Level of the next tick; may be read from any thread.
+    QualityLevel getLevel() const { return (QualityLevel)m_level.load(std::memory_order_relaxed); }
+
+    //! Smoothed busy time of a tick [ns].
+    double getCostNs() const { return m_cost; }
+
+    //! Graphics thread: pop the oldest transition not yet logged.
+    bool popTransition(QualityTransition& a_transition) { return m_transitions.pop(a_transition); }
+
+    //! Name of a level.
+    static const char* levelName(QualityLevel a_level);
+
+private:
+    void change(QualityLevel a_level);
+
+    double m_deadlineNs;
+    double m_cost;
+    std::atomic<int> m_level;
+    unsigned long long m_tick;
+
+    //! Ticks since the last transition, and since the cost was last high.
+    unsigned long long m_sinceChange;
+    unsigned long long m_sinceLoaded;
+
+    //! Tick of the last step up, and the ticks of low cost required before the next.
+    unsigned long long m_lastStepUp;
+    unsigned long long m_recoverTicks;
+
+    TelemetryRing<QualityTransition, 64> m_transitions;
+};
+
+#endif
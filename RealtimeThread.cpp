@@ -0,0 +1,323 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    Real-time configuration of the haptic threads.  See RealtimeThread.h.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#include "RealtimeThread.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <stdint.h>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <errno.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+using namespace std;
+
+
+int parseRealtimeOptions(int a_argc, char* a_argv[], RealtimeConfig& a_config)
+{
+    int kept = 1;
+    for (int n = 1; n < a_argc; ++n)
+    {
+        const char* option = a_argv[n];
+        bool value = (n + 1 < a_argc);
+        if (strcmp(option, "--rate") == 0 && value)
+        {
+            a_config.rate = atof(a_argv[++n]);
+            if (a_config.pacing == REALTIME_PACING_FREE)
+                a_config.pacing = REALTIME_PACING_SLEEP;
+        }
+        else if (strcmp(option, "--spin") == 0)
+            a_config.pacing = REALTIME_PACING_SPIN;
+        else if (strcmp(option, "--fifo") == 0 && value)
+            a_config.priority = atoi(a_argv[++n]);
+        else if (strcmp(option, "--cpu") == 0 && value)
+            a_config.cpu = atoi(a_argv[++n]);
+        else if (strcmp(option, "--mlock") == 0)
+            a_config.lockMemory = true;
+        else if (strcmp(option, "--rt") == 0)
+        {
+            a_config.rate = 4000.0;
+            a_config.pacing = REALTIME_PACING_SPIN;
+            a_config.priority = 80;
+            a_config.lockMemory = true;
+        }
+        else
+            a_argv[kept++] = a_argv[n];
+    }
+
+    // a pacing without a rate runs free
+    if (a_config.rate <= 0.0)
+        a_config.pacing = REALTIME_PACING_FREE;
+
+    return kept;
+}
+
+bool lockProcessMemory(string& a_report, const void* a_unlocked, size_t a_unlockedBytes)
+{
+#if defined(__linux__)
+    // mlockall(MCL_CURRENT) would read every mapping in, a mapped volume
+    // file too, and fail once they add up past the memlock limit: lock
+    // what is mapped now region by region instead, around a_unlocked
+    FILE* maps = fopen("/proc/self/maps", "r");
+    if (!maps)
+    {
+        a_report = string("cannot list the mappings: ") + strerror(errno);
+        return false;
+    }
+    uintptr_t skipBegin = (uintptr_t)a_unlocked;
+    uintptr_t skipEnd = skipBegin + a_unlockedBytes;
+    size_t locked = 0;
+    int error = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), maps))
+    {
+        unsigned long begin = 0, end = 0;
+        char permissions[8] = { 0 };
+        char name[256] = { 0 };
+        if (sscanf(line, "%lx-%lx %7s %*s %*s %*s %255s", &begin, &end, permissions, name) < 3)
+            continue;
+
+        // guard pages, and the kernel's own pages ([vvar], [vsyscall])
+        bool accessible = permissions[0] == 'r' || permissions[1] == 'w' || permissions[2] == 'x';
+        bool special = name[0] == '[' && strcmp(name, "[heap]") != 0 && strncmp(name, "[stack", 6) != 0;
+        if (!accessible || special)
+            continue;
+
+        uintptr_t pieces[2][2] = { { begin, std::min<uintptr_t>(end, skipBegin) }, { std::max<uintptr_t>(begin, skipEnd), end } };
+        if (a_unlockedBytes == 0)
+            pieces[1][0] = pieces[1][1] = 0;
+        for (int n = 0; n < 2; ++n)
+        {
+            if (pieces[n][0] >= pieces[n][1])
+                continue;
+            if (mlock((void*)pieces[n][0], pieces[n][1] - pieces[n][0]) == 0)
+                locked += pieces[n][1] - pieces[n][0];
+            else if (!error)
+                error = errno;
+        }
+    }
+    fclose(maps);
+
+    // and whatever is mapped from now on
+    if (!error && mlockall(MCL_FUTURE) != 0)
+        error = errno;
+    if (error)
+    {
+        a_report = string("memory locking failed: ") + strerror(error) + " (raise the memlock limit)";
+        return false;
+    }
+
+    char text[160];
+    snprintf(text, sizeof(text), "memory locked (%.0f MB%s)", locked / 1048576.0,
+             a_unlockedBytes ? ", leaving out the mapped volume" : "");
+    a_report = text;
+    return true;
+#else
+    (void)a_unlocked;
+    (void)a_unlockedBytes;
+    a_report = "memory locking is only supported on Linux";
+    return false;
+#endif
+}
+
+bool isCpuIsolated(int a_cpu)
+{
+#if defined(__linux__)
+    // a list of CPUs and ranges, such as "2-3,6"
+    FILE* file = fopen("/sys/devices/system/cpu/isolated", "r");
+    if (!file)
+        return false;
+    char list[256] = { 0 };
+    bool found = false;
+    if (fgets(list, sizeof(list), file))
+    {
+        for (char* range = strtok(list, ",\n"); range && !found; range = strtok(0, ",\n"))
+        {
+            int first = 0, last = 0;
+            int fields = sscanf(range, "%d-%d", &first, &last);
+            if (fields == 1)
+                last = first;
+            found = (fields >= 1 && a_cpu >= first && a_cpu <= last);
+        }
+    }
+    fclose(file);
+    return found;
+#else
+    (void)a_cpu;
+    return false;
+#endif
+}
+
+bool configureRealtimeThread(int a_priority, int a_cpu, string& a_report)
+{
+    bool ok = true;
+    a_report.clear();
+
+    if (a_priority > 0)
+    {
+#if defined(__linux__)
+        sched_param param;
+        param.sched_priority = a_priority;
+        int maximum = sched_get_priority_max(SCHED_FIFO);
+        if (param.sched_priority > maximum)
+            param.sched_priority = maximum;
+        int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (error == 0)
+            a_report += "SCHED_FIFO " + to_string(param.sched_priority);
+        else
+        {
+            a_report += string("SCHED_FIFO failed: ") + strerror(error) + " (needs CAP_SYS_NICE or an rtprio limit)";
+            ok = false;
+        }
+#elif defined(_WIN32)
+        if (SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL))
+            a_report += "time critical priority";
+        else
+        {
+            a_report += "raising the priority failed";
+            ok = false;
+        }
+#else
+        a_report += "priorities are not supported here";
+        ok = false;
+#endif
+    }
+
+    if (a_cpu >= 0)
+    {
+        if (!a_report.empty())
+            a_report += ", ";
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(a_cpu, &set);
+        int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (error == 0)
+        {
+            a_report += "pinned to CPU " + to_string(a_cpu);
+            if (!isCpuIsolated(a_cpu))
+                a_report += " (not isolated: boot with isolcpus=" + to_string(a_cpu) +
+                            " nohz_full=" + to_string(a_cpu) + ")";
+        }
+        else
+        {
+            a_report += "pinning to CPU " + to_string(a_cpu) + " failed: " + strerror(error);
+            ok = false;
+        }
+#elif defined(_WIN32)
+        if (SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << a_cpu))
+            a_report += "pinned to CPU " + to_string(a_cpu);
+        else
+        {
+            a_report += "pinning to CPU " + to_string(a_cpu) + " failed";
+            ok = false;
+        }
+#else
+        a_report += "pinning is not supported here";
+        ok = false;
+#endif
+    }
+
+    if (a_report.empty())
+        a_report = "default scheduling";
+    return ok;
+}
+
+//------------------------------------------------------------------------------
+
+RealtimePacer::RealtimePacer()
+    : m_periodNs(0), m_pacing(REALTIME_PACING_FREE), m_next(0), m_missed(0)
+{
+}
+
+void RealtimePacer::start(double a_rate, RealtimePacing a_pacing)
+{
+    m_pacing = (a_rate > 0.0) ? a_pacing : REALTIME_PACING_FREE;
+    m_periodNs = (m_pacing == REALTIME_PACING_FREE) ? 0 : (unsigned long long)(1e9 / a_rate);
+    m_next = hapticNowNs();
+    m_missed = 0;
+}
+
+void RealtimePacer::wait()
+{
+    if (m_periodNs == 0)
+        return;
+
+    m_next += m_periodNs;
+    unsigned long long now = hapticNowNs();
+    if (now >= m_next)
+    {
+        if (now - m_next >= m_periodNs)
+        {
+            ++m_missed;
+            m_next = now;
+        }
+        return;
+    }
+
+    if (m_pacing == REALTIME_PACING_SLEEP)
+    {
+#if defined(__linux__)
+        // hapticNowNs() reads CLOCK_MONOTONIC, so its deadlines can be
+        // handed to the kernel as they are
+        timespec deadline;
+        deadline.tv_sec = (time_t)(m_next / 1000000000ULL);
+        deadline.tv_nsec = (long)(m_next % 1000000000ULL);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, 0) == EINTR)
+            ;
+#else
+        // elsewhere sleeps are coarse: sleep while the deadline is far and
+        // poll the rest of the way
+        const unsigned long long coarse = 2000000;
+        if (m_next - now > coarse)
+            this_thread::sleep_for(chrono::nanoseconds(m_next - now - coarse));
+#endif
+    }
+
+    while (hapticNowNs() < m_next)
+        ;
+}
+
+void measurePacingJitter(RealtimePacer& a_pacer, int a_ticks, LatencyHistogram& a_jitter,
+                         void (*a_load)(void*), void* a_context)
+{
+    unsigned long long period = a_pacer.getPeriodNs();
+    a_pacer.wait();
+    unsigned long long previous = hapticNowNs();
+    for (int n = 0; n < a_ticks; ++n)
+    {
+        if (a_load)
+            a_load(a_context);
+        a_pacer.wait();
+        unsigned long long now = hapticNowNs();
+        unsigned long long elapsed = now - previous;
+        a_jitter.record(elapsed > period ? elapsed - period : period - elapsed);
+        previous = now;
+    }
+}
+
+string describeJitter(const LatencyHistogram& a_jitter)
+{
+    char text[128];
+    snprintf(text, sizeof(text), "jitter p50 %.1f / p99 %.1f / max %.1f us",
+             a_jitter.percentile(0.50) * 1e-3, a_jitter.percentile(0.99) * 1e-3, a_jitter.getMax() * 1e-3);
+    return string(text);
+}
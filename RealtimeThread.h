@@ -0,0 +1,136 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    Real-time configuration of the haptic threads.  cThread starts a haptic
+    loop at a high priority and lets it spin as fast as it can, so its rate
+    and jitter depend on whatever else the machine does.  Here a haptic
+    thread can instead be given:
+
+    - SCHED_FIFO scheduling at a chosen priority (Linux; the highest
+      priority class on Windows), so it is never preempted by ordinary
+      threads;
+    - a CPU of its own, ideally one the kernel was told to keep other work
+      off (isolcpus= / nohz_full= on the kernel command line), which is
+      checked and reported;
+    - locked memory, so it never waits on a page fault; a large file
+      mapped into memory (see VolumeSource) is left out, as locking would
+      read all of it in and count it against the memlock limit;
+    - a fixed rate, paced either by sleeping to an absolute deadline
+      (clock_nanosleep) or by busy-polling the clock, which costs a CPU
+      but wakes within a microsecond.
+
+    Raising the priority needs CAP_SYS_NICE or an rtprio limit on Linux;
+    what could not be done is reported rather than treated as an error.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#ifndef REALTIMETHREAD_H
+#define REALTIMETHREAD_H
+
+#include "HapticProfiler.h"
+#include <string>
+
+//! How a RealtimePacer waits for the next tick.
+enum RealtimePacing
+{
+    REALTIME_PACING_FREE,   //!< do not wait: run as fast as the loop spins
+    REALTIME_PACING_SLEEP,  //!< sleep to the deadline on the monotonic clock
+    REALTIME_PACING_SPIN    //!< poll the clock until the deadline
+};
+
+//! Real-time settings of the haptic threads, read from the command line.
+struct RealtimeConfig
+{
+    //! Target rate of the loop [Hz]; ignored for REALTIME_PACING_FREE.
+    double rate;
+
+    RealtimePacing pacing;
+
+    //! SCHED_FIFO priority (1-99); 0 leaves the scheduling as it is.
+    int priority;
+
+    //! CPU of the first device's thread, the next devices taking the next
+    //! CPUs; -1 leaves the threads free to migrate.
+    int cpu;
+
+    //! Lock the memory of the process.
+    bool lockMemory;
+
+    RealtimeConfig() : rate(0.0), pacing(REALTIME_PACING_FREE), priority(0), cpu(-1), lockMemory(false) {}
+
+    //! True if any setting differs from what cThread does on its own.
+    bool isEnabled() const
+    {
+        return pacing != REALTIME_PACING_FREE || priority > 0 || cpu >= 0 || lockMemory;
+    }
+};
+
+//! Remove the real-time options from the command line, filling a_config:
+//!   --rate <Hz>    pace the haptic loop at a fixed rate (by sleeping)
+//!   --spin         pace by busy-polling instead of sleeping
+//!   --fifo <prio>  SCHED_FIFO at the given priority
+//!   --cpu <n>      pin the first haptic thread to CPU n, the next to n+1, ...
+//!   --mlock        lock the memory of the process
+//!   --rt           the settings of the lab rigs: --rate 4000 --spin --fifo 80 --mlock
+//! Returns the number of arguments left in a_argv.
+int parseRealtimeOptions(int a_argc, char* a_argv[], RealtimeConfig& a_config);
+
+//! Lock the pages of the process, present and future, into memory, but
+//! for the a_unlockedBytes at a_unlocked (a file mapped before the call).
+//! Call once, before the haptic threads start.  a_report says what was done.
+bool lockProcessMemory(std::string& a_report, const void* a_unlocked = 0, size_t a_unlockedBytes = 0);
+
+//! Apply a priority (0 to leave it) and a CPU (-1 to leave it) to the
+//! calling thread.  a_report says what was done and what failed.
+bool configureRealtimeThread(int a_priority, int a_cpu, std::string& a_report);
+
+//! True if a_cpu is kept free of other work by the kernel (Linux only).
+bool isCpuIsolated(int a_cpu);
+
+//===========================================================================
+/*
+    Paces a loop at a fixed rate.  Deadlines are absolute, one period
+    apart, so the rate does not drift with the time spent in the loop.  A
+    loop that falls more than a period behind counts a miss and starts
+    over from the present, rather than running ticks back to back to catch
+    up.
+*/
+//===========================================================================
+class RealtimePacer
+{
+public:
+    RealtimePacer();
+
+    //! Start pacing from now at a_rate [Hz].
+    void start(double a_rate, RealtimePacing a_pacing);
+
+    //! Wait for the next tick.
+    void wait();
+
+    //! Period of the loop [ns]; 0 if it is not paced.
+    unsigned long long getPeriodNs() const { return m_periodNs; }
+
+    //! Number of ticks that started more than a period late.
+    unsigned long long getMissed() const { return m_missed; }
+
+private:
+    unsigned long long m_periodNs;
+    RealtimePacing m_pacing;
+    unsigned long long m_next;
+    unsigned long long m_missed;
+};
+
+//! Run a_pacer for a_ticks ticks, recording how far each period is from
+//! the target into a_jitter.  Each tick calls a_load(a_context), if given,
+//! so the loop is measured under the work of a real tick.
+void measurePacingJitter(RealtimePacer& a_pacer, int a_ticks, LatencyHistogram& a_jitter,
+                         void (*a_load)(void*) = 0, void* a_context = 0);
+
+//! One-line summary of a jitter histogram.
+std::string describeJitter(const LatencyHistogram& a_jitter);
+
+#endif
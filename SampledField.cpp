@@ -0,0 +1,583 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    Sparse tricubic sampled implicit field.  See SampledField.h.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#include "SampledField.h"
+#include "ParallelFor.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+
+using namespace chai3d;
+
+#define SAMPLED_BRICK_MASK (SAMPLED_BRICK_SIZE - 1)
+
+//---------------------------------------------------------------------------
+// Whole tiles covering every lattice node of a box along one axis.
+//---------------------------------------------------------------------------
+static int tilesCovering(double a_lower, double a_upper, double a_spacing)
+{
+    int nodes = (int)floor((a_upper - a_lower) / a_spacing + 1e-6) + 2;
+    return (nodes + SAMPLED_BRICK_MASK) / SAMPLED_BRICK_SIZE;
+}
+
+
+SampledField::SampledField()
+    : m_spacing(1.0), m_invSpacing(1.0), m_band(0.0), m_maxDistance(0.0), m_sampledNodes(0), m_buildSeconds(0.0)
+{
+    m_origin.zero();
+    m_size[0] = m_size[1] = m_size[2] = 0;
+    m_tiles[0] = m_tiles[1] = m_tiles[2] = 0;
+}
+
+//---------------------------------------------------------------------------
+// First-order signed distance f / |grad f| of a source at a point, clamped
+// to +/- a_maxDistance (which also catches a vanishing gradient).
+//---------------------------------------------------------------------------
+static float signedDistance(const ImplicitSource& a_source, const cVector3d& a_point, double a_maxDistance)
+{
+    cVector3d gradient;
+    double f = a_source.evaluate(a_point, gradient);
+    double g = gradient.length();
+
+    if (fabs(f) >= a_maxDistance * g)
+        return (float)(f < 0.0 ? -a_maxDistance : a_maxDistance);
+    return (float)(f / g);
+}
+
+//===========================================================================
+/*!
+    Sample a source onto the grid.  The tile corners are sampled first, as
+    the coarse level.  Only tiles with a corner close enough to the zero
+    set to reach into the band are sampled at full resolution, and they
+    keep a brick only if one of their nodes is inside the band.  Both
+    levels are sampled on a_threads threads (all cores if 0), so a_source
+    must be safe to evaluate concurrently.
+
+    \param  a_source  Field to sample.
+    \param  a_lower  Lower corner of the sampled box (position of node 0,0,0).
+    \param  a_upper  Upper corner of the sampled box.
+    \param  a_spacing  Distance between nodes.
+    \param  a_maxDistance  Clamp of the coarse level far from the surface.
+    \param  a_threads  Number of sampling threads, or 0 for one per core.
+*/
+//===========================================================================
+void SampledField::build(const ImplicitSource& a_source,
+                         const cVector3d& a_lower, const cVector3d& a_upper,
+                         double a_spacing, double a_maxDistance, int a_threads)
+{
+    clear();
+
+    m_origin = a_lower;
+    m_spacing = a_spacing;
+    m_invSpacing = 1.0 / a_spacing;
+    m_band = SAMPLED_BAND_NODES * a_spacing;
+    m_maxDistance = a_maxDistance;
+
+    // whole tiles covering every lattice node of the box
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        m_tiles[axis] = tilesCovering(a_lower(axis), a_upper(axis), a_spacing);
+        m_size[axis] = m_tiles[axis] * SAMPLED_BRICK_SIZE;
+    }
+
+    int threads = parallelThreadCount(a_threads);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    // coarse level: one clamped distance per tile corner
+    int cx = m_tiles[0] + 1, cy = m_tiles[1] + 1, cz = m_tiles[2] + 1;
+    m_coarse.resize((size_t)cx * cy * cz);
+    parallelFor(cz, threads, [&](int k, int)
+    {
+        for (int j = 0; j < cy; ++j)
+            for (int i = 0; i < cx; ++i)
+                m_coarse[i + cx*(j + cy*k)] = signedDistance(a_source,
+                    nodePosition(i*SAMPLED_BRICK_SIZE, j*SAMPLED_BRICK_SIZE, k*SAMPLED_BRICK_SIZE), a_maxDistance);
+    });
+
+    // a point of the tile can only be within the band of the surface if one
+    // of the corners is within the band plus the diagonal of the tile
+    double reach = m_band + sqrt(3.0) * SAMPLED_BRICK_SIZE * a_spacing;
+    std::vector<int> candidates;
+
+    m_root.resize((size_t)m_tiles[0] * m_tiles[1] * m_tiles[2]);
+    for (int tk = 0; tk < m_tiles[2]; ++tk)
+        for (int tj = 0; tj < m_tiles[1]; ++tj)
+            for (int ti = 0; ti < m_tiles[0]; ++ti)
+            {
+                int tile = ti + m_tiles[0]*(tj + m_tiles[1]*tk);
+                double nearest = a_maxDistance;
+                double sum = 0.0;
+                for (int c = 0; c < 8; ++c)
+                {
+                    float d = m_coarse[(ti + (c & 1)) + cx*((tj + ((c >> 1) & 1)) + cy*(tk + (c >> 2)))];
+                    nearest = cMin(nearest, (double)fabs(d));
+                    sum += d;
+                }
+
+                m_root[tile] = (sum < 0.0) ? TILE_INSIDE : TILE_OUTSIDE;
+                if (nearest < reach)
+                    candidates.push_back(tile);
+            }
+
+    // sample the candidates in parallel, each worker keeping the bricks
+    // that have a node inside the band
+    struct Kept
+    {
+        std::vector<int> tiles;
+        std::vector<float> samples;
+    };
+    std::vector<Kept> kept(threads);
+    float band = (float)m_band;
+
+    parallelFor((int)candidates.size(), threads, [&](int n, int worker)
+    {
+        int tile = candidates[n];
+        int ti = tile % m_tiles[0];
+        int tj = (tile / m_tiles[0]) % m_tiles[1];
+        int tk = tile / (m_tiles[0] * m_tiles[1]);
+
+        float samples[SAMPLED_BRICK_NODES];
+        bool inBand = false;
+        float* sample = samples;
+        for (int k = 0; k < SAMPLED_BRICK_SIZE; ++k)
+            for (int j = 0; j < SAMPLED_BRICK_SIZE; ++j)
+                for (int i = 0; i < SAMPLED_BRICK_SIZE; ++i, ++sample)
+                {
+                    *sample = signedDistance(a_source,
+                        nodePosition(ti*SAMPLED_BRICK_SIZE + i, tj*SAMPLED_BRICK_SIZE + j, tk*SAMPLED_BRICK_SIZE + k),
+                        m_band);
+                    inBand = inBand || fabs(*sample) < band;
+                }
+
+        // each candidate is written by one worker only
+        if (!inBand)
+        {
+            m_root[tile] = (samples[0] < 0.0f) ? TILE_INSIDE : TILE_OUTSIDE;
+            return;
+        }
+        kept[worker].tiles.push_back(tile);
+        kept[worker].samples.insert(kept[worker].samples.end(), samples, samples + SAMPLED_BRICK_NODES);
+    });
+
+    // lay the bricks out in tile order, so neighbours in space are close in memory
+    std::vector<std::pair<int, const float*> > order;
+    for (size_t w = 0; w < kept.size(); ++w)
+        for (size_t b = 0; b < kept[w].tiles.size(); ++b)
+            order.push_back(std::make_pair(kept[w].tiles[b], &kept[w].samples[b * SAMPLED_BRICK_NODES]));
+    std::sort(order.begin(), order.end());
+
+    m_bricks.reserve(order.size() * SAMPLED_BRICK_NODES);
+    for (size_t b = 0; b < order.size(); ++b)
+    {
+        m_root[order[b].first] = (int)b;
+        m_brickTiles.push_back(order[b].first);
+        m_bricks.insert(m_bricks.end(), order[b].second, order[b].second + SAMPLED_BRICK_NODES);
+    }
+
+    m_sampledNodes = m_coarse.size() + candidates.size() * (size_t)SAMPLED_BRICK_NODES;
+    m_buildSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool SampledField::matches(const cVector3d& a_lower, const cVector3d& a_upper,
+                           double a_spacing, double a_maxDistance) const
+{
+    if (isEmpty() || !m_origin.equals(a_lower) || m_spacing != a_spacing ||
+        m_band != SAMPLED_BAND_NODES * a_spacing || m_maxDistance != a_maxDistance)
+        return false;
+    for (int axis = 0; axis < 3; ++axis)
+        if (m_tiles[axis] != tilesCovering(a_lower(axis), a_upper(axis), a_spacing))
+            return false;
+    return true;
+}
+
+void SampledField::clear()
+{
+    std::vector<int>().swap(m_root);
+    std::vector<float>().swap(m_bricks);
+    std::vector<int>().swap(m_brickTiles);
+    std::vector<float>().swap(m_coarse);
+    m_size[0] = m_size[1] = m_size[2] = 0;
+    m_tiles[0] = m_tiles[1] = m_tiles[2] = 0;
+}
+
+float SampledField::node(int i, int j, int k) const
+{
+    int brick = m_root[(i >> SAMPLED_BRICK_SHIFT) +
+                       m_tiles[0]*((j >> SAMPLED_BRICK_SHIFT) + m_tiles[1]*(k >> SAMPLED_BRICK_SHIFT))];
+    if (brick >= 0)
+        return m_bricks[(size_t)brick * SAMPLED_BRICK_NODES + (i & SAMPLED_BRICK_MASK) +
+                        ((j & SAMPLED_BRICK_MASK) << SAMPLED_BRICK_SHIFT) +
+                        ((k & SAMPLED_BRICK_MASK) << (2*SAMPLED_BRICK_SHIFT))];
+    return (float)(brick == TILE_INSIDE ? -m_band : m_band);
+}
+
+cVector3d SampledField::nodePosition(int i, int j, int k) const
+{
+    return cVector3d(m_origin.x() + i*m_spacing,
+                     m_origin.y() + j*m_spacing,
+                     m_origin.z() + k*m_spacing);
+}
+
+void SampledField::getBrickOrigin(int a_brick, int& i, int& j, int& k) const
+{
+    int tile = m_brickTiles[a_brick];
+    i = (tile % m_tiles[0]) * SAMPLED_BRICK_SIZE;
+    j = ((tile / m_tiles[0]) % m_tiles[1]) * SAMPLED_BRICK_SIZE;
+    k = (tile / (m_tiles[0] * m_tiles[1])) * SAMPLED_BRICK_SIZE;
+}
+
+size_t SampledField::getMemoryBytes() const
+{
+    return m_bricks.size() * sizeof(float) + m_root.size() * sizeof(int) +
+           m_brickTiles.size() * sizeof(int) + m_coarse.size() * sizeof(float);
+}
+
+size_t SampledField::getDenseMemoryBytes() const
+{
+    return (size_t)m_size[0] * m_size[1] * m_size[2] * sizeof(float);
+}
+
+//---------------------------------------------------------------------------
+// Cache file layout: a fixed header followed by the tile table, the tile of
+// every brick, the bricks and the coarse level, all in native byte order.
+//---------------------------------------------------------------------------
+#define SAMPLED_CACHE_MAGIC 0x32464453u   // "SDF2"
+
+struct SampledCacheHeader
+{
+    uint32_t magic;
+    uint32_t brickSize;
+    uint64_t key;
+    double origin[3];
+    double spacing;
+    double band;
+    double maxDistance;
+    int32_t size[3];
+    int32_t tiles[3];
+    uint64_t bricks;
+    uint64_t coarse;
+};
+
+template <class T>
+static bool writeArray(FILE* a_file, const std::vector<T>& a_array)
+{
+    return a_array.empty() || fwrite(&a_array[0], sizeof(T), a_array.size(), a_file) == a_array.size();
+}
+
+template <class T>
+static bool readArray(FILE* a_file, std::vector<T>& a_array, size_t a_count)
+{
+    a_array.resize(a_count);
+    return a_array.empty() || fread(&a_array[0], sizeof(T), a_count, a_file) == a_count;
+}
+
+//===========================================================================
+/*!
+    Write the grid to a cache file.
+
+    \param  a_fileName  File to write.
+    \param  a_key  Identifies the source the grid was sampled from; load()
+                    only accepts the file back with the same key.
+    \return  False if the grid is empty or the file could not be written.
+*/
+//===========================================================================
+bool SampledField::save(const std::string& a_fileName, uint64_t a_key) const
+{
+    if (isEmpty())
+        return false;
+
+    FILE* file = fopen(a_fileName.c_str(), "wb");
+    if (!file)
+        return false;
+
+    SampledCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = SAMPLED_CACHE_MAGIC;
+    header.brickSize = SAMPLED_BRICK_SIZE;
+    header.key = a_key;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        header.origin[axis] = m_origin(axis);
+        header.size[axis] = m_size[axis];
+        header.tiles[axis] = m_tiles[axis];
+    }
+    header.spacing = m_spacing;
+    header.band = m_band;
+    header.maxDistance = m_maxDistance;
+    header.bricks = m_brickTiles.size();
+    header.coarse = m_coarse.size();
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              writeArray(file, m_root) && writeArray(file, m_brickTiles) &&
+              writeArray(file, m_bricks) && writeArray(file, m_coarse);
+    ok = (fclose(file) == 0) && ok;
+    if (!ok)
+        remove(a_fileName.c_str());
+    return ok;
+}
+
+//===========================================================================
+/*!
+    Read a grid written by save().
+
+    \param  a_fileName  File to read.
+    \param  a_key  Key the file must have been saved with.
+    \return  False, leaving the grid empty, if the file is missing, was
+              saved with another key or brick size, or is truncated.
+*/
+//===========================================================================
+bool SampledField::load(const std::string& a_fileName, uint64_t a_key)
+{
+    clear();
+
+    FILE* file = fopen(a_fileName.c_str(), "rb");
+    if (!file)
+        return false;
+
+    SampledCacheHeader header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+              header.magic == SAMPLED_CACHE_MAGIC &&
+              header.brickSize == SAMPLED_BRICK_SIZE &&
+              header.key == a_key;
+
+    size_t tiles = 0;
+    if (ok)
+    {
+        tiles = (size_t)header.tiles[0] * header.tiles[1] * header.tiles[2];
+        ok = readArray(file, m_root, tiles) &&
+             readArray(file, m_brickTiles, (size_t)header.bricks) &&
+             readArray(file, m_bricks, (size_t)header.bricks * SAMPLED_BRICK_NODES) &&
+             readArray(file, m_coarse, (size_t)header.coarse);
+    }
+    fclose(file);
+
+    // reject tables that would index out of the arrays
+    for (size_t t = 0; ok && t < m_root.size(); ++t)
+        ok = m_root[t] < (int)header.bricks && m_root[t] >= TILE_INSIDE;
+    ok = ok && header.coarse == (size_t)(header.tiles[0] + 1) * (header.tiles[1] + 1) * (header.tiles[2] + 1);
+
+    if (!ok)
+    {
+        clear();
+        return false;
+    }
+
+    m_origin.set(header.origin[0], header.origin[1], header.origin[2]);
+    m_spacing = header.spacing;
+    m_invSpacing = 1.0 / header.spacing;
+    m_band = header.band;
+    m_maxDistance = header.maxDistance;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        m_size[axis] = header.size[axis];
+        m_tiles[axis] = header.tiles[axis];
+    }
+    m_sampledNodes = 0;
+    m_buildSeconds = 0.0;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// Catmull-Rom weights of the four nodes around fractional offset t, and
+// their derivatives with respect to t.
+//---------------------------------------------------------------------------
+static inline void catmullRom(double t, double w[4], double d[4])
+{
+    double t2 = t*t;
+    double t3 = t2*t;
+
+    w[0] = 0.5 * (-t3 + 2.0*t2 - t);
+    w[1] = 0.5 * (3.0*t3 - 5.0*t2 + 2.0);
+    w[2] = 0.5 * (-3.0*t3 + 4.0*t2 + t);
+    w[3] = 0.5 * (t3 - t2);
+
+    d[0] = 0.5 * (-3.0*t2 + 4.0*t - 1.0);
+    d[1] = 0.5 * (9.0*t2 - 10.0*t);
+    d[2] = 0.5 * (-9.0*t2 + 8.0*t + 1.0);
+    d[3] = 0.5 * (3.0*t2 - 2.0*t);
+}
+
+double SampledField::value(const cVector3d& a_point) const
+{
+    cVector3d gradient;
+    return evaluate(a_point, gradient);
+}
+
+cVector3d SampledField::gradient(const cVector3d& a_point) const
+{
+    cVector3d gradient;
+    evaluate(a_point, gradient);
+    return gradient;
+}
+
+//===========================================================================
+/*!
+    Interpolate the field and its gradient at a point.  Points outside the
+    grid are clamped onto its boundary, and the distance to the boundary
+    is added so the field keeps growing (and pointing) away from the grid.
+
+    \param  a_point  Query position.
+    \param  a_gradient  Returned gradient of the interpolant.
+    \return Interpolated value.
+*/
+//===========================================================================
+double SampledField::evaluate(const cVector3d& a_point, cVector3d& a_gradient) const
+{
+    double u[3];
+    int base[3];
+    double outside[3];
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        int n = m_size[axis];
+        double v = (a_point(axis) - m_origin(axis)) * m_invSpacing;
+        u[axis] = v < 0.0 ? 0.0 : (v > n - 1 ? n - 1 : v);
+        outside[axis] = (v - u[axis]) * m_spacing;
+
+        base[axis] = (int)u[axis];
+        if (base[axis] > n - 2) base[axis] = n - 2;
+    }
+
+    double value;
+    int tile = (base[0] >> SAMPLED_BRICK_SHIFT) +
+               m_tiles[0]*((base[1] >> SAMPLED_BRICK_SHIFT) + m_tiles[1]*(base[2] >> SAMPLED_BRICK_SHIFT));
+
+    // the fine level is used where the stencil reaches into the band
+    bool inBand = false;
+
+    if (m_root[tile] >= 0)
+    {
+        // split each stencil node index into its tile and its offset in the
+        // brick, so the 64 lookups below are additions only
+        int tilePart[3][4];
+        int offsetPart[3][4];
+        double w[3][4];
+        double d[3][4];
+        int tileStride[3] = { 1, m_tiles[0], m_tiles[0] * m_tiles[1] };
+
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            int n = m_size[axis];
+            catmullRom(u[axis] - base[axis], w[axis], d[axis]);
+
+            // replicate the boundary nodes for the outermost cells
+            for (int c = 0; c < 4; ++c)
+            {
+                int node = base[axis] - 1 + c;
+                node = node < 0 ? 0 : (node > n - 1 ? n - 1 : node);
+                tilePart[axis][c] = (node >> SAMPLED_BRICK_SHIFT) * tileStride[axis];
+                offsetPart[axis][c] = (node & SAMPLED_BRICK_MASK) << (axis * SAMPLED_BRICK_SHIFT);
+            }
+        }
+
+        float band = (float)m_band;
+        value = 0.0;
+        double gx = 0.0, gy = 0.0, gz = 0.0;
+
+        // rows of the stencil that do not cross a tile boundary in x (most
+        // of them) need a single tile lookup
+        bool rowInOneTile = (tilePart[0][0] == tilePart[0][3]);
+
+        for (int c = 0; c < 4; ++c)
+            for (int b = 0; b < 4; ++b)
+            {
+                int rowTile = tilePart[1][b] + tilePart[2][c];
+                int rowOffset = offsetPart[1][b] + offsetPart[2][c];
+                double v[4];
+
+                if (rowInOneTile)
+                {
+                    int brick = m_root[rowTile + tilePart[0][0]];
+                    const float* row = (brick >= 0) ? &m_bricks[(size_t)brick * SAMPLED_BRICK_NODES + rowOffset] : 0;
+                    for (int a = 0; a < 4; ++a)
+                        v[a] = row ? row[offsetPart[0][a]] : (brick == TILE_INSIDE ? -band : band);
+                }
+                else
+                {
+                    for (int a = 0; a < 4; ++a)
+                    {
+                        int brick = m_root[rowTile + tilePart[0][a]];
+                        v[a] = (brick >= 0) ? m_bricks[(size_t)brick * SAMPLED_BRICK_NODES + rowOffset + offsetPart[0][a]]
+                                            : (brick == TILE_INSIDE ? -band : band);
+                    }
+                }
+
+                inBand = inBand || fabs(v[0]) < band || fabs(v[1]) < band ||
+                                   fabs(v[2]) < band || fabs(v[3]) < band;
+
+                double sx = w[0][0]*v[0] + w[0][1]*v[1] + w[0][2]*v[2] + w[0][3]*v[3];
+                double dx = d[0][0]*v[0] + d[0][1]*v[1] + d[0][2]*v[2] + d[0][3]*v[3];
+
+                double wyz = w[1][b] * w[2][c];
+                value += wyz * sx;
+                gx += wyz * dx;
+                gy += d[1][b] * w[2][c] * sx;
+                gz += w[1][b] * d[2][c] * sx;
+            }
+
+        a_gradient.set(gx * m_invSpacing, gy * m_invSpacing, gz * m_invSpacing);
+    }
+
+    // far field: the clamped fine level is flat, so use the coarse level
+    if (!inBand)
+        value = evaluateCoarse(u, a_gradient);
+
+    double outsideSq = outside[0]*outside[0] + outside[1]*outside[1] + outside[2]*outside[2];
+    if (outsideSq > 0.0)
+    {
+        double distance = sqrt(outsideSq);
+        value += distance;
+        a_gradient += cVector3d(outside[0], outside[1], outside[2]) / distance;
+    }
+
+    return value;
+}
+
+//---------------------------------------------------------------------------
+// Trilinear interpolation of the coarse level at node coordinates a_u.
+//---------------------------------------------------------------------------
+double SampledField::evaluateCoarse(const double a_u[3], cVector3d& a_gradient) const
+{
+    int cx = m_tiles[0] + 1, cy = m_tiles[1] + 1;
+    int i[3];
+    double t[3];
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        double cu = a_u[axis] / SAMPLED_BRICK_SIZE;
+        i[axis] = cMin((int)cu, m_tiles[axis] - 1);
+        t[axis] = cu - i[axis];
+    }
+
+    const float* p = &m_coarse[i[0] + cx*(i[1] + cy*i[2])];
+    double c000 = p[0],          c100 = p[1];
+    double c010 = p[cx],         c110 = p[cx + 1];
+    double c001 = p[cx*cy],      c101 = p[cx*cy + 1];
+    double c011 = p[cx*cy + cx], c111 = p[cx*cy + cx + 1];
+
+    // interpolate along x, then y, then z
+    double c00 = c000 + t[0]*(c100 - c000), c10 = c010 + t[0]*(c110 - c010);
+    double c01 = c001 + t[0]*(c101 - c001), c11 = c011 + t[0]*(c111 - c011);
+    double c0 = c00 + t[1]*(c10 - c00), c1 = c01 + t[1]*(c11 - c01);
+
+    double dx0 = (c100 - c000) + t[1]*((c110 - c010) - (c100 - c000));
+    double dx1 = (c101 - c001) + t[1]*((c111 - c011) - (c101 - c001));
+    double scale = m_invSpacing / SAMPLED_BRICK_SIZE;
+
+    a_gradient.set((dx0 + t[2]*(dx1 - dx0)) * scale,
+                   ((c10 - c00) + t[2]*((c11 - c01) - (c10 - c00))) * scale,
+                   (c1 - c0) * scale);
+
+    return c0 + t[2]*(c1 - c0);
+}
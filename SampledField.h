@@ -0,0 +1,155 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    An implicit function sampled once onto a regular 3D grid, and evaluated
+    by tricubic (Catmull-Rom) interpolation of the 4x4x4 nodes around the
+    query point.  The gradient is the analytic derivative of the same
+    interpolant, so value and gradient always agree, and the cost of a
+    query does not depend on how expensive the original function was.
+
+    The nodes hold an estimate of the signed distance to the zero set,
+    f / |grad f|, which keeps high-degree functions such as the whiffle
+    cube well conditioned for both the interpolation and the Newton
+    projection of the proxy.
+
+    The grid is stored sparsely, in two levels.  It is split into tiles of
+    SAMPLED_BRICK_SIZE^3 nodes; only the tiles in a narrow band around the
+    zero set own a brick of samples, and all bricks sit back to back in
+    one array.  Samples are clamped to the band width, and so read every
+    node of a tile without a brick.  Queries whose stencil lies entirely
+    in the clamped far field fall back to a coarse grid sampled at the
+    tile corners, which still points the way back to the surface.  Both
+    levels are a direct lookup, so a query costs the same wherever it
+    lands.
+
+    Sampling an expensive source (such as a MeshSource) is parallel over
+    tiles, and the result can be saved to a file and loaded back.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#ifndef SAMPLEDFIELD_H
+#define SAMPLEDFIELD_H
+
+#include "ImplicitSource.h"
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+//! Nodes along each side of a brick (must be a power of two).
+#define SAMPLED_BRICK_SHIFT 3
+#define SAMPLED_BRICK_SIZE (1 << SAMPLED_BRICK_SHIFT)
+#define SAMPLED_BRICK_NODES (SAMPLED_BRICK_SIZE * SAMPLED_BRICK_SIZE * SAMPLED_BRICK_SIZE)
+
+//! Half width of the band kept around the zero set, in nodes.  The
+//! tricubic stencil reaches two nodes beyond the cell of a query.
+#define SAMPLED_BAND_NODES 3
+
+class SampledField : public ImplicitSource
+{
+public:
+    SampledField();
+
+    //! Sample a_source over the box [a_lower, a_upper] with nodes a_spacing
+    //! apart.  Coarse (far field) values are clamped to +/- a_maxDistance.
+    //! Sampling runs on a_threads threads, or one per core if 0.
+    void build(const ImplicitSource& a_source,
+               const chai3d::cVector3d& a_lower, const chai3d::cVector3d& a_upper,
+               double a_spacing, double a_maxDistance, int a_threads = 0);
+
+    //! Write the grid to a file, tagged with a key identifying its source.
+    bool save(const std::string& a_fileName, uint64_t a_key) const;
+
+    //! Read a grid written by save() with the same key.
+    bool load(const std::string& a_fileName, uint64_t a_key);
+
+    //! True if the grid is the one build() makes over the same box, with
+    //! the same spacing, band and a_maxDistance, such as a grid load()ed
+    //! from a cache for a box that may have changed since.
+    bool matches(const chai3d::cVector3d& a_lower, const chai3d::cVector3d& a_upper,
+                 double a_spacing, double a_maxDistance) const;
+
+    //! Release all samples.
+    void clear();
+
+    //! True if no grid has been sampled.
+    bool isEmpty() const { return m_root.empty(); }
+
+    //! Node (i, j, k), or the clamped band value if its tile has no brick.
+    float node(int i, int j, int k) const;
+
+    //! Position of node (i, j, k).
+    chai3d::cVector3d nodePosition(int i, int j, int k) const;
+
+    virtual double value(const chai3d::cVector3d& a_point) const;
+    virtual chai3d::cVector3d gradient(const chai3d::cVector3d& a_point) const;
+    virtual double evaluate(const chai3d::cVector3d& a_point, chai3d::cVector3d& a_gradient) const;
+
+    //! Number of nodes along an axis (0, 1 or 2).
+    int getSize(int a_axis) const { return m_size[a_axis]; }
+
+    //! Distance between neighbouring nodes.
+    double getSpacing() const { return m_spacing; }
+
+    //! Half width of the band kept around the zero set.
+    double getBandWidth() const { return m_band; }
+
+    //! Number of tiles that own a brick.
+    int getBrickCount() const { return (int)(m_bricks.size() / SAMPLED_BRICK_NODES); }
+
+    //! Number of tiles in the grid.
+    int getTileCount() const { return (int)m_root.size(); }
+
+    //! Node index of the first node of a brick.
+    void getBrickOrigin(int a_brick, int& i, int& j, int& k) const;
+
+    //! Bytes held by the bricks, the tile table and the coarse grid.
+    size_t getMemoryBytes() const;
+
+    //! Bytes the same grid would need if every node were stored as a float.
+    size_t getDenseMemoryBytes() const;
+
+    //! Nodes evaluated on the source by the last build() (0 after load()).
+    size_t getSampledNodeCount() const { return m_sampledNodes; }
+
+    //! Wall-clock seconds taken by the last build() (0 after load()).
+    double getBuildSeconds() const { return m_buildSeconds; }
+
+    //! Position of node (0, 0, 0).
+    const chai3d::cVector3d& getOrigin() const { return m_origin; }
+
+private:
+    //! Tile table entries for tiles without a brick.
+    enum { TILE_OUTSIDE = -1, TILE_INSIDE = -2 };
+
+    double evaluateCoarse(const double a_u[3], chai3d::cVector3d& a_gradient) const;
+
+    //! Brick index of every tile (or TILE_OUTSIDE / TILE_INSIDE), x fastest.
+    std::vector<int> m_root;
+
+    //! Node samples of every brick, SAMPLED_BRICK_NODES each, x fastest.
+    std::vector<float> m_bricks;
+
+    //! Tile of every brick, so bricks can be walked in storage order.
+    std::vector<int> m_brickTiles;
+
+    //! Clamped distance at every tile corner, x fastest.
+    std::vector<float> m_coarse;
+
+    chai3d::cVector3d m_origin;
+    double m_spacing;
+    double m_invSpacing;
+    double m_band;
+    double m_maxDistance;
+    int m_size[3];
+    int m_tiles[3];
+
+    size_t m_sampledNodes;
+    double m_buildSeconds;
+};
+
+#endif
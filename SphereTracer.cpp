@@ -0,0 +1,422 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    CPU ray marching of implicit sources.  See SphereTracer.h.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#include "SphereTracer.h"
+#include "ParallelFor.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <chrono>
+
+using namespace chai3d;
+using namespace std;
+
+
+namespace
+{
+
+double secondsSince(const chrono::steady_clock::time_point& a_start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - a_start).count();
+}
+
+// CRC-32 of PNG chunks
+uint32_t crc32(const unsigned char* a_data, size_t a_size, uint32_t a_crc = 0)
+{
+    static uint32_t table[256];
+    static bool filled = false;
+    if (!filled)
+    {
+        for (uint32_t n = 0; n < 256; ++n)
+        {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+        filled = true;
+    }
+
+    uint32_t c = a_crc ^ 0xFFFFFFFFu;
+    for (size_t n = 0; n < a_size; ++n)
+        c = table[(c ^ a_data[n]) & 0xFF] ^ (c >> 8);
+    return c ^ 0xFFFFFFFFu;
+}
+
+void putBigEndian(vector<unsigned char>& a_out, uint32_t a_value)
+{
+    a_out.push_back((unsigned char)(a_value >> 24));
+    a_out.push_back((unsigned char)(a_value >> 16));
+    a_out.push_back((unsigned char)(a_value >> 8));
+    a_out.push_back((unsigned char)a_value);
+}
+
+void putChunk(FILE* a_file, const char* a_type, const vector<unsigned char>& a_data)
+{
+    vector<unsigned char> chunk;
+    putBigEndian(chunk, (uint32_t)a_data.size());
+    chunk.insert(chunk.end(), a_type, a_type + 4);
+    chunk.insert(chunk.end(), a_data.begin(), a_data.end());
+    putBigEndian(chunk, crc32(&chunk[4], chunk.size() - 4));
+    fwrite(&chunk[0], 1, chunk.size(), a_file);
+}
+
+} // namespace
+
+//------------------------------------------------------------------------------
+
+//===========================================================================
+/*!
+    Write the image.  PNG data is stored in uncompressed deflate blocks,
+    which every reader accepts and which needs no compression library.
+
+    \param  a_fileName  File to write, .png or anything else for PPM.
+    \return True if it was written.
+*/
+//===========================================================================
+bool PreviewImage::save(const string& a_fileName) const
+{
+    FILE* file = fopen(a_fileName.c_str(), "wb");
+    if (!file)
+        return false;
+
+    bool png = a_fileName.size() >= 4 && a_fileName.compare(a_fileName.size() - 4, 4, ".png") == 0;
+    if (!png)
+    {
+        fprintf(file, "P6\n%d %d\n255\n", width, height);
+        fwrite(&pixels[0], 1, pixels.size(), file);
+        return fclose(file) == 0;
+    }
+
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    fwrite(signature, 1, 8, file);
+
+    vector<unsigned char> header;
+    putBigEndian(header, (uint32_t)width);
+    putBigEndian(header, (uint32_t)height);
+    header.push_back(8);    // bits per channel
+    header.push_back(2);    // RGB
+    header.push_back(0);    // deflate
+    header.push_back(0);    // adaptive filtering
+    header.push_back(0);    // not interlaced
+    putChunk(file, "IHDR", header);
+
+    // rows, each behind a "no filter" byte
+    vector<unsigned char> raw;
+    size_t stride = 3 * (size_t)width;
+    for (int y = 0; y < height; ++y)
+    {
+        raw.push_back(0);
+        raw.insert(raw.end(), pixels.begin() + y * stride, pixels.begin() + (y + 1) * stride);
+    }
+
+    // a zlib stream of stored blocks, and the Adler-32 of the rows
+    vector<unsigned char> data;
+    data.push_back(0x78);
+    data.push_back(0x01);
+    for (size_t offset = 0; offset < raw.size() || offset == 0; )
+    {
+        size_t length = min(raw.size() - offset, (size_t)65535);
+        bool last = offset + length == raw.size();
+        data.push_back(last ? 1 : 0);
+        data.push_back((unsigned char)length);
+        data.push_back((unsigned char)(length >> 8));
+        data.push_back((unsigned char)~length);
+        data.push_back((unsigned char)(~length >> 8));
+        data.insert(data.end(), raw.begin() + offset, raw.begin() + offset + length);
+        offset += length;
+        if (last)
+            break;
+    }
+    uint32_t a = 1, b = 0;
+    for (size_t n = 0; n < raw.size(); ++n)
+    {
+        a = (a + raw[n]) % 65521;
+        b = (b + a) % 65521;
+    }
+    putBigEndian(data, (b << 16) | a);
+    putChunk(file, "IDAT", data);
+    putChunk(file, "IEND", vector<unsigned char>());
+
+    return fclose(file) == 0;
+}
+
+//------------------------------------------------------------------------------
+
+SphereTracer::SphereTracer(const ImplicitSource& a_source, const cVector3d& a_lower, const cVector3d& a_upper,
+                           int a_threads)
+    : m_source(a_source), m_lower(a_lower), m_upper(a_upper), m_threads(parallelThreadCount(a_threads)),
+      m_lipschitz(0.0), m_minStep(SPHERE_TRACER_MIN_STEP * (a_upper - a_lower).length())
+{
+    m_cellSize = (m_upper - m_lower) / (double)SPHERE_TRACER_CELLS;
+}
+
+//===========================================================================
+/*!
+    Estimate the gradient bound of each cell from the lattice of cell
+    corners, edge midpoints and centres (so 27 points per cell, shared
+    with its neighbours).
+
+    \param  a_stats  Counts the evaluations.
+*/
+//===========================================================================
+void SphereTracer::estimateBounds(PreviewStats& a_stats)
+{
+    const int cells = SPHERE_TRACER_CELLS;
+    const int nodes = 2 * cells + 1;
+    vector<double> slopes((size_t)nodes * nodes * nodes);
+    parallelFor(nodes, m_threads, [&](int k, int)
+    {
+        for (int j = 0; j < nodes; ++j)
+            for (int i = 0; i < nodes; ++i)
+            {
+                cVector3d p(m_lower.x() + 0.5 * i * m_cellSize.x(),
+                            m_lower.y() + 0.5 * j * m_cellSize.y(),
+                            m_lower.z() + 0.5 * k * m_cellSize.z());
+                slopes[((size_t)k * nodes + j) * nodes + i] = m_source.gradient(p).length();
+            }
+    });
+    a_stats.evaluations += (long long)slopes.size();
+
+    m_bounds.assign((size_t)cells * cells * cells, 0.0);
+    for (int k = 0; k < cells; ++k)
+        for (int j = 0; j < cells; ++j)
+            for (int i = 0; i < cells; ++i)
+            {
+                double steepest = 0.0;
+                for (int c = 0; c < 27; ++c)
+                {
+                    // a singular point (such as the whiffle cube's) is left to the bisection
+                    double slope = slopes[((size_t)(2*k + c / 9) * nodes + 2*j + (c / 3) % 3) * nodes + 2*i + c % 3];
+                    if (slope < 1e300)
+                        steepest = cMax(steepest, slope);
+                }
+                m_bounds[((size_t)k * cells + j) * cells + i] = SPHERE_TRACER_SAFETY * steepest;
+            }
+}
+
+double SphereTracer::boundAt(const cVector3d& a_point, const cVector3d& a_direction, double& a_reach) const
+{
+    if (m_lipschitz > 0.0)
+    {
+        a_reach = 1e300;
+        return m_lipschitz;
+    }
+
+    // the cell of the point, and the distance to where the ray leaves it
+    int cell[3];
+    a_reach = 1e300;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        double u = (a_point(axis) - m_lower(axis)) / m_cellSize(axis);
+        cell[axis] = cClamp((int)floor(u), 0, SPHERE_TRACER_CELLS - 1);
+        if (a_direction(axis) > 0.0)
+            a_reach = cMin(a_reach, (m_lower(axis) + (cell[axis] + 1) * m_cellSize(axis) - a_point(axis)) / a_direction(axis));
+        else if (a_direction(axis) < 0.0)
+            a_reach = cMin(a_reach, (m_lower(axis) + cell[axis] * m_cellSize(axis) - a_point(axis)) / a_direction(axis));
+    }
+    return m_bounds[((size_t)cell[2] * SPHERE_TRACER_CELLS + cell[1]) * SPHERE_TRACER_CELLS + cell[0]];
+}
+
+//===========================================================================
+/*!
+    Trace and shade every pixel of a_image.
+
+    \param  a_view  Direction the box is seen from.
+    \param  a_image  Image of the size to render, overwritten.
+    \return Its cost.
+*/
+//===========================================================================
+PreviewStats SphereTracer::render(const PreviewView& a_view, PreviewImage& a_image)
+{
+    PreviewStats stats;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    if (m_lipschitz <= 0.0 && m_bounds.empty())
+        estimateBounds(stats);
+    stats.setupSeconds = secondsSince(start);
+    start = chrono::steady_clock::now();
+
+    // a camera framing the bounding sphere of the box, z up
+    cVector3d centre = 0.5 * (m_lower + m_upper);
+    double radius = 0.5 * (m_upper - m_lower).length();
+    double azimuth = a_view.azimuth * C_PI / 180.0, elevation = a_view.elevation * C_PI / 180.0;
+    double halfAngle = 0.5 * a_view.fieldOfView * C_PI / 180.0;
+    cVector3d back(cos(elevation) * cos(azimuth), cos(elevation) * sin(azimuth), sin(elevation));
+    cVector3d eye = centre + (1.05 * radius / sin(halfAngle)) * back;
+    cVector3d forward = -back;
+    cVector3d right = forward.cross(cVector3d(0.0, 0.0, 1.0));
+    if (right.length() < 1e-9)
+        right = cVector3d(0.0, 1.0, 0.0);
+    right.normalize();
+    cVector3d up = right.cross(forward);
+    double spanY = tan(halfAngle);
+    double spanX = spanY * a_image.width / cMax(a_image.height, 1);
+
+    // a headlight and a key light above and to the right of the camera
+    cVector3d key = back + up + 0.5 * right;
+    key.normalize();
+
+    a_image.pixels.assign(3 * (size_t)a_image.width * a_image.height, 0);
+    int tilesX = (a_image.width + SPHERE_TRACER_TILE - 1) / SPHERE_TRACER_TILE;
+    int tilesY = (a_image.height + SPHERE_TRACER_TILE - 1) / SPHERE_TRACER_TILE;
+    vector<PreviewStats> workerStats(m_threads);
+
+    parallelFor(tilesX * tilesY, m_threads, [&](int a_tile, int a_worker)
+    {
+        PreviewStats& counts = workerStats[a_worker];
+        const int P = SPHERE_TRACER_PACKET * SPHERE_TRACER_PACKET;
+        int tileX = (a_tile % tilesX) * SPHERE_TRACER_TILE;
+        int tileY = (a_tile / tilesX) * SPHERE_TRACER_TILE;
+
+        for (int py = tileY; py < cMin(tileY + SPHERE_TRACER_TILE, a_image.height); py += SPHERE_TRACER_PACKET)
+            for (int px = tileX; px < cMin(tileX + SPHERE_TRACER_TILE, a_image.width); px += SPHERE_TRACER_PACKET)
+            {
+                // the rays of the packet, clipped to the box
+                int pixel[P];
+                cVector3d direction[P];
+                double t[P], end[P], previous[P];
+                int steps[P];
+                bool hit[P];
+                int active[P];
+                int count = 0, live = 0;
+                for (int y = py; y < cMin(py + SPHERE_TRACER_PACKET, a_image.height); ++y)
+                    for (int x = px; x < cMin(px + SPHERE_TRACER_PACKET, a_image.width); ++x)
+                    {
+                        cVector3d d = forward + (spanX * (2.0 * (x + 0.5) / a_image.width - 1.0)) * right +
+                                      (spanY * (1.0 - 2.0 * (y + 0.5) / a_image.height)) * up;
+                        d.normalize();
+
+                        double near = 0.0, far = 1e300;
+                        for (int axis = 0; axis < 3; ++axis)
+                        {
+                            double inverse = 1.0 / d(axis);
+                            double t0 = (m_lower(axis) - eye(axis)) * inverse;
+                            double t1 = (m_upper(axis) - eye(axis)) * inverse;
+                            near = cMax(near, cMin(t0, t1));
+                            far = cMin(far, cMax(t0, t1));
+                        }
+
+                        pixel[count] = y * a_image.width + x;
+                        direction[count] = d;
+                        t[count] = near;
+                        end[count] = far;
+                        previous[count] = -1.0;
+                        steps[count] = 0;
+                        hit[count] = false;
+                        if (near < far)
+                            active[live++] = count;
+                        count++;
+                    }
+                counts.rays += count;
+
+                // march the live rays together
+                double xs[P], ys[P], zs[P], values[P];
+                while (live > 0)
+                {
+                    for (int n = 0; n < live; ++n)
+                    {
+                        int r = active[n];
+                        xs[n] = eye.x() + t[r] * direction[r].x();
+                        ys[n] = eye.y() + t[r] * direction[r].y();
+                        zs[n] = eye.z() + t[r] * direction[r].z();
+                    }
+                    m_source.valueBatch(xs, ys, zs, live, values);
+                    counts.evaluations += live;
+                    counts.steps += live;
+
+                    int kept = 0;
+                    for (int n = 0; n < live; ++n)
+                    {
+                        int r = active[n];
+                        steps[r]++;
+                        double f = values[n];
+
+                        if (f <= 0.0)
+                        {
+                            // stepped across the surface: bisect back onto it
+                            if (previous[r] >= 0.0)
+                            {
+                                double lo = previous[r], hi = t[r];
+                                for (int k = 0; k < SPHERE_TRACER_BISECTIONS && hi - lo > 1e-3 * m_minStep; ++k)
+                                {
+                                    double mid = 0.5 * (lo + hi);
+                                    counts.evaluations++;
+                                    if (m_source.value(eye + mid * direction[r]) > 0.0)
+                                        lo = mid;
+                                    else
+                                        hi = mid;
+                                }
+                                t[r] = 0.5 * (lo + hi);
+                            }
+                            hit[r] = true;
+                            continue;
+                        }
+
+                        // still outside: step as far as the bound allows
+                        cVector3d point(xs[n], ys[n], zs[n]);
+                        double reach;
+                        double bound = boundAt(point, direction[r], reach);
+
+                        // a bound of zero (a flat cell) lets the ray cross its cell
+                        double step = (bound > 0.0) ? f / bound : reach;
+                        step = cMax(cMin(step, reach + 0.1 * m_minStep), m_minStep);
+                        previous[r] = t[r];
+                        t[r] += step;
+                        if (t[r] < end[r] && steps[r] < SPHERE_TRACER_MAX_STEPS)
+                            active[kept++] = r;
+                    }
+                    live = kept;
+                }
+
+                // shade the packet
+                for (int r = 0; r < count; ++r)
+                {
+                    unsigned char* rgb = &a_image.pixels[3 * (size_t)pixel[r]];
+                    if (!hit[r])
+                    {
+                        // the application's white to light grey backdrop
+                        double v = 1.0 - 0.2 * (pixel[r] / a_image.width) / (double)cMax(a_image.height - 1, 1);
+                        rgb[0] = rgb[1] = rgb[2] = (unsigned char)(255.0 * v + 0.5);
+                        continue;
+                    }
+
+                    counts.hits++;
+                    counts.evaluations++;
+                    cVector3d normal = m_source.gradient(eye + t[r] * direction[r]);
+                    if (normal.length() > 0.0)
+                        normal.normalize();
+                    if (normal.dot(direction[r]) > 0.0)
+                        normal = -normal;
+
+                    cVector3d halfway = key - direction[r];
+                    halfway.normalize();
+                    double diffuse = 0.15 + 0.5 * cMax(0.0, -normal.dot(direction[r])) + 0.45 * cMax(0.0, normal.dot(key));
+                    double specular = 0.25 * pow(cMax(0.0, normal.dot(halfway)), 40.0);
+                    const double base[3] = { 0.80, 0.32, 0.30 };
+                    for (int c = 0; c < 3; ++c)
+                    {
+                        double linear = cMin(1.0, base[c] * diffuse + specular);
+                        rgb[c] = (unsigned char)(255.0 * pow(linear, 1.0 / 2.2) + 0.5);
+                    }
+                }
+            }
+    });
+
+    stats.seconds = secondsSince(start);
+    for (int w = 0; w < m_threads; ++w)
+    {
+        stats.rays += workerStats[w].rays;
+        stats.hits += workerStats[w].hits;
+        stats.steps += workerStats[w].steps;
+        stats.evaluations += workerStats[w].evaluations;
+    }
+    return stats;
+}
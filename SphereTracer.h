@@ -0,0 +1,140 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    A CPU ray marcher that renders an implicit source straight to an
+    image, to preview a shape before it is meshed at a fine granularity
+    and to check shapes on machines without a GPU (see preview.cpp).
+
+    Rays are sphere traced: from a point where the function is f, a
+    function whose gradient is no longer than L cannot reach zero within
+    f / L, so the ray can step that far.  L is either a bound given for
+    the whole box (such as a plugin's Lipschitz bound) or, by default,
+    estimated per cell of a coarse grid over the box from the gradient at
+    the cell's corners, edges and centre, with a safety factor; a step
+    then ends where the ray leaves its cell.  An estimate can fall short
+    of the true bound, so a ray that steps across the surface anyway is
+    bisected back onto it.  A change of sign is the only hit: a bound far
+    above the true one (near a singular point) just shortens the steps,
+    down to a floor, instead of stopping rays short of the surface.
+
+    The image is cut into tiles, handed out to the threads one by one;
+    each tile is traced in square packets of rays whose points are
+    evaluated together through ImplicitSource::valueBatch().  Hits are
+    shaded with the gradient of the source.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#ifndef SPHERETRACER_H
+#define SPHERETRACER_H
+
+#include "ImplicitSource.h"
+#include <string>
+#include <vector>
+
+//! Side, in pixels, of the tiles handed out to threads.
+#define SPHERE_TRACER_TILE 16
+
+//! Side, in pixels, of the packets of rays traced together.
+#define SPHERE_TRACER_PACKET 8
+
+//! Cells per axis of the grid of local gradient bounds.
+#define SPHERE_TRACER_CELLS 16
+
+//! Factor applied to the largest gradient sampled in a cell.
+#define SPHERE_TRACER_SAFETY 2.0
+
+//! Steps after which a ray is given up as a miss.
+#define SPHERE_TRACER_MAX_STEPS 1024
+
+//! Shortest step, relative to the diagonal of the box, so that a ray can
+//! cross the box within SPHERE_TRACER_MAX_STEPS steps however high the
+//! bound; features thinner than this can be stepped over.
+#define SPHERE_TRACER_MIN_STEP 1e-3
+
+//! Bisections narrowing down a ray that stepped across the surface.
+#define SPHERE_TRACER_BISECTIONS 20
+
+//! An 8-bit RGB image, row by row from the top.
+struct PreviewImage
+{
+    PreviewImage() : width(0), height(0) {}
+
+    int width;
+    int height;
+    std::vector<unsigned char> pixels;
+
+    //! Write a binary PPM, or an (uncompressed) PNG if a_fileName ends in .png.
+    bool save(const std::string& a_fileName) const;
+};
+
+//! Where the camera looks at the box from; it frames the whole box.
+struct PreviewView
+{
+    PreviewView() : azimuth(30.0), elevation(20.0), fieldOfView(35.0) {}
+
+    //! Degrees around the z (up) axis from +x, and above the xy plane.
+    double azimuth;
+    double elevation;
+
+    //! Vertical field of view, in degrees.
+    double fieldOfView;
+};
+
+//! What a render cost.
+struct PreviewStats
+{
+    PreviewStats() : setupSeconds(0.0), seconds(0.0), rays(0), hits(0), steps(0), evaluations(0) {}
+
+    //! Seconds spent estimating gradient bounds, and tracing.
+    double setupSeconds;
+    double seconds;
+
+    //! Primary rays, rays that hit the surface, sphere tracing steps, and
+    //! evaluations of the source (gradients for shading included).
+    long long rays;
+    long long hits;
+    long long steps;
+    long long evaluations;
+
+    double getMegaraysPerSecond() const { return (seconds > 0.0) ? 1e-6 * rays / seconds : 0.0; }
+};
+
+class SphereTracer
+{
+public:
+    //! Trace a_source inside the box [a_lower, a_upper], outside which it
+    //! must be positive, on a_threads threads (0 for one per core).
+    SphereTracer(const ImplicitSource& a_source, const chai3d::cVector3d& a_lower,
+                 const chai3d::cVector3d& a_upper, int a_threads = 0);
+
+    //! Bound the gradient by a_bound over the whole box, instead of
+    //! estimating local bounds (0 to estimate them again).
+    void setLipschitz(double a_bound) { m_lipschitz = a_bound; }
+
+    //! Render the box seen from a_view into a_image, whose size must be set.
+    PreviewStats render(const PreviewView& a_view, PreviewImage& a_image);
+
+private:
+    //! Sample the gradient over the box into m_bounds.
+    void estimateBounds(PreviewStats& a_stats);
+
+    //! Gradient bound around a_point, and how far along a_direction it holds.
+    double boundAt(const chai3d::cVector3d& a_point, const chai3d::cVector3d& a_direction, double& a_reach) const;
+
+    const ImplicitSource& m_source;
+    chai3d::cVector3d m_lower;
+    chai3d::cVector3d m_upper;
+    int m_threads;
+    double m_lipschitz;
+    double m_minStep;
+
+    //! Gradient bound of each cell, x fastest, when no global bound is set.
+    std::vector<double> m_bounds;
+    chai3d::cVector3d m_cellSize;
+};
+
+#endif
@@ -0,0 +1,337 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    Procedural micro-texture on implicit surfaces.  See SurfaceTexture.h.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#include "SurfaceTexture.h"
+#include <math.h>
+#include <stdint.h>
+
+using namespace chai3d;
+
+//------------------------------------------------------------------------------
+
+SurfaceTexture::SurfaceTexture(SurfaceTexturePattern a_pattern, double a_amplitude, double a_wavelength,
+                               int a_octaves, const cVector3d& a_direction)
+    : m_pattern(a_pattern), m_amplitude(a_amplitude), m_wavelength(cMax(a_wavelength, C_SMALL)),
+      m_octaves(cClamp(a_octaves, 0, SURFACE_TEXTURE_MAX_OCTAVES)), m_direction(a_direction)
+{
+    if (m_direction.length() < C_SMALL)
+        m_direction.set(0.0, 0.0, 1.0);
+    m_direction.normalize();
+
+    // the displaced surface folds over where the height rises along the
+    // normal faster than the surface moves, and every octave is as steep as
+    // the first: scale the amplitude down until the sum is gentle enough
+    double slope = getSlope();
+    if (slope > SURFACE_TEXTURE_MAX_SLOPE)
+        m_amplitude *= SURFACE_TEXTURE_MAX_SLOPE / slope;
+}
+
+double SurfaceTexture::getReach() const
+{
+    // a ridge is a sine; noise is no higher than half the diagonal of its
+    // cell times its longest gradient (sqrt 3 long)
+    double peak = (m_pattern == TEXTURE_RIDGES) ? 1.0 : 1.5;
+    double reach = 0.0;
+    for (int k = 0; k < m_octaves; ++k)
+        reach += peak * ldexp(m_amplitude, -k);
+    return reach;
+}
+
+double SurfaceTexture::getSlope() const
+{
+    // a ridge is a sine of 2 pi times its frequency; an octave of noise
+    // slopes less than three times its frequency (sampled, about 2.8)
+    double peak = (m_pattern == TEXTURE_RIDGES) ? 2.0 * C_PI : 3.0;
+    return peak * fabs(m_amplitude) / m_wavelength * m_octaves;
+}
+
+int SurfaceTexture::getMeshedOctaves(double a_spacing) const
+{
+    int count = 0;
+    while (count < m_octaves && ldexp(m_wavelength, -count) >= SURFACE_TEXTURE_MESH_SAMPLES * a_spacing)
+        count++;
+    return count;
+}
+
+double SurfaceTexture::getFinestWavelength(int a_last) const
+{
+    return ldexp(m_wavelength, -cMax(cMin(a_last, m_octaves) - 1, 0));
+}
+
+//------------------------------------------------------------------------------
+
+namespace
+{
+    // a pseudo-random 32-bit hash of a lattice point, differing per octave
+    inline uint32_t hashLattice(int32_t a_i, int32_t a_j, int32_t a_k, uint32_t a_seed)
+    {
+        uint32_t h = ((uint32_t)a_i * 0x8da6b343u) ^ ((uint32_t)a_j * 0xd8163841u) ^
+                     ((uint32_t)a_k * 0xcb1ab31fu) ^ a_seed;
+        h ^= h >> 13;
+        h *= 0x5bd1e995u;
+        h ^= h >> 15;
+        return h;
+    }
+}
+
+//===========================================================================
+/*!
+    Height of the texture at LANES points, and its gradient.  Each octave
+    of noise interpolates, between the eight corners of the cell of the
+    lattice around a point, the planes through the corners along their
+    hashed gradients; the weights of the corners are products of the
+    quintic fade 6t^5 - 15t^4 + 10t^3 along each axis, whose derivatives
+    give the gradient exactly.
+
+    \param  a_x  LANES x coordinates (likewise a_y and a_z).
+    \param  a_first  First octave summed.
+    \param  a_last  Octave after the last one summed.
+    \param  a_h  Returns the LANES heights.
+    \param  a_hx  Returns the x components of their gradients (likewise a_hy, a_hz).
+*/
+//===========================================================================
+template <int LANES>
+void SurfaceTexture::heightBlock(const double* a_x, const double* a_y, const double* a_z, int a_first,
+                                 int a_last, double* a_h, double* a_hx, double* a_hy, double* a_hz) const
+{
+    double h[LANES], hx[LANES], hy[LANES], hz[LANES];
+    for (int l = 0; l < LANES; ++l)
+        h[l] = hx[l] = hy[l] = hz[l] = 0.0;
+
+    for (int k = a_first; k < a_last && k < m_octaves; ++k)
+    {
+        double amplitude = ldexp(m_amplitude, -k);
+        double frequency = ldexp(1.0, k) / m_wavelength;
+
+        if (m_pattern == TEXTURE_RIDGES)
+        {
+            double dx = m_direction.x(), dy = m_direction.y(), dz = m_direction.z();
+            double omega = 2.0 * C_PI * frequency;
+            for (int l = 0; l < LANES; ++l)
+            {
+                double t = omega * (dx * a_x[l] + dy * a_y[l] + dz * a_z[l]);
+                double slope = amplitude * omega * cos(t);
+                h[l] += amplitude * sin(t);
+                hx[l] += slope * dx;
+                hy[l] += slope * dy;
+                hz[l] += slope * dz;
+            }
+            continue;
+        }
+
+        // the cell of each point and where in it the point lies, with the
+        // fade along each axis and its derivative; each octave is shifted
+        // so that the lattices of the octaves do not line up
+        double shift = 0.6180339887 * k;
+        uint32_t seed = 0x9e3779b9u * (uint32_t)(k + 1);
+        int32_t cell[3][LANES];
+        double f[3][LANES], fade[3][LANES], slope[3][LANES];
+        const double* coordinates[3] = { a_x, a_y, a_z };
+        for (int axis = 0; axis < 3; ++axis)
+            for (int l = 0; l < LANES; ++l)
+            {
+                double p = frequency * coordinates[axis][l] + shift;
+                double c = floor(p);
+                double t = p - c;
+                cell[axis][l] = (int32_t)c;
+                f[axis][l] = t;
+                fade[axis][l] = t * t * t * (t * (6.0 * t - 15.0) + 10.0);
+                slope[axis][l] = 30.0 * t * t * (t * (t - 2.0) + 1.0);
+            }
+
+        // the corners in turn, each over all the lanes
+        double n[LANES], nx[LANES], ny[LANES], nz[LANES];
+        for (int l = 0; l < LANES; ++l)
+            n[l] = nx[l] = ny[l] = nz[l] = 0.0;
+        for (int corner = 0; corner < 8; ++corner)
+        {
+            int ci = corner & 1, cj = (corner >> 1) & 1, ck = corner >> 2;
+            for (int l = 0; l < LANES; ++l)
+            {
+                uint32_t hash = hashLattice(cell[0][l] + ci, cell[1][l] + cj, cell[2][l] + ck, seed);
+                double gx = (int32_t)(hash & 0x3ff) * (2.0 / 1023.0) - 1.0;
+                double gy = (int32_t)((hash >> 10) & 0x3ff) * (2.0 / 1023.0) - 1.0;
+                double gz = (int32_t)((hash >> 20) & 0x3ff) * (2.0 / 1023.0) - 1.0;
+                double plane = gx * (f[0][l] - ci) + gy * (f[1][l] - cj) + gz * (f[2][l] - ck);
+
+                // the weight of the corner, and its derivative along each axis
+                double wx = ci ? fade[0][l] : 1.0 - fade[0][l];
+                double wy = cj ? fade[1][l] : 1.0 - fade[1][l];
+                double wz = ck ? fade[2][l] : 1.0 - fade[2][l];
+                double dwx = ci ? slope[0][l] : -slope[0][l];
+                double dwy = cj ? slope[1][l] : -slope[1][l];
+                double dwz = ck ? slope[2][l] : -slope[2][l];
+                double weight = wx * wy * wz;
+                n[l] += weight * plane;
+                nx[l] += dwx * wy * wz * plane + weight * gx;
+                ny[l] += wx * dwy * wz * plane + weight * gy;
+                nz[l] += wx * wy * dwz * plane + weight * gz;
+            }
+        }
+
+        for (int l = 0; l < LANES; ++l)
+        {
+            h[l] += amplitude * n[l];
+            hx[l] += amplitude * frequency * nx[l];
+            hy[l] += amplitude * frequency * ny[l];
+            hz[l] += amplitude * frequency * nz[l];
+        }
+    }
+
+    for (int l = 0; l < LANES; ++l)
+    {
+        a_h[l] = h[l];
+        a_hx[l] = hx[l];
+        a_hy[l] = hy[l];
+        a_hz[l] = hz[l];
+    }
+}
+
+void SurfaceTexture::heightBatch(const double* a_x, const double* a_y, const double* a_z, int a_count,
+                                 int a_first, int a_last, double* a_h, double* a_hx, double* a_hy,
+                                 double* a_hz) const
+{
+    const int W = SURFACE_TEXTURE_BATCH_WIDTH;
+    int n = 0;
+    for (; n + W <= a_count; n += W)
+        heightBlock<W>(a_x + n, a_y + n, a_z + n, a_first, a_last, a_h + n, a_hx + n, a_hy + n, a_hz + n);
+    for (; n < a_count; ++n)
+        heightBlock<1>(a_x + n, a_y + n, a_z + n, a_first, a_last, a_h + n, a_hx + n, a_hy + n, a_hz + n);
+}
+
+//------------------------------------------------------------------------------
+
+int TextureCache::setOf(const double a_point[3], double a_reach)
+{
+    long long i = (long long)floor(a_point[0] / a_reach);
+    long long j = (long long)floor(a_point[1] / a_reach);
+    long long k = (long long)floor(a_point[2] / a_reach);
+    unsigned long long hash = (unsigned long long)(i * 73856093LL) ^
+                              (unsigned long long)(j * 19349663LL) ^
+                              (unsigned long long)(k * 83492791LL);
+    hash = (hash ^ (hash >> 31)) * 0xbf58476d1ce4e5b9ull;
+    return (int)((hash >> 32) & (SURFACE_TEXTURE_CACHE_SIZE / 2 - 1));
+}
+
+bool TextureCache::lookup(const double a_point[3], unsigned int a_version, double a_reach,
+                          double& a_h, double a_gradient[3])
+{
+    Entry* set = &m_entries[2 * setOf(a_point, a_reach)];
+    for (int way = 0; way < 2; ++way)
+    {
+        const Entry& entry = set[way];
+        double dx = a_point[0] - entry.point[0];
+        double dy = a_point[1] - entry.point[1];
+        double dz = a_point[2] - entry.point[2];
+        if (!entry.valid || entry.version != a_version || dx * dx + dy * dy + dz * dz > a_reach * a_reach)
+            continue;
+
+        a_h = entry.h + entry.gradient[0] * dx + entry.gradient[1] * dy + entry.gradient[2] * dz;
+        for (int i = 0; i < 3; ++i)
+            a_gradient[i] = entry.gradient[i];
+
+        // the entry used last comes first, so a store replaces the other
+        if (way == 1)
+        {
+            Entry used = set[1];
+            set[1] = set[0];
+            set[0] = used;
+        }
+        return true;
+    }
+    return false;
+}
+
+void TextureCache::store(const double a_point[3], unsigned int a_version, double a_reach,
+                         double a_h, const double a_gradient[3])
+{
+    Entry* set = &m_entries[2 * setOf(a_point, a_reach)];
+    set[1] = set[0];
+    Entry& entry = set[0];
+    for (int i = 0; i < 3; ++i)
+    {
+        entry.point[i] = a_point[i];
+        entry.gradient[i] = a_gradient[i];
+    }
+    entry.h = a_h;
+    entry.version = a_version;
+    entry.valid = true;
+}
+
+void TextureCache::clear()
+{
+    for (int n = 0; n < SURFACE_TEXTURE_CACHE_SIZE; ++n)
+        m_entries[n].valid = false;
+}
+
+//------------------------------------------------------------------------------
+
+double TexturedSource::evaluate(const cVector3d& a_point, cVector3d& a_gradient) const
+{
+    cVector3d g;
+    double f = m_base.evaluate(a_point, g);
+
+    // the height, from the cache if one near enough was computed
+    double point[3] = { a_point.x(), a_point.y(), a_point.z() };
+    double h, hg[3];
+    double reach = SURFACE_TEXTURE_CACHE_REACH * m_texture->getFinestWavelength(m_last);
+    if (!m_cache || !m_cache->lookup(point, m_version, reach, h, hg))
+    {
+        m_texture->heightBatch(&point[0], &point[1], &point[2], 1, m_first, m_last, &h, &hg[0], &hg[1], &hg[2]);
+        if (m_cache)
+            m_cache->store(point, m_version, reach, h, hg);
+    }
+
+    double slope = g.length();
+    a_gradient.set(g.x() - slope * hg[0], g.y() - slope * hg[1], g.z() - slope * hg[2]);
+    return f - slope * h;
+}
+
+void TexturedSource::valueBatch(const double* a_x, const double* a_y, const double* a_z, int a_count,
+                                double* a_values) const
+{
+    // the displacement needs the gradient of the base anyway
+    const int W = SURFACE_TEXTURE_BATCH_WIDTH;
+    double gx[W], gy[W], gz[W];
+    for (int n = 0; n < a_count; n += W)
+    {
+        int count = cMin(W, a_count - n);
+        evaluateBatch(a_x + n, a_y + n, a_z + n, count, a_values + n, gx, gy, gz);
+    }
+}
+
+void TexturedSource::evaluateBatch(const double* a_x, const double* a_y, const double* a_z, int a_count,
+                                   double* a_values, double* a_gx, double* a_gy, double* a_gz) const
+{
+    if (!a_gx || !a_gy || !a_gz)
+    {
+        valueBatch(a_x, a_y, a_z, a_count, a_values);
+        return;
+    }
+
+    const int W = SURFACE_TEXTURE_BATCH_WIDTH;
+    double h[W], hx[W], hy[W], hz[W];
+    m_base.evaluateBatch(a_x, a_y, a_z, a_count, a_values, a_gx, a_gy, a_gz);
+    for (int n = 0; n < a_count; n += W)
+    {
+        int count = cMin(W, a_count - n);
+        m_texture->heightBatch(a_x + n, a_y + n, a_z + n, count, m_first, m_last, h, hx, hy, hz);
+        for (int l = 0; l < count; ++l)
+        {
+            int p = n + l;
+            double slope = sqrt(a_gx[p] * a_gx[p] + a_gy[p] * a_gy[p] + a_gz[p] * a_gz[p]);
+            a_values[p] -= slope * h[l];
+            a_gx[p] -= slope * hx[l];
+            a_gy[p] -= slope * hy[l];
+            a_gz[p] -= slope * hz[l];
+        }
+    }
+}
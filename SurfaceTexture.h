@@ -0,0 +1,213 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    Micro-texture laid over a smooth implicit surface.  A texture is a
+    height h(p), in units of length: gradient noise (as Perlin's, with a
+    quintic fade so that the height is smooth to the second derivative)
+    or a periodic pattern of ridges.  Either is summed over octaves, each
+    half the wavelength and half the amplitude of the one before.
+
+    TexturedSource lays a texture over any source by displacing its
+    surface outwards by h along the normal:
+
+        f'(p) = f(p) - |grad f(p)| h(p)
+        grad f'(p) ~ grad f(p) - |grad f(p)| grad h(p)
+
+    which to first order keeps f' / |grad f'| the distance to the new
+    surface.  The term of the gradient in the change of |grad f| is left
+    out: it would need second derivatives of f, and it is small beside
+    grad h, which grows as the wavelength shrinks.
+
+    The height is computed over blocks of SURFACE_TEXTURE_BATCH_WIDTH
+    points at once, each step over all the points of the block in turn,
+    so the compiler can vectorize it; a single point runs the same code
+    on one lane.
+
+    A haptic tick rarely asks for exactly the same point twice, but the
+    last Newton steps of a projection, and the ticks of a tool resting on
+    the surface, ask for points within a hair of each other.  Each tool
+    keeps a TextureCache of the heights it computed, and a height is
+    extended to first order, h(a) + grad h(a) . (p - a), to points within
+    SURFACE_TEXTURE_CACHE_REACH of the finest wavelength of it.  That is
+    off from the height itself by about 1e-5 of the amplitude, and its
+    gradient by under a percent.
+
+    A mesh cannot show detail much finer than its lattice: the octaves
+    with fewer than SURFACE_TEXTURE_MESH_SAMPLES lattice points per
+    wavelength are left out of the mesh and the sampled grid, and a tick
+    on the grid adds just those.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#ifndef SURFACETEXTURE_H
+#define SURFACETEXTURE_H
+
+#include "ImplicitSource.h"
+
+//! Most octaves of a texture.
+#define SURFACE_TEXTURE_MAX_OCTAVES 8
+
+//! Points whose height is computed together.
+#define SURFACE_TEXTURE_BATCH_WIDTH 8
+
+//! Steepest a texture may get; past 1 the displaced surface folds over.
+#define SURFACE_TEXTURE_MAX_SLOPE 0.7
+
+//! Lattice points per wavelength an octave needs to be meshed.
+#define SURFACE_TEXTURE_MESH_SAMPLES 4.0
+
+//! Heights remembered by a TextureCache, two per set; a power of two.
+#define SURFACE_TEXTURE_CACHE_SIZE 8
+
+//! Distance, in finest wavelengths, over which a remembered height is
+//! extended to first order.
+#define SURFACE_TEXTURE_CACHE_REACH (1.0 / 1024.0)
+
+enum SurfaceTexturePattern
+{
+    TEXTURE_NOISE,
+    TEXTURE_RIDGES
+};
+
+class SurfaceTexture
+{
+public:
+    //! A texture of a_octaves octaves, the first of which has a_amplitude
+    //! and a_wavelength.  Ridges run across a_direction.  The amplitude is
+    //! scaled down if the texture would be steeper than
+    //! SURFACE_TEXTURE_MAX_SLOPE.  A texture must not change while it is
+    //! rendered: make another and set that.
+    SurfaceTexture(SurfaceTexturePattern a_pattern = TEXTURE_NOISE, double a_amplitude = 0.002,
+                   double a_wavelength = 0.02, int a_octaves = 3,
+                   const chai3d::cVector3d& a_direction = chai3d::cVector3d(0.0, 0.0, 1.0));
+
+    SurfaceTexturePattern getPattern() const { return m_pattern; }
+    double getAmplitude() const { return m_amplitude; }
+    double getWavelength() const { return m_wavelength; }
+    int getOctaveCount() const { return m_octaves; }
+
+    //! The highest the height can be either side of the surface.
+    double getReach() const;
+
+    //! The steepest the height can slope, summed over the octaves.
+    double getSlope() const;
+
+    //! Octaves meshed on a lattice of spacing a_spacing, the first ones.
+    int getMeshedOctaves(double a_spacing) const;
+
+    //! Wavelength of the finest octave below a_last.
+    double getFinestWavelength(int a_last) const;
+
+    //! Height at a_count points, with its gradient, summed over the
+    //! octaves from a_first up to a_last (excluded).
+    void heightBatch(const double* a_x, const double* a_y, const double* a_z, int a_count,
+                     int a_first, int a_last, double* a_h, double* a_hx, double* a_hy, double* a_hz) const;
+
+private:
+    //! One block of at most SURFACE_TEXTURE_BATCH_WIDTH points.
+    template <int LANES>
+    void heightBlock(const double* a_x, const double* a_y, const double* a_z, int a_first, int a_last,
+                     double* a_h, double* a_hx, double* a_hy, double* a_hz) const;
+
+    SurfaceTexturePattern m_pattern;
+    double m_amplitude;
+    double m_wavelength;
+    int m_octaves;
+    chai3d::cVector3d m_direction;
+};
+
+//! Heights of a texture that one tool (and so one haptic thread) has
+//! computed, each for the version of the shape it was computed on.  The
+//! heights near a point go to one set of two entries, the one used last
+//! kept, so that a tick's tool position and proxy do not push each other
+//! out.
+class TextureCache
+{
+public:
+    TextureCache() { clear(); }
+
+    //! The height, with its gradient, at a_point from one remembered
+    //! within a_reach of it on version a_version of the shape.
+    bool lookup(const double a_point[3], unsigned int a_version, double a_reach,
+                double& a_h, double a_gradient[3]);
+
+    //! Remember the height at a_point, replacing whatever shared its slot.
+    void store(const double a_point[3], unsigned int a_version, double a_reach,
+               double a_h, const double a_gradient[3]);
+
+    //! Forget every entry.
+    void clear();
+
+private:
+    struct Entry
+    {
+        double point[3];
+        double h;
+        double gradient[3];
+        unsigned int version;
+        bool valid;
+    };
+
+    static int setOf(const double a_point[3], double a_reach);
+
+    Entry m_entries[SURFACE_TEXTURE_CACHE_SIZE];
+};
+
+//===========================================================================
+/*
+    A source with a texture laid over it: the octaves from a_first up to
+    a_last of a_texture (which must not be NULL once the source is
+    queried) displace the surface of a_base.  With a cache, the heights of
+    single points are taken from it and kept in it for version a_version
+    of the shape, and the source belongs to the thread that owns the
+    cache; without one, it is as thread-safe as a_base.
+*/
+//===========================================================================
+class TexturedSource : public ImplicitSource
+{
+public:
+    TexturedSource(const ImplicitSource& a_base, const SurfaceTexture* a_texture,
+                   int a_first = 0, int a_last = SURFACE_TEXTURE_MAX_OCTAVES,
+                   TextureCache* a_cache = 0, unsigned int a_version = 0)
+        : m_base(a_base), m_texture(a_texture), m_first(a_first), m_last(a_last), m_cache(a_cache),
+          m_version(a_version) {}
+
+    const ImplicitSource& getBase() const { return m_base; }
+
+    virtual double value(const chai3d::cVector3d& a_point) const
+    {
+        chai3d::cVector3d g;
+        return evaluate(a_point, g);
+    }
+
+    virtual chai3d::cVector3d gradient(const chai3d::cVector3d& a_point) const
+    {
+        chai3d::cVector3d g;
+        evaluate(a_point, g);
+        return g;
+    }
+
+    virtual double evaluate(const chai3d::cVector3d& a_point, chai3d::cVector3d& a_gradient) const;
+
+    virtual void valueBatch(const double* a_x, const double* a_y, const double* a_z, int a_count,
+                            double* a_values) const;
+
+    virtual void evaluateBatch(const double* a_x, const double* a_y, const double* a_z, int a_count,
+                               double* a_values, double* a_gx = 0, double* a_gy = 0, double* a_gz = 0) const;
+
+    virtual void prefetch(const chai3d::cVector3d& a_point) const { m_base.prefetch(a_point); }
+
+private:
+    const ImplicitSource& m_base;
+    const SurfaceTexture* m_texture;
+    int m_first;
+    int m_last;
+    TextureCache* m_cache;
+    unsigned int m_version;
+};
+
+#endif
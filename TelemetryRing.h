@@ -0,0 +1,73 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    A fixed-capacity single-producer/single-consumer ring buffer used to
+    hand per-tick snapshots from a haptic thread to the graphics loop (or
+    a logger) without locks.  The producer never blocks: when the ring is
+    full the newest sample is dropped and counted.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#ifndef TELEMETRYRING_H
+#define TELEMETRYRING_H
+
+#include <atomic>
+
+template <typename T, unsigned int N>
+class TelemetryRing
+{
+    static_assert((N & (N - 1)) == 0, "TelemetryRing capacity must be a power of two");
+
+public:
+    TelemetryRing() : m_head(0), m_tail(0), m_dropped(0) {}
+
+    //! Producer side: append a sample. Returns false (and drops it) if full.
+    bool push(const T& a_item)
+    {
+        unsigned int head = m_head.load(std::memory_order_relaxed);
+        if (head - m_tail.load(std::memory_order_acquire) == N)
+        {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        m_items[head & (N - 1)] = a_item;
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    //! Consumer side: remove the oldest sample. Returns false if empty.
+    bool pop(T& a_item)
+    {
+        unsigned int tail = m_tail.load(std::memory_order_relaxed);
+        if (tail == m_head.load(std::memory_order_acquire))
+            return false;
+        a_item = m_items[tail & (N - 1)];
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    //! Consumer side: discard everything but the newest sample. Returns false if empty.
+    bool popLatest(T& a_item)
+    {
+        bool any = false;
+        while (pop(a_item))
+            any = true;
+        return any;
+    }
+
+    //! Number of samples dropped because the consumer fell behind.
+    unsigned int getDropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+private:
+    // producer and consumer indices live on separate cache lines
+    alignas(64) std::atomic<unsigned int> m_head;
+    alignas(64) std::atomic<unsigned int> m_tail;
+    alignas(64) std::atomic<unsigned int> m_dropped;
+    T m_items[N];
+};
+
+#endif
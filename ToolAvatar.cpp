@@ -0,0 +1,234 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    Tools of finite size touching implicit surfaces.  See ToolAvatar.h.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#include "ToolAvatar.h"
+#include <math.h>
+
+using namespace chai3d;
+using namespace std;
+
+//------------------------------------------------------------------------------
+
+ToolAvatar::ToolAvatar(const vector<cVector3d>& a_points) : m_reach(0.0)
+{
+    int count = cMin((int)a_points.size(), TOOL_AVATAR_MAX_POINTS);
+    for (int n = 0; n < count; ++n)
+    {
+        m_x.push_back(a_points[n].x());
+        m_y.push_back(a_points[n].y());
+        m_z.push_back(a_points[n].z());
+        m_reach = cMax(m_reach, a_points[n].length());
+    }
+}
+
+ToolAvatar ToolAvatar::sphere(double a_radius, int a_count)
+{
+    int count = cClamp(a_count, 1, TOOL_AVATAR_MAX_POINTS);
+    vector<cVector3d> points;
+    for (int i = 0; i < count; ++i)
+    {
+        double z = 1.0 - (2.0 * i + 1.0) / count;
+        double phi = i * C_PI * (3.0 - sqrt(5.0));
+        double r = sqrt(1.0 - z * z);
+        points.push_back(a_radius * cVector3d(r * cos(phi), r * sin(phi), z));
+    }
+    return ToolAvatar(points);
+}
+
+void ToolAvatar::sample(const ImplicitSource& a_source, const cVector3d& a_centre,
+                        ToolAvatarSamples& a_samples) const
+{
+    int count = getPointCount();
+    double cx = a_centre.x(), cy = a_centre.y(), cz = a_centre.z();
+    for (int n = 0; n < count; ++n)
+    {
+        a_samples.x[n] = cx + m_x[n];
+        a_samples.y[n] = cy + m_y[n];
+        a_samples.z[n] = cz + m_z[n];
+    }
+    a_samples.centre = a_centre;
+    a_samples.count = count;
+    a_source.evaluateBatch(a_samples.x, a_samples.y, a_samples.z, count,
+                           a_samples.value, a_samples.gx, a_samples.gy, a_samples.gz);
+
+    // the plane of each point, once for the solves of the tick
+    for (int n = 0; n < count; ++n)
+    {
+        double length = sqrt(a_samples.gx[n] * a_samples.gx[n] + a_samples.gy[n] * a_samples.gy[n] +
+                             a_samples.gz[n] * a_samples.gz[n]);
+        double inverse = (length > 0.0) ? 1.0 / length : 0.0;
+        a_samples.gx[n] *= inverse;
+        a_samples.gy[n] *= inverse;
+        a_samples.gz[n] *= inverse;
+        a_samples.distance[n] = (length > 0.0) ? a_samples.value[n] * inverse : 1e300;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+namespace
+{
+    // solve a_gram a_r = a_b for the a_count (up to 3) planes held
+    void solveGram(int a_count, const double a_gram[3][3], const double a_b[3], double a_r[3])
+    {
+        const double (*g)[3] = a_gram;
+        if (a_count == 1)
+        {
+            a_r[0] = a_b[0] / g[0][0];
+        }
+        else if (a_count == 2)
+        {
+            double det = g[0][0] * g[1][1] - g[0][1] * g[1][0];
+            a_r[0] = (a_b[0] * g[1][1] - a_b[1] * g[0][1]) / det;
+            a_r[1] = (g[0][0] * a_b[1] - g[1][0] * a_b[0]) / det;
+        }
+        else if (a_count == 3)
+        {
+            double c00 = g[1][1] * g[2][2] - g[1][2] * g[2][1];
+            double c01 = g[1][2] * g[2][0] - g[1][0] * g[2][2];
+            double c02 = g[1][0] * g[2][1] - g[1][1] * g[2][0];
+            double det = g[0][0] * c00 + g[0][1] * c01 + g[0][2] * c02;
+            a_r[0] = (a_b[0] * c00 + a_b[1] * (g[0][2] * g[2][1] - g[0][1] * g[2][2]) +
+                      a_b[2] * (g[0][1] * g[1][2] - g[0][2] * g[1][1])) / det;
+            a_r[1] = (a_b[0] * c01 + a_b[1] * (g[0][0] * g[2][2] - g[0][2] * g[2][0]) +
+                      a_b[2] * (g[0][2] * g[1][0] - g[0][0] * g[1][2])) / det;
+            a_r[2] = (a_b[0] * c02 + a_b[1] * (g[0][1] * g[2][0] - g[0][0] * g[2][1]) +
+                      a_b[2] * (g[0][0] * g[1][1] - g[0][1] * g[1][0])) / det;
+        }
+    }
+}
+
+//===========================================================================
+/*!
+    Project a_target onto the positions that keep every point outside its
+    tangent plane: relative to the centre of the samples, point n asks for
+    n_n . u >= -distance_n.  The dual active set method keeps the planes
+    that hold the current position, with how hard each pushes; the plane
+    most in the way is added by stepping along it, within the planes held,
+    until it is met, or until a plane held stops pushing and is dropped
+    first.
+
+    \param  a_samples  The points, evaluated around their centre.
+    \param  a_target  Position to get as near to as possible.
+    \param  a_result  Returns the position found.
+    \return Number of planes holding it (0 if a_target is free).
+*/
+//===========================================================================
+int ToolAvatar::solve(const ToolAvatarSamples& a_samples, const cVector3d& a_target,
+                      cVector3d& a_result) const
+{
+    const double* nx = a_samples.gx;
+    const double* ny = a_samples.gy;
+    const double* nz = a_samples.gz;
+    const double* d = a_samples.distance;
+    const double tolerance = 1e-10 * cMax(m_reach, C_SMALL);
+
+    cVector3d target = a_target - a_samples.centre;
+    double ux = target.x(), uy = target.y(), uz = target.z();
+
+    // the planes held, and how hard each pushes
+    int held[3];
+    double push[3];
+    int count = 0;
+
+    int iterations = 0;
+    while (iterations < TOOL_AVATAR_ITERATIONS)
+    {
+        // the plane most in the way
+        int p = -1;
+        double slack = -tolerance;
+        for (int n = 0; n < a_samples.count; ++n)
+        {
+            double s = nx[n] * ux + ny[n] * uy + nz[n] * uz + d[n];
+            if (s < slack)
+            {
+                slack = s;
+                p = n;
+            }
+        }
+        if (p < 0)
+            break;
+
+        double pushP = 0.0;
+        bool added = false;
+        while (!added && iterations++ < TOOL_AVATAR_ITERATIONS)
+        {
+            // how the planes held must give way to plane p (r), and the
+            // direction p can still be met along without leaving them (z)
+            double gram[3][3], b[3], r[3];
+            for (int i = 0; i < count; ++i)
+            {
+                int a = held[i];
+                for (int j = 0; j < count; ++j)
+                    gram[i][j] = nx[a] * nx[held[j]] + ny[a] * ny[held[j]] + nz[a] * nz[held[j]];
+                b[i] = nx[a] * nx[p] + ny[a] * ny[p] + nz[a] * nz[p];
+            }
+            solveGram(count, gram, b, r);
+            double zx = nx[p], zy = ny[p], zz = nz[p];
+            for (int i = 0; i < count; ++i)
+            {
+                zx -= r[i] * nx[held[i]];
+                zy -= r[i] * ny[held[i]];
+                zz -= r[i] * nz[held[i]];
+            }
+            double zSq = zx * zx + zy * zy + zz * zz;
+
+            // the step that meets plane p, and the one at which a plane held stops pushing
+            double full = (zSq > 1e-12 && count < 3) ? -slack / zSq : 1e300;
+            double partial = 1e300;
+            int drop = -1;
+            for (int i = 0; i < count; ++i)
+                if (r[i] > 1e-12 && push[i] / r[i] < partial)
+                {
+                    partial = push[i] / r[i];
+                    drop = i;
+                }
+            if (full >= 1e300 && drop < 0)
+            {
+                // the planes cannot all be met; stay as near as they allow
+                iterations = TOOL_AVATAR_ITERATIONS;
+                break;
+            }
+
+            double step = cMin(full, partial);
+            if (full < 1e300)
+            {
+                ux += step * zx;
+                uy += step * zy;
+                uz += step * zz;
+            }
+            for (int i = 0; i < count; ++i)
+                push[i] -= step * r[i];
+            pushP += step;
+            slack = nx[p] * ux + ny[p] * uy + nz[p] * uz + d[p];
+
+            if (full <= partial)
+            {
+                held[count] = p;
+                push[count] = pushP;
+                count++;
+                added = true;
+            }
+            else
+            {
+                for (int i = drop; i + 1 < count; ++i)
+                {
+                    held[i] = held[i + 1];
+                    push[i] = push[i + 1];
+                }
+                count--;
+            }
+        }
+    }
+
+    a_result = a_samples.centre + cVector3d(ux, uy, uz);
+    return count;
+}
@@ -0,0 +1,108 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    A tool of finite size for ImplicitMesh, in place of the single point
+    of Salisbury & Tarr: a set of contact points around the tool position,
+    such as points spread over the tool sphere, that all stay outside the
+    surface.
+
+    On each tick every point is evaluated, value and gradient, in one call
+    to ImplicitSource::evaluateBatch(), around the proxy while the avatar
+    is held on the surface and around the tool otherwise.  Each point then
+    gives the tangent plane of the surface there, and the proxy is the
+    position nearest the tool (or, while friction holds it, nearest its
+    previous position) at which every point is outside its plane.  That
+    small projection is solved exactly by the dual active set method of
+    Goldfarb & Idnani: starting at the target, the plane most in the way
+    is added, and a plane that no longer pushes is dropped, until no
+    plane is crossed; at most three hold the proxy at once, however many
+    points touch.  A curved surface leaves the avatar slightly off the
+    linearized planes, or inside them; ImplicitMesh puts it back on the
+    surface with a few Newton steps, and sweeps its path to where it first
+    touches, as the planes of points sampled deep inside are no guide.
+
+    The points are offsets from the tool position in the local coordinates
+    of the object, so the avatar does not turn with the tool (a sphere
+    need not).  Features narrower than the spacing of the points can pass
+    between them.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#ifndef TOOLAVATAR_H
+#define TOOLAVATAR_H
+
+#include "chai3d.h"
+#include "ImplicitSource.h"
+#include <vector>
+
+//! Most contact points of an avatar, so that a tick's samples fit on the stack.
+#define TOOL_AVATAR_MAX_POINTS 256
+
+//! Most planes added to, or dropped from, those holding the proxy in one solve.
+#define TOOL_AVATAR_ITERATIONS 32
+
+//! The contact points of an avatar, evaluated around a centre on one tick.
+struct ToolAvatarSamples
+{
+    chai3d::cVector3d centre;
+    int count;
+
+    //! Where each point was evaluated.
+    double x[TOOL_AVATAR_MAX_POINTS];
+    double y[TOOL_AVATAR_MAX_POINTS];
+    double z[TOOL_AVATAR_MAX_POINTS];
+
+    //! The value at each point, and the unit gradient n (zero where there
+    //! is none); the point moved by u stays outside its tangent plane
+    //! while n . u >= -distance.
+    double value[TOOL_AVATAR_MAX_POINTS];
+    double gx[TOOL_AVATAR_MAX_POINTS];
+    double gy[TOOL_AVATAR_MAX_POINTS];
+    double gz[TOOL_AVATAR_MAX_POINTS];
+
+    //! First order distance from each point to the surface, f / |grad f|,
+    //! or a huge value for a point that has no gradient to be pushed along.
+    double distance[TOOL_AVATAR_MAX_POINTS];
+};
+
+class ToolAvatar
+{
+public:
+    //! An avatar of the points a_points (at most TOOL_AVATAR_MAX_POINTS),
+    //! offsets from the tool position.
+    ToolAvatar(const std::vector<chai3d::cVector3d>& a_points = std::vector<chai3d::cVector3d>());
+
+    //! An avatar of a_count points spread evenly over a sphere of a_radius
+    //! (a Fibonacci lattice).
+    static ToolAvatar sphere(double a_radius, int a_count);
+
+    int getPointCount() const { return (int)m_x.size(); }
+    chai3d::cVector3d getPoint(int a_index) const { return chai3d::cVector3d(m_x[a_index], m_y[a_index], m_z[a_index]); }
+
+    //! Distance from the tool position to the farthest point.
+    double getReach() const { return m_reach; }
+
+    //! Evaluate every point around a_centre in one batch, and find its plane.
+    void sample(const ImplicitSource& a_source, const chai3d::cVector3d& a_centre,
+                ToolAvatarSamples& a_samples) const;
+
+    //! The position nearest a_target at which every point of a_samples is
+    //! outside the tangent plane at its sample, in a_result.  Returns the
+    //! number of planes holding it there (up to 3), 0 if a_target is free.
+    int solve(const ToolAvatarSamples& a_samples, const chai3d::cVector3d& a_target,
+              chai3d::cVector3d& a_result) const;
+
+private:
+    //! The points, coordinate by coordinate so that a batch is filled with
+    //! a loop the compiler vectorizes.
+    std::vector<double> m_x;
+    std::vector<double> m_y;
+    std::vector<double> m_z;
+    double m_reach;
+};
+
+#endif
@@ -0,0 +1,73 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    An example implicit shape plugin (see ImplicitPlugin.h): a torus
+    around the z axis.  It is not part of the application; build it as a
+    shared library and run "application plugin <library>", then edit,
+    rebuild and feel the new shape without restarting:
+
+        g++ -O2 -shared -fPIC TorusPlugin.cpp -o torus.so
+        cl /O2 /LD TorusPlugin.cpp /Fe:torus.dll
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#include "ImplicitPlugin.h"
+#include <math.h>
+
+// radius of the ring, and of the tube around it
+static const double R = 0.7;
+static const double r = 0.3;
+
+// (sqrt(x^2 + y^2) - R)^2 + z^2 - r^2, scaled so that its gradient is
+// about 1 near the surface
+static double torusValue(double x, double y, double z)
+{
+    double ring = sqrt(x*x + y*y) - R;
+    return (ring*ring + z*z - r*r) / (2.0 * r);
+}
+
+static void torusBatch(const double* x, const double* y, const double* z, int count, double* values)
+{
+    for (int n = 0; n < count; ++n)
+    {
+        double ring = sqrt(x[n]*x[n] + y[n]*y[n]) - R;
+        values[n] = (ring*ring + z[n]*z[n] - r*r) / (2.0 * r);
+    }
+}
+
+static double torusEvaluate(double x, double y, double z, double* gradient)
+{
+    double radial = sqrt(x*x + y*y);
+    double ring = radial - R;
+
+    // on the axis the radial direction is undefined; any one will do
+    double scale = (radial > 1e-12) ? ring / (radial * r) : 0.0;
+    gradient[0] = x * scale;
+    gradient[1] = y * scale;
+    gradient[2] = z / r;
+    return (ring*ring + z*z - r*r) / (2.0 * r);
+}
+
+static const ImplicitPluginInfo torusInfo =
+{
+    IMPLICIT_PLUGIN_ABI,
+    "torus",
+    torusValue,
+    torusBatch,
+    torusEvaluate,
+    { -(R + r), -(R + r), -r },
+    {   R + r,    R + r,   r },
+    IMPLICIT_SYMMETRIC_X | IMPLICIT_SYMMETRIC_Y | IMPLICIT_SYMMETRIC_Z,
+
+    // |grad f| = sqrt(ring^2 + z^2) / r, under 2.6 anywhere in the box
+    3.0
+};
+
+IMPLICIT_PLUGIN_EXPORT const ImplicitPluginInfo* implicitPluginInfo(void)
+{
+    return &torusInfo;
+}
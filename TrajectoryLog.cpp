@@ -0,0 +1,119 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    Binary recording of haptic trajectories.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#include "TrajectoryLog.h"
+#include <string.h>
+
+TrajectoryHeader makeTrajectoryHeader(const char* a_shape, double a_stiffness,
+                                      double a_staticFriction, double a_dynamicFriction)
+{
+    TrajectoryHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = TRAJECTORY_MAGIC;
+    header.version = TRAJECTORY_VERSION;
+    strncpy(header.shape, a_shape, sizeof(header.shape) - 1);
+    header.stiffness = a_stiffness;
+    header.staticFriction = a_staticFriction;
+    header.dynamicFriction = a_dynamicFriction;
+    return header;
+}
+
+bool TrajectoryRecorder::start(const std::string& a_filename, const TrajectoryHeader& a_header)
+{
+    stop();
+
+    m_file = fopen(a_filename.c_str(), "wb");
+    if (!m_file)
+        return false;
+
+    // written again with the proxy state once the haptic thread begins
+    m_header = a_header;
+    fwrite(&m_header, sizeof(m_header), 1, m_file);
+    m_written = 0;
+
+    // discard anything pushed after the previous log was closed
+    TrajectoryRecord stale;
+    while (m_ring.pop(stale)) {}
+
+    m_phase.store(TRAJECTORY_STARTED, std::memory_order_release);
+    return true;
+}
+
+void TrajectoryRecorder::stop()
+{
+    if (!m_file)
+        return;
+
+    m_phase.store(TRAJECTORY_IDLE, std::memory_order_release);
+    flush();
+    fclose(m_file);
+    m_file = 0;
+}
+
+void TrajectoryRecorder::flush()
+{
+    if (!m_file)
+        return;
+
+    // the proxy state from begin() comes ahead of the records; one left
+    // over from a log stopped as the haptic thread began it comes ahead of
+    // that, and is overwritten
+    TrajectoryRecord record;
+    while (m_ring.pop(record))
+    {
+        if (record.flags & TRAJECTORY_BEGIN)
+        {
+            for (int i = 0; i < 3; ++i)
+                m_header.proxy[i] = record.proxy[i];
+            m_header.flags = record.flags & ~TRAJECTORY_BEGIN;
+            fseek(m_file, 0, SEEK_SET);
+            fwrite(&m_header, sizeof(m_header), 1, m_file);
+            fseek(m_file, 0, SEEK_END);
+            continue;
+        }
+        fwrite(&record, sizeof(record), 1, m_file);
+        m_written++;
+    }
+}
+
+bool readTrajectory(const std::string& a_filename, TrajectoryHeader& a_header,
+                    std::vector<TrajectoryRecord>& a_records)
+{
+    FILE* file = fopen(a_filename.c_str(), "rb");
+    if (!file)
+        return false;
+
+    bool ok = fread(&a_header, sizeof(a_header), 1, file) == 1 &&
+              a_header.magic == TRAJECTORY_MAGIC && a_header.version == TRAJECTORY_VERSION;
+
+    a_records.clear();
+    TrajectoryRecord record;
+    while (ok && fread(&record, sizeof(record), 1, file) == 1)
+        a_records.push_back(record);
+
+    fclose(file);
+    return ok;
+}
+
+bool writeTrajectory(const std::string& a_filename, const TrajectoryHeader& a_header,
+                     const std::vector<TrajectoryRecord>& a_records)
+{
+    FILE* file = fopen(a_filename.c_str(), "wb");
+    if (!file)
+        return false;
+
+    bool ok = fwrite(&a_header, sizeof(a_header), 1, file) == 1;
+    if (ok && !a_records.empty())
+        ok = fwrite(&a_records[0], sizeof(TrajectoryRecord), a_records.size(), file) == a_records.size();
+
+    fclose(file);
+    return ok;
+}
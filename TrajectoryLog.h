@@ -0,0 +1,177 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    Binary recording of the tool trajectory fed to
+    ImplicitMesh::computeLocalInteraction, together with the proxy and
+    force it produced, so that a session can be replayed headless and
+    compared tick by tick.
+
+    A log is a TrajectoryHeader followed by TrajectoryRecord entries, one
+    per haptic tick, in host byte order.  Positions are stored as doubles
+    so that replayed inputs are bit-exact.
+
+    The header also holds what the haptic threads rendered besides the
+    shape (the friction model, the tool avatar, the texture and the
+    sampled grid), and the proxy state the first recorded tick started
+    from, so that a recording started in contact replays from the same
+    contact.  The haptic thread hands that state over with begin() at the
+    start of the first tick it records, as the first entry of the ring,
+    and flush() writes it into the header.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#ifndef TRAJECTORYLOG_H
+#define TRAJECTORYLOG_H
+
+#include "TelemetryRing.h"
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+//! Magic number at the start of every trajectory log ("IMTR").
+#define TRAJECTORY_MAGIC 0x52544D49u
+
+//! Current version of the trajectory log format.
+#define TRAJECTORY_VERSION 3u
+
+//! Flags stored with each record.
+#define TRAJECTORY_INSIDE  0x1u
+#define TRAJECTORY_TOUCHED 0x2u
+#define TRAJECTORY_KINETIC 0x4u
+#define TRAJECTORY_TRACKED 0x8u
+
+//! Marks the entry begin() hands to flush(); never written to a log.
+#define TRAJECTORY_BEGIN 0x80000000u
+
+#pragma pack(push, 1)
+
+//! Describes the scene a trajectory was recorded against.
+struct TrajectoryHeader
+{
+    unsigned int magic;
+    unsigned int version;
+    char shape[32];
+    double stiffness;
+    double staticFriction;
+    double dynamicFriction;
+
+    //! A FrictionModelType.
+    unsigned int frictionModel;
+
+    //! The points and radius of a sphere avatar (none for a single point).
+    unsigned int avatarPoints;
+    double avatarRadius;
+
+    //! A SurfaceTexturePattern, with the octaves (none for a smooth
+    //! surface), amplitude and wavelength of the texture.
+    unsigned int texturePattern;
+    unsigned int textureOctaves;
+    double textureAmplitude;
+    double textureWavelength;
+
+    //! Nonzero if the haptic threads rendered the sampled grid.
+    unsigned int sampled;
+
+    //! The proxy before the first tick, and its flags.
+    double proxy[3];
+    unsigned int flags;
+};
+
+//! Inputs and outputs of one haptic tick.
+struct TrajectoryRecord
+{
+    double toolPos[3];
+    double toolVel[3];
+    double proxy[3];
+    double force[3];
+    unsigned int flags;
+};
+
+#pragma pack(pop)
+
+//===========================================================================
+/*
+    Records trajectory ticks from the haptic thread.  record() only pushes
+    into a lock-free ring; flush() (called from the graphics loop) writes
+    the buffered records to disk, so the haptic thread never does I/O.
+*/
+//===========================================================================
+class TrajectoryRecorder
+{
+public:
+    TrajectoryRecorder() : m_file(0), m_phase(TRAJECTORY_IDLE), m_written(0) {}
+    ~TrajectoryRecorder() { stop(); }
+
+    //! Open a log and wait for begin(). Returns false if the file cannot be created.
+    bool start(const std::string& a_filename, const TrajectoryHeader& a_header);
+
+    //! Stop accepting records, write what is buffered and close the log.
+    void stop();
+
+    //! True while a log is open.
+    bool isRecording() const { return m_phase.load(std::memory_order_acquire) != TRAJECTORY_IDLE; }
+
+    //! Haptic thread: true if the next tick is the first one recorded.
+    bool isAwaitingBegin() const { return m_phase.load(std::memory_order_acquire) == TRAJECTORY_STARTED; }
+
+    //! Haptic thread: the proxy state before the first tick recorded, with
+    //! its TRAJECTORY_ flags; records are accepted from then on.  Does
+    //! nothing if the log was stopped since isAwaitingBegin().
+    void begin(const double a_proxy[3], unsigned int a_flags)
+    {
+        int expected = TRAJECTORY_STARTED;
+        if (!m_phase.compare_exchange_strong(expected, TRAJECTORY_RECORDING, std::memory_order_acq_rel))
+            return;
+
+        TrajectoryRecord state = TrajectoryRecord();
+        for (int i = 0; i < 3; ++i)
+            state.proxy[i] = a_proxy[i];
+        state.flags = a_flags | TRAJECTORY_BEGIN;
+        m_ring.push(state);
+    }
+
+    //! Haptic thread: buffer one tick. Never blocks.
+    void record(const TrajectoryRecord& a_record)
+    {
+        if (m_phase.load(std::memory_order_acquire) == TRAJECTORY_RECORDING)
+            m_ring.push(a_record);
+    }
+
+    //! Write buffered records to the log. Call from a single consumer thread.
+    void flush();
+
+    //! Number of records written to the current log so far.
+    unsigned long long getWritten() const { return m_written; }
+
+    //! Number of records dropped because flush() fell behind.
+    unsigned int getDropped() const { return m_ring.getDropped(); }
+
+private:
+    enum Phase { TRAJECTORY_IDLE, TRAJECTORY_STARTED, TRAJECTORY_RECORDING };
+
+    FILE* m_file;
+    TrajectoryHeader m_header;
+    std::atomic<int> m_phase;
+    unsigned long long m_written;
+    TelemetryRing<TrajectoryRecord, 4096> m_ring;
+};
+
+//! Fill a header with the current format magic and version, for a point
+//! tool on a smooth surface rendered from the function with friction cones.
+TrajectoryHeader makeTrajectoryHeader(const char* a_shape, double a_stiffness,
+                                      double a_staticFriction, double a_dynamicFriction);
+
+//! Read a whole log into memory. Returns false if it is missing or malformed.
+bool readTrajectory(const std::string& a_filename, TrajectoryHeader& a_header,
+                    std::vector<TrajectoryRecord>& a_records);
+
+//! Write a whole log. Returns false if the file cannot be written.
+bool writeTrajectory(const std::string& a_filename, const TrajectoryHeader& a_header,
+                     const std::vector<TrajectoryRecord>& a_records);
+
+#endif
@@ -0,0 +1,117 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    Dirty tracking of the scene graph's global transforms.  See
+    TransformQueue.h.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#include "TransformQueue.h"
+#include <thread>
+
+using namespace chai3d;
+
+//! Bit of m_readers that keeps new readers out while apply() waits.
+static const int TRANSFORM_WRITER_WAITING = 1 << 30;
+
+TransformQueue::TransformQueue(cGenericObject* a_root)
+    : m_root(a_root), m_overflow(true), m_readers(0), m_deferred(0)
+{
+}
+
+bool TransformQueue::setPose(cGenericObject* a_object, const cVector3d& a_pos, const cMatrix3d& a_rot)
+{
+    Change change;
+    change.object = a_object;
+    change.move = true;
+    change.pos = a_pos;
+    change.rot = a_rot;
+    return m_changes.push(change);
+}
+
+void TransformQueue::markDirty(cGenericObject* a_object)
+{
+    Change change;
+    change.object = a_object;
+    change.move = false;
+
+    // a lost mark would leave the subtree stale: fall back to a full walk
+    if (!m_changes.push(change))
+        m_overflow.store(true, std::memory_order_release);
+}
+
+//===========================================================================
+/*!
+    Apply every queued change.  Each changed object has its global
+    transform recomputed from its parent's, which is up to date since the
+    parent either did not change or was recomputed before it, and passes
+    it down its subtree.  Nothing is applied while another thread reads
+    the transforms; the queue waits for the next call, unless it has
+    waited TRANSFORM_QUEUE_DEFERRALS calls already.  Then new readers are
+    held back and the current ones waited out.
+*/
+//===========================================================================
+int TransformQueue::apply()
+{
+    int idle = 0;
+    if (!m_readers.compare_exchange_strong(idle, -1, std::memory_order_acquire))
+    {
+        if (++m_deferred <= TRANSFORM_QUEUE_DEFERRALS)
+            return 0;
+
+        m_readers.fetch_or(TRANSFORM_WRITER_WAITING, std::memory_order_relaxed);
+        idle = TRANSFORM_WRITER_WAITING;
+        while (!m_readers.compare_exchange_weak(idle, -1, std::memory_order_acquire))
+        {
+            std::this_thread::yield();
+            idle = TRANSFORM_WRITER_WAITING;
+        }
+    }
+    m_deferred = 0;
+
+    int subtrees = 0;
+    Change change;
+    while (m_changes.pop(change))
+    {
+        if (change.move)
+        {
+            change.object->setLocalPos(change.pos);
+            change.object->setLocalRot(change.rot);
+        }
+
+        cGenericObject* parent = change.object->getParent();
+        if (parent)
+            change.object->computeGlobalPositions(true, parent->getGlobalPos(), parent->getGlobalRot());
+        else
+            change.object->computeGlobalPositions(true);
+        ++subtrees;
+    }
+
+    // checked after draining, so the walk also covers what was just applied
+    if (m_overflow.exchange(false, std::memory_order_acq_rel))
+    {
+        m_root->computeGlobalPositions(true);
+        subtrees = -1;
+    }
+
+    m_readers.store(0, std::memory_order_release);
+    return subtrees;
+}
+
+void TransformQueue::beginRead()
+{
+    int readers = m_readers.load(std::memory_order_relaxed);
+    while (readers < 0 || (readers & TRANSFORM_WRITER_WAITING) ||
+           !m_readers.compare_exchange_weak(readers, readers + 1, std::memory_order_acquire))
+    {
+        if (readers < 0 || (readers & TRANSFORM_WRITER_WAITING))
+        {
+            std::this_thread::yield();
+            readers = m_readers.load(std::memory_order_relaxed);
+        }
+    }
+}
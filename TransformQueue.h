@@ -0,0 +1,104 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    Dirty tracking of the scene graph's global transforms.  CHAI3D's
+    computeGlobalPositions() walks the whole graph, which the haptic loop
+    used to do on every tick although the scene hardly ever moves.
+
+    Instead, the thread that moves objects (the graphics loop) queues the
+    new local pose of each object it moves, or marks an object it changed
+    some other way, and the first haptic thread applies the queue at the
+    start of its tick, recomputing the global transforms of the changed
+    subtrees only.  A static scene costs one empty queue check per tick,
+    however large it is.  Local poses are then only ever written by the
+    haptic thread, between ticks, so it never reads one half updated.
+
+    The queue is a TelemetryRing, so there must be a single producer and
+    a single consumer.  A pose that does not fit is refused; a dirty mark
+    that does not fit makes the next apply() walk the whole graph.
+
+    The other haptic threads (and physics threads) read the global
+    transforms while the first one may be writing them, so they bracket
+    their reads with beginRead() and endRead().  apply() leaves the queue
+    for its next tick while any thread is reading, and a reader only waits
+    out an apply() already running, which recomputes a few subtrees.  As
+    readers hold the transforms for most of their ticks, they could keep
+    the writer out for good: after TRANSFORM_QUEUE_DEFERRALS ticks put off,
+    apply() stops new readers and waits for the current ones to finish,
+    which takes at most one of their ticks.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#ifndef TRANSFORMQUEUE_H
+#define TRANSFORMQUEUE_H
+
+#include "chai3d.h"
+#include "CacheAligned.h"
+#include "TelemetryRing.h"
+#include <atomic>
+
+//! Pending changes held between two haptic ticks.
+#define TRANSFORM_QUEUE_CAPACITY 64
+
+//! Ticks apply() leaves the queue to readers before it waits them out.
+#define TRANSFORM_QUEUE_DEFERRALS 4
+
+class TransformQueue
+{
+public:
+    //! a_root is walked in full on the first apply() and after an overflow.
+    TransformQueue(chai3d::cGenericObject* a_root);
+
+    //! The indices of the ring keep to cache lines of their own.
+    CACHE_ALIGNED_NEW
+
+    //! Producer: move a_object to a_pos and a_rot within its parent.
+    //! Returns false, leaving the object where it is, if the queue is full.
+    bool setPose(chai3d::cGenericObject* a_object,
+                 const chai3d::cVector3d& a_pos, const chai3d::cMatrix3d& a_rot);
+
+    //! Producer: recompute the subtree of a_object, whose children or
+    //! pose were changed directly.
+    void markDirty(chai3d::cGenericObject* a_object);
+
+    //! Producer: recompute the whole graph on the next apply().
+    void markAllDirty() { m_overflow.store(true, std::memory_order_release); }
+
+    //! Consumer (the first haptic thread): apply the queued poses and bring
+    //! the global transforms of their subtrees up to date.  Returns the
+    //! number of subtrees recomputed, or -1 for a walk of the whole graph;
+    //! 0 as well if another thread is reading, the changes being kept, for
+    //! up to TRANSFORM_QUEUE_DEFERRALS calls in a row.
+    int apply();
+
+    //! Any other thread: read global transforms until endRead(), within
+    //! one tick.  Waits while apply() is writing them, or waiting to.
+    void beginRead();
+    void endRead() { m_readers.fetch_sub(1, std::memory_order_release); }
+
+private:
+    struct Change
+    {
+        chai3d::cGenericObject* object;
+        bool move;
+        chai3d::cVector3d pos;
+        chai3d::cMatrix3d rot;
+    };
+
+    chai3d::cGenericObject* m_root;
+    TelemetryRing<Change, TRANSFORM_QUEUE_CAPACITY> m_changes;
+    std::atomic<bool> m_overflow;
+
+    //! Threads reading the global transforms, with TRANSFORM_WRITER_WAITING
+    //! set while apply() waits for them, or -1 while it writes them.
+    std::atomic<int> m_readers;
+
+    //! Calls to apply() in a row that left the queue (consumer only).
+    int m_deferred;
+};
+
+#endif
@@ -0,0 +1,525 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    Memory-mapped scalar volume as an implicit surface.  See VolumeSource.h.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#include "VolumeSource.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace chai3d;
+using namespace std;
+
+
+VolumeSource::VolumeSource()
+    : m_mapping(0), m_mappingSize(0), m_data(0),
+#ifdef _WIN32
+      m_file(INVALID_HANDLE_VALUE), m_fileMapping(0),
+#endif
+      m_type(VOLUME_UINT8), m_swapBytes(false), m_voxelBytes(1), m_isoValue(0.0),
+      m_prefetchRadius(16), m_prefetching(false), m_prefetchRequests(0)
+{
+    m_size[0] = m_size[1] = m_size[2] = 0;
+    m_origin.zero();
+    m_spacing.set(1.0, 1.0, 1.0);
+    m_invSpacing.set(1.0, 1.0, 1.0);
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        m_prefetchVoxel[axis].store(-1);
+        m_servicedVoxel[axis].store(-1);
+    }
+}
+
+VolumeSource::~VolumeSource()
+{
+    close();
+}
+
+//===========================================================================
+/*!
+    Map a volume without a header.
+
+    \param  a_fileName  Volume file.
+    \param  a_nx  Voxels along x (fastest varying in the file).
+    \param  a_ny  Voxels along y.
+    \param  a_nz  Voxels along z.
+    \param  a_type  Format of each voxel.
+    \param  a_offset  Bytes to skip before the first voxel.
+    \param  a_bigEndian  True if multi-byte voxels are stored big-endian.
+    \return True if the file holds at least the requested voxels.
+*/
+//===========================================================================
+bool VolumeSource::openRaw(const string& a_fileName, int a_nx, int a_ny, int a_nz,
+                           VolumeType a_type, size_t a_offset, bool a_bigEndian)
+{
+    close();
+
+    static const size_t bytes[] = { 1, 2, 2, 4 };
+    m_type = a_type;
+    m_voxelBytes = bytes[a_type];
+    m_size[0] = a_nx;
+    m_size[1] = a_ny;
+    m_size[2] = a_nz;
+
+    unsigned short probe = 1;
+    bool hostBigEndian = (*(unsigned char*)&probe == 0);
+    m_swapBytes = (m_voxelBytes > 1) && (a_bigEndian != hostBigEndian);
+
+    if (a_nx < 2 || a_ny < 2 || a_nz < 2 || !map(a_fileName, a_offset))
+    {
+        close();
+        return false;
+    }
+
+    // unit voxels with voxel (0,0,0) at the origin, until told otherwise
+    m_origin.zero();
+    setVoxelSpacing(1.0, 1.0, 1.0);
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// Parse the voxel type of a NRRD header.
+//---------------------------------------------------------------------------
+static bool parseNRRDType(const string& a_name, VolumeType& a_type)
+{
+    static const struct { const char* name; VolumeType type; } types[] =
+    {
+        { "uchar", VOLUME_UINT8 }, { "unsigned char", VOLUME_UINT8 },
+        { "uint8", VOLUME_UINT8 }, { "uint8_t", VOLUME_UINT8 },
+        { "short", VOLUME_INT16 }, { "short int", VOLUME_INT16 },
+        { "signed short", VOLUME_INT16 }, { "signed short int", VOLUME_INT16 },
+        { "int16", VOLUME_INT16 }, { "int16_t", VOLUME_INT16 },
+        { "ushort", VOLUME_UINT16 }, { "unsigned short", VOLUME_UINT16 },
+        { "unsigned short int", VOLUME_UINT16 }, { "uint16", VOLUME_UINT16 },
+        { "uint16_t", VOLUME_UINT16 }, { "float", VOLUME_FLOAT }
+    };
+
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); ++i)
+        if (a_name == types[i].name)
+        {
+            a_type = types[i].type;
+            return true;
+        }
+    return false;
+}
+
+//===========================================================================
+/*!
+    Map a NRRD volume.  Only 3D, raw-encoded volumes of the types in
+    VolumeType are supported.  The data may follow the header in the same
+    file, or be named by a "data file" field (a detached .nhdr header,
+    which is also the easiest way to describe a headerless .raw file).
+    Voxel spacing is taken from "spacings" or "space directions".
+
+    \param  a_fileName  NRRD (.nrrd) or detached header (.nhdr) file.
+    \return True if the volume was mapped.
+*/
+//===========================================================================
+bool VolumeSource::openNRRD(const string& a_fileName)
+{
+    close();
+
+    FILE* file = fopen(a_fileName.c_str(), "rb");
+    if (!file)
+        return false;
+
+    char line[1024];
+    if (!fgets(line, sizeof(line), file) || strncmp(line, "NRRD000", 7) != 0)
+    {
+        fclose(file);
+        return false;
+    }
+
+    VolumeType type = VOLUME_UINT8;
+    bool haveType = false;
+    int dimension = 0;
+    int size[3] = { 0, 0, 0 };
+    double spacing[3] = { 1.0, 1.0, 1.0 };
+    bool bigEndian = false;
+    string encoding = "raw";
+    string dataFile;
+    long byteSkip = 0;
+
+    while (fgets(line, sizeof(line), file))
+    {
+        // the header ends at the first empty line
+        size_t length = strcspn(line, "\r\n");
+        line[length] = 0;
+        if (length == 0)
+            break;
+        if (line[0] == '#')
+            continue;
+
+        char* colon = strstr(line, ":");
+        if (!colon)
+            continue;
+        *colon = 0;
+        string field = line;
+        const char* text = colon + 1;
+        if (*text == '=')
+            continue;   // key/value pair, not a field
+        while (*text == ' ')
+            ++text;
+
+        if (field == "type")
+            haveType = parseNRRDType(text, type);
+        else if (field == "dimension")
+            dimension = atoi(text);
+        else if (field == "sizes")
+            sscanf(text, "%d %d %d", &size[0], &size[1], &size[2]);
+        else if (field == "spacings")
+            sscanf(text, "%lf %lf %lf", &spacing[0], &spacing[1], &spacing[2]);
+        else if (field == "space directions")
+        {
+            // the length of each axis vector is the spacing along it
+            double d[3][3];
+            if (sscanf(text, " (%lf,%lf,%lf) (%lf,%lf,%lf) (%lf,%lf,%lf)",
+                       &d[0][0], &d[0][1], &d[0][2], &d[1][0], &d[1][1], &d[1][2],
+                       &d[2][0], &d[2][1], &d[2][2]) == 9)
+                for (int axis = 0; axis < 3; ++axis)
+                    spacing[axis] = sqrt(d[axis][0]*d[axis][0] + d[axis][1]*d[axis][1] + d[axis][2]*d[axis][2]);
+        }
+        else if (field == "endian")
+            bigEndian = (strcmp(text, "big") == 0);
+        else if (field == "encoding")
+            encoding = text;
+        else if (field == "data file" || field == "datafile")
+            dataFile = text;
+        else if (field == "byte skip" || field == "byteskip")
+            byteSkip = atol(text);
+    }
+
+    long headerBytes = ftell(file);
+    fclose(file);
+
+    if (!haveType || dimension != 3 || encoding != "raw" || byteSkip < 0)
+        return false;
+
+    // a detached data file is named relative to the header
+    string volumeFile = a_fileName;
+    size_t offset = byteSkip;
+    if (!dataFile.empty())
+    {
+        size_t slash = a_fileName.find_last_of("/\\");
+        volumeFile = (dataFile[0] == '/' || slash == string::npos) ? dataFile
+                   : a_fileName.substr(0, slash + 1) + dataFile;
+    }
+    else
+    {
+        offset += headerBytes;
+    }
+
+    if (!openRaw(volumeFile, size[0], size[1], size[2], type, offset, bigEndian))
+        return false;
+
+    setVoxelSpacing(spacing[0], spacing[1], spacing[2]);
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// Map the whole file read-only; the voxels start a_offset bytes in.
+//---------------------------------------------------------------------------
+bool VolumeSource::map(const string& a_fileName, size_t a_offset)
+{
+    size_t needed = a_offset + m_voxelBytes * m_size[0] * m_size[1] * (size_t)m_size[2];
+
+#ifdef _WIN32
+    m_file = CreateFileA(a_fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                         OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+    if (m_file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(m_file, &fileSize) || (unsigned long long)fileSize.QuadPart < needed)
+        return false;
+
+    m_fileMapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!m_fileMapping)
+        return false;
+
+    m_mapping = MapViewOfFile(m_fileMapping, FILE_MAP_READ, 0, 0, 0);
+    if (!m_mapping)
+        return false;
+    m_mappingSize = (size_t)fileSize.QuadPart;
+#else
+    int fd = open(a_fileName.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < needed)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void* mapping = mmap(0, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    // queries hop around the volume; do not read ahead on every fault
+    madvise(mapping, info.st_size, MADV_RANDOM);
+
+    m_mapping = mapping;
+    m_mappingSize = info.st_size;
+#endif
+
+    m_data = (const unsigned char*)m_mapping + a_offset;
+    return true;
+}
+
+void VolumeSource::close()
+{
+    // the helper must be done with the pages before they are unmapped
+    if (m_prefetcher.joinable())
+    {
+        {
+            lock_guard<mutex> lock(m_prefetchMutex);
+            m_prefetching.store(false);
+        }
+        m_prefetchWake.notify_one();
+        m_prefetcher.join();
+    }
+
+#ifdef _WIN32
+    if (m_mapping)
+        UnmapViewOfFile(m_mapping);
+    if (m_fileMapping)
+        CloseHandle(m_fileMapping);
+    if (m_file != INVALID_HANDLE_VALUE)
+        CloseHandle(m_file);
+    m_fileMapping = 0;
+    m_file = INVALID_HANDLE_VALUE;
+#else
+    if (m_mapping)
+        munmap(m_mapping, m_mappingSize);
+#endif
+    m_mapping = 0;
+    m_mappingSize = 0;
+    m_data = 0;
+}
+
+void VolumeSource::setVoxelSpacing(double a_x, double a_y, double a_z)
+{
+    m_spacing.set(a_x, a_y, a_z);
+    m_invSpacing.set(1.0 / a_x, 1.0 / a_y, 1.0 / a_z);
+}
+
+void VolumeSource::fitToBox(double a_halfExtent)
+{
+    double longest = 0.0;
+    for (int axis = 0; axis < 3; ++axis)
+        longest = cMax(longest, (m_size[axis] - 1) * m_spacing(axis));
+
+    double scale = 2.0 * a_halfExtent / longest;
+    setVoxelSpacing(m_spacing.x() * scale, m_spacing.y() * scale, m_spacing.z() * scale);
+
+    for (int axis = 0; axis < 3; ++axis)
+        m_origin(axis) = -0.5 * (m_size[axis] - 1) * m_spacing(axis);
+}
+
+void VolumeSource::getBounds(cVector3d& a_lower, cVector3d& a_upper) const
+{
+    a_lower = m_origin;
+    a_upper.set(m_origin.x() + (m_size[0] - 1) * m_spacing.x(),
+                m_origin.y() + (m_size[1] - 1) * m_spacing.y(),
+                m_origin.z() + (m_size[2] - 1) * m_spacing.z());
+}
+
+double VolumeSource::voxel(int i, int j, int k) const
+{
+    i = cClamp(i, 0, m_size[0] - 1);
+    j = cClamp(j, 0, m_size[1] - 1);
+    k = cClamp(k, 0, m_size[2] - 1);
+
+    const unsigned char* p = m_data + m_voxelBytes * (i + m_size[0] * (j + (size_t)m_size[1] * k));
+    unsigned char b[4];
+    memcpy(b, p, m_voxelBytes);
+    if (m_swapBytes)
+        for (size_t n = 0; n < m_voxelBytes / 2; ++n)
+        {
+            unsigned char t = b[n];
+            b[n] = b[m_voxelBytes - 1 - n];
+            b[m_voxelBytes - 1 - n] = t;
+        }
+
+    switch (m_type)
+    {
+    case VOLUME_UINT8:  return b[0];
+    case VOLUME_INT16:  { short v;          memcpy(&v, b, 2); return v; }
+    case VOLUME_UINT16: { unsigned short v; memcpy(&v, b, 2); return v; }
+    case VOLUME_FLOAT:  { float v;          memcpy(&v, b, 4); return v; }
+    }
+    return 0.0;
+}
+
+double VolumeSource::density(const cVector3d& a_point) const
+{
+    int base[3];
+    double t[3];
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        double u = (a_point(axis) - m_origin(axis)) * m_invSpacing(axis);
+        u = cClamp(u, 0.0, (double)(m_size[axis] - 1));
+        base[axis] = cMin((int)u, m_size[axis] - 2);
+        t[axis] = u - base[axis];
+    }
+
+    int i = base[0], j = base[1], k = base[2];
+    double c00 = voxel(i, j,   k)   + t[0] * (voxel(i+1, j,   k)   - voxel(i, j,   k));
+    double c10 = voxel(i, j+1, k)   + t[0] * (voxel(i+1, j+1, k)   - voxel(i, j+1, k));
+    double c01 = voxel(i, j,   k+1) + t[0] * (voxel(i+1, j,   k+1) - voxel(i, j,   k+1));
+    double c11 = voxel(i, j+1, k+1) + t[0] * (voxel(i+1, j+1, k+1) - voxel(i, j+1, k+1));
+    double c0 = c00 + t[1] * (c10 - c00);
+    double c1 = c01 + t[1] * (c11 - c01);
+    return c0 + t[2] * (c1 - c0);
+}
+
+double VolumeSource::value(const cVector3d& a_point) const
+{
+    return m_isoValue - density(a_point);
+}
+
+cVector3d VolumeSource::gradient(const cVector3d& a_point) const
+{
+    cVector3d g;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        cVector3d step(0.0, 0.0, 0.0);
+        step(axis) = m_spacing(axis);
+        g(axis) = (value(a_point + step) - value(a_point - step)) * 0.5 * m_invSpacing(axis);
+    }
+    return g;
+}
+
+void VolumeSource::prefetch(const cVector3d& a_point) const
+{
+    // wake the helper once the point has left the middle of the pages it
+    // brought in; the signal does not take the lock, so this never waits
+    bool moved = false;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        double u = (a_point(axis) - m_origin(axis)) * m_invSpacing(axis);
+        int voxel = (int)cClamp(u, 0.0, (double)(m_size[axis] - 1));
+        m_prefetchVoxel[axis].store(voxel, std::memory_order_relaxed);
+        int serviced = m_servicedVoxel[axis].load(std::memory_order_relaxed);
+        moved = moved || serviced < 0 || 4 * abs(voxel - serviced) > m_prefetchRadius;
+    }
+    if (moved && m_prefetching.load(std::memory_order_relaxed))
+    {
+        m_prefetchRequests.fetch_add(1, std::memory_order_release);
+        m_prefetchWake.notify_one();
+    }
+}
+
+void VolumeSource::startPrefetching()
+{
+    if (!m_data || m_prefetcher.joinable())
+        return;
+
+    m_prefetching.store(true);
+    m_prefetcher = thread([this]()
+    {
+        unsigned int seen = m_prefetchRequests.load(std::memory_order_acquire);
+        unique_lock<mutex> lock(m_prefetchMutex);
+        while (m_prefetching.load())
+        {
+            m_prefetchWake.wait_for(lock, chrono::milliseconds(5));
+            unsigned int requests = m_prefetchRequests.load(std::memory_order_acquire);
+            if (requests == seen || !m_prefetching.load())
+                continue;
+            seen = requests;
+
+            lock.unlock();
+            servicePrefetch();
+            lock.lock();
+        }
+    });
+}
+
+//===========================================================================
+/*!
+    Bring in every page that holds a voxel within the prefetch radius of
+    the last prefetch() point: the system is first asked to read them all
+    ahead, which it does in parallel, and one byte of each is then read,
+    which waits for any still missing.
+*/
+//===========================================================================
+void VolumeSource::servicePrefetch()
+{
+    if (!m_data || m_prefetchVoxel[0].load(std::memory_order_relaxed) < 0)
+        return;
+
+    static size_t pageSize = 0;
+    if (!pageSize)
+    {
+#ifdef _WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        pageSize = info.dwPageSize;
+#else
+        pageSize = (size_t)sysconf(_SC_PAGESIZE);
+#endif
+    }
+
+    int lower[3], upper[3];
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        int centre = m_prefetchVoxel[axis].load(std::memory_order_relaxed);
+        m_servicedVoxel[axis].store(centre, std::memory_order_relaxed);
+        lower[axis] = cMax(0, centre - m_prefetchRadius);
+        upper[axis] = cMin(m_size[axis] - 1, centre + m_prefetchRadius);
+    }
+
+    // each row of the box is contiguous in the file, and rows that follow
+    // each other in it are advised together
+    size_t rowBytes = m_voxelBytes * (upper[0] - lower[0] + 1);
+#ifndef _WIN32
+    uintptr_t adviseStart = 0, adviseEnd = 0;
+    for (int k = lower[2]; k <= upper[2]; ++k)
+        for (int j = lower[1]; j <= upper[1]; ++j)
+        {
+            uintptr_t row = (uintptr_t)(m_data + m_voxelBytes * (lower[0] + m_size[0] * (j + (size_t)m_size[1] * k)));
+            uintptr_t first = row & ~(uintptr_t)(pageSize - 1);
+            if (first > adviseEnd)
+            {
+                if (adviseEnd > adviseStart)
+                    madvise((void*)adviseStart, adviseEnd - adviseStart, MADV_WILLNEED);
+                adviseStart = first;
+            }
+            adviseEnd = row + rowBytes;
+        }
+    if (adviseEnd > adviseStart)
+        madvise((void*)adviseStart, adviseEnd - adviseStart, MADV_WILLNEED);
+#endif
+
+    volatile unsigned char sink = 0;
+    for (int k = lower[2]; k <= upper[2]; ++k)
+        for (int j = lower[1]; j <= upper[1]; ++j)
+        {
+            const unsigned char* row = m_data + m_voxelBytes * (lower[0] + m_size[0] * (j + (size_t)m_size[1] * k));
+            uintptr_t first = (uintptr_t)row & ~(uintptr_t)(pageSize - 1);
+            for (uintptr_t page = first; page < (uintptr_t)(row + rowBytes); page += pageSize)
+                sink += *(const unsigned char*)cMax(page, (uintptr_t)row);
+        }
+    (void)sink;
+}
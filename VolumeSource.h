@@ -0,0 +1,149 @@
+//===========================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    A scanned scalar volume (raw or NRRD) used as an implicit surface: the
+    iso-surface at a chosen density.  The file is memory-mapped rather
+    than read, so volumes larger than RAM can be explored, and the field
+    is the trilinear interpolation of the voxels, with its gradient taken
+    by central differences one voxel apart.
+
+    The value is (iso - density), so denser than the iso value is inside.
+
+    A page of the volume that is not resident would stall the haptic
+    thread on disk.  The haptic thread only records the position of the
+    proxy (which is at the tool while it is free) through prefetch() on
+    every tick, and wakes a helper thread once it has moved a quarter of
+    the prefetch radius from where the pages were last brought in.  The
+    helper, started by startPrefetching(), asks the system to read the
+    voxels around it ahead (madvise(MADV_WILLNEED)), then touches every
+    page of them so that they are resident before the haptic thread
+    gets there.
+
+    \author    Your Name
+*/
+//===========================================================================
+
+#ifndef VOLUMESOURCE_H
+#define VOLUMESOURCE_H
+
+#include "ImplicitSource.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <stddef.h>
+
+//! Voxel formats that can be read.
+enum VolumeType
+{
+    VOLUME_UINT8,
+    VOLUME_INT16,
+    VOLUME_UINT16,
+    VOLUME_FLOAT
+};
+
+class VolumeSource : public ImplicitSource
+{
+public:
+    VolumeSource();
+    virtual ~VolumeSource();
+
+    //! Map a headerless volume of a_nx * a_ny * a_nz voxels, x fastest,
+    //! starting a_offset bytes into the file.
+    bool openRaw(const std::string& a_fileName, int a_nx, int a_ny, int a_nz,
+                 VolumeType a_type, size_t a_offset = 0, bool a_bigEndian = false);
+
+    //! Map a 3D NRRD volume with raw encoding (attached or detached header).
+    bool openNRRD(const std::string& a_fileName);
+
+    //! Stop prefetching and unmap the volume.
+    void close();
+
+    //! True while a volume is mapped.
+    bool isOpen() const { return m_data != 0; }
+
+    //! The mapping of the volume file, or NULL when it was read instead.
+    const void* getMapping(size_t& a_size) const { a_size = m_mappingSize; return m_mapping; }
+
+    //! Density of the rendered iso-surface.
+    void setIsoValue(double a_isoValue) { m_isoValue = a_isoValue; }
+    double getIsoValue() const { return m_isoValue; }
+
+    //! Distance between voxel centres along each axis, before fitToBox().
+    void setVoxelSpacing(double a_x, double a_y, double a_z);
+
+    //! Centre the volume on the origin and scale its longest side to 2 * a_halfExtent.
+    void fitToBox(double a_halfExtent);
+
+    //! Box covered by the voxel centres.
+    void getBounds(chai3d::cVector3d& a_lower, chai3d::cVector3d& a_upper) const;
+
+    //! Number of voxels along an axis (0, 1 or 2).
+    int getSize(int a_axis) const { return m_size[a_axis]; }
+
+    //! Density of voxel (i, j, k), clamped to the volume.
+    double voxel(int i, int j, int k) const;
+
+    //! Trilinearly interpolated density at a_point.
+    double density(const chai3d::cVector3d& a_point) const;
+
+    virtual double value(const chai3d::cVector3d& a_point) const;
+    virtual chai3d::cVector3d gradient(const chai3d::cVector3d& a_point) const;
+    virtual void prefetch(const chai3d::cVector3d& a_point) const;
+
+    //! Voxels on each side of the last prefetch() point to keep resident.
+    void setPrefetchRadius(int a_voxels) { m_prefetchRadius = a_voxels; }
+
+    //! Start the helper thread that keeps the pages around the tool
+    //! resident, once a volume is open; close() stops it.
+    void startPrefetching();
+
+    //! Bring in the pages around the last prefetch() point now.  Not for
+    //! the haptic thread; the helper thread calls it when woken.
+    void servicePrefetch();
+
+private:
+    bool map(const std::string& a_fileName, size_t a_offset);
+
+    //! Mapped file, and the first voxel inside it.
+    void* m_mapping;
+    size_t m_mappingSize;
+    const unsigned char* m_data;
+#ifdef _WIN32
+    void* m_file;
+    void* m_fileMapping;
+#endif
+
+    VolumeType m_type;
+    bool m_swapBytes;
+    int m_size[3];
+    size_t m_voxelBytes;
+
+    //! Position of voxel (0,0,0), and distance between voxels, in local coordinates.
+    chai3d::cVector3d m_origin;
+    chai3d::cVector3d m_spacing;
+    chai3d::cVector3d m_invSpacing;
+
+    double m_isoValue;
+
+    //! Voxel last requested by prefetch(), written by the haptic thread.
+    mutable std::atomic<int> m_prefetchVoxel[3];
+    int m_prefetchRadius;
+
+    //! Voxel around which servicePrefetch() last brought pages in.
+    std::atomic<int> m_servicedVoxel[3];
+
+    //! The helper thread, and the requests that wake it; the haptic thread
+    //! signals without the lock, so the helper also wakes on its own now
+    //! and then in case it missed one.
+    std::thread m_prefetcher;
+    std::atomic<bool> m_prefetching;
+    mutable std::atomic<unsigned int> m_prefetchRequests;
+    std::mutex m_prefetchMutex;
+    mutable std::condition_variable m_prefetchWake;
+};
+
+#endif
@@ -21,8 +21,26 @@
 //------------------------------------------------------------------------------
 #include "chai3d.h"
 #include "ImplicitMesh.h"
+#include "ImplicitShapes.h"
+#include "TrajectoryLog.h"
+#include "HapticProfiler.h"
+#include "VolumeSource.h"
+#include "MeshSource.h"
+#include "PointCloudSource.h"
+#include "ExpressionSource.h"
+#include "PluginSource.h"
+#include "CSGNode.h"
+#include "ImplicitGroup.h"
+#include "TransformQueue.h"
+#include "ContactPatch.h"
+#include "RealtimeThread.h"
+#include "QualityGovernor.h"
+#include "ToolAvatar.h"
+#include "SurfaceTexture.h"
 //------------------------------------------------------------------------------
 #include <GLFW/glfw3.h>
+#include <atomic>
+#include <string.h>
 //------------------------------------------------------------------------------
 using namespace chai3d;
 using namespace std;
@@ -58,35 +76,93 @@ cWorld* world;
 // a camera to render the world in the window display
 cCamera* camera;
 
+// poses moved by the graphics loop, applied by the first haptic thread
+TransformQueue* transforms;
+
 // a light source to illuminate the objects in the world
 cSpotLight *light;
 
 // a haptic device handler
 cHapticDeviceHandler* handler;
 
-// a pointer to the current haptic device
-cGenericHapticDevicePtr hapticDevice;
+// maximum number of haptic devices supported by this application
+const int MAX_DEVICES = 4;
+
+// number of haptic devices detected
+int numHapticDevices = 0;
+
+// a pointer to each haptic device
+cGenericHapticDevicePtr hapticDevice[MAX_DEVICES];
 
 // a label to display the rates [Hz] at which the simulation is running
 cLabel* labelRates;
 
-// a virtual tool representing the haptic device in the scene
-cToolCursor* tool;
+// a virtual tool representing each haptic device in the scene
+cToolCursor* tool[MAX_DEVICES];
 
 // flag to indicate if the haptic simulation currently running
 bool simulationRunning = false;
 
-// flag to indicate if the haptic simulation has terminated
-bool simulationFinished = false;
+// number of haptic threads that have not yet terminated
+std::atomic<int> numHapticThreadsRunning(0);
 
 // a frequency counter to measure the simulation graphic rate
 cFrequencyCounter freqCounterGraphics;
 
-// a frequency counter to measure the simulation haptic rate
-cFrequencyCounter freqCounterHaptics;
+// a frequency counter to measure the haptic rate of each device
+cFrequencyCounter freqCounterHaptics[MAX_DEVICES];
+
+// one haptic thread per device
+cThread* hapticsThread[MAX_DEVICES];
+
+// index of the device served by each haptic thread
+int hapticsThreadDevice[MAX_DEVICES];
+
+// multi-rate rendering: while enabled, a physics thread per device runs the
+// proxy solve at a low rate and hands a contact patch to its haptic thread,
+// which renders the patch instead of the surface
+std::atomic<bool> multiRate(false);
+cThread* physicsThread[MAX_DEVICES];
+PatchServo patchServo[MAX_DEVICES];
+cFrequencyCounter freqCounterPhysics[MAX_DEVICES];
+
+// period of the physics loop [ms]
+const int physicsPeriodMs = 5;
+
+// force algorithm numbers of the physics threads, apart from the tools' own
+// so the two loops never share proxy states
+const unsigned int physicsIDN = 0x10000;
+
+// per-stage timing histograms of each haptic thread (1 ms deadline)
+HapticProfiler hapticProfiler[MAX_DEVICES];
 
-// haptic thread
-cThread* hapticsThread;
+// scheduling and pacing of the haptic threads (see RealtimeThread.h)
+RealtimeConfig realtime;
+
+// the jitter of the pacing is measured over this long before and after
+// the haptic thread is configured [s], under the load of a contact tick
+const double jitterSeconds = 0.5;
+
+// force algorithm numbers the jitter is measured with, never claimed by
+// a tick so they take no proxy state
+const unsigned int jitterIDN = 0x20000;
+
+// quality of service: each haptic thread steps down to cheaper rendering
+// as its ticks near the deadline (see QualityGovernor.h), and the first
+// thread applies the lowest level of all of them to the objects; it is the
+// only one to, so other threads ask it to apply the level again
+QualityGovernor qualityGovernor[MAX_DEVICES];
+std::atomic<int> appliedQuality(QUALITY_FULL);
+std::atomic<bool> qualityRequested(false);
+
+// the haptic backend chosen with [g], which the governor may override
+std::atomic<bool> sampledBackend(false);
+
+// a label per device to display haptic loop latency and overruns
+cLabel* labelTiming[MAX_DEVICES];
+
+// file to which haptic timing statistics are written on exit
+const char* timingFileName = "haptic-timing.csv";
 
 // a handle to window display context
 GLFWwindow* window = NULL;
@@ -107,6 +183,67 @@ cLabel *debugFrictionLabel;
 cLabel *debugFrictionLabelB;
 cLabel *debugTempLabel;
 
+// newest proxy snapshot received from the haptic thread
+ImplicitTelemetry telemetry;
+
+// name of the built-in shape being rendered (see ImplicitShapes.h)
+const char* shapeName = "heart";
+
+// a scanned volume rendered instead of the shape, if one is given on the command line
+VolumeSource volume;
+
+// a triangle mesh rendered instead of the shape, if one is given on the command line
+MeshSource triangleMesh;
+
+// a scanned point cloud rendered instead of the shape, if one is given on the command line
+PointCloudSource pointCloud;
+
+// a CSG scene of many shapes, rendered instead of the shape if "csg" is given on the command line
+CSGNode* csgScene = 0;
+
+// many small objects behind a broad phase, rendered instead of the shape if "many" is given
+ImplicitGroup* objectGroup = 0;
+int groupCount = 0;
+
+// the two shapes the objects of the group alternate between
+CSGNode* groupShapes[2] = { 0, 0 };
+
+// an implicit function typed in, rendered instead of the shape if "expr" is given
+ExpressionSource expression;
+
+// a shape plugin, rendered instead of the shape if "plugin" is given, and
+// reloaded whenever it is rebuilt
+PluginSource plugin;
+PluginReloader* pluginReloader = 0;
+cVector3d pluginLower, pluginUpper;
+
+// recorder of the first device's trajectory, for headless replay
+TrajectoryRecorder recorder;
+
+// file to which trajectories are recorded, and the header of the one open
+const char* trajectoryFileName = "trajectory.imtr";
+TrajectoryHeader recordedHeader;
+
+// friction model of the implicit surface
+FrictionModelType frictionModel = FRICTION_CONE;
+
+// the tool sphere as points touching the surface, used instead of the
+// single point while enabled with [a]
+const double toolAvatarRadius = 0.05;
+const int toolAvatarPoints = 64;
+ToolAvatar toolAvatar = ToolAvatar::sphere(toolAvatarRadius, toolAvatarPoints);
+bool avatarMode = false;
+
+// texture felt on the surface while enabled with [x]; its first octave is
+// coarse enough to be meshed on a lattice of 0.015, the finer ones are felt
+SurfaceTexture surfaceTexture(TEXTURE_NOISE, 0.008, 0.08, 5);
+bool textureMode = false;
+
+// the object (or group) turns slowly about the vertical axis while enabled
+bool turntable = false;
+double turntableAngle = 0.0;
+cPrecisionClock turntableClock;
+
 
 //------------------------------------------------------------------------------
 // DECLARED FUNCTIONS
@@ -124,77 +261,44 @@ void keyCallback(GLFWwindow* a_window, int a_key, int a_scancode, int a_action,
 // this function renders the scene
 void updateGraphics(void);
 
-// this function contains the main haptics simulation loop
-void updateHaptics(void);
+// this function contains the main haptics simulation loop of one device
+void updateHaptics(void* a_device);
 
-// this function closes the application
-void close(void);
+// this function contains the physics loop of one device in multi-rate mode
+void updatePhysics(void* a_device);
 
+// the contact patch of the surface nearest a tool, in world coordinates
+bool findContactPatch(unsigned int a_IDN, const cVector3d& a_toolPos, ContactPatch& a_patch);
 
-// [CPSC.86] Implicit Sphere and Implciit Sphere Gradient Functions.
-double implicitSphere(double x, double y, double z)
-{
-    return x*x + y*y + z*z - 1.0;
-}
+// set the objects up for a quality level (see QualityGovernor.h)
+void applyQualityLevel(QualityLevel a_level);
 
-cVector3d implicitSphereGrad(double x, double y, double z)
-{
-	return cVector3d(2.0*x, 2.0*y, 2.0*z);
-}
+// let every tool start afresh on every object (see ImplicitMesh::releaseProxies())
+void releaseProxies(void);
 
+// the header of a trajectory recorded now; false, with the reason, if
+// replay could not reproduce what the haptic threads render
+bool makeReplayableHeader(TrajectoryHeader& a_header, string& a_reason);
 
-
-// [CPSC.86] Implicit Heart and Implicit Heart Gradient Functions.
-double implicitHeart(double x, double y, double z)
+// the work of a contact tick, repeated while the jitter is measured
+struct JitterLoad
 {
-	return (pow((2*x*x + y*y + z*z - 1.0), 3.0) - (0.1*x*x + y*y)*z*z*z);
-}
-
-cVector3d implicitHeartGrad(double x, double y, double z)
-{
-	double termA = pow((2.0*x*x + y*y + z*z - 1.0), 2.0);
-	return cVector3d
-	(
-		12.0*x*pow((2.0*x*x + y * y + z * z - 1.0), 2.0) - 0.2*x*z*z*z,
-		6.0*y*pow((2.0*x*x + y * y + z * z - 1.0), 2.0) - 2.0*y*z*z*z,
-		6.0*z*pow((2.0*x*x + y * y + z * z - 1.0), 2.0) - 3.0*z*z*(0.1*x*x + y*y)
-	);
-}
-
-
-
-// [CPSC.86] Implicit Whiffle Cube and Implicit Whiffle Cube Gradient Functions.
-double implicitWhiffleCube(double x, double y, double z)
-{
-	return (pow((pow(x, 8.0) + pow(y, 8.0) + pow(z, 8.0)), 8.0)   +   pow((x*x + y*y + z*z - 0.44), -8.0) - 1);
-}
-
-cVector3d implicitWhiffleCubeGrad(double x, double y, double z)
-{
-	double termA = pow((pow(x, 8.0) + pow(y, 8.0) + pow(z, 8.0)), 7.0);
-	double termB = pow((x*x + y*y + z*z - 0.44), -9.0);
-
-	return cVector3d
-	(
-		64.0*pow(x,7.0)*termA - 16.0*x*termB,
-		64.0*pow(y,7.0)*termA - 16.0*y*termB,
-		64.0*pow(z,7.0)*termA - 16.0*z*termB
-	);
-}
-
+    unsigned int IDN;
+    cVector3d centre;
+    cVector3d tangent;
+    cVector3d bitangent;
+    int tick;
+};
+void loadContactTick(void* a_load);
 
+// this function closes the application
+void close(void);
 
+// this function builds the CSG demonstration scene
+CSGNode* createCSGScene(void);
 
-// [CPSC.86] Implicit Custom and Implicit Custom Gradient Functions.
-double implicitCustom(double x, double y, double z)
-{
-	return 		12.0*x*pow((2.0*x*x + y * y + z * z - 1.0), 2.0) - 0.2*x*z*z*z + 
-				6.0*y*pow((2.0*x*x + y * y + z * z - 1.0), 2.0) + 
-				6.0*z*pow((2.0*x*x + y * y + z * z - 1.0), 2.0);
-
-}
-
-
+// this function builds a group of many small objects, the first of which is a_first
+ImplicitGroup* createObjectGroup(ImplicitMesh* a_first, int a_count);
 
 
 // create the object representing the implicit surface
@@ -221,6 +325,99 @@ int main(int argc, char* argv[])
     // INITIALIZATION
     //--------------------------------------------------------------------------
 
+    // usage: application [<volume.nrrd | volume.nhdr> <iso value> | <mesh.obj | mesh.stl>
+    //                     | <cloud.xyz | cloud.ply> [<centre spacing>] | csg | many [<count>]
+    //                     | expr "<f(x, y, z)>" | plugin <library>]
+    //                    [--rate <Hz>] [--spin] [--fifo <priority>] [--cpu <n>] [--mlock] [--rt]
+    argc = parseRealtimeOptions(argc, argv, realtime);
+    if (argc >= 2 && strcmp(argv[1], "csg") == 0)
+    {
+        csgScene = createCSGScene();
+        cout << "CSG scene: " << csgScene->getPrimitiveCount() << " primitives" << endl;
+        shapeName = "csg";
+    }
+    else if (argc >= 2 && strcmp(argv[1], "many") == 0)
+    {
+        // small spheres and hearts, 0.1 units in radius
+        cMatrix3d identity;
+        identity.identity();
+        groupShapes[0] = new CSGNode(implicitSphere, implicitSphereGrad,
+                                     cVector3d(-1.0, -1.0, -1.0), cVector3d(1.0, 1.0, 1.0),
+                                     IMPLICIT_SPHERE_DISTANCE_RATIO);
+        groupShapes[1] = new CSGNode(implicitHeart, implicitHeartGrad,
+                                     cVector3d(-1.5, -1.5, -1.5), cVector3d(1.5, 1.5, 1.5),
+                                     IMPLICIT_HEART_DISTANCE_RATIO);
+        groupShapes[0]->setTransform(cVector3d(0.0, 0.0, 0.0), identity, 0.08);
+        groupShapes[1]->setTransform(cVector3d(0.0, 0.0, 0.0), identity, 0.06);
+        groupCount = (argc >= 3) ? cMax(1, atoi(argv[2])) : 300;
+        shapeName = "many";
+    }
+    else if (argc >= 3 && strcmp(argv[1], "expr") == 0)
+    {
+        if (!expression.compile(argv[2]))
+        {
+            cout << "expression: " << expression.getError() << endl;
+            return 1;
+        }
+        cout << "Expression: " << expression.getValueInstructionCount() << " instructions, "
+             << expression.getGradientInstructionCount() << " with the gradient" << endl;
+        shapeName = "expression";
+    }
+    else if (argc >= 3 && strcmp(argv[1], "plugin") == 0)
+    {
+        // check the plugin before anything is rendered from it
+        PluginBuild build = PluginReloader::build(argv[2], 0.015);
+        if (!build.library)
+        {
+            cout << "plugin: " << build.message << endl;
+            return 1;
+        }
+        cout << "Plugin: " << build.message << endl;
+        plugin.publish(build.library);
+        pluginLower = build.lower;
+        pluginUpper = build.upper;
+        pluginReloader = new PluginReloader(argv[2], 0.015);
+        shapeName = "plugin";
+    }
+    else if (argc >= 2 && triangleMesh.load(argv[1]))
+    {
+        triangleMesh.fitToBox(1.0);
+        shapeName = "mesh";
+    }
+    else if (argc >= 2 && pointCloud.load(argv[1]))
+    {
+        // centres a_spacing apart, each reaching its neighbours three cells away
+        double spacing = (argc >= 3) ? atof(argv[2]) : 0.02;
+        pointCloud.fitToBox(1.0);
+        if (!pointCloud.fit(spacing, 3.0 * spacing))
+            cout << "point cloud fit did not converge (residual " << pointCloud.getSolverResidual() << ")" << endl;
+        cout << "Point cloud: " << pointCloud.getPointCount() << " points, " << pointCloud.getCentreCount()
+             << " centres, fitted in " << pointCloud.getFitSeconds() << " s (" << pointCloud.getSolverIterations()
+             << " iterations)" << endl;
+
+        // time queries just off the surface, where the proxy spends its time
+        int queries = cMin(pointCloud.getPointCount(), 100000);
+        cVector3d gradient;
+        cPrecisionClock clock;
+        clock.start(true);
+        for (int n = 0; n < queries; ++n)
+            pointCloud.evaluate(pointCloud.getPoint(n) + cVector3d(0.01, 0.0, 0.0), gradient);
+        cout << "Point cloud query: " << 1e9 * clock.getCurrentTimeSeconds() / queries << " ns" << endl;
+        shapeName = "cloud";
+    }
+    else if (argc >= 3)
+    {
+        if (!volume.openNRRD(argv[1]))
+        {
+            cout << "failed to open volume " << argv[1] << endl;
+            return 1;
+        }
+        volume.setIsoValue(atof(argv[2]));
+        volume.fitToBox(1.0);
+        volume.startPrefetching();
+        shapeName = "volume";
+    }
+
     cout << endl;
     cout << "-----------------------------------" << endl;
     cout << "CPSC 599.86/601.86 - Computer Haptics" << endl;
@@ -231,6 +428,14 @@ int main(int argc, char* argv[])
     cout << "Keyboard Options:" << endl << endl;
     cout << "[f] - Enable/Disable full screen mode" << endl;
     cout << "[m] - Enable/Disable vertical mirroring" << endl;
+    cout << "[r] - Start/Stop recording the device trajectory" << endl;
+    cout << "[c] - Toggle friction model (cone / Coulomb)" << endl;
+    cout << "[g] - Toggle haptic rendering from the function / sampled grid" << endl;
+    cout << "[t] - Start/Stop turning the object" << endl;
+    cout << "[h] - Enable/Disable multi-rate rendering through contact patches" << endl;
+    cout << "[a] - Enable/Disable touching with the whole tool sphere" << endl;
+    cout << "[x] - Enable/Disable the surface texture" << endl;
+    cout << "[l] - Reload the shape plugin (also done whenever it is rebuilt)" << endl;
     cout << "[q] - Exit application" << endl;
     cout << endl << endl;
 
@@ -317,6 +522,9 @@ int main(int argc, char* argv[])
     // create a new world.
     world = new cWorld();
 
+    // global transforms are recomputed only where something moved
+    transforms = new TransformQueue(world);
+
     // set the background color of the environment
     world->m_backgroundColor.setWhite();
 
@@ -374,33 +582,40 @@ int main(int argc, char* argv[])
     // create a haptic device handler
     handler = new cHapticDeviceHandler();
 
-    // get a handle to the first haptic device
-    handler->getDevice(hapticDevice, 0);
+    // each connected device gets its own tool and haptic thread; with none
+    // connected, the handler's virtual device stands in for the first
+    numHapticDevices = cClamp((int)handler->getNumDevices(), 1, MAX_DEVICES);
 
-    // retrieve information about the current haptic device
-    cHapticDeviceInfo info = hapticDevice->getSpecifications();
+    for (int i = 0; i < numHapticDevices; i++)
+    {
+        // get a handle to the haptic device
+        handler->getDevice(hapticDevice[i], i);
+
+        // if the device has a gripper, enable the gripper to simulate a user switch
+        hapticDevice[i]->setEnableGripperUserSwitch(true);
 
-    // if the device has a gripper, enable the gripper to simulate a user switch
-    hapticDevice->setEnableGripperUserSwitch(true);
+        // create a tool (cursor) and insert into the world
+        tool[i] = new cToolCursor(world);
+        world->addChild(tool[i]);
 
-    // create a tool (cursor) and insert into the world
-    tool = new cToolCursor(world);
-    world->addChild(tool);
+        // connect the haptic device to the tool
+        tool[i]->setHapticDevice(hapticDevice[i]);
 
-    // connect the haptic device to the tool
-    tool->setHapticDevice(hapticDevice);
+        // map the physical workspace of the haptic device to a larger virtual workspace.
+        tool[i]->setWorkspaceRadius(2.0);
 
-    // map the physical workspace of the haptic device to a larger virtual workspace.
-    tool->setWorkspaceRadius(2.0);
+        // define a radius for the virtual tool (sphere)
+        tool[i]->setRadius(0.05);
 
-    // define a radius for the virtual tool (sphere)
-    tool->setRadius(0.05);
+        // hide the device sphere. only show proxy.
+        tool[i]->setShowContactPoints(true, false);
 
-    // hide the device sphere. only show proxy.
-    tool->setShowContactPoints(true, false);
+        // start the haptic tool
+        tool[i]->start();
+    }
 
-    // start the haptic tool
-    tool->start();
+    // retrieve information about the first haptic device
+    cHapticDeviceInfo info = hapticDevice[0]->getSpecifications();
 
 
     //--------------------------------------------------------------------------
@@ -409,7 +624,7 @@ int main(int argc, char* argv[])
 
     // read the scale factor between the physical workspace of the haptic
     // device and the virtual workspace defined for the tool
-    double workspaceScaleFactor = tool->getWorkspaceScaleFactor();
+    double workspaceScaleFactor = tool[0]->getWorkspaceScaleFactor();
 
     // stiffness properties
     double maxStiffness	= info.m_maxLinearStiffness / workspaceScaleFactor;
@@ -430,10 +645,67 @@ int main(int argc, char* argv[])
 
 	// generate a mesh for the implicit surface (inside a bounding box with
 	// range -1.25 to 1.25, and a resolution of 0.025 units)
-	object->createFromFunction( implicitHeart,
-								implicitHeartGrad,
-								cVector3d(-1.25, -1.25, -1.25),
-								cVector3d(1.25, 1.25, 1.25), 0.015);
+	const ImplicitShape* shape = findImplicitShape(shapeName);
+	if (csgScene)
+		object->createFromSource( csgScene,
+								  cVector3d(-1.25, -1.25, -1.25),
+								  cVector3d(1.25, 1.25, 1.25), 0.015);
+	else if (groupCount > 0)
+		object->createFromSource( groupShapes[0],
+								  cVector3d(-0.1, -0.1, -0.1),
+								  cVector3d(0.1, 0.1, 0.1), 0.01);
+	else if (pointCloud.getCentreCount() > 0)
+		object->createFromSource( &pointCloud,
+								  cVector3d(-1.25, -1.25, -1.25),
+								  cVector3d(1.25, 1.25, 1.25), 0.015);
+	else if (triangleMesh.getTriangleCount() > 0)
+	{
+		// the exact distance is too slow for the haptic thread on large
+		// meshes, so the sampled field is cached next to the mesh and used
+		object->createFromSource( &triangleMesh,
+								  cVector3d(-1.25, -1.25, -1.25),
+								  cVector3d(1.25, 1.25, 1.25), 0.015,
+								  string(argv[1]) + ".sdf", triangleMesh.getKey());
+		object->setSampledBackend(true);
+
+		// the whole conversion is the load, the hierarchy built again for
+		// the fitted mesh, and the sampling
+		const SampledField& sdf = object->getSampledField();
+		int triangles = triangleMesh.getTriangleCount();
+		cout << "Mesh: " << triangles << " triangles, hierarchy built at "
+		     << triangles / cMax(triangleMesh.getBuildSeconds(), 1e-9) << " tris/s" << endl;
+		if (sdf.getSampledNodeCount() > 0)
+		{
+			double seconds = triangleMesh.getLoadSeconds() + triangleMesh.getBuildSeconds() + sdf.getBuildSeconds();
+			cout << "Signed distance: " << sdf.getSampledNodeCount() << " voxels sampled at "
+			     << sdf.getSampledNodeCount() / cMax(sdf.getBuildSeconds(), 1e-9) << " voxels/s" << endl;
+			cout << "Conversion: " << cStr(seconds, 2) << " s from the file to the signed distance, "
+			     << triangles / cMax(seconds, 1e-9) << " tris/s" << endl;
+		}
+		else
+			cout << "Signed distance: loaded from " << argv[1] << ".sdf" << endl;
+	}
+	else if (volume.isOpen())
+		object->createFromSource( &volume,
+								  cVector3d(-1.25, -1.25, -1.25),
+								  cVector3d(1.25, 1.25, 1.25), 0.015);
+	else if (pluginReloader)
+		object->createFromSource( &plugin, pluginLower, pluginUpper, 0.015);
+	else if (expression.isCompiled())
+		object->createFromSource( &expression,
+								  cVector3d(-1.25, -1.25, -1.25),
+								  cVector3d(1.25, 1.25, 1.25), 0.015);
+	else
+		object->createFromFunction( shape->function,
+									shape->gradient,
+									cVector3d(-1.25, -1.25, -1.25),
+									cVector3d(1.25, 1.25, 1.25), 0.015);
+
+	// report what the sparse sampled grid (used by the [g] backend) costs
+	const SampledField& field = object->getSampledField();
+	cout << "Sampled grid: " << field.getBrickCount() << " of " << field.getTileCount() << " bricks, "
+	     << field.getMemoryBytes() / 1024 << " KB (dense: " << field.getDenseMemoryBytes() / 1024 << " KB)"
+	     << endl << endl;
 
 
 	//// generate a mesh for the implicit surface (inside a bounding box with
@@ -447,14 +719,14 @@ int main(int argc, char* argv[])
 	//// generate a mesh for the implicit surface (inside a bounding box with
 	//// range -1.25 to 1.25, and a resolution of 0.025 units)
 	//object->createFromFunction( implicitCustom,
-	//							implicitWhiffleCubeGrad,
+	//							0,	// no gradient of its own: estimated
 	//							cVector3d(-1.25, -1.25, -1.25),
 	//							cVector3d(1.25, 1.25, 1.25), 0.025);
 
 
-    // the surface effect renders a spring force between the device and proxy
-    // points with the given stiffness in the material
-    object->addEffect(new cEffectSurface(object));
+    // the surface effect renders a spring force between each device and its
+    // own proxy point with the given stiffness in the material
+    object->addEffect(new ImplicitSurfaceEffect(object));
     object->m_material->setStiffness(0.5 * maxStiffness);
 
     // give the surface a nice red colour
@@ -463,7 +735,18 @@ int main(int argc, char* argv[])
     // add some friction to the object's material
     object->setFriction(0.5, 0.3);
 
-    world->addChild(object);
+    // trajectories are only written while recording is toggled on
+    object->setRecorder(&recorder);
+
+    if (groupCount > 0)
+    {
+        objectGroup = createObjectGroup(object, groupCount);
+        world->addChild(objectGroup);
+    }
+    else
+    {
+        world->addChild(object);
+    }
 
 
     //--------------------------------------------------------------------------
@@ -478,6 +761,14 @@ int main(int argc, char* argv[])
     labelRates->m_fontColor.setBlack();
     camera->m_frontLayer->addChild(labelRates);
 
+    // create a label per device to display haptic loop latency
+    for (int i = 0; i < numHapticDevices; i++)
+    {
+        labelTiming[i] = new cLabel(font);
+        labelTiming[i]->m_fontColor.setBlack();
+        camera->m_frontLayer->addChild(labelTiming[i]);
+    }
+
 
 	debugPositionLabel = new cLabel(font);
 	debugPositionLabel->m_fontColor.setBlack();
@@ -512,9 +803,40 @@ int main(int argc, char* argv[])
     // START SIMULATION
     //--------------------------------------------------------------------------
 
-    // create a thread which starts the main haptics rendering loop
-    hapticsThread = new cThread();
-    hapticsThread->start(updateHaptics, CTHREAD_PRIORITY_HAPTICS);
+    // lock the memory before the haptic threads start; a paced loop
+    // overruns when a tick starts more than half a period late.  A mapped
+    // volume is left to the prefetcher: locking it would read all of it in
+    if (realtime.lockMemory)
+    {
+        string report;
+        size_t mappingSize = 0;
+        const void* mapping = volume.isOpen() ? volume.getMapping(mappingSize) : 0;
+        lockProcessMemory(report, mapping, mapping ? mappingSize : 0);
+        cout << "Real-time: " << report << endl;
+    }
+    if (realtime.pacing != REALTIME_PACING_FREE)
+    {
+        for (int i = 0; i < numHapticDevices; i++)
+        {
+            hapticProfiler[i].setDeadline(1.5 / realtime.rate);
+            qualityGovernor[i].setDeadline(1.0 / realtime.rate);
+        }
+    }
+    sampledBackend = object->isSampledBackend();
+
+    // create one thread per device which starts its haptics rendering loop
+    simulationRunning = true;
+    numHapticThreadsRunning = 2 * numHapticDevices;
+    for (int i = 0; i < numHapticDevices; i++)
+    {
+        hapticsThreadDevice[i] = i;
+        hapticsThread[i] = new cThread();
+        hapticsThread[i]->start(updateHaptics, CTHREAD_PRIORITY_HAPTICS, &hapticsThreadDevice[i]);
+
+        // its physics loop, idle until multi-rate rendering is enabled
+        physicsThread[i] = new cThread();
+        physicsThread[i]->start(updatePhysics, CTHREAD_PRIORITY_GRAPHICS, &hapticsThreadDevice[i]);
+    }
 
     // setup callback when application exits
     atexit(close);
@@ -574,6 +896,89 @@ void errorCallback(int a_error, const char* a_description)
 
 //------------------------------------------------------------------------------
 
+CSGNode* createCSGScene(void)
+{
+    cMatrix3d identity;
+    identity.identity();
+    vector<CSGNode*> parts;
+
+    // a heart with a bite taken out of it
+    CSGNode* heart = new CSGNode(implicitHeart, implicitHeartGrad,
+                                 cVector3d(-1.5, -1.5, -1.5), cVector3d(1.5, 1.5, 1.5),
+                                 IMPLICIT_HEART_DISTANCE_RATIO);
+    CSGNode* bite = new CSGNode(implicitSphere, implicitSphereGrad,
+                                cVector3d(-1.0, -1.0, -1.0), cVector3d(1.0, 1.0, 1.0),
+                                IMPLICIT_SPHERE_DISTANCE_RATIO);
+    bite->setTransform(cVector3d(0.6, 0.0, 0.3), identity, 0.4);
+    CSGNode* bitten = new CSGNode(CSG_DIFFERENCE, heart, bite);
+    cMatrix3d turn;
+    turn.setAxisAngleRotationDeg(cVector3d(0.0, 0.0, 1.0), 30.0);
+    bitten->setTransform(cVector3d(0.0, 0.0, 0.25), turn, 0.5);
+    parts.push_back(bitten);
+
+    // two spheres melted together
+    CSGNode* left = new CSGNode(implicitSphere, implicitSphereGrad,
+                                cVector3d(-1.0, -1.0, -1.0), cVector3d(1.0, 1.0, 1.0),
+                                IMPLICIT_SPHERE_DISTANCE_RATIO);
+    left->setTransform(cVector3d(-0.2, 0.0, 0.0), identity, 0.2);
+    CSGNode* right = new CSGNode(implicitSphere, implicitSphereGrad,
+                                 cVector3d(-1.0, -1.0, -1.0), cVector3d(1.0, 1.0, 1.0),
+                                 IMPLICIT_SPHERE_DISTANCE_RATIO);
+    right->setTransform(cVector3d(0.2, 0.0, 0.0), identity, 0.2);
+    CSGNode* drop = new CSGNode(CSG_BLEND, left, right, 0.15);
+    drop->setTransform(cVector3d(-0.75, 0.0, 0.6), identity, 1.0);
+    parts.push_back(drop);
+
+    // a floor of bumps, to show that distant primitives cost nothing
+    for (int i = 0; i < 12; ++i)
+        for (int j = 0; j < 12; ++j)
+        {
+            CSGNode* bump = new CSGNode(implicitSphere, implicitSphereGrad,
+                                        cVector3d(-1.0, -1.0, -1.0), cVector3d(1.0, 1.0, 1.0),
+                                        IMPLICIT_SPHERE_DISTANCE_RATIO);
+            bump->setTransform(cVector3d(-1.1 + 0.2 * i, -1.1 + 0.2 * j, -0.8), identity, 0.08);
+            parts.push_back(bump);
+        }
+
+    CSGNode* scene = CSGNode::createUnion(parts);
+    scene->updateBounds();
+    return scene;
+}
+
+//------------------------------------------------------------------------------
+
+ImplicitGroup* createObjectGroup(ImplicitMesh* a_first, int a_count)
+{
+    ImplicitGroup* group = new ImplicitGroup();
+
+    // layers of 10 x 10 objects, 0.25 units apart, from the floor up
+    for (int n = 0; n < a_count; ++n)
+    {
+        ImplicitMesh* mesh = a_first;
+        if (n > 0)
+        {
+            mesh = new ImplicitMesh();
+            mesh->createFromSource(groupShapes[n % 2], cVector3d(-0.1, -0.1, -0.1),
+                                   cVector3d(0.1, 0.1, 0.1), 0.01);
+            mesh->addEffect(new ImplicitSurfaceEffect(mesh));
+            mesh->m_material->setStiffness(a_first->m_material->getStiffness());
+            mesh->setFriction(a_first->m_material->getStaticFriction(),
+                              a_first->m_material->getDynamicFriction());
+            mesh->setFrictionModel(frictionModel);
+            if (n % 2) mesh->m_material->setBlueRoyal();
+            else mesh->m_material->setRedDark();
+        }
+        mesh->setLocalPos(-1.125 + 0.25 * (n % 10), -1.125 + 0.25 * ((n / 10) % 10), -0.8 + 0.25 * (n / 100));
+        group->addObject(mesh);
+    }
+
+    group->update();
+    cout << "Object group: " << a_count << " objects" << endl;
+    return group;
+}
+
+//------------------------------------------------------------------------------
+
 void keyCallback(GLFWwindow* a_window, int a_key, int a_scancode, int a_action, int a_mods)
 {
     // filter calls that only include a key press
@@ -623,6 +1028,99 @@ void keyCallback(GLFWwindow* a_window, int a_key, int a_scancode, int a_action,
         mirroredDisplay = !mirroredDisplay;
         camera->setMirrorVertical(mirroredDisplay);
     }
+
+    // option - toggle friction model
+    else if (a_key == GLFW_KEY_C)
+    {
+        frictionModel = (frictionModel == FRICTION_CONE) ? FRICTION_COULOMB : FRICTION_CONE;
+        object->setFrictionModel(frictionModel);
+        cout << "> Friction model: " << (frictionModel == FRICTION_CONE ? "cone" : "Coulomb") << endl;
+    }
+
+    // option - toggle sampled grid backend
+    else if (a_key == GLFW_KEY_G)
+    {
+        sampledBackend = !sampledBackend;
+        qualityRequested = true;
+        cout << "> Haptic backend: " << (sampledBackend ? "sampled grid" : "function") << endl;
+    }
+
+    // option - toggle turntable
+    else if (a_key == GLFW_KEY_T)
+    {
+        turntable = !turntable;
+        turntableClock.start(true);
+        cout << "> Turntable: " << (turntable ? "on" : "off") << endl;
+    }
+
+    // option - toggle multi-rate rendering
+    else if (a_key == GLFW_KEY_H)
+    {
+        // the tools and the physics loops each take over from proxies the
+        // other has been moving, or that sat still while the other ran
+        multiRate = !multiRate;
+        releaseProxies();
+        cout << "> Multi-rate rendering: " << (multiRate ? "on (the proxy shown, telemetry and recording pause)" : "off") << endl;
+    }
+
+    // option - toggle the tool avatar
+    else if (a_key == GLFW_KEY_A)
+    {
+        avatarMode = !avatarMode;
+        int count = objectGroup ? objectGroup->getObjectCount() : 1;
+        for (int n = 0; n < count; n++)
+        {
+            ImplicitMesh* mesh = objectGroup ? objectGroup->getObject(n) : object;
+            mesh->setAvatar(avatarMode ? &toolAvatar : 0);
+        }
+
+        // the broad phase must find objects within reach of the sphere
+        if (objectGroup)
+        {
+            objectGroup->setMargin(0.02 + (avatarMode ? toolAvatar.getReach() : 0.0));
+            objectGroup->update();
+        }
+        cout << "> Tool avatar: " << (avatarMode ? "sphere" : "point") << endl;
+    }
+
+    // option - toggle the surface texture
+    else if (a_key == GLFW_KEY_X)
+    {
+        textureMode = !textureMode;
+        int count = objectGroup ? objectGroup->getObjectCount() : 1;
+        for (int n = 0; n < count; n++)
+        {
+            ImplicitMesh* mesh = objectGroup ? objectGroup->getObject(n) : object;
+            mesh->setTexture(textureMode ? &surfaceTexture : 0);
+            mesh->rebuildMesh();
+        }
+        cout << "> Surface texture: " << (textureMode ? "on" : "off") << endl;
+    }
+
+    // option - reload the shape plugin
+    else if (a_key == GLFW_KEY_L && pluginReloader)
+    {
+        pluginReloader->reload();
+        cout << "> Reloading plugin" << endl;
+    }
+
+    // option - toggle trajectory recording
+    else if (a_key == GLFW_KEY_R)
+    {
+        if (recorder.isRecording())
+        {
+            recorder.stop();
+            cout << "> Recorded " << recorder.getWritten() << " ticks to " << trajectoryFileName << endl;
+        }
+        else
+        {
+            string reason;
+            if (!makeReplayableHeader(recordedHeader, reason))
+                cout << "> Not recording: " << reason << endl;
+            else if (recorder.start(trajectoryFileName, recordedHeader))
+                cout << "> Recording trajectory to " << trajectoryFileName << endl;
+        }
+    }
 }
 
 //------------------------------------------------------------------------------
@@ -633,15 +1131,37 @@ void close(void)
     simulationRunning = false;
 
     // wait for graphics and haptics loops to terminate
-    while (!simulationFinished) { cSleepMs(100); }
+    while (numHapticThreadsRunning > 0) { cSleepMs(100); }
 
-    // close haptic device
-    tool->stop();
+    // close haptic devices
+    for (int i = 0; i < numHapticDevices; i++)
+    {
+        tool[i]->stop();
+        delete hapticsThread[i];
+        delete physicsThread[i];
+    }
+
+    // close any trajectory still being recorded
+    recorder.stop();
+
+    // dump haptic loop timing statistics
+    FILE* timingFile = fopen(timingFileName, "w");
+    if (timingFile)
+    {
+        HapticProfiler::writeCSVHeader(timingFile);
+        for (int i = 0; i < numHapticDevices; i++)
+            hapticProfiler[i].writeCSV(timingFile, to_string(i));
+        fclose(timingFile);
+    }
 
     // delete resources
-    delete hapticsThread;
     delete world;
+    delete transforms;
     delete handler;
+    delete csgScene;
+    delete groupShapes[0];
+    delete groupShapes[1];
+    delete pluginReloader;
 }
 
 //------------------------------------------------------------------------------
@@ -652,29 +1172,110 @@ void updateGraphics(void)
     // UPDATE WIDGETS
     /////////////////////////////////////////////////////////////////////
 
-	string debugSeedPt = object->debugSeedPoint.str();
-	string debugPos = object->debugToolPos.str();
-	string debugVal = to_string(object->functionValue);
-	string debugGradientVector = object->debugGradientVector.str();
-	string deltaP = to_string(object->deltaMovement);
-	string kinetic = object->debugKinetic ? "kinetic" : "Not Kinetic";
-	string touched = object->debugTouched ? "touched" : "Not Touched";
-	string toolVec = object->debugTempVec.str();
-	string gradLen = to_string(object->debugTempVec.length());
-	string tempA = to_string(object->debugTempA);
-	string tempB = to_string(object->debugTempB);
-	string cosThta = to_string(object->cosThta);
-	string theta = to_string(object->theta);
-	string tanTheta = to_string(object->tanTheta);
-	string thetaK = to_string(object->thetaK);
-	string sinThetaK = to_string(object->singThetaK);
+	// drain the haptic thread's telemetry, keeping the newest snapshot; the
+	// other objects of a group drain theirs to show where their proxy is
+	object->popLatestTelemetry(telemetry);
+	for (int n = 1; objectGroup && n < objectGroup->getObjectCount(); n++)
+	{
+		ImplicitTelemetry shown;
+		objectGroup->getObject(n)->popLatestTelemetry(shown);
+	}
+
+    // log the quality levels the haptic threads went through since the last frame
+    for (int i = 0; i < numHapticDevices; i++)
+    {
+        QualityTransition transition;
+        while (qualityGovernor[i].popTransition(transition))
+            cout << "> Device " << i << " quality: " << QualityGovernor::levelName(transition.from)
+                 << " -> " << QualityGovernor::levelName(transition.to) << " at tick " << transition.tick
+                 << " (tick cost " << cStr(1e-3 * transition.costNs, 0) << " of "
+                 << cStr(1e-3 * transition.deadlineNs, 0) << " us)" << endl;
+    }
+
+	// swap in a rebuilt plugin together with its mesh; the haptic threads
+	// render the plugin itself from then on, as its sampled grid is stale
+	PluginBuild pluginBuild;
+	if (pluginReloader && pluginReloader->poll(pluginBuild))
+	{
+		if (pluginBuild.library)
+		{
+			object->growHapticBounds(pluginBuild.lower, pluginBuild.upper);
+			plugin.publish(pluginBuild.library);
+			object->replaceSurface(pluginBuild.triangles, pluginBuild.lower, pluginBuild.upper);
+			sampledBackend = false;
+			cout << "> Plugin reloaded: " << pluginBuild.message << " ("
+			     << cStr(pluginBuild.seconds, 2) << " s)" << endl;
+		}
+		else
+		{
+			cout << "> Plugin kept, the new one failed: " << pluginBuild.message << endl;
+		}
+	}
+
+	// write any recorded trajectory ticks to disk, and stop as soon as the
+	// scene changes in a way the log cannot describe
+	recorder.flush();
+	if (recorder.isRecording())
+	{
+		TrajectoryHeader current;
+		string reason;
+		if (makeReplayableHeader(current, reason) &&
+		    (current.frictionModel != recordedHeader.frictionModel ||
+		     current.avatarPoints != recordedHeader.avatarPoints))
+			reason = "the friction model or the tool avatar changed";
+		if (!reason.empty())
+		{
+			recorder.stop();
+			cout << "> Recording stopped (" << reason << "): " << recorder.getWritten() << " ticks in "
+			     << trajectoryFileName << ", the last ones may not replay" << endl;
+		}
+	}
+
+	// derived angles are only needed for display, so compute them here
+	// rather than on the haptic thread
+	double radToDeg = 180.0 / C_PI;
+	double mu_k = object->m_material->getDynamicFriction();
+
+	string debugSeedPt = telemetry.seedPoint.str();
+	string debugPos = telemetry.toolPos.str();
+	string debugVal = to_string(telemetry.functionValue);
+	string debugGradientVector = telemetry.gradient.str();
+	string kinetic = telemetry.kinetic ? "kinetic" : "Not Kinetic";
+	string touched = telemetry.touched ? "touched" : "Not Touched";
+	string toolVec = telemetry.proxyToTool.str();
+	string tempA = to_string(telemetry.frictionDist);
+	string cosThta = to_string(telemetry.cosTheta);
+	string theta = to_string(acos(cClamp(telemetry.cosTheta, -1.0, 1.0)) * radToDeg);
+	string tanTheta = to_string(tan(acos(cClamp(telemetry.cosTheta, -1.0, 1.0))));
+	string thetaK = to_string(atan(mu_k) * radToDeg);
+	string sinThetaK = to_string(sin(atan(mu_k)));
+
     // update haptic and graphic rate data
-    labelRates->setText(cStr(freqCounterGraphics.getFrequency(), 0) + " Hz / " +
-        cStr(freqCounterHaptics.getFrequency(), 0) + " Hz");
+    string rates = cStr(freqCounterGraphics.getFrequency(), 0) + " Hz";
+    for (int i = 0; i < numHapticDevices; i++)
+    {
+        rates += " / " + cStr(freqCounterHaptics[i].getFrequency(), 0) + " Hz";
+        if (multiRate)
+            rates += " (physics " + cStr(freqCounterPhysics[i].getFrequency(), 0) + " Hz)";
+    }
+    if (objectGroup)
+        rates += " (" + to_string(objectGroup->getVisitedCount()) + " of " +
+                 to_string(objectGroup->getObjectCount()) + " objects touched)";
+    if (multiRate)
+        rates += "  --  multi-rate: proxy, telemetry and recording paused";
+    labelRates->setText(rates);
 
     // update position of label
     labelRates->setLocalPos((int)(0.5 * (width - labelRates->getWidth())), 15);
 
+    // update haptic loop latency of each device
+    for (int i = 0; i < numHapticDevices; i++)
+    {
+        labelTiming[i]->setText("Device " + to_string(i) + ": " + hapticProfiler[i].summary() +
+                                "  --  quality: " + QualityGovernor::levelName(qualityGovernor[i].getLevel()));
+        labelTiming[i]->setLocalPos((int)(0.5 * (width - labelTiming[i]->getWidth())), 150 + 25 * i);
+    }
+
 
 	debugPositionLabel->setText("Haptic Point Position: " + debugPos + " and Implicit Function Value: " + debugVal + " and Kinetic: " + kinetic + " and Touched: " + touched);
 	debugPositionLabel->setLocalPos((int)(0.5 * (width - debugPositionLabel->getWidth())), height - 50);
@@ -684,18 +1285,30 @@ void updateGraphics(void)
 
 	debugFrictionLabelB->setText("Cos(@): " + cosThta + "  --  @: " + theta + "  --  tan(@): " + tanTheta + "  --  Kinetic @: " + thetaK + "  --  sin(Kinetic@): " + sinThetaK);
 	debugFrictionLabelB->setLocalPos((int)(0.5 * (width - debugFrictionLabelB->getWidth())), 50);
-	
-	double cosThta;
-	double theta;
-	double tanTheta;
-	double thetaK;
-	double sinThetaK;
-	
-	
-	debugTempLabel->setText("ProxyToTool: " + toolVec + "  --  FrictionDistance: " + tempA);
+
+
+	unsigned long long projectionHits, projectionMisses;
+	object->getProjectionCacheStats(projectionHits, projectionMisses);
+	debugTempLabel->setText("ProxyToTool: " + toolVec + "  --  FrictionDistance: " + tempA +
+	                        "  --  Cached projections: " + to_string(projectionHits) + " of " +
+	                        to_string(projectionHits + projectionMisses));
 	debugTempLabel->setLocalPos((int)(0.5 * (width - debugTempLabel->getWidth())), 100);
 
 
+    // turn the object by the time since the last frame; the haptic thread
+    // applies the new pose between two of its ticks
+    if (turntable)
+    {
+        turntableAngle += 20.0 * turntableClock.getCurrentTimeSeconds();
+        turntableClock.start(true);
+
+        cGenericObject* turned = objectGroup ? (cGenericObject*)objectGroup : (cGenericObject*)object;
+        cMatrix3d rotation;
+        rotation.setAxisAngleRotationDeg(cVector3d(0.0, 0.0, 1.0), turntableAngle);
+        transforms->setPose(turned, turned->getLocalPos(), rotation);
+    }
+
+
     /////////////////////////////////////////////////////////////////////
     // RENDER SCENE
     /////////////////////////////////////////////////////////////////////
@@ -717,37 +1330,318 @@ void updateGraphics(void)
 
 //------------------------------------------------------------------------------
 
-void updateHaptics(void)
+void updateHaptics(void* a_device)
 {
-    // simulation in now running
-    simulationRunning  = true;
-    simulationFinished = false;
+    // the device served by this thread
+    int i = *(int*)a_device;
+
+    // timing of this thread's loop
+    HapticProfiler& profiler = hapticProfiler[i];
+
+    // whether the previous tick rendered a contact patch
+    bool patchRendered = false;
+
+    // make this thread real-time, measuring the jitter of its pacing under
+    // the default scheduling and under the new one
+    RealtimePacer pacer;
+    pacer.start(realtime.rate, realtime.pacing);
+    if (realtime.isEnabled())
+    {
+        // each tick projects onto the surface from a point just under it,
+        // as a tool in contact does
+        JitterLoad load;
+        load.IDN = jitterIDN + i;
+        load.tick = 0;
+        ContactPatch start;
+        if (object->getContactPatch(load.IDN, cVector3d(0.0, 0.0, 0.0), start))
+        {
+            load.centre = start.point - 0.005 * start.normal;
+            cVector3d axis = (fabs(start.normal.x()) < 0.9) ? cVector3d(1.0, 0.0, 0.0) : cVector3d(0.0, 1.0, 0.0);
+            load.tangent = start.normal.cross(axis);
+            load.tangent.normalize();
+            load.bitangent = start.normal.cross(load.tangent);
+        }
+
+        int jitterTicks = (int)(jitterSeconds * realtime.rate);
+        LatencyHistogram before, after;
+        if (jitterTicks > 0)
+            measurePacingJitter(pacer, jitterTicks, before, loadContactTick, &load);
+
+        string report;
+        configureRealtimeThread(realtime.priority, (realtime.cpu < 0) ? -1 : realtime.cpu + i, report);
+
+        string message = "Device " + to_string(i) + " haptic thread: " + report;
+        if (jitterTicks > 0)
+        {
+            measurePacingJitter(pacer, jitterTicks, after, loadContactTick, &load);
+            message += "\n  " + cStr(realtime.rate, 0) + " Hz " +
+                       (realtime.pacing == REALTIME_PACING_SPIN ? "busy-polled" : "sleeping") +
+                       ", with a contact tick's load" +
+                       "\n  before: " + describeJitter(before) + "\n  after:  " + describeJitter(after);
+        }
+        cout << message << endl;
+    }
+
+    // the plane the tool is held against at QUALITY_PLANE_HOLD
+    ContactPatch heldPlane;
+    bool planeHeld = false;
 
     // main haptic simulation loop
     while(simulationRunning)
     {
+        // wait for the next tick if the loop is paced
+        pacer.wait();
+
+        profiler.beginTick();
+
         /////////////////////////////////////////////////////////////////////
         // HAPTIC FORCE COMPUTATION
         /////////////////////////////////////////////////////////////////////
 
-        // compute global reference frames for each object
-        world->computeGlobalPositions(true);
+        // bring global reference frames up to date where objects moved; only
+        // the first thread writes to the scene graph so the threads never do
+        // it together, and the others read it only while it does not
+        if (i == 0)
+            transforms->apply();
+        else
+            transforms->beginRead();
+        profiler.mark(HAPTIC_STAGE_GLOBAL_POSITIONS);
 
         // update position and orientation of tool
-        tool->updateFromDevice();
-
-        // compute interaction forces
-        tool->computeInteractionForces();
+        tool[i]->updateFromDevice();
+        profiler.mark(HAPTIC_STAGE_UPDATE_FROM_DEVICE);
+
+        // compute interaction forces: from the surface itself, from the
+        // latest patch handed over by the physics thread, or from the plane
+        // held while the loops are overloaded
+        bool renderPatch = multiRate;
+        bool holdPlane = !renderPatch && appliedQuality == QUALITY_PLANE_HOLD;
+        if (renderPatch)
+        {
+            if (!patchRendered)
+                patchServo[i].reset();
+            cVector3d force = patchServo[i].update(tool[i]->getDeviceGlobalPos(),
+                                                   tool[i]->getDeviceGlobalLinVel());
+            tool[i]->setDeviceGlobalForce(force);
+        }
+        else if (holdPlane)
+        {
+            // the plane the tool was pressing on when the level was entered,
+            // found from the last force rendered: the proxy lies a force
+            // over the stiffness away from the tool, along the force
+            if (!planeHeld)
+            {
+                cVector3d force = tool[i]->getDeviceGlobalForce();
+                double length = force.length();
+                heldPlane = ContactPatch();
+                if (length > 0.0)
+                {
+                    heldPlane.stiffness = object->m_material->getStiffness();
+                    heldPlane.point = tool[i]->getDeviceGlobalPos() + force / heldPlane.stiffness;
+                    heldPlane.normal = force / length;
+                    heldPlane.valid = true;
+                }
+            }
+
+            // pressing on nothing, there is no plane to hold the tool
+            // against, so it is rendered from the sampled grid, as the
+            // objects are set up at this level
+            if (heldPlane.valid)
+                tool[i]->setDeviceGlobalForce(heldPlane.force(tool[i]->getDeviceGlobalPos()));
+            else
+                tool[i]->computeInteractionForces();
+        }
+        else
+        {
+            tool[i]->computeInteractionForces();
+        }
+        patchRendered = renderPatch;
+        planeHeld = holdPlane;
+        if (i != 0)
+            transforms->endRead();
+        profiler.mark(HAPTIC_STAGE_INTERACTION_FORCES);
 
         // send forces to haptic device
-        tool->applyToDevice();
+        tool[i]->applyToDevice();
+        profiler.mark(HAPTIC_STAGE_APPLY_TO_DEVICE);
 
         // signal frequency counter
-        freqCounterHaptics.signal(1);
+        freqCounterHaptics[i].signal(1);
+
+        profiler.endTick();
+
+        // step the rendering down or up with the cost of the tick
+        qualityGovernor[i].update(profiler.getLastTickNs());
+        if (i == 0)
+        {
+            int level = QUALITY_FULL;
+            for (int n = 0; n < numHapticDevices; n++)
+                level = cMax(level, (int)qualityGovernor[n].getLevel());
+            if (level != appliedQuality || qualityRequested.exchange(false))
+                applyQualityLevel((QualityLevel)level);
+        }
     }
     
     // exit haptics thread
-    simulationFinished = true;
+    numHapticThreadsRunning--;
+}
+
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+
+void updatePhysics(void* a_device)
+{
+    // the device whose haptic thread this loop feeds
+    int i = *(int*)a_device;
+
+    cInteractionRecorder interactions;
+
+    while(simulationRunning)
+    {
+        ServoToolState state;
+        if (!multiRate || !patchServo[i].readTool(state))
+        {
+            cSleepMs(physicsPeriodMs);
+            continue;
+        }
+
+        // the full proxy solve, at the tool position last seen by the servo
+        transforms->beginRead();
+        interactions.m_interactions.clear();
+        world->computeInteractions(state.pos, state.vel, physicsIDN + i, interactions);
+
+        ContactPatch patch;
+        findContactPatch(physicsIDN + i, state.pos, patch);
+        transforms->endRead();
+        patchServo[i].publish(patch);
+
+        freqCounterPhysics[i].signal(1);
+        cSleepMs(physicsPeriodMs);
+    }
+
+    // exit physics thread
+    numHapticThreadsRunning--;
+}
+
+//------------------------------------------------------------------------------
+
+bool findContactPatch(unsigned int a_IDN, const cVector3d& a_toolPos, ContactPatch& a_patch)
+{
+    // the objects in contact with the tool, or the single object
+    ImplicitMesh* candidates[IMPLICIT_GROUP_MAX_CONTACTS];
+    int count = 1;
+    candidates[0] = object;
+    if (objectGroup)
+        count = objectGroup->getContacts(a_IDN, candidates, IMPLICIT_GROUP_MAX_CONTACTS);
+
+    // keep the patch the tool is deepest into
+    a_patch = ContactPatch();
+    double deepest = 0.0;
+    for (int n = 0; n < count; ++n)
+    {
+        cVector3d position = candidates[n]->getGlobalPos();
+        cMatrix3d rotation = candidates[n]->getGlobalRot();
+        ContactPatch local;
+        if (!candidates[n]->getContactPatch(a_IDN, rotation.getTranspose() * (a_toolPos - position), local))
+            continue;
+
+        ContactPatch patch = local;
+        patch.point = position + rotation * local.point;
+        patch.normal = rotation * local.normal;
+        double depth = (patch.point - a_toolPos).dot(patch.normal);
+        if (!a_patch.valid || depth > deepest)
+        {
+            a_patch = patch;
+            deepest = depth;
+        }
+    }
+
+    return a_patch.valid;
 }
 
 //------------------------------------------------------------------------------
+
+void applyQualityLevel(QualityLevel a_level)
+{
+    // the proxies sat still while their planes were held: the tools start
+    // afresh from where they are, before any thread renders the new level
+    if (appliedQuality == QUALITY_PLANE_HOLD && a_level < QUALITY_PLANE_HOLD)
+        releaseProxies();
+    appliedQuality = a_level;
+
+    // the plane hold is up to each haptic thread; the objects are left as
+    // for the sampled grid
+    int limit = (a_level >= QUALITY_FEWER_ITERATIONS) ? QUALITY_NEWTON_ITERATIONS : 0;
+    bool sampled = sampledBackend || a_level >= QUALITY_SAMPLED;
+
+    int count = objectGroup ? objectGroup->getObjectCount() : 1;
+    for (int n = 0; n < count; n++)
+    {
+        ImplicitMesh* mesh = objectGroup ? objectGroup->getObject(n) : object;
+        mesh->setNewtonIterationLimit(limit);
+        mesh->setSampledBackend(sampled);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void releaseProxies(void)
+{
+    if (objectGroup)
+        objectGroup->releaseProxies();
+    else
+        object->releaseProxies();
+}
+
+//------------------------------------------------------------------------------
+
+bool makeReplayableHeader(TrajectoryHeader& a_header, string& a_reason)
+{
+    a_header = makeTrajectoryHeader(shapeName, object->m_material->getStiffness(),
+                                    object->m_material->getStaticFriction(),
+                                    object->m_material->getDynamicFriction());
+    a_header.frictionModel = frictionModel;
+    if (avatarMode)
+    {
+        a_header.avatarPoints = toolAvatarPoints;
+        a_header.avatarRadius = toolAvatarRadius;
+    }
+    if (textureMode)
+    {
+        a_header.texturePattern = surfaceTexture.getPattern();
+        a_header.textureOctaves = surfaceTexture.getOctaveCount();
+        a_header.textureAmplitude = surfaceTexture.getAmplitude();
+        a_header.textureWavelength = surfaceTexture.getWavelength();
+    }
+    a_header.sampled = object->isSampledBackend() ? 1 : 0;
+
+    // replay renders a built-in shape from its function, one tick at a time
+    if (!findImplicitShape(shapeName))
+        a_reason = string("replay cannot rebuild the ") + shapeName + " shape";
+    else if (textureMode)
+        a_reason = "replay does not texture the surface";
+    else if (a_header.sampled)
+        a_reason = "replay does not render the sampled grid";
+    else if (appliedQuality != QUALITY_FULL)
+        a_reason = "the haptic threads render a degraded quality level";
+    else if (multiRate)
+        a_reason = "the physics loop moves the proxy in multi-rate mode";
+    else
+        a_reason.clear();
+    return a_reason.empty();
+}
+
+//------------------------------------------------------------------------------
+
+void loadContactTick(void* a_load)
+{
+    // a new point on a small circle every tick, so the projection is
+    // never the one before it
+    JitterLoad& load = *(JitterLoad*)a_load;
+    double angle = 0.05 * load.tick++;
+    cVector3d point = load.centre + 0.002 * (cos(angle) * load.tangent + sin(angle) * load.bitangent);
+
+    ContactPatch patch;
+    object->getContactPatch(load.IDN, point, patch);
+}
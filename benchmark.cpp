@@ -0,0 +1,866 @@
+//==============================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    Headless throughput benchmark of ImplicitMesh::computeLocalInteraction.
+    Synthetic probe trajectories are driven against every built-in shape
+    without a window or a haptic device, and the cost of each scenario is
+    reported as machine-readable JSON.
+
+    Scenarios:
+        approach  - tool moves towards the surface without touching it
+        press     - tool presses into the surface and back out
+        slide     - tool slides along the surface below a great circle
+        cusp      - tool circles the top (+z) pole of the surface
+        stab      - tool stabs in and out of the surface at high speed
+
+    With --sampled, each shape is first sampled onto a grid of the given
+    spacing (as createFromFunction does for the application) and the
+    scenarios query the grid instead of the function.
+
+    With --gradient estimated, the scenarios run without the analytic
+    gradients, which are estimated by finite differences instead (see
+    GradientEstimator.h).  With --gradient compare, no scenario is run:
+    the estimated gradients of the shapes that have analytic ones are
+    compared with them, for accuracy and cost, at points around their
+    surfaces.
+
+    With --expression compare, no scenario is run either: each shape is
+    compiled from an expression (see ExpressionSource.h) and compared with
+    its C function, for accuracy and for the cost of a value and gradient
+    one point at a time and in batches.
+
+    With --avatar, the tool is a sphere of radius 0.05 (as set up in the
+    application) touching the surface at the given number of points (see
+    ToolAvatar.h), all evaluated in one batch per tick.
+
+    With --texture, the surface is textured with noise or ridges 0.02
+    long, in three octaves, as high as SurfaceTexture allows up to 0.002
+    (see SurfaceTexture.h).
+
+    With --tools compare, no scenario is timed: each is run by two tools
+    on one object, each on a thread of its own as two haptic threads
+    would, and the proxy of each is compared with the one it has alone on
+    an object of its own.  Tools must not disturb each other, so any
+    deviation is a bug.
+
+    With --csg compare, no scenario is run either: CSG trees of spheres
+    and hearts (see CSGNode.h), which are not distance fields, are
+    evaluated on a lattice of points with and without pruning.  Pruning
+    must not change the field, so any error is a bug.
+
+    Usage:
+        benchmark [--ticks <count>] [--shape <name>] [--output <file>]
+                  [--sampled <spacing>] [--gradient <analytic | estimated | compare>]
+                  [--expression compare] [--avatar <points>] [--texture <noise | ridges>]
+                  [--tools compare] [--csg compare]
+
+    \author    Your Name
+*/
+//==============================================================================
+
+//------------------------------------------------------------------------------
+#include "chai3d.h"
+#include "ImplicitMesh.h"
+#include "ImplicitShapes.h"
+#include "HapticProfiler.h"
+#include "ExpressionSource.h"
+#include "ToolAvatar.h"
+#include "SurfaceTexture.h"
+#include "CSGNode.h"
+//------------------------------------------------------------------------------
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+//------------------------------------------------------------------------------
+using namespace chai3d;
+using namespace std;
+//------------------------------------------------------------------------------
+
+// the shape being benchmarked, wrapped so that evaluations can be counted
+const ImplicitShape* benchShape = 0;
+unsigned long long functionEvaluations = 0;
+unsigned long long gradientEvaluations = 0;
+
+double countedFunction(double x, double y, double z)
+{
+    functionEvaluations++;
+    return benchShape->function(x, y, z);
+}
+
+cVector3d countedGradient(double x, double y, double z)
+{
+    gradientEvaluations++;
+    return benchShape->gradient(x, y, z);
+}
+
+//------------------------------------------------------------------------------
+
+// a surface point and its outward unit normal
+struct SurfaceSample
+{
+    cVector3d point;
+    cVector3d normal;
+};
+
+// find where a ray from far outside the shape towards the origin first
+// crosses the surface; returns false if it never does
+bool findSurfaceAlong(const ImplicitShape* a_shape, const cVector3d& a_direction, SurfaceSample& a_sample)
+{
+    const double outer = 1.5;
+    const int steps = 600;
+
+    cVector3d dir = a_direction;
+    dir.normalize();
+
+    double previous = outer;
+    for (int i = 1; i <= steps; ++i)
+    {
+        double r = outer * (1.0 - (double)i / steps);
+        cVector3d p = r * dir;
+        if (a_shape->function(p.x(), p.y(), p.z()) < 0.0)
+        {
+            // bisect between the last outside and the first inside radius
+            double lo = r, hi = previous;
+            for (int k = 0; k < 60; ++k)
+            {
+                double mid = 0.5 * (lo + hi);
+                cVector3d m = mid * dir;
+                if (a_shape->function(m.x(), m.y(), m.z()) < 0.0) lo = mid;
+                else hi = mid;
+            }
+            a_sample.point = hi * dir;
+            a_sample.normal = FunctionSource(a_shape->function, a_shape->gradient).gradient(a_sample.point);
+            if (a_sample.normal.length() < C_SMALL)
+                a_sample.normal = dir;
+            a_sample.normal.normalize();
+            return true;
+        }
+        previous = r;
+    }
+
+    return false;
+}
+
+// a direction at angle a_theta from a_pole, at azimuth a_phi around it
+cVector3d aroundPole(const cVector3d& a_pole, double a_theta, double a_phi)
+{
+    cVector3d pole = a_pole;
+    pole.normalize();
+    cVector3d u = (fabs(pole.x()) < 0.9) ? cVector3d(1.0, 0.0, 0.0).cross(pole) : cVector3d(0.0, 1.0, 0.0).cross(pole);
+    u.normalize();
+    cVector3d v = pole.cross(u);
+    return cos(a_theta) * pole + sin(a_theta) * (cos(a_phi) * u + sin(a_phi) * v);
+}
+
+//------------------------------------------------------------------------------
+
+// a point outside the surface, along the normal, from which a tool reaches
+// a_point; a_fallback is used where no surface lies towards a_point
+cVector3d entryTo(const ImplicitShape* a_shape, const cVector3d& a_point, const SurfaceSample& a_fallback)
+{
+    SurfaceSample start;
+    if (!findSurfaceAlong(a_shape, a_point, start))
+        start = a_fallback;
+    return start.point + 0.2 * start.normal;
+}
+
+// build the tool trajectory of a scenario (outside the timed region), and
+// a point outside the surface from which the tool reaches its start
+bool buildScenario(const string& a_name, const ImplicitShape* a_shape, int a_ticks,
+                   vector<cVector3d>& a_path, cVector3d& a_entry)
+{
+    a_path.clear();
+    a_path.reserve(a_ticks);
+
+    // a side of the shape, and the pole of the shape (+z, where the heart
+    // has its cusp); shapes without surface there fall back to a diagonal
+    cVector3d sideDir(1.0, 0.3, 0.2);
+    SurfaceSample side;
+    if (!findSurfaceAlong(a_shape, sideDir, side))
+    {
+        sideDir.set(1.0, 0.95, 0.9);
+        if (!findSurfaceAlong(a_shape, sideDir, side))
+            return false;
+    }
+
+    cVector3d poleDir(0.0, 0.0, 1.0);
+    SurfaceSample pole;
+    if (!findSurfaceAlong(a_shape, poleDir, pole))
+        poleDir = sideDir;
+
+    if (a_name == "approach")
+    {
+        for (int i = 0; i < a_ticks; ++i)
+        {
+            double s = 0.5 + 0.5 * cos(2.0 * C_PI * i / 2000.0);
+            a_path.push_back(side.point + (0.01 + 0.3 * s) * side.normal);
+        }
+    }
+    else if (a_name == "press")
+    {
+        for (int i = 0; i < a_ticks; ++i)
+        {
+            double depth = 0.08 * sin(2.0 * C_PI * i / 1000.0);
+            a_path.push_back(side.point - depth * side.normal);
+        }
+    }
+    else if (a_name == "slide" || a_name == "cusp")
+    {
+        // follow the surface, 0.03 below it, along a closed loop of directions
+        const double depth = 0.03;
+        const int period = 4000;
+        SurfaceSample s = side;
+        for (int i = 0; i < a_ticks; ++i)
+        {
+            double phi = 2.0 * C_PI * (i % period) / period;
+            cVector3d dir = (a_name == "slide") ? aroundPole(sideDir, 0.3, phi) : aroundPole(poleDir, 0.15, phi);
+            if (findSurfaceAlong(a_shape, dir, s))
+                a_path.push_back(s.point - depth * s.normal);
+            else
+                a_path.push_back(a_path.empty() ? side.point : a_path.back());
+        }
+    }
+    else if (a_name == "stab")
+    {
+        // jump between well outside and deep inside every few ticks
+        for (int i = 0; i < a_ticks; ++i)
+        {
+            double depth = ((i / 5) % 2) ? 0.15 : -0.2;
+            a_path.push_back(side.point - depth * side.normal);
+        }
+    }
+    else
+    {
+        return false;
+    }
+
+    a_entry = entryTo(a_shape, a_path[0], side);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+// how the objects of the scenarios are set up
+struct BenchOptions
+{
+    double sampledSpacing;
+    string gradientMode;
+    const ToolAvatar* avatar;
+    const SurfaceTexture* texture;
+};
+
+// an object rendering a_shape as the options ask, with the stiffness and
+// friction of the application; evaluations are counted if a_counted, in
+// which case only one thread may tick it
+ImplicitMesh* createBenchObject(const ImplicitShape* a_shape, const BenchOptions& a_options,
+                                bool a_counted = true)
+{
+    benchShape = a_shape;
+    bool analytic = a_shape->gradient && a_options.gradientMode != "estimated";
+    ImplicitMesh* object = new ImplicitMesh();
+    object->setTexture(a_options.texture);
+    if (a_options.sampledSpacing > 0.0)
+    {
+        // sampled on several threads, so not through the counting wrappers
+        object->createFromFunction(a_shape->function, analytic ? a_shape->gradient : 0,
+                                   cVector3d(-1.25, -1.25, -1.25),
+                                   cVector3d(1.25, 1.25, 1.25), a_options.sampledSpacing);
+        object->setSampledBackend(true);
+    }
+    else if (a_counted)
+    {
+        object->setSurfaceFunction(countedFunction, analytic ? countedGradient : 0);
+    }
+    else
+    {
+        object->setSurfaceFunction(a_shape->function, analytic ? a_shape->gradient : 0);
+    }
+    object->m_material->setStiffness(1000.0);
+    object->setFriction(0.5, 0.3);
+    if (a_options.avatar->getPointCount() > 0)
+        object->setAvatar(a_options.avatar);
+    return object;
+}
+
+// untimed lead-in: bring tool a_IDN from a_entry, outside, to a_start so
+// the proxy is planted on the surface, as it is live
+void leadIn(ImplicitMesh* a_object, const cVector3d& a_entry, const cVector3d& a_start, unsigned int a_IDN)
+{
+    for (int i = 0; i <= 100; ++i)
+    {
+        double t = i / 100.0;
+        a_object->computeLocalInteraction((1.0 - t) * a_entry + t * a_start, cVector3d(0.0, 0.0, 0.0), a_IDN);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// tick tool a_IDN of a_object along a_path from a_entry, keeping its proxies
+void runTool(ImplicitMesh* a_object, const vector<cVector3d>& a_path, const cVector3d& a_entry,
+             unsigned int a_IDN, vector<cVector3d>& a_proxies)
+{
+    leadIn(a_object, a_entry, a_path[0], a_IDN);
+    for (size_t i = 0; i < a_path.size(); ++i)
+    {
+        a_object->computeLocalInteraction(a_path[i], cVector3d(0.0, 0.0, 0.0), a_IDN);
+        a_proxies.push_back(a_object->findProxyState(a_IDN)->proxy);
+    }
+}
+
+// run the path of a scenario with two tools on one object, the second
+// half a path behind the first, each on a thread of its own as two haptic
+// threads would, and compare the proxies of each with those it has alone
+// on an object of its own, into a JSON object; they must be the same
+bool compareTools(const ImplicitShape* a_shape, const char* a_scenario, int a_ticks,
+                  const BenchOptions& a_options, string& a_json)
+{
+    vector<cVector3d> paths[2];
+    cVector3d entries[2];
+    if (!buildScenario(a_scenario, a_shape, a_ticks, paths[0], entries[0]))
+        return false;
+    paths[1] = paths[0];
+    rotate(paths[1].begin(), paths[1].begin() + a_ticks / 2, paths[1].end());
+    SurfaceSample fallback;
+    fallback.point = entries[0];
+    fallback.normal.zero();
+    entries[1] = entryTo(a_shape, paths[1][0], fallback);
+
+    // each tool alone
+    vector<cVector3d> alone[2];
+    for (int t = 0; t < 2; ++t)
+    {
+        ImplicitMesh* object = createBenchObject(a_shape, a_options, false);
+        runTool(object, paths[t], entries[t], t, alone[t]);
+        delete object;
+    }
+
+    // both together, released at once so that their ticks overlap
+    ImplicitMesh* object = createBenchObject(a_shape, a_options, false);
+    vector<cVector3d> together[2];
+    atomic<int> waiting(2);
+    thread threads[2];
+    for (int t = 0; t < 2; ++t)
+        threads[t] = thread([&, t]()
+        {
+            waiting--;
+            while (waiting.load() > 0) {}
+            runTool(object, paths[t], entries[t], t, together[t]);
+        });
+    for (int t = 0; t < 2; ++t)
+        threads[t].join();
+    delete object;
+
+    double deviation = 0.0;
+    for (int t = 0; t < 2; ++t)
+        for (int i = 0; i < a_ticks; ++i)
+            deviation = cMax(deviation, (together[t][i] - alone[t][i]).length());
+
+    ostringstream json;
+    json << "\n    {"
+         << "\"shape\": \"" << a_shape->name << "\", "
+         << "\"scenario\": \"" << a_scenario << "\", "
+         << "\"tools\": 2, \"threads\": 2, "
+         << "\"proxy_deviation_max\": " << deviation << ", "
+         << "\"independent\": " << (deviation == 0.0 ? "true" : "false") << "}";
+    a_json = json.str();
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+// a_count points from 0.1 inside to 0.1 outside the surface of a shape,
+// along directions spread evenly over the sphere (a Fibonacci lattice)
+bool sampleSurfaceBand(const ImplicitShape* a_shape, int a_count, vector<cVector3d>& a_points)
+{
+    for (int i = 0; i < a_count; ++i)
+    {
+        double z = 1.0 - (2.0 * i + 1.0) / a_count;
+        double phi = i * C_PI * (3.0 - sqrt(5.0));
+        double r = sqrt(1.0 - z * z);
+        SurfaceSample sample;
+        if (findSurfaceAlong(a_shape, cVector3d(r * cos(phi), r * sin(phi), z), sample))
+            a_points.push_back(sample.point + (0.1 - 0.2 * (i % 5) / 4.0) * sample.normal);
+    }
+    return !a_points.empty();
+}
+
+//------------------------------------------------------------------------------
+
+// compare the estimated gradient of a shape with its analytic one at
+// a_count points, from 0.1 inside to 0.1 outside its surface, into a JSON
+// object; returns false if the shape has no analytic gradient
+bool compareGradients(const ImplicitShape* a_shape, int a_count, string& a_json)
+{
+    if (!a_shape->gradient)
+        return false;
+
+    vector<cVector3d> points;
+    if (!sampleSurfaceBand(a_shape, a_count, points))
+        return false;
+
+    FunctionSource analytic(a_shape->function, a_shape->gradient);
+    FunctionSource estimated(a_shape->function, 0);
+
+    // accuracy: angle between the gradients, and the relative error of the estimate
+    vector<double> angles, errors;
+    for (size_t n = 0; n < points.size(); ++n)
+    {
+        cVector3d exact, estimate;
+        analytic.evaluate(points[n], exact);
+        estimated.evaluate(points[n], estimate);
+        if (exact.length() < C_SMALL)
+            continue;
+        double cosine = exact.dot(estimate) / (exact.length() * cMax(estimate.length(), C_SMALL));
+        angles.push_back(acos(cClamp(cosine, -1.0, 1.0)) * 180.0 / C_PI);
+        errors.push_back((estimate - exact).length() / exact.length());
+    }
+    if (angles.empty())
+        return false;
+    sort(angles.begin(), angles.end());
+    sort(errors.begin(), errors.end());
+
+    // cost of a value with its gradient, each way, over several passes
+    const int passes = 200;
+    double sink = 0.0;
+    cVector3d gradient;
+    functionEvaluations = 0;
+    benchShape = a_shape;
+    FunctionSource counted(countedFunction, 0);
+    for (size_t n = 0; n < points.size(); ++n)
+        sink += counted.evaluate(points[n], gradient);
+    double evaluations = (double)functionEvaluations / points.size();
+
+    unsigned long long start = hapticNowNs();
+    for (int pass = 0; pass < passes; ++pass)
+        for (size_t n = 0; n < points.size(); ++n)
+            sink += analytic.evaluate(points[n], gradient) + gradient.x();
+    double analyticNs = (double)(hapticNowNs() - start) / (passes * points.size());
+
+    start = hapticNowNs();
+    for (int pass = 0; pass < passes; ++pass)
+        for (size_t n = 0; n < points.size(); ++n)
+            sink += estimated.evaluate(points[n], gradient) + gradient.x();
+    double estimatedNs = (double)(hapticNowNs() - start) / (passes * points.size());
+
+    ostringstream json;
+    json << "\n    {"
+         << "\"shape\": \"" << a_shape->name << "\", "
+         << "\"points\": " << angles.size() << ", "
+         << "\"angle_deg_p50\": " << angles[angles.size() / 2] << ", "
+         << "\"angle_deg_max\": " << angles.back() << ", "
+         << "\"relative_error_p50\": " << errors[errors.size() / 2] << ", "
+         << "\"relative_error_max\": " << errors.back() << ", "
+         << "\"evals_per_gradient\": " << evaluations << ", "
+         << "\"ns_analytic\": " << analyticNs << ", "
+         << "\"ns_estimated\": " << estimatedNs << ", "
+         << "\"checksum\": " << (sink != 0.0) << "}";
+    a_json = json.str();
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+// the built-in shapes written as expressions
+struct ShapeExpression
+{
+    const char* shape;
+    const char* expression;
+};
+
+const ShapeExpression shapeExpressions[] =
+{
+    { "sphere",  "x^2 + y^2 + z^2 - 1" },
+    { "heart",   "(2x^2 + y^2 + z^2 - 1)^3 - (0.1x^2 + y^2) z^3" },
+    { "whiffle", "(x^8 + y^8 + z^8)^8 + (x^2 + y^2 + z^2 - 0.44)^-8 - 1" },
+    { "custom",  "12x (2x^2 + y^2 + z^2 - 1)^2 - 0.2x z^3 + 6y (2x^2 + y^2 + z^2 - 1)^2"
+                 " + 6z (2x^2 + y^2 + z^2 - 1)^2" },
+};
+
+// compare a shape compiled from its expression (see ExpressionSource.h)
+// with its C function, value and gradient, at a_count points around its
+// surface, into a JSON object; the C gradient is estimated if the shape
+// has none
+bool compareExpression(const ImplicitShape* a_shape, const char* a_expression, int a_count, string& a_json)
+{
+    ExpressionSource expression;
+    if (!expression.compile(a_expression))
+    {
+        cerr << a_shape->name << ": " << expression.getError() << endl;
+        return false;
+    }
+
+    vector<cVector3d> points;
+    if (!sampleSurfaceBand(a_shape, a_count, points))
+        return false;
+    int count = (int)points.size();
+    FunctionSource compiled(a_shape->function, a_shape->gradient);
+
+    // accuracy, relative to the size of the C gradient
+    double valueError = 0.0, gradientError = 0.0;
+    for (int n = 0; n < count; ++n)
+    {
+        cVector3d exact, computed;
+        double f = compiled.evaluate(points[n], exact);
+        double g = expression.evaluate(points[n], computed);
+        double scale = cMax(exact.length(), C_SMALL);
+        valueError = cMax(valueError, fabs(g - f) / scale);
+        gradientError = cMax(gradientError, (computed - exact).length() / scale);
+    }
+
+    // cost of a value with its gradient: the C function, the machine one
+    // point at a time, and the machine in batches
+    vector<double> x(count), y(count), z(count), f(count), gx(count), gy(count), gz(count);
+    for (int n = 0; n < count; ++n)
+    {
+        x[n] = points[n].x();
+        y[n] = points[n].y();
+        z[n] = points[n].z();
+    }
+
+    const int passes = 200;
+    double sink = 0.0;
+    cVector3d gradient;
+    unsigned long long start = hapticNowNs();
+    for (int pass = 0; pass < passes; ++pass)
+        for (int n = 0; n < count; ++n)
+            sink += compiled.evaluate(points[n], gradient) + gradient.x();
+    double compiledNs = (double)(hapticNowNs() - start) / (passes * count);
+
+    start = hapticNowNs();
+    for (int pass = 0; pass < passes; ++pass)
+        for (int n = 0; n < count; ++n)
+            sink += expression.evaluate(points[n], gradient) + gradient.x();
+    double singleNs = (double)(hapticNowNs() - start) / (passes * count);
+
+    start = hapticNowNs();
+    for (int pass = 0; pass < passes; ++pass)
+    {
+        expression.evaluateBatch(&x[0], &y[0], &z[0], count, &f[0], &gx[0], &gy[0], &gz[0]);
+        sink += f[pass % count] + gx[pass % count];
+    }
+    double batchNs = (double)(hapticNowNs() - start) / (passes * count);
+
+    ostringstream json;
+    json << "\n    {"
+         << "\"shape\": \"" << a_shape->name << "\", "
+         << "\"expression\": \"" << a_expression << "\", "
+         << "\"points\": " << count << ", "
+         << "\"value_instructions\": " << expression.getValueInstructionCount() << ", "
+         << "\"gradient_instructions\": " << expression.getGradientInstructionCount() << ", "
+         << "\"value_error_max\": " << valueError << ", "
+         << "\"gradient_error_max\": " << gradientError << ", "
+         << "\"c_gradient\": \"" << (a_shape->gradient ? "analytic" : "estimated") << "\", "
+         << "\"ns_c\": " << compiledNs << ", "
+         << "\"ns_single\": " << singleNs << ", "
+         << "\"ns_batch\": " << batchNs << ", "
+         << "\"checksum\": " << (sink != 0.0) << "}";
+    a_json = json.str();
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+// a leaf of a CSG scene: a built-in sphere or heart, placed at a_position
+// and scaled by a_scale, with the distance ratio the application gives it
+CSGNode* createCSGLeaf(bool a_heart, const cVector3d& a_position, double a_scale)
+{
+    cMatrix3d identity;
+    identity.identity();
+    CSGNode* leaf = a_heart ?
+        new CSGNode(implicitHeart, implicitHeartGrad,
+                    cVector3d(-1.5, -1.5, -1.5), cVector3d(1.5, 1.5, 1.5), IMPLICIT_HEART_DISTANCE_RATIO) :
+        new CSGNode(implicitSphere, implicitSphereGrad,
+                    cVector3d(-1.0, -1.0, -1.0), cVector3d(1.0, 1.0, 1.0), IMPLICIT_SPHERE_DISTANCE_RATIO);
+    leaf->setTransform(a_position, identity, a_scale);
+    return leaf;
+}
+
+// the CSG scenes whose pruning is checked, of leaves that are not distance
+// fields; returns 0 for an unknown name
+CSGNode* createCSGTestScene(const string& a_name)
+{
+    if (a_name == "two_balls")
+        return new CSGNode(CSG_UNION, createCSGLeaf(false, cVector3d(1.2, 1.2, 0.0), 0.5),
+                                      createCSGLeaf(false, cVector3d(-1.5, 0.0, 0.0), 0.5));
+    if (a_name == "bitten_heart")
+        return new CSGNode(CSG_DIFFERENCE, createCSGLeaf(true, cVector3d(0.0, 0.0, 0.0), 1.0),
+                                           createCSGLeaf(false, cVector3d(0.6, 0.0, 0.3), 0.4));
+    if (a_name == "overlap")
+        return new CSGNode(CSG_INTERSECTION, createCSGLeaf(true, cVector3d(0.0, 0.0, 0.0), 1.0),
+                                             createCSGLeaf(false, cVector3d(0.5, 0.3, 0.0), 0.9));
+    if (a_name == "blend")
+        return new CSGNode(CSG_BLEND, createCSGLeaf(false, cVector3d(-0.6, 0.0, 0.0), 0.5),
+                                      createCSGLeaf(true, cVector3d(0.6, 0.0, 0.0), 0.4), 0.3);
+    if (a_name == "many")
+    {
+        vector<CSGNode*> leaves;
+        for (int i = 0; i < 8; ++i)
+            for (int j = 0; j < 8; ++j)
+                leaves.push_back(createCSGLeaf((i + j) % 2 == 1,
+                                               cVector3d(-1.75 + 0.5 * i, -1.75 + 0.5 * j, 0.3 * sin(i + 2.0 * j)),
+                                               0.15));
+        CSGNode* floor = CSGNode::createUnion(leaves);
+        return new CSGNode(CSG_BLEND, floor, createCSGLeaf(false, cVector3d(0.0, 0.0, 0.8), 0.5), 0.2);
+    }
+    return 0;
+}
+
+// compare the pruned value and gradient of a CSG scene with those of every
+// leaf evaluated, on a lattice of points through and around it, into a
+// JSON object; pruning must not change either, so any error is a bug
+bool compareCSG(const string& a_name, string& a_json)
+{
+    CSGNode* scene = createCSGTestScene(a_name);
+    if (!scene)
+        return false;
+
+    const int steps = 41;
+    double valueError = 0.0, gradientError = 0.0;
+    long long pruned = 0, unpruned = 0;
+    int count = 0;
+    for (int i = 0; i < steps; ++i)
+        for (int j = 0; j < steps; ++j)
+            for (int k = 0; k < steps; ++k)
+            {
+                cVector3d point(-2.4 + 0.12 * i, -2.4 + 0.12 * j, -2.4 + 0.12 * k);
+                cVector3d fast, exact;
+                int fastLeaves = 0, exactLeaves = 0;
+                double f = scene->evaluateCounted(point, fast, fastLeaves);
+                double g = scene->evaluateUnpruned(point, exact, exactLeaves);
+                valueError = cMax(valueError, fabs(f - g));
+                gradientError = cMax(gradientError, (fast - exact).length());
+                pruned += fastLeaves;
+                unpruned += exactLeaves;
+                count++;
+            }
+
+    cVector3d gradient;
+    int leaves = 0;
+    ostringstream json;
+    json << "\n    {"
+         << "\"scene\": \"" << a_name << "\", "
+         << "\"leaves\": " << scene->getPrimitiveCount() << ", "
+         << "\"points\": " << count << ", "
+         << "\"value_at_origin\": " << scene->evaluateCounted(cVector3d(0.0, 0.0, 0.0), gradient, leaves) << ", "
+         << "\"value_error_max\": " << valueError << ", "
+         << "\"gradient_error_max\": " << gradientError << ", "
+         << "\"leaves_pruned_mean\": " << (double)pruned / count << ", "
+         << "\"leaves_unpruned_mean\": " << (double)unpruned / count << ", "
+         << "\"exact\": " << (valueError == 0.0 && gradientError == 0.0 ? "true" : "false") << "}";
+    a_json = json.str();
+    delete scene;
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+// write the JSON document of a benchmark: its a_fields ("\"name\": value",
+// comma separated) and its a_results objects, to a_outputName or stdout
+void writeResults(const string& a_fields, const vector<string>& a_results, const string& a_outputName)
+{
+    ostringstream json;
+    json << "{\n  " << a_fields << ",\n  \"results\": [";
+    for (size_t i = 0; i < a_results.size(); ++i)
+        json << (i > 0 ? "," : "") << a_results[i];
+    json << "\n  ]\n}\n";
+
+    if (a_outputName.empty())
+    {
+        cout << json.str();
+    }
+    else
+    {
+        ofstream file(a_outputName.c_str());
+        file << json.str();
+    }
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+    int ticks = 20000;
+    string onlyShape;
+    string outputName;
+    double sampledSpacing = 0.0;
+    string gradientMode = "analytic";
+    bool expressions = false;
+    int avatarPoints = 0;
+    string textureName;
+    bool tools = false;
+    bool csg = false;
+
+    for (int i = 1; i < argc; i += 2)
+    {
+        if (i + 1 == argc)
+        {
+            cerr << "missing value for " << argv[i] << endl;
+            return 2;
+        }
+        else if (strcmp(argv[i], "--ticks") == 0)       ticks = cMax(1, atoi(argv[i+1]));
+        else if (strcmp(argv[i], "--shape") == 0)  onlyShape = argv[i+1];
+        else if (strcmp(argv[i], "--output") == 0) outputName = argv[i+1];
+        else if (strcmp(argv[i], "--sampled") == 0) sampledSpacing = atof(argv[i+1]);
+        else if (strcmp(argv[i], "--gradient") == 0) gradientMode = argv[i+1];
+        else if (strcmp(argv[i], "--expression") == 0 && strcmp(argv[i+1], "compare") == 0) expressions = true;
+        else if (strcmp(argv[i], "--avatar") == 0) avatarPoints = cMax(0, atoi(argv[i+1]));
+        else if (strcmp(argv[i], "--texture") == 0 &&
+                 (strcmp(argv[i+1], "noise") == 0 || strcmp(argv[i+1], "ridges") == 0)) textureName = argv[i+1];
+        else if (strcmp(argv[i], "--tools") == 0 && strcmp(argv[i+1], "compare") == 0) tools = true;
+        else if (strcmp(argv[i], "--csg") == 0 && strcmp(argv[i+1], "compare") == 0) csg = true;
+        else
+        {
+            cerr << "usage: benchmark [--ticks <count>] [--shape <name>] [--output <file>]"
+                    " [--sampled <spacing>] [--gradient <analytic | estimated | compare>]"
+                    " [--expression compare] [--avatar <points>] [--texture <noise | ridges>]"
+                    " [--tools compare] [--csg compare]" << endl;
+            return 2;
+        }
+    }
+
+    if (csg)
+    {
+        const char* scenes[] = { "two_balls", "bitten_heart", "overlap", "blend", "many" };
+        vector<string> results;
+        for (size_t c = 0; c < sizeof(scenes) / sizeof(scenes[0]); ++c)
+        {
+            string entry;
+            if (compareCSG(scenes[c], entry))
+                results.push_back(entry);
+        }
+        writeResults("\"benchmark\": \"csg\"", results, outputName);
+        return 0;
+    }
+
+    if (gradientMode == "compare" || expressions)
+    {
+        vector<string> results;
+        for (int s = 0; s < IMPLICIT_SHAPE_COUNT; ++s)
+        {
+            const ImplicitShape* shape = &implicitShapes[s];
+            if (!onlyShape.empty() && onlyShape != shape->name)
+                continue;
+            string entry;
+            if (expressions)
+            {
+                const ShapeExpression* written = 0;
+                for (size_t e = 0; e < sizeof(shapeExpressions) / sizeof(shapeExpressions[0]); ++e)
+                    if (strcmp(shapeExpressions[e].shape, shape->name) == 0)
+                        written = &shapeExpressions[e];
+                if (!written || !compareExpression(shape, written->expression, 2000, entry))
+                    continue;
+            }
+            else if (!compareGradients(shape, 2000, entry))
+            {
+                continue;
+            }
+            results.push_back(entry);
+        }
+        writeResults(string("\"benchmark\": \"") + (expressions ? "expression" : "gradient") + "\"",
+                     results, outputName);
+        return 0;
+    }
+
+    const char* scenarios[] = { "approach", "press", "slide", "cusp", "stab" };
+    const int scenarioCount = sizeof(scenarios) / sizeof(scenarios[0]);
+    ToolAvatar avatar = (avatarPoints > 0) ? ToolAvatar::sphere(0.05, avatarPoints) : ToolAvatar();
+    SurfaceTexture texture(textureName == "ridges" ? TEXTURE_RIDGES : TEXTURE_NOISE, 0.002, 0.02, 3);
+    BenchOptions options;
+    options.sampledSpacing = sampledSpacing;
+    options.gradientMode = gradientMode;
+    options.avatar = &avatar;
+    options.texture = textureName.empty() ? 0 : &texture;
+
+    if (tools)
+    {
+        vector<string> results;
+        for (int s = 0; s < IMPLICIT_SHAPE_COUNT; ++s)
+        {
+            const ImplicitShape* shape = &implicitShapes[s];
+            if (!onlyShape.empty() && onlyShape != shape->name)
+                continue;
+            for (int c = 0; c < scenarioCount; ++c)
+            {
+                string entry;
+                if (compareTools(shape, scenarios[c], ticks, options, entry))
+                    results.push_back(entry);
+            }
+        }
+        writeResults("\"benchmark\": \"tools\",\n  \"ticks\": " + to_string(ticks), results, outputName);
+        return 0;
+    }
+
+    ostringstream fields;
+    fields << "\"benchmark\": \"computeLocalInteraction\",\n  \"ticks\": " << ticks
+           << ",\n  \"backend\": \"" << (sampledSpacing > 0.0 ? "sampled" : "function") << "\""
+           << ",\n  \"spacing\": " << sampledSpacing << ",\n  \"gradient\": \"" << gradientMode << "\""
+           << ",\n  \"avatar_points\": " << avatar.getPointCount()
+           << ",\n  \"texture\": \"" << (textureName.empty() ? "none" : textureName) << "\"";
+    vector<string> results;
+
+    for (int s = 0; s < IMPLICIT_SHAPE_COUNT; ++s)
+    {
+        const ImplicitShape* shape = &implicitShapes[s];
+        if (!onlyShape.empty() && onlyShape != shape->name)
+            continue;
+
+        for (int c = 0; c < scenarioCount; ++c)
+        {
+            vector<cVector3d> path;
+            cVector3d entry;
+            if (!buildScenario(scenarios[c], shape, ticks, path, entry))
+            {
+                cerr << "skipping " << shape->name << "/" << scenarios[c] << ": no surface found" << endl;
+                continue;
+            }
+
+            // a fresh object per scenario so proxy state does not carry over
+            ImplicitMesh* object = createBenchObject(shape, options);
+            leadIn(object, entry, path[0], 0);
+
+            LatencyHistogram tickTimes;
+            functionEvaluations = 0;
+            gradientEvaluations = 0;
+            int contactTicks = 0;
+            cVector3d previous = path[0];
+
+            unsigned long long start = hapticNowNs();
+            for (int i = 0; i < ticks; ++i)
+            {
+                cVector3d velocity = (path[i] - previous) * 1000.0;
+                previous = path[i];
+
+                unsigned long long tickStart = hapticNowNs();
+                object->computeLocalInteraction(path[i], velocity, 0);
+                tickTimes.record(hapticNowNs() - tickStart);
+
+                if (object->findProxyState(0)->inside)
+                    contactTicks++;
+            }
+            double seconds = (hapticNowNs() - start) * 1e-9;
+
+            delete object;
+
+            ostringstream json;
+            json << "\n    {"
+                 << "\"shape\": \"" << shape->name << "\", "
+                 << "\"scenario\": \"" << scenarios[c] << "\", "
+                 << "\"ticks_per_sec\": " << (seconds > 0.0 ? ticks / seconds : 0.0) << ", "
+                 << "\"ns_mean\": " << tickTimes.getMean() << ", "
+                 << "\"ns_p50\": " << tickTimes.percentile(0.50) << ", "
+                 << "\"ns_p99\": " << tickTimes.percentile(0.99) << ", "
+                 << "\"ns_p999\": " << tickTimes.percentile(0.999) << ", "
+                 << "\"ns_max\": " << tickTimes.getMax() << ", "
+                 << "\"evals_per_tick\": " << (double)functionEvaluations / ticks << ", "
+                 << "\"gradient_evals_per_tick\": " << (double)gradientEvaluations / ticks << ", "
+                 << "\"contact_fraction\": " << (double)contactTicks / ticks << "}";
+            results.push_back(json.str());
+        }
+    }
+
+    writeResults(fields.str(), results, outputName);
+    return 0;
+}
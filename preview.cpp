@@ -0,0 +1,166 @@
+//==============================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    Headless preview of implicit shapes.  Each shape is ray marched on the
+    CPU (see SphereTracer.h) into an image, without meshing it and without
+    a GPU, and the cost of the render is reported as machine-readable JSON.
+
+    Without a shape, every built-in shape is rendered to
+    preview-<name>.png.  An expression (see ExpressionSource.h) or a plugin
+    (see ImplicitPlugin.h) is rendered over the box it is meshed in by the
+    application, and a plugin with its own Lipschitz bound.
+
+    Usage:
+        preview [--shape <name> | --expression "<f(x, y, z)>" | --plugin <library>]
+                [--output <image.png | image.ppm>] [--size <width>x<height>]
+                [--azimuth <degrees>] [--elevation <degrees>] [--threads <count>]
+                [--lipschitz <bound>]
+
+    \author    Your Name
+*/
+//==============================================================================
+
+//------------------------------------------------------------------------------
+#include "chai3d.h"
+#include "ImplicitShapes.h"
+#include "ExpressionSource.h"
+#include "PluginSource.h"
+#include "SphereTracer.h"
+#include "ParallelFor.h"
+//------------------------------------------------------------------------------
+#include <string.h>
+//------------------------------------------------------------------------------
+using namespace chai3d;
+using namespace std;
+//------------------------------------------------------------------------------
+
+// one shape to render
+struct PreviewJob
+{
+    string name;
+    const ImplicitSource* source;
+    cVector3d lower;
+    cVector3d upper;
+    double lipschitz;
+    string output;
+};
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+    string onlyShape, expressionText, pluginPath, outputName;
+    PreviewView view;
+    PreviewImage image;
+    image.width = 640;
+    image.height = 480;
+    int threads = 0;
+    double lipschitz = 0.0;
+
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "--shape") == 0)           onlyShape = argv[i+1];
+        else if (strcmp(argv[i], "--expression") == 0) expressionText = argv[i+1];
+        else if (strcmp(argv[i], "--plugin") == 0)     pluginPath = argv[i+1];
+        else if (strcmp(argv[i], "--output") == 0)     outputName = argv[i+1];
+        else if (strcmp(argv[i], "--azimuth") == 0)    view.azimuth = atof(argv[i+1]);
+        else if (strcmp(argv[i], "--elevation") == 0)  view.elevation = atof(argv[i+1]);
+        else if (strcmp(argv[i], "--threads") == 0)    threads = cMax(0, atoi(argv[i+1]));
+        else if (strcmp(argv[i], "--lipschitz") == 0)  lipschitz = atof(argv[i+1]);
+        else if (strcmp(argv[i], "--size") == 0 &&
+                 sscanf(argv[i+1], "%dx%d", &image.width, &image.height) == 2 &&
+                 image.width > 0 && image.height > 0) {}
+        else
+        {
+            cerr << "usage: preview [--shape <name> | --expression \"<f(x, y, z)>\" | --plugin <library>]"
+                    " [--output <image.png | image.ppm>] [--size <width>x<height>]"
+                    " [--azimuth <degrees>] [--elevation <degrees>] [--threads <count>]"
+                    " [--lipschitz <bound>]" << endl;
+            return 2;
+        }
+    }
+
+    // the shapes to render, over the application's box unless they have their own
+    vector<PreviewJob> jobs;
+    vector<FunctionSource> functions(IMPLICIT_SHAPE_COUNT);
+    ExpressionSource expression;
+    PluginSource plugin;
+    cVector3d lower(-1.25, -1.25, -1.25), upper(1.25, 1.25, 1.25);
+    if (!expressionText.empty())
+    {
+        if (!expression.compile(expressionText))
+        {
+            cerr << "expression: " << expression.getError() << endl;
+            return 1;
+        }
+        PreviewJob job = { "expression", &expression, lower, upper, lipschitz, outputName };
+        jobs.push_back(job);
+    }
+    else if (!pluginPath.empty())
+    {
+        string report;
+        ImplicitPluginLibrary* library = ImplicitPluginLibrary::open(pluginPath, report);
+        if (!library || !library->validate(report))
+        {
+            cerr << "plugin: " << report << endl;
+            delete library;
+            return 1;
+        }
+        const ImplicitPluginInfo& info = library->getInfo();
+        PreviewJob job = { info.name ? info.name : "plugin", &plugin,
+                           cVector3d(info.lower[0], info.lower[1], info.lower[2]),
+                           cVector3d(info.upper[0], info.upper[1], info.upper[2]),
+                           (lipschitz > 0.0) ? lipschitz : info.lipschitz, outputName };
+        plugin.publish(library);
+        jobs.push_back(job);
+    }
+    else
+    {
+        for (int s = 0; s < IMPLICIT_SHAPE_COUNT; ++s)
+        {
+            const ImplicitShape* shape = &implicitShapes[s];
+            if (!onlyShape.empty() && onlyShape != shape->name)
+                continue;
+            functions[s] = FunctionSource(shape->function, shape->gradient);
+            PreviewJob job = { shape->name, &functions[s], lower, upper, lipschitz,
+                               outputName.empty() ? string("preview-") + shape->name + ".png" : outputName };
+            jobs.push_back(job);
+        }
+    }
+    if (jobs.empty())
+    {
+        cerr << "no shape named " << onlyShape << endl;
+        return 1;
+    }
+
+    ostringstream json;
+    json << "{\n  \"benchmark\": \"preview\",\n  \"width\": " << image.width << ",\n  \"height\": "
+         << image.height << ",\n  \"threads\": " << parallelThreadCount(threads) << ",\n  \"results\": [";
+    for (size_t n = 0; n < jobs.size(); ++n)
+    {
+        const PreviewJob& job = jobs[n];
+        SphereTracer tracer(*job.source, job.lower, job.upper, threads);
+        tracer.setLipschitz(job.lipschitz);
+        PreviewStats stats = tracer.render(view, image);
+        bool saved = job.output.empty() || image.save(job.output);
+        if (!saved)
+            cerr << "cannot write " << job.output << endl;
+
+        json << (n ? "," : "") << "\n    {"
+             << "\"shape\": \"" << job.name << "\", "
+             << "\"image\": \"" << job.output << "\", "
+             << "\"bounds\": \"" << (job.lipschitz > 0.0 ? "global" : "local") << "\", "
+             << "\"setup_ms\": " << 1e3 * stats.setupSeconds << ", "
+             << "\"render_ms\": " << 1e3 * stats.seconds << ", "
+             << "\"mrays_per_sec\": " << stats.getMegaraysPerSecond() << ", "
+             << "\"steps_per_ray\": " << (double)stats.steps / cMax(stats.rays, 1LL) << ", "
+             << "\"evals_per_ray\": " << (double)stats.evaluations / cMax(stats.rays, 1LL) << ", "
+             << "\"hit_fraction\": " << (double)stats.hits / cMax(stats.rays, 1LL) << "}";
+    }
+    json << "\n  ]\n}\n";
+    cout << json.str();
+
+    return 0;
+}
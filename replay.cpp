@@ -0,0 +1,247 @@
+//==============================================================================
+/*
+    CPSC 599.86 / 601.86 - Computer Haptics
+    Winter 2018, University of Calgary
+
+    Headless replay of a recorded device trajectory.  The tool positions
+    and velocities of every tick are fed to ImplicitMesh without a window
+    or a haptic device; the resulting proxy and force are compared against
+    the recorded (or a separate reference) log, and the cost per tick is
+    reported.  Only the built-in shapes, rendered from their function by
+    a point or a sphere avatar, can be replayed; logs of anything else are
+    refused.
+
+    Usage:
+        replay <log> [--reference <log>] [--tolerance <value>]
+                     [--output <log>] [--repeat <count>]
+
+    \author    Your Name
+*/
+//==============================================================================
+
+//------------------------------------------------------------------------------
+#include "chai3d.h"
+#include "ImplicitMesh.h"
+#include "ImplicitShapes.h"
+#include "TrajectoryLog.h"
+#include "HapticProfiler.h"
+//------------------------------------------------------------------------------
+#include <string.h>
+//------------------------------------------------------------------------------
+using namespace chai3d;
+using namespace std;
+//------------------------------------------------------------------------------
+
+// result of replaying a log once
+struct ReplayResult
+{
+    vector<TrajectoryRecord> outputs;
+    LatencyHistogram tickTimes;
+};
+
+//------------------------------------------------------------------------------
+
+void replay(const TrajectoryHeader& a_header, const ImplicitShape* a_shape,
+            const vector<TrajectoryRecord>& a_inputs, ReplayResult& a_result)
+{
+    // a fresh object so every repetition starts from the same proxy state
+    ImplicitMesh* object = new ImplicitMesh();
+    object->setSurfaceFunction(a_shape->function, a_shape->gradient);
+    object->m_material->setStiffness(a_header.stiffness);
+    object->setFriction(a_header.staticFriction, a_header.dynamicFriction);
+    object->setFrictionModel((FrictionModelType)a_header.frictionModel);
+
+    // the avatar first, as a proxy state held for another avatar is reset
+    ToolAvatar avatar = ToolAvatar::sphere(a_header.avatarRadius, a_header.avatarPoints);
+    if (a_header.avatarPoints > 0)
+        object->setAvatar(&avatar);
+
+    // from the proxy state the recording started in
+    object->setProxyState(0, cVector3d(a_header.proxy[0], a_header.proxy[1], a_header.proxy[2]),
+                          (a_header.flags & TRAJECTORY_INSIDE) != 0, (a_header.flags & TRAJECTORY_TOUCHED) != 0,
+                          (a_header.flags & TRAJECTORY_KINETIC) != 0, (a_header.flags & TRAJECTORY_TRACKED) != 0);
+
+    a_result.outputs.clear();
+    a_result.outputs.reserve(a_inputs.size());
+
+    for (size_t i = 0; i < a_inputs.size(); ++i)
+    {
+        const TrajectoryRecord& in = a_inputs[i];
+        cVector3d toolPos(in.toolPos[0], in.toolPos[1], in.toolPos[2]);
+        cVector3d toolVel(in.toolVel[0], in.toolVel[1], in.toolVel[2]);
+
+        unsigned long long start = hapticNowNs();
+        object->computeLocalInteraction(toolPos, toolVel, 0);
+        a_result.tickTimes.record(hapticNowNs() - start);
+
+        // read back the proxy and force of this tick
+        const ImplicitProxyState* state = object->findProxyState(0);
+        cVector3d force(0.0, 0.0, 0.0);
+        if (state->inside)
+            force = a_header.stiffness * (state->proxy - toolPos);
+
+        TrajectoryRecord out = in;
+        for (int k = 0; k < 3; ++k)
+        {
+            out.proxy[k] = state->proxy(k);
+            out.force[k] = force(k);
+        }
+        out.flags = (state->inside ? TRAJECTORY_INSIDE : 0) |
+                    (state->touched ? TRAJECTORY_TOUCHED : 0) |
+                    (state->kinetic ? TRAJECTORY_KINETIC : 0);
+        a_result.outputs.push_back(out);
+    }
+
+    delete object;
+}
+
+//------------------------------------------------------------------------------
+
+// compare replayed outputs against a reference; returns the number of ticks
+// whose proxy or force differs by more than a_tolerance
+size_t compare(const vector<TrajectoryRecord>& a_outputs,
+               const vector<TrajectoryRecord>& a_reference, double a_tolerance)
+{
+    size_t count = cMin(a_outputs.size(), a_reference.size());
+    size_t mismatches = 0;
+    size_t bitExact = 0;
+    size_t flagMismatches = 0;
+    size_t firstMismatch = count;
+    double maxProxyError = 0.0;
+    double maxForceError = 0.0;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const TrajectoryRecord& a = a_outputs[i];
+        const TrajectoryRecord& b = a_reference[i];
+
+        if (memcmp(a.proxy, b.proxy, sizeof(a.proxy)) == 0 &&
+            memcmp(a.force, b.force, sizeof(a.force)) == 0 && a.flags == b.flags)
+            bitExact++;
+
+        if (a.flags != b.flags)
+            flagMismatches++;
+
+        double proxyError = 0.0;
+        double forceError = 0.0;
+        for (int k = 0; k < 3; ++k)
+        {
+            proxyError = cMax(proxyError, fabs(a.proxy[k] - b.proxy[k]));
+            forceError = cMax(forceError, fabs(a.force[k] - b.force[k]));
+        }
+        maxProxyError = cMax(maxProxyError, proxyError);
+        maxForceError = cMax(maxForceError, forceError);
+
+        if (proxyError > a_tolerance || forceError > a_tolerance || a.flags != b.flags)
+        {
+            if (mismatches == 0)
+                firstMismatch = i;
+            mismatches++;
+        }
+    }
+
+    if (a_outputs.size() != a_reference.size())
+        cout << "warning: replayed " << a_outputs.size() << " ticks but reference has "
+             << a_reference.size() << endl;
+
+    cout << "bit-exact ticks:   " << bitExact << " / " << count << endl;
+    cout << "state mismatches:  " << flagMismatches << endl;
+    cout << "max proxy error:   " << maxProxyError << endl;
+    cout << "max force error:   " << maxForceError << endl;
+    cout << "out of tolerance:  " << mismatches;
+    if (mismatches)
+        cout << " (first at tick " << firstMismatch << ")";
+    cout << endl;
+
+    return mismatches;
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        cout << "usage: replay <log> [--reference <log>] [--tolerance <value>]" << endl
+             << "                    [--output <log>] [--repeat <count>]" << endl;
+        return 2;
+    }
+
+    string inputName = argv[1];
+    string referenceName;
+    string outputName;
+    double tolerance = 0.0;
+    int repeat = 1;
+
+    for (int i = 2; i < argc; i += 2)
+    {
+        if (i + 1 == argc)
+        {
+            cout << "missing value for " << argv[i] << endl;
+            return 2;
+        }
+        else if (strcmp(argv[i], "--reference") == 0)      referenceName = argv[i+1];
+        else if (strcmp(argv[i], "--tolerance") == 0) tolerance = atof(argv[i+1]);
+        else if (strcmp(argv[i], "--output") == 0)    outputName = argv[i+1];
+        else if (strcmp(argv[i], "--repeat") == 0)    repeat = cMax(1, atoi(argv[i+1]));
+        else
+        {
+            cout << "unknown option " << argv[i] << endl;
+            return 2;
+        }
+    }
+
+    // load the trajectory to replay
+    TrajectoryHeader header;
+    vector<TrajectoryRecord> inputs;
+    if (!readTrajectory(inputName, header, inputs))
+    {
+        cout << "failed to read trajectory " << inputName << endl;
+        return 2;
+    }
+
+    const ImplicitShape* shape = findImplicitShape(header.shape);
+    if (!shape)
+    {
+        cout << "unknown shape \"" << header.shape << "\" in " << inputName << endl;
+        return 2;
+    }
+
+    // a texture and the sampled grid are not rebuilt here
+    if (header.textureOctaves > 0 || header.sampled)
+    {
+        cout << "cannot replay " << inputName << ": it was recorded on a "
+             << (header.sampled ? "sampled grid" : "textured surface") << endl;
+        return 2;
+    }
+
+    // by default the recorded outputs are the reference
+    TrajectoryHeader referenceHeader = header;
+    vector<TrajectoryRecord> reference = inputs;
+    if (!referenceName.empty() && !readTrajectory(referenceName, referenceHeader, reference))
+    {
+        cout << "failed to read reference " << referenceName << endl;
+        return 2;
+    }
+
+    cout << "replaying " << inputs.size() << " ticks of \"" << header.shape << "\" x" << repeat << endl;
+
+    ReplayResult result;
+    for (int r = 0; r < repeat; ++r)
+        replay(header, shape, inputs, result);
+
+    const LatencyHistogram& t = result.tickTimes;
+    cout << "ns per tick:       mean " << t.getMean() << "  p50 " << t.percentile(0.5)
+         << "  p99 " << t.percentile(0.99) << "  p99.9 " << t.percentile(0.999)
+         << "  max " << t.getMax() << endl;
+
+    size_t mismatches = compare(result.outputs, reference, tolerance);
+
+    if (!outputName.empty() && !writeTrajectory(outputName, header, result.outputs))
+    {
+        cout << "failed to write " << outputName << endl;
+        return 2;
+    }
+
+    return mismatches == 0 ? 0 : 1;
+}